@@ -6,6 +6,7 @@
  */
 
 #include "RelayManager.h"
+#include <math.h>
 
 
 
@@ -13,12 +14,42 @@
 //-- PRIVATE TYPEDEFS ----------------------------------------------------------------
 //------------------------------------------------------------------------------------
 
-/** Macro para imprimir trazas de depuracin, siempre que se haya configurado un objeto
- *	Logger vlido (ej: _debug)
+/** Macro para imprimir trazas de depuración, siempre que se haya configurado un objeto
+ *	Logger válido (ej: _debug)
  */
 static const char* _MODULE_ = "[RlyMan]........";
 #define _EXPR_	(_defdbg && !IS_ISR())
 
+/** Trazas del camino crítico (recepción de comandos, lotes, conmutaciones y feedback). Con el log binario habilitado
+ *  (RELAYMANAGER_ENABLE_TRACELOG) se registran como eventos de tamaño fijo y las trazas formateadas desaparecen del
+ *  código compilado. En otro caso, el log binario no genera código.
+ */
+#if defined(RELAYMANAGER_ENABLE_TRACELOG)
+#define TRACE_LOG(evt, id, arg0, arg1)	traceLog((uint8_t)(evt), (uint8_t)(id), (uint32_t)(arg0), (uint32_t)(arg1))
+#define HOT_TRACE_D(...)
+#define HOT_TRACE_W(...)
+#else
+#define TRACE_LOG(evt, id, arg0, arg1)
+#define HOT_TRACE_D(...)	DEBUG_TRACE_D(__VA_ARGS__)
+#define HOT_TRACE_W(...)	DEBUG_TRACE_W(__VA_ARGS__)
+#endif
+
+/** Registro de las medidas de rendimiento por relé, que desaparece del código compilado con RELAYMANAGER_RELAY_PERF=0 */
+#if RELAYMANAGER_RELAY_PERF
+#define RELAY_PERF_ADD(hnd, stat, value)	perfAdd(&(hnd)->perf.stat, (value))
+#else
+#define RELAY_PERF_ADD(hnd, stat, value)
+#endif
+
+/** Identificador de relé en los eventos del log binario que no corresponden a un relé */
+static const uint8_t TraceNoRelay = 0xFF;
+
+/** Clave NV del bloque empaquetado con la configuración de todos los relés */
+static const char* CfgBlobKey = "RlyManCfgPack";
+
+/** Clave NV del bloque con la telemetría de salud de todos los relés */
+static const char* HealthBlobKey = "RlyManHealth";
+
 
  
 //------------------------------------------------------------------------------------
@@ -27,63 +58,157 @@ static const char* _MODULE_ = "[RlyMan]........";
 
 
 //------------------------------------------------------------------------------------
-RelayManager::RelayManager(PinName zc, Zerocross::LogicLevel zc_level, uint8_t num_relays, FSManager* fs, bool defdbg) : ActiveModule("RlyMan", osPriorityNormal, 3096, fs, defdbg) {
+RelayManager::RelayManager(PinName zc, Zerocross::LogicLevel zc_level, uint8_t num_relays, FSManager* fs, bool defdbg) : ActiveModule("RlyMan", osPriorityNormal, DefaultStackSize, fs, defdbg), _timed_wheel(_timed_nodes, MaxTimedActions) {
 	DEBUG_TRACE_I(_EXPR_, _MODULE_, "Creando objeto");
-    // Borro valor de sincronizacin 
-    _flags = (Flags)0;
-        
-    // Crea lista de rels
-    _max_num_relays = num_relays;
-    _relay_list = new RelayHandler[_max_num_relays];
-    MBED_ASSERT(_relay_list);
-    for(int i = 0; i < _max_num_relays; i++){
-    	_relay_list[i] = {NULL, NULL, {0,0,0}};
-    }
+    // Crea lista de relés
+    RelayHandler* relay_list = new RelayHandler[num_relays];
+    MBED_ASSERT(relay_list);
 
     // Crea objeto zerocross
-    _zc = new Zerocross(zc);
-    MBED_ASSERT(_zc);
-    _zc_level = zc_level;
-    
-    // borra tester zc
-    _zc_test_cb = NULL;
+    Zerocross* zcross = new Zerocross(zc);
+    MBED_ASSERT(zcross);
 
-    // Carga callbacks estticas
-    _publicationCb = callback(this, &RelayManager::publicationCb);
+    init(relay_list, num_relays, zcross, zc_level, NULL, hotPaths<true, true>());
     DEBUG_TRACE_I(_EXPR_, _MODULE_, "Objeto listo!");
 }
 
 
 //------------------------------------------------------------------------------------
-RelayManager::RelayManager(uint8_t num_relays, FSManager* fs, bool defdbg) : ActiveModule("RlyMan", osPriorityNormal, 3096, fs, defdbg) {
+RelayManager::RelayManager(uint8_t num_relays, FSManager* fs, bool defdbg) : ActiveModule("RlyMan", osPriorityNormal, DefaultStackSize, fs, defdbg), _timed_wheel(_timed_nodes, MaxTimedActions) {
 	DEBUG_TRACE_I(_EXPR_, _MODULE_, "Creando objeto");
-    // Borro valor de sincronizacin
-    _flags = (Flags)0;
+    // Crea lista de relés
+    RelayHandler* relay_list = new RelayHandler[num_relays];
+    MBED_ASSERT(relay_list);
+
+    init(relay_list, num_relays, NULL, (Zerocross::LogicLevel)0, NULL, hotPaths<false, true>());
+    DEBUG_TRACE_I(_EXPR_, _MODULE_, "Objeto listo!");
+}
 
-    // Crea lista de rels
+
+//------------------------------------------------------------------------------------
+RelayManager::RelayManager(ZerocrossHub* hub, uint8_t num_relays, FSManager* fs, bool defdbg) : ActiveModule("RlyMan", osPriorityNormal, DefaultStackSize, fs, defdbg), _timed_wheel(_timed_nodes, MaxTimedActions) {
+	DEBUG_TRACE_I(_EXPR_, _MODULE_, "Creando objeto con zerocross compartido");
+	MBED_ASSERT(hub);
+    // Crea lista de relés
+    RelayHandler* relay_list = new RelayHandler[num_relays];
+    MBED_ASSERT(relay_list);
+
+    init(relay_list, num_relays, NULL, (Zerocross::LogicLevel)0, hub, hotPaths<true, true>());
+    DEBUG_TRACE_I(_EXPR_, _MODULE_, "Objeto listo!");
+}
+
+
+//------------------------------------------------------------------------------------
+RelayManager::RelayManager(RelayHandler* relay_list, uint8_t num_relays, Zerocross* zc, Zerocross::LogicLevel zc_level, ZerocrossHub* hub, const HotPaths* paths, FSManager* fs, bool defdbg, uint32_t stack_size) : ActiveModule("RlyMan", osPriorityNormal, stack_size, fs, defdbg), _timed_wheel(_timed_nodes, MaxTimedActions) {
+	DEBUG_TRACE_I(_EXPR_, _MODULE_, "Creando objeto con almacenamiento estático");
+	// la lista de relés y el zerocross son propiedad del llamante, y aún pueden no estar construidos
+    init(relay_list, num_relays, zc, zc_level, hub, paths);
+    DEBUG_TRACE_I(_EXPR_, _MODULE_, "Objeto listo!");
+}
+
+
+//------------------------------------------------------------------------------------
+void RelayManager::init(RelayHandler* relay_list, uint8_t num_relays, Zerocross* zc, Zerocross::LogicLevel zc_level, ZerocrossHub* hub, const HotPaths* paths){
+    // los relés se indexan por fase en máscaras de bits
+    MBED_ASSERT(num_relays <= MaxGroupRelays);
+
+    // Asigna la lista de relés
     _max_num_relays = num_relays;
-    _relay_list = new RelayHandler[_max_num_relays];
-    MBED_ASSERT(_relay_list);
+    _relay_list = relay_list;
     for(int i = 0; i < _max_num_relays; i++){
-    	_relay_list[i] = {NULL, NULL, {0,0,0}};
+    	_relay_list[i].relay = NULL;
+    	_relay_list[i].fdb = NULL;
+    	_relay_list[i].sense = NULL;
+    	memset(&_relay_list[i].cfg, 0, sizeof(Config_t));
+    	_relay_list[i].owner = this;
+    	_relay_list[i].cal = {{0, 0, 0, 0, 0}, {0, 0, 0, 0, 0}};
+    	_relay_list[i].saved_cfg = {0,0,0};
+    	_relay_list[i].dirty = false;
+    	_relay_list[i].action = (Blob::RlyManEvtFlags)0;
+    	_relay_list[i].grouped = false;
+    	_relay_list[i].pending = (Blob::RlyManEvtFlags)0;
+    	_relay_list[i].pending_grouped = false;
+    	_relay_list[i].state = (Blob::RlyManEvtFlags)0;
+    	_relay_list[i].armed = false;
+    	_relay_list[i].inrush = {DefaultInrushSlots, 1};
+    	_relay_list[i].slot = 0;
+    	memset(&_relay_list[i].burst, 0, sizeof(BurstState));
+    	_relay_list[i].fdb_status = NoFeedbackStatus;
+    	_relay_list[i].t_on_us = 0;
+    	_relay_list[i].t_off_us = 0;
+    	_relay_list[i].t_sc_us = 0;
+    	_relay_list[i].switches = 0;
+    	_relay_list[i].sw_ts = 0;
+    	_relay_list[i].phase_req = NoPhaseRequest;
+    	memset(&_relay_list[i].snap, 0, sizeof(RelaySnapshot));
+    	memset(&_relay_list[i].health, 0, sizeof(RelayHealth));
+    	_relay_list[i].fdb_armed = false;
     }
-
-    // Crea objeto zerocross
-    _zc = NULL;
-    _zc_level = (Zerocross::LogicLevel)0;
+    _inrush_budget = 0;
+    _batch_arm_us = 0;
+    _batch_unsync = false;
+    _sync_stat = {1, 0, 0, 0};
+    _burst_stat = {0, 0, 0, 0};
+    _stage = StageIdle;
+    _batch_count = 0;
+    _batch_has_on = false;
+    _batch_pending = 0;
+    _pending_count = 0;
+    _backlog_head = 0;
+    _backlog_count = 0;
+    _stage_evt = 0;
+    _isr_events = 0;
+    _evt_token = {0, NULL};
+    _isr_msg = {0, NULL};
+    _internal_msg = NULL;
+    _cmd_free = (MaxQueueMessages < 32)? ((1u << MaxQueueMessages) - 1) : 0xFFFFFFFF;
+    _pool_stats = {0, 0, 0, 0, 0, 0};
+    _cmd_stats = {0, 0};
+    _topics = {NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL};
+    _shed_req = 0;
+    _shed_req_ts = 0;
+    _shed_active = 0;
+    _shed_on = 0;
+    _shed_pending = 0;
+    _shed_ts = 0;
+    _shed_stat = {0};
+    _shed_stats = {0, 0, 0, 0, 0};
+    memset(_phases, 0, sizeof(_phases));
+    memset(&_persist, 0, sizeof(_persist));
+    _restore_us = 0;
+    _health_reported = 0;
+    _health_saved = 0;
+    _health_periods = 0;
+    resetPerfStats();
+    _group_stat = {0, 0};
+    memset(_timed, 0, sizeof(_timed));
+    _timed_last_us = 0;
+    _timed_stats = {0, 0, 0, 0, 0};
+    _zc_ts_us = 0;
+    _sw_ts_us = 0;
+#if defined(RELAYMANAGER_ENABLE_TRACELOG)
+    memset(_trace_buf, 0, sizeof(_trace_buf));
+    _trace_head = 0;
+#endif
+
+    // Asigna objeto zerocross o hub (NULL si no hay zerocross). Las fases del hub se toman en el arranque
+    _zc = zc;
+    _zc_level = zc_level;
+    _hub = hub;
+    _num_phases = (_zc)? 1 : 0;
+    _paths = paths;
 
     // borra tester zc
     _zc_test_cb = NULL;
 
-    // Carga callbacks estticas
+    // Carga callbacks estáticas
     _publicationCb = callback(this, &RelayManager::publicationCb);
-    DEBUG_TRACE_I(_EXPR_, _MODULE_, "Objeto listo!");
 }
 
 //------------------------------------------------------------------------------------
 int32_t RelayManager::addRelayHandler(Relay* relay, RelayFeedback* fdb){
-	// obtiene la referencia del rel para insertarlo en la posicin correcta
-	// si hay otro rel ya instalado, no lo permite
+	// obtiene la referencia del relé para insertarlo en la posición correcta
+	// si hay otro relé ya instalado, no lo permite
 	uint8_t id = (uint8_t)relay->getId();
 	if(id >= _max_num_relays){
 		return -1;
@@ -91,6 +216,10 @@ int32_t RelayManager::addRelayHandler(Relay* relay, RelayFeedback* fdb){
 	if(_relay_list[id].relay != NULL){
 		return -2;
 	}
+	// la variante sin feedback no lo procesa
+	if(fdb != NULL && !_paths->feedback){
+		return -3;
+	}
 
 	// inserta en la lista
 	_relay_list[id].relay = relay;
@@ -98,13 +227,326 @@ int32_t RelayManager::addRelayHandler(Relay* relay, RelayFeedback* fdb){
 	return id;
 }
 
+
+//------------------------------------------------------------------------------------
+int32_t RelayManager::addRelayHandler(Relay* relay, PinName fdb_pin){
+	if(!_paths->feedback){
+		return -3;
+	}
+	int32_t id = addRelayHandler(relay, (RelayFeedback*)NULL);
+	if(id < 0){
+		return id;
+	}
+
+	// la entrada registra sus flancos de forma continua desde la instalación
+	FdbSense* sense = new FdbSense(fdb_pin);
+	MBED_ASSERT(sense);
+	sense->in.rise(callback(&RelayManager::isrFdbRiseCb, sense));
+	sense->in.fall(callback(&RelayManager::isrFdbFallCb, sense));
+	_relay_list[id].sense = sense;
+	return id;
+}
+
 //------------------------------------------------------------------------------------
 RelayFeedback::Status RelayManager::getFeedbackResult(uint8_t id, uint32_t* t_on_us, uint32_t* t_off_us, uint32_t *t_sc_us){
-	if(_relay_list[id].fdb){
-		return _relay_list[id].fdb->getResult(t_on_us, t_off_us, t_sc_us, _relay_list[id].cfg.deltaUs);
+	// lee la instantánea publicada por la tarea, sin acceder al feedback desde el hilo llamante. Si no hay
+	// feedback, devuelve un resultado con todos los errores marcados
+	Blob::RlyManRelayStat_t stat;
+	if(!getRelayStat(id, &stat) || (_relay_list[id].fdb == NULL && _relay_list[id].sense == NULL)){
+		return NoFeedbackStatus;
+	}
+	*t_on_us = stat.tOnUs;
+	*t_off_us = stat.tOffUs;
+	*t_sc_us = stat.tScUs;
+	return (RelayFeedback::Status)stat.fdbStatus;
+}
+
+
+//------------------------------------------------------------------------------------
+bool RelayManager::getRelayStat(uint8_t id, Blob::RlyManRelayStat_t* stat){
+	MBED_ASSERT(stat);
+	if(id >= _max_num_relays || _relay_list[id].relay == NULL){
+		return false;
+	}
+	// lee la copia estable indicada por el contador, repitiendo si la tarea la ha actualizado mientras tanto
+	RelaySnapshot& snap = _relay_list[id].snap;
+	uint32_t seq;
+	do{
+		seq = snap.seq;
+		__DMB();
+		*stat = snap.buf[seq & 1];
+		__DMB();
+	}while(seq != snap.seq);
+	return true;
+}
+
+
+//------------------------------------------------------------------------------------
+bool RelayManager::getMainsEstimation(uint32_t* period_us, uint32_t* rejected_edges, uint8_t phase){
+	if(phase >= ZerocrossHub::MaxPhases){
+		return false;
+	}
+	core_util_critical_section_enter();
+	MainsPll pll = _phases[phase].pll;
+	core_util_critical_section_exit();
+	*period_us = pll.periodUs;
+	*rejected_edges = pll.rejectedEdges;
+	return (pll.goodEdges >= PllLockEdges);
+}
+
+
+//------------------------------------------------------------------------------------
+void RelayManager::resetPerfStats(){
+	core_util_critical_section_enter();
+	memset(&_perf, 0, sizeof(_perf));
+	_perf.startUs = us_ticker_read();
+#if RELAYMANAGER_RELAY_PERF
+	for(int i = 0; i < _max_num_relays; i++){
+		memset(&_relay_list[i].perf, 0, sizeof(RelayPerf));
+	}
+#endif
+	core_util_critical_section_exit();
+}
+
+
+//------------------------------------------------------------------------------------
+int32_t RelayManager::getPerfJson(char* buf, uint32_t len){
+	MBED_ASSERT(buf);
+	// copia los datos actualizados desde ISR
+	core_util_critical_section_enter();
+	PerfStat isr_time = _perf.isrTime;
+	uint64_t isr_relays = _perf.isrRelays;
+	core_util_critical_section_exit();
+
+	// posición y espacio restantes en el buffer, teniendo en cuenta que snprintf devuelve el tamaño requerido
+	uint32_t n = 0;
+	auto at = [&]()->char* { return buf + ((n < len)? n : len); };
+	auto left = [&]()->uint32_t { return (n < len)? (len - n) : 0; };
+
+	uint32_t elapsed_ms = (us_ticker_read() - _perf.startUs) / 1000;
+	n = snprintf(buf, len, "{\"elapsedMs\":%lu,\"commands\":%lu,\"cmdPerSec\":%lu,\"isrUs\":",
+			(unsigned long)elapsed_ms, (unsigned long)_perf.commands,
+			(unsigned long)((elapsed_ms > 0)? (((uint64_t)_perf.commands * 1000) / elapsed_ms) : 0));
+	n += printPerfStat(at(), left(), isr_time);
+	// coste de la ISR por relé programado, para evaluar su escalado con el número de relés
+	n += snprintf(at(), left(), ",\"isrRelays\":%lu,\"isrNsPerRelay\":%lu", (unsigned long)isr_relays,
+			(unsigned long)((isr_relays > 0)? ((isr_time.sum * 1000) / isr_relays) : 0));
+	n += snprintf(at(), left(), ",\"shedUs\":");
+	n += printPerfStat(at(), left(), _perf.shedLatency);
+	n += snprintf(at(), left(), ",\"relays\":[");
+#if RELAYMANAGER_RELAY_PERF
+	bool first = true;
+	for(int i = 0; i < _max_num_relays; i++){
+		if(_relay_list[i].relay == NULL){
+			continue;
+		}
+		n += snprintf(at(), left(), "%s{\"id\":%d,\"zcToContactUs\":", (first)? "" : ",", i);
+		n += printPerfStat(at(), left(), _relay_list[i].perf.zcToContact);
+		n += snprintf(at(), left(), ",\"latencyUs\":");
+		n += printPerfStat(at(), left(), _relay_list[i].perf.latency);
+		n += snprintf(at(), left(), "}");
+		first = false;
+	}
+#endif
+	n += snprintf(at(), left(), "]}");
+	return (n < len)? (int32_t)n : -1;
+}
+
+
+//------------------------------------------------------------------------------------
+bool RelayManager::getPhaseStats(uint8_t id, Phase phase, PhaseStats* stats){
+	MBED_ASSERT(stats);
+#if RELAYMANAGER_RELAY_PERF
+	if(id >= _max_num_relays || _relay_list[id].relay == NULL || phase >= PhaseCount){
+		return false;
+	}
+	PerfStat stat = _relay_list[id].perf.phase[phase];
+	stats->count = stat.count;
+	stats->min = stat.min;
+	stats->mean = (stat.count > 0)? (uint32_t)(stat.sum / stat.count) : 0;
+	stats->p50 = perfPercentile(stat, 50);
+	stats->p99 = perfPercentile(stat, 99);
+	stats->max = stat.max;
+	memcpy(stats->hist, stat.hist, sizeof(stats->hist));
+	return true;
+#else
+	return false;
+#endif
+}
+
+
+//------------------------------------------------------------------------------------
+int32_t RelayManager::getPhaseJson(uint8_t id, char* buf, uint32_t len){
+	MBED_ASSERT(buf);
+#if RELAYMANAGER_RELAY_PERF
+	if(id >= _max_num_relays || _relay_list[id].relay == NULL){
+		return -1;
+	}
+	static const char* names[PhaseCount] = {"queueUs", "batchUs", "zcWaitUs", "switchUs", "feedbackUs", "publishUs"};
+	uint32_t n = 0;
+	auto at = [&]()->char* { return buf + ((n < len)? n : len); };
+	auto left = [&]()->uint32_t { return (n < len)? (len - n) : 0; };
+
+	n = snprintf(buf, len, "{\"id\":%d", id);
+	for(int p = 0; p < PhaseCount; p++){
+		n += snprintf(at(), left(), ",\"%s\":", names[p]);
+		n += printPerfStat(at(), left(), _relay_list[id].perf.phase[p]);
+	}
+	n += snprintf(at(), left(), "}");
+	return (n < len)? (int32_t)n : -1;
+#else
+	return -1;
+#endif
+}
+
+
+//------------------------------------------------------------------------------------
+int32_t RelayManager::getTraceLog(uint8_t* buf, uint32_t len){
+	MBED_ASSERT(buf);
+#if defined(RELAYMANAGER_ENABLE_TRACELOG)
+	if(len < sizeof(Blob::RlyManTraceHeader_t)){
+		return -1;
+	}
+	// los registros se copian sin bloquear a los escritores: los que se sobrescriban durante la copia se
+	// detectan en el decodificador por el número de secuencia
+	uint32_t head = _trace_head;
+	uint32_t count = (head < TraceLogSize)? head : TraceLogSize;
+	uint32_t fit = (len - sizeof(Blob::RlyManTraceHeader_t)) / sizeof(Blob::RlyManTraceRecord_t);
+	count = (count < fit)? count : fit;
+	Blob::RlyManTraceHeader_t hdr = {TraceMagic, TraceVersion, (uint16_t)sizeof(Blob::RlyManTraceRecord_t), head, count};
+	memcpy(buf, &hdr, sizeof(hdr));
+	uint8_t* at = buf + sizeof(hdr);
+	for(uint32_t i = head - count; i != head; i++){
+		memcpy(at, &_trace_buf[i & (TraceLogSize - 1)], sizeof(Blob::RlyManTraceRecord_t));
+		at += sizeof(Blob::RlyManTraceRecord_t);
+	}
+	return (int32_t)(at - buf);
+#else
+	return -1;
+#endif
+}
+
+
+//------------------------------------------------------------------------------------
+bool RelayManager::getCalibrationInfo(uint8_t id, CalibrationInfo* info){
+	MBED_ASSERT(info);
+	if(id >= _max_num_relays || _relay_list[id].relay == NULL){
+		return false;
+	}
+	RelayHandler* hnd = &_relay_list[id];
+	info->delayOnUs = hnd->cfg.delayOnUs;
+	info->delayOffUs = hnd->cfg.delayOffUs;
+	info->stdDevOnUs = (hnd->cal.on.samples > 0)? (uint32_t)sqrtf(hnd->cal.on.var) : 0;
+	info->stdDevOffUs = (hnd->cal.off.samples > 0)? (uint32_t)sqrtf(hnd->cal.off.var) : 0;
+	info->samplesOn = hnd->cal.on.samples;
+	info->samplesOff = hnd->cal.off.samples;
+	info->outliers = hnd->cal.on.outliers + hnd->cal.off.outliers;
+	info->fdbOverruns = (hnd->sense)? hnd->sense->overruns : 0;
+	return true;
+}
+
+
+//------------------------------------------------------------------------------------
+bool RelayManager::getHealth(uint8_t id, Blob::RlyManHealth_t* health){
+	MBED_ASSERT(health);
+	if(id >= _max_num_relays || _relay_list[id].relay == NULL){
+		return false;
+	}
+	RelayHandler* hnd = &_relay_list[id];
+	const RelayHealth& rh = hnd->health;
+	health->id = id;
+	health->operations = rh.operations + hnd->switches;
+	health->offZero = rh.offZero;
+	health->errMeanOnUs = (int16_t)(rh.errAvg[0] / HealthAvgScale);
+	health->errMeanOffUs = (int16_t)(rh.errAvg[1] / HealthAvgScale);
+	memcpy(health->errHistOn, rh.errHist[0], sizeof(health->errHistOn));
+	memcpy(health->errHistOff, rh.errHist[1], sizeof(health->errHistOff));
+	health->delayOnUs = hnd->cfg.delayOnUs;
+	health->delayOffUs = hnd->cfg.delayOffUs;
+	health->driftOnUs = (int32_t)hnd->cfg.delayOnUs - (int32_t)rh.baseOnUs;
+	health->driftOffUs = (int32_t)hnd->cfg.delayOffUs - (int32_t)rh.baseOffUs;
+	return true;
+}
+
+
+//------------------------------------------------------------------------------------
+void RelayManager::getPersistStats(PersistStats* stats){
+	MBED_ASSERT(stats);
+	*stats = _persist;
+}
+
+
+//------------------------------------------------------------------------------------
+void RelayManager::getPoolStats(PoolStats* stats){
+	MBED_ASSERT(stats);
+	core_util_critical_section_enter();
+	*stats = _pool_stats;
+	core_util_critical_section_exit();
+}
+
+
+//------------------------------------------------------------------------------------
+bool RelayManager::setInrushProfile(uint8_t id, uint8_t slots, uint16_t weight){
+	if(id >= _max_num_relays || slots == 0 || slots > MaxInrushSlots){
+		return false;
+	}
+	_relay_list[id].inrush = {slots, weight};
+	return true;
+}
+
+
+//------------------------------------------------------------------------------------
+bool RelayManager::setRelayPhase(uint8_t id, uint8_t phase){
+	if(id >= _max_num_relays || phase >= ZerocrossHub::MaxPhases){
+		return false;
+	}
+	_relay_list[id].phase_req = phase;
+	return true;
+}
+
+
+//------------------------------------------------------------------------------------
+bool RelayManager::getBurstInfo(uint8_t id, Blob::RlyManBurstStat_t* info){
+	if(id >= _max_num_relays || _relay_list[id].relay == NULL){
+		return false;
+	}
+	core_util_critical_section_enter();
+	BurstState burst = _relay_list[id].burst;
+	core_util_critical_section_exit();
+	burstStat(id, burst, info);
+	return true;
+}
+
+
+//------------------------------------------------------------------------------------
+void RelayManager::getCmdStats(CmdStats* stats){
+	core_util_critical_section_enter();
+	*stats = _cmd_stats;
+	core_util_critical_section_exit();
+}
+
+
+//------------------------------------------------------------------------------------
+void RelayManager::getShedStats(ShedStats* stats){
+	*stats = _shed_stats;
+}
+
+
+//------------------------------------------------------------------------------------
+void RelayManager::getSyncStat(Blob::RlyManSyncStat_t* stat){
+	MBED_ASSERT(stat);
+	*stat = _sync_stat;
+	for(int p = 0; p < _num_phases; p++){
+		if(p == 0 || (int32_t)(_phases[p].lastUs - stat->lastEdgeUs) > 0){
+			stat->lastEdgeUs = _phases[p].lastUs;
+		}
 	}
-	// si no hay feedback, devuelve un resultado con todos los errores marcados
-	return ((RelayFeedback::Status)(RelayFeedback::ErrorTimeOnHigh | RelayFeedback::ErrorTimeOnLow | RelayFeedback::ErrorTimeOffHigh | RelayFeedback::ErrorTimeOffLow));
+}
+
+
+//------------------------------------------------------------------------------------
+void RelayManager::getTimedStats(TimedStats* stats){
+	*stats = _timed_stats;
 }
 
 
@@ -127,37 +569,143 @@ osStatus RelayManager::putMessage(State::Msg *msg){
 
 //------------------------------------------------------------------------------------
 void RelayManager::subscriptionCb(const char* topic, void* msg, uint16_t msg_len){
-    // si es un comando solicitando una accin manual...
+    // si es una consulta del estado o del feedback de un relé, responde desde su instantánea sin pasar por la tarea
+    if(MQ::MQClient::isTokenRoot(topic, "get/value") || MQ::MQClient::isTokenRoot(topic, "get/fdbk")){
+        HOT_TRACE_D(_EXPR_, _MODULE_, "Recibido topic %s", topic);
+
+        // el mensaje es el identificador del relé
+        if(msg_len != sizeof(uint8_t)){
+        	DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_MSG, tamaño incorrecto en %s", topic);
+        	return;
+        }
+        Blob::RlyManRelayStat_t stat;
+        if(!getRelayStat(*((uint8_t*)msg), &stat)){
+        	DEBUG_TRACE_E(_EXPR_, _MODULE_, "ERR_ID el relé '%d' no existe.", *((uint8_t*)msg));
+        	return;
+        }
+        if(MQ::MQClient::isTokenRoot(topic, "get/value")){
+        	Blob::RlyManAction_t value = {stat.id, stat.state};
+        	MQ::MQClient::publish(_topics.statValue, &value, sizeof(Blob::RlyManAction_t), &_publicationCb);
+        }
+        else{
+        	MQ::MQClient::publish(_topics.statSnap, &stat, sizeof(Blob::RlyManRelayStat_t), &_publicationCb);
+        }
+        return;
+    }
+
+    // si es una desconexión de emergencia, se atiende con prioridad sin pasar por la cola de comandos
+    if(MQ::MQClient::isTokenRoot(topic, "set/shed") ){
+        HOT_TRACE_D(_EXPR_, _MODULE_, "Recibido topic %s", topic);
+
+        // el mensaje es un blob tipo 'RlyManShedAction_t'
+        // chequea el mensaje
+        if(msg_len != sizeof(Blob::RlyManShedAction_t)){
+        	DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_MSG, tamaño incorrecto en %s", topic);
+        	return;
+        }
+
+        // acumula los relés a desconectar, manteniendo el instante de la primera solicitud no atendida
+        core_util_critical_section_enter();
+        if(_shed_req == 0){
+        	_shed_req_ts = us_ticker_read();
+        }
+        _shed_req |= ((Blob::RlyManShedAction_t*)msg)->offMask;
+        core_util_critical_section_exit();
+        postIsrEvent(ShedPendingFlag);
+        return;
+    }
+
+    // si es un comando solicitando una acción manual...
     if(MQ::MQClient::isTokenRoot(topic, "set/value") ){
-        DEBUG_TRACE_D(_EXPR_, _MODULE_, "Recibido topic %s", topic);
+        HOT_TRACE_D(_EXPR_, _MODULE_, "Recibido topic %s", topic);
 
         // el mensaje es un blob tipo 'RlyManAction_t'
         // chequea el mensaje
         if(msg_len != sizeof(Blob::RlyManAction_t)){
-        	DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_MSG, tamao incorrecto en %s", topic);
+        	DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_MSG, tamaño incorrecto en %s", topic);
         	return;
         }
 
-        // crea mensaje para publicar en la mquina de estados
-        State::Msg* op = (State::Msg*)Heap::memAlloc(sizeof(State::Msg));
-        MBED_ASSERT(op);
-
-        // reserva espacio, chequea y copia
-        Blob::RlyManAction_t* action = (Blob::RlyManAction_t*)Heap::memAlloc(sizeof(Blob::RlyManAction_t));
-        MBED_ASSERT(action);
-        *action = *((Blob::RlyManAction_t*)msg);
-        // aplica el tipo de mensaje en funcin del topic recibido
-        op->sig = RelayActionPendingFlag;
-        // apunta a los datos
-        op->msg = action;
-
-        // postea en la cola de la mquina de estados
-        if(putMessage(op) != osOK){
-        	if(op->msg){
-        		Heap::memFree(op->msg);
-        	}
-        	Heap::memFree(op);
+        // lo copia en un mensaje del pool y lo postea en la cola de la tarea
+        postCmdMsg(topic, RelayActionPendingFlag, msg, sizeof(Blob::RlyManAction_t));
+        return;
+    }
+
+    // si es una consulta del desglose por fases de la latencia de un relé, responde en formato JSON
+    if(MQ::MQClient::isTokenRoot(topic, "get/perf") ){
+        HOT_TRACE_D(_EXPR_, _MODULE_, "Recibido topic %s", topic);
+
+        // el mensaje es el identificador del relé
+        if(msg_len != sizeof(uint8_t)){
+        	DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_MSG, tamaño incorrecto en %s", topic);
+        	return;
+        }
+        // la respuesta se formatea en la tarea, ya que esta callback se ejecuta en el hilo del publicador
+        postCmdMsg(topic, PerfQueryFlag, msg, sizeof(uint8_t));
+        return;
+    }
+
+    // si es una consulta del log binario de trazas, responde con su volcado
+    if(MQ::MQClient::isTokenRoot(topic, "get/trace") ){
+        DEBUG_TRACE_D(_EXPR_, _MODULE_, "Recibido topic %s", topic);
+#if defined(RELAYMANAGER_ENABLE_TRACELOG)
+        uint32_t size = sizeof(Blob::RlyManTraceHeader_t) + (TraceLogSize * sizeof(Blob::RlyManTraceRecord_t));
+        uint8_t* dump = (uint8_t*)Heap::memAlloc(size);
+        MBED_ASSERT(dump);
+        int32_t n = getTraceLog(dump, size);
+        MQ::MQClient::publish(_topics.statTrace, dump, n, &_publicationCb);
+        Heap::memFree(dump);
+#else
+        DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_TRACE log binario no disponible");
+#endif
+        return;
+    }
+
+    // si es un comando configurando el modo ráfaga...
+    if(MQ::MQClient::isTokenRoot(topic, "set/burst") ){
+        HOT_TRACE_D(_EXPR_, _MODULE_, "Recibido topic %s", topic);
+
+        // el mensaje es un blob tipo 'RlyManBurstAction_t'
+        // chequea el mensaje
+        if(msg_len != sizeof(Blob::RlyManBurstAction_t)){
+        	DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_MSG, tamaño incorrecto en %s", topic);
+        	return;
+        }
+
+        // lo copia en un mensaje del pool y lo postea en la cola de la tarea
+        postCmdMsg(topic, BurstActionPendingFlag, msg, sizeof(Blob::RlyManBurstAction_t));
+        return;
+    }
+
+    // si es un comando solicitando una acción temporizada...
+    if(MQ::MQClient::isTokenRoot(topic, "set/timed") ){
+        HOT_TRACE_D(_EXPR_, _MODULE_, "Recibido topic %s", topic);
+
+        // el mensaje es un blob tipo 'RlyManTimedAction_t'
+        // chequea el mensaje
+        if(msg_len != sizeof(Blob::RlyManTimedAction_t)){
+        	DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_MSG, tamaño incorrecto en %s", topic);
+        	return;
+        }
+
+        // lo copia en un mensaje del pool y lo postea en la cola de la tarea
+        postCmdMsg(topic, TimedActionPendingFlag, msg, sizeof(Blob::RlyManTimedAction_t));
+        return;
+    }
+
+    // si es un comando solicitando una acción en grupo...
+    if(MQ::MQClient::isTokenRoot(topic, "set/group") ){
+        HOT_TRACE_D(_EXPR_, _MODULE_, "Recibido topic %s", topic);
+
+        // el mensaje es un blob tipo 'RlyManGroupAction_t'
+        // chequea el mensaje
+        if(msg_len != sizeof(Blob::RlyManGroupAction_t)){
+        	DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_MSG, tamaño incorrecto en %s", topic);
+        	return;
         }
+
+        // lo copia en un mensaje del pool y lo postea en la cola de la tarea
+        postCmdMsg(topic, GroupActionPendingFlag, msg, sizeof(Blob::RlyManGroupAction_t));
         return;
     }
 
@@ -170,121 +718,177 @@ State::StateResult RelayManager::Init_EventHandler(State::StateEvent* se){
 	State::Msg* st_msg = (State::Msg*)se->oe->value.p;
     switch((int)se->evt){
         case State::EV_ENTRY:{
-        	DEBUG_TRACE_I(_EXPR_, _MODULE_, "Iniciando recuperacin de datos...");
+        	DEBUG_TRACE_I(_EXPR_, _MODULE_, "Iniciando recuperación de datos...");
         	// recupera los datos de memoria NV
         	restoreConfig();
 
+        	// aplica las fases solicitadas antes del arranque y graba si han cambiado
+        	bool phase_changed = false;
+        	for(int i = 0; i < _max_num_relays; i++){
+        		if(_relay_list[i].phase_req != NoPhaseRequest && _relay_list[i].phase_req != _relay_list[i].cfg.phase){
+        			_relay_list[i].cfg.phase = _relay_list[i].phase_req;
+        			phase_changed = true;
+        		}
+        	}
+        	if(phase_changed){
+        		saveConfig();
+        	}
+
+        	// toma la configuración recuperada como la ya grabada, para la persistencia diferida
+        	for(int i = 0; i < _max_num_relays; i++){
+        		_relay_list[i].saved_cfg = _relay_list[i].cfg;
+        		_relay_list[i].dirty = false;
+        		updateSnapshot(i);
+        	}
+
+        	// recupera la telemetría de salud, tomando los retardos recuperados como referencia si no la hay
+        	restoreHealth();
+
         	DEBUG_TRACE_D(_EXPR_, _MODULE_, "Relay0 Ton=%d, Toff=%d, delta=%d", _relay_list[0].cfg.delayOnUs, _relay_list[0].cfg.delayOffUs, _relay_list[0].cfg.deltaUs);
 
-        	// realiza la suscripcin local ej: "cmd/$module/#"
-        	char* sub_topic_local = (char*)Heap::memAlloc(MQ::MQClient::getMaxTopicLen());
-        	MBED_ASSERT(sub_topic_local);
-        	sprintf(sub_topic_local, "set/+/%s", _sub_topic_base);
-        	if(MQ::MQClient::subscribe(sub_topic_local, new MQ::SubscribeCallback(this, &RelayManager::subscriptionCb)) == MQ::SUCCESS){
-        		DEBUG_TRACE_D(_EXPR_, _MODULE_, "Sucripcin LOCAL hecha a %s", sub_topic_local);
+        	// activa la sincronización con el zerocross, si la hay
+        	(this->*_paths->startSync)();
+
+        	// construye una única vez los topics utilizados, de forma que las publicaciones no requieran
+        	// reservar memoria ni formatear
+        	buildTopics();
+
+        	// inicia la publicación periódica de la telemetría de salud
+        	_health_tmr.attach_us(callback(this, &RelayManager::isrHealthTimeoutCb), HealthPeriodMs * 1000);
+
+        	// realiza la suscripción local ej: "cmd/$module/#"
+        	if(MQ::MQClient::subscribe(_topics.subSet, new MQ::SubscribeCallback(this, &RelayManager::subscriptionCb)) == MQ::SUCCESS){
+        		DEBUG_TRACE_D(_EXPR_, _MODULE_, "Sucripción LOCAL hecha a %s", _topics.subSet);
         	}
         	else{
-        		DEBUG_TRACE_E(_EXPR_, _MODULE_, "ERR_SUBSC en la suscripcin LOCAL a %s", sub_topic_local);
+        		DEBUG_TRACE_E(_EXPR_, _MODULE_, "ERR_SUBSC en la suscripción LOCAL a %s", _topics.subSet);
         	}
-        	sprintf(sub_topic_local, "get/+/%s", _sub_topic_base);
-        	if(MQ::MQClient::subscribe(sub_topic_local, new MQ::SubscribeCallback(this, &RelayManager::subscriptionCb)) == MQ::SUCCESS){
-        		DEBUG_TRACE_D(_EXPR_, _MODULE_, "Sucripcin LOCAL hecha a %s", sub_topic_local);
+        	if(MQ::MQClient::subscribe(_topics.subGet, new MQ::SubscribeCallback(this, &RelayManager::subscriptionCb)) == MQ::SUCCESS){
+        		DEBUG_TRACE_D(_EXPR_, _MODULE_, "Sucripción LOCAL hecha a %s", _topics.subGet);
         	}
         	else{
-        		DEBUG_TRACE_E(_EXPR_, _MODULE_, "ERR_SUBSC en la suscripcin LOCAL a %s", sub_topic_local);
+        		DEBUG_TRACE_E(_EXPR_, _MODULE_, "ERR_SUBSC en la suscripción LOCAL a %s", _topics.subGet);
         	}
-        	Heap::memFree(sub_topic_local);
             return State::HANDLED;
         }
 
+        // Los eventos internos (comandos del pool y eventos ISR) se entregan como eventos temporizados, ya que
+        // la máquina de estados no debe liberarlos. Se despachan aquí con su flag original.
         case State::EV_TIMED:{
+        	if(_internal_msg){
+        		State::Msg* msg = _internal_msg;
+        		_internal_msg = NULL;
+        		osEvent oe;
+        		oe.status = osEventMessage;
+        		oe.value.p = msg;
+        		State::StateEvent ev = *se;
+        		ev.evt = (State::EventType)msg->sig;
+        		ev.oe = &oe;
+        		Init_EventHandler(&ev);
+        		if(isCmdMsg(msg)){
+        			freeCmdMsg((CmdMsg*)msg);
+        		}
+        	}
             return State::HANDLED;
         }
 
-        // Procesa datos recibidos de la publicacin en $BASE/value/cmd
-        case RelayActionPendingFlag:{
-        	// obtiene la accin a realizar
-        	_curr_action = *((Blob::RlyManAction_t*)st_msg->msg);
-        	DEBUG_TRACE_D(_EXPR_, _MODULE_, "Iniciando accin sobre rel '%d'", _curr_action.id);
-        	// si el rel tiene feedback asociado...
-        	if(_relay_list[_curr_action.id].fdb){
-				// si la operacin es un ON activa el feedback
-				if(_curr_action.request == Blob::RlyManOn){
-					DEBUG_TRACE_D(_EXPR_, _MODULE_, "Arrancando feedback");
-					_relay_list[_curr_action.id].fdb->start();
-					Thread::wait(RelayFeedback::DefaultPreviousCaptureTime);
-				}
-				// si es un OFF lo reactiva
-				else if(_curr_action.request == Blob::RlyManOff){
-					DEBUG_TRACE_D(_EXPR_, _MODULE_, "Resumiendo feedback");
-					_relay_list[_curr_action.id].fdb->resume();
-					Thread::wait(RelayFeedback::DefaultPreviousCaptureTime);
-				}
-				// si es otro, habr que notificar error
-				else{
-					DEBUG_TRACE_E(_EXPR_, _MODULE_, "ERR_REQ la accin es desconocida.");
-					return State::HANDLED;
-				}
+        // Procesa datos recibidos de la publicación en $BASE/value/cmd o $BASE/group/cmd
+        case RelayActionPendingFlag:
+        case GroupActionPendingFlag:
+        case BurstActionPendingFlag:
+        case TimedActionPendingFlag:{
+        	acceptMsg(st_msg);
+        	// si no hay ningún lote en curso, acepta el resto de comandos encolados e inicia uno nuevo, de forma que
+        	// todas las acciones se ejecuten sincronizadas con el mismo flanco de zerocross
+        	if(_stage == StageIdle){
+        		collectCommands();
+        		startBatch();
         	}
+            return State::HANDLED;
+        }
 
-            // activa flag de estado
-            _flags = (Flags)(_flags | ActionPending);
+        // Procesa una consulta del desglose por fases de la latencia de un relé
+        case PerfQueryFlag:{
+        	acceptMsg(st_msg);
+            return State::HANDLED;
+        }
 
-        	// si el zerocross est habilitado
-        	if(_zc){
-				DEBUG_TRACE_D(_EXPR_, _MODULE_, "Iniciando Zerocross para accin sincronizada");
+        // Procesa el tick de la rueda de temporización, iniciando un lote con las acciones vencidas si no hay
+        // ninguno en curso
+        case TimedTickFlag:{
+        	timedUpdate();
+        	timedArm();
+        	if(_stage == StageIdle){
+        		collectCommands();
+        		startBatch();
+        	}
+            return State::HANDLED;
+        }
 
-				// activa eventos del zerocross para ejecutar las acciones pendientes de forma sincronizada
-				_zc->enableEvents(_zc_level, callback(this, &RelayManager::isrZerocrossCb));
+        // Procesa el fin de la pre-captura del feedback
+        case FeedbackReadyFlag:{
+        	awaitZerocross();
+            return State::HANDLED;
+        }
 
-				// queda bloqueado hasta que se complete la accin
-				_sem.wait();
+        // Procesa la finalización de las conmutaciones del lote
+        case RelayChangedFlag:{
+        	startInrush();
+            return State::HANDLED;
+        }
 
-				// desactiva eventos del zerocross
-				_zc->disableEvents(_zc_level);
-        	}
-        	// si no est habilitado el zc, ejecuta su callback sin esperar ms
-        	else{
-        		isrZerocrossCb(Zerocross::EdgeActiveAreBoth);
-        	}
+        // Procesa el fin del pico de corriente, finalizando el lote e iniciando el siguiente si hay acciones pendientes
+        case MaxCurrTimeoutFlag:{
+        	completeBatch();
+        	startBatch();
+        	// reprograma la grabación diferida, que se realizará tras un tiempo en reposo
+        	schedulePersist();
+            return State::HANDLED;
+        }
 
-			DEBUG_TRACE_D(_EXPR_, _MODULE_, "Fn de la accin");
-			char msg;
-			if(_curr_action.request == Blob::RlyManOn){
-				Thread::wait(DefaultMaxCurrentTimeMs);
-				if(_relay_list[_curr_action.id].fdb){
-					DEBUG_TRACE_D(_EXPR_, _MODULE_, "Pausando feedback");
-					_relay_list[_curr_action.id].fdb->pause();
-				}
-				msg = '1';
-			}
-			else{
-				Thread::wait(DefaultMaxCurrentTimeMs/2);
-				// detiene feedback y captura estado
-				if(_relay_list[_curr_action.id].fdb){
-					_relay_list[_curr_action.id].fdb->stop();
-				}
-				msg = '0';
-			}
+        // Procesa una desconexión de emergencia, con prioridad sobre los comandos encolados
+        case ShedPendingFlag:{
+        	startShed();
+            return State::HANDLED;
+        }
 
+        // Procesa el fin de la desconexión de emergencia, atendiendo las solicitudes recibidas mientras tanto y
+        // reanudando las acciones pendientes
+        case ShedDoneFlag:{
+        	completeShed();
+        	startShed();
+        	startBatch();
+            return State::HANDLED;
+        }
 
-			// realiza calibracin de los retardos de On y Off en funcin del resultado obtenido del feedback
-			feedbackUpdate();
+        // Procesa la pérdida o recuperación del zerocross
+        case SyncUpdateFlag:{
+        	updateSync();
+            return State::HANDLED;
+        }
 
-			// Notifica el cambio de estado
-			char* topic = (char*)Heap::memAlloc(MQ::MQClient::getMaxTopicLen());
-        	MBED_ASSERT(topic);
-        	sprintf(topic, "stat/value/%s", _pub_topic_base);
-        	DEBUG_TRACE_D(_EXPR_, _MODULE_, "Publicando resultado en '%s'", topic);
-			MQ::MQClient::publish(topic, &_curr_action, sizeof(Blob::RlyManAction_t), &_publicationCb);
+        // Publica periódicamente la telemetría de salud
+        case HealthReportFlag:{
+        	healthReport();
+        	_health_tmr.attach_us(callback(this, &RelayManager::isrHealthTimeoutCb), HealthPeriodMs * 1000);
+            return State::HANDLED;
+        }
 
-			// tambin habr que notificar feedback disponible
-			if(_relay_list[_curr_action.id].fdb){
-				sprintf(topic, "stat/fdbk/%s", _pub_topic_base);
-				DEBUG_TRACE_D(_EXPR_, _MODULE_, "Publicando resultado en '%s'", topic);
-				MQ::MQClient::publish(topic, &msg, sizeof(char), &_publicationCb);
-			}
-			Heap::memFree(topic);
+        // Procesa la grabación diferida de la configuración
+        case PersistFlushFlag:{
+        	if(_persist.pendingWrites == 0){
+        		return State::HANDLED;
+        	}
+        	// graba si está en reposo o ha vencido el plazo máximo, respetando el intervalo mínimo entre grabaciones
+        	uint32_t now = us_ticker_read();
+        	bool deadline = ((int32_t)(now - (_persist.firstDirtyUs + (PersistDeadlineMs * 1000))) >= 0);
+        	bool allowed = (_persist.flushes == 0 || (now - _persist.lastFlushUs) >= (PersistMinIntervalMs * 1000));
+        	if((_stage == StageIdle || deadline) && allowed){
+        		flushConfig();
+        	}
+        	else{
+        		schedulePersist();
+        	}
             return State::HANDLED;
         }
 
@@ -302,169 +906,2417 @@ State::StateResult RelayManager::Init_EventHandler(State::StateEvent* se){
 
 
 //------------------------------------------------------------------------------------
-osEvent RelayManager:: getOsEvent(){
-	return _queue.get();
+void RelayManager::acceptMsg(State::Msg* msg){
+	// copia el comando, ya que el mensaje se libera tras su procesado
+	PendingCmd cmd;
+	cmd.sig = msg->sig;
+	cmd.ts = (isCmdMsg(msg))? ((CmdMsg*)msg)->ts : us_ticker_read();
+	cmd.deq = us_ticker_read();
+	if(msg->sig == RelayActionPendingFlag){
+		cmd.action = *((Blob::RlyManAction_t*)msg->msg);
+	}
+	else if(msg->sig == GroupActionPendingFlag){
+		cmd.group = *((Blob::RlyManGroupAction_t*)msg->msg);
+	}
+	else if(msg->sig == BurstActionPendingFlag){
+		// el modo ráfaga se configura de inmediato, no forma parte de los lotes
+		setBurst(*((Blob::RlyManBurstAction_t*)msg->msg));
+		return;
+	}
+	else if(msg->sig == TimedActionPendingFlag){
+		// las acciones temporizadas se aceptan como comandos al vencer
+		setTimed(*((Blob::RlyManTimedAction_t*)msg->msg));
+		return;
+	}
+	else if(msg->sig == PerfQueryFlag){
+		// las consultas se responden de inmediato, no forman parte de los lotes
+		publishPhaseJson(*((uint8_t*)msg->msg));
+		return;
+	}
+	else{
+		DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_SIG. Descartando evento %x", msg->sig);
+		return;
+	}
+
+	acceptCmd(cmd);
 }
 
 
 //------------------------------------------------------------------------------------
-void RelayManager::publicationCb(const char* topic, int32_t result){
+void RelayManager::acceptCmd(const PendingCmd& cmd){
+	if(!isValidCmd(cmd)){
+		return;
+	}
+
+	// las acciones individuales que no modifican el estado del relé se notifican sin conmutar, y las sucesivas
+	// sobre un mismo relé se agrupan quedando sólo la última
+	if(cmd.sig == RelayActionPendingFlag && (skipRedundant(cmd) || coalesceCmd(cmd))){
+		return;
+	}
 
+	// para mantener el orden, si hay comandos retenidos o algún relé ya tiene una acción pendiente, lo retiene
+	if(_backlog_count > 0 || !canBePending(cmd)){
+		if(_backlog_count >= MaxQueueMessages){
+			DEBUG_TRACE_E(_EXPR_, _MODULE_, "ERR_BACKLOG. Descartando comando");
+			return;
+		}
+		_backlog[(_backlog_head + _backlog_count) % MaxQueueMessages] = cmd;
+		_backlog_count++;
+		return;
+	}
+	setPending(cmd);
 }
 
 
 //------------------------------------------------------------------------------------
-bool RelayManager::checkIntegrity(){
-	for(int i=0; i<_max_num_relays; i++){
-		if(_relay_list[i].cfg.delayOnUs < DefaultSwitchingDelay || _relay_list[i].cfg.delayOnUs >= MaxSwitchingDelay){
+bool RelayManager::isValidCmd(const PendingCmd& cmd){
+	if(cmd.sig == RelayActionPendingFlag){
+		// descarta acciones sobre relés inexistentes o peticiones desconocidas
+		if(cmd.action.id >= _max_num_relays || _relay_list[cmd.action.id].relay == NULL){
+			DEBUG_TRACE_E(_EXPR_, _MODULE_, "ERR_ID el relé '%d' no existe.", cmd.action.id);
 			return false;
 		}
-		if(_relay_list[i].cfg.delayOffUs < DefaultSwitchingDelay || _relay_list[i].cfg.delayOffUs >= MaxSwitchingDelay){
+		if(cmd.action.request != Blob::RlyManOn && cmd.action.request != Blob::RlyManOff){
+			DEBUG_TRACE_E(_EXPR_, _MODULE_, "ERR_REQ la acción es desconocida.");
 			return false;
 		}
-		if(_relay_list[i].cfg.deltaUs == 0){
+		if(_relay_list[cmd.action.id].burst.active){
+			DEBUG_TRACE_E(_EXPR_, _MODULE_, "ERR_MODE el relé '%d' está en modo ráfaga.", cmd.action.id);
 			return false;
 		}
+		return true;
 	}
-	return true;
-}
 
-
-//------------------------------------------------------------------------------------
+	// la acción en grupo es atómica: se descarta completa si algún relé no existe o se solicita a la vez On y Off
+	if((cmd.group.onMask & cmd.group.offMask) != 0){
+		DEBUG_TRACE_E(_EXPR_, _MODULE_, "ERR_REQ máscaras On/Off solapadas.");
+		return false;
+	}
+	uint32_t mask = cmd.group.onMask | cmd.group.offMask;
+	for(int i = 0; i < MaxGroupRelays; i++){
+		if((mask & (1u << i)) != 0 && (i >= _max_num_relays || _relay_list[i].relay == NULL)){
+			DEBUG_TRACE_E(_EXPR_, _MODULE_, "ERR_ID el relé '%d' no existe.", i);
+			return false;
+		}
+		if((mask & (1u << i)) != 0 && _relay_list[i].burst.active){
+			DEBUG_TRACE_E(_EXPR_, _MODULE_, "ERR_MODE el relé '%d' está en modo ráfaga.", i);
+			return false;
+		}
+	}
+	return true;
+}
+
+
+//------------------------------------------------------------------------------------
+bool RelayManager::canBePending(const PendingCmd& cmd){
+	if(cmd.sig == RelayActionPendingFlag){
+		return (_relay_list[cmd.action.id].pending == (Blob::RlyManEvtFlags)0);
+	}
+	uint32_t mask = cmd.group.onMask | cmd.group.offMask;
+	for(int i = 0; i < _max_num_relays && i < MaxGroupRelays; i++){
+		if((mask & (1u << i)) != 0 && _relay_list[i].pending != (Blob::RlyManEvtFlags)0){
+			return false;
+		}
+	}
+	return true;
+}
+
+
+//------------------------------------------------------------------------------------
+void RelayManager::setPending(const PendingCmd& cmd){
+	if(cmd.sig == RelayActionPendingFlag){
+		HOT_TRACE_D(_EXPR_, _MODULE_, "Acción sobre relé '%d' pendiente", cmd.action.id);
+		TRACE_LOG(Blob::RlyManTraceCmd, cmd.action.id, cmd.action.request, 0);
+		_relay_list[cmd.action.id].pending = cmd.action.request;
+		_relay_list[cmd.action.id].pending_grouped = false;
+		_relay_list[cmd.action.id].pending_ts = cmd.ts;
+		_relay_list[cmd.action.id].pending_deq = cmd.deq;
+		_pending_count++;
+		return;
+	}
+	HOT_TRACE_D(_EXPR_, _MODULE_, "Grupo On=%x, Off=%x pendiente", cmd.group.onMask, cmd.group.offMask);
+	TRACE_LOG(Blob::RlyManTraceCmd, TraceNoRelay, cmd.group.onMask, cmd.group.offMask);
+	for(int i = 0; i < _max_num_relays && i < MaxGroupRelays; i++){
+		if(((cmd.group.onMask | cmd.group.offMask) & (1u << i)) != 0){
+			_relay_list[i].pending = ((cmd.group.onMask & (1u << i)) != 0)? Blob::RlyManOn : Blob::RlyManOff;
+			_relay_list[i].pending_grouped = true;
+			_relay_list[i].pending_ts = cmd.ts;
+			_relay_list[i].pending_deq = cmd.deq;
+			_pending_count++;
+		}
+	}
+}
+
+
+//------------------------------------------------------------------------------------
+int32_t RelayManager::findBacklog(uint8_t id){
+	// busca desde el más reciente, ya que es el que determinará el estado final del relé
+	for(int32_t n = _backlog_count - 1; n >= 0; n--){
+		int32_t idx = (_backlog_head + n) % MaxQueueMessages;
+		const PendingCmd& cmd = _backlog[idx];
+		if(cmd.sig == RelayActionPendingFlag && cmd.action.id == id){
+			return idx;
+		}
+		if(cmd.sig == GroupActionPendingFlag && id < MaxGroupRelays && ((cmd.group.onMask | cmd.group.offMask) & (1u << id)) != 0){
+			return idx;
+		}
+	}
+	return -1;
+}
+
+
+//------------------------------------------------------------------------------------
+bool RelayManager::skipRedundant(const PendingCmd& cmd){
+	// sólo si el relé no tiene acciones en curso, pendientes ni retenidas, y ya está en el estado solicitado
+	RelayHandler* hnd = &_relay_list[cmd.action.id];
+	if(hnd->state != cmd.action.request || hnd->action != (Blob::RlyManEvtFlags)0 || hnd->pending != (Blob::RlyManEvtFlags)0 || findBacklog(cmd.action.id) >= 0){
+		return false;
+	}
+	HOT_TRACE_D(_EXPR_, _MODULE_, "Relé '%d' ya en el estado solicitado", cmd.action.id);
+	TRACE_LOG(Blob::RlyManTraceSkip, cmd.action.id, hnd->state, 0);
+	notifySkipped(cmd.action.id, cmd.action.request, false, cmd.ts);
+	return true;
+}
+
+
+//------------------------------------------------------------------------------------
+bool RelayManager::coalesceCmd(const PendingCmd& cmd){
+	RelayHandler* hnd = &_relay_list[cmd.action.id];
+
+	// si hay comandos retenidos sobre el relé, sólo sustituye al último si es una acción individual
+	int32_t idx = findBacklog(cmd.action.id);
+	if(idx >= 0){
+		if(_backlog[idx].sig != RelayActionPendingFlag){
+			return false;
+		}
+		_backlog[idx].action.request = cmd.action.request;
+		_backlog[idx].ts = cmd.ts;
+		_backlog[idx].deq = cmd.deq;
+		_cmd_stats.coalesced++;
+		return true;
+	}
+
+	// en otro caso, sustituye la acción individual pendiente del siguiente lote
+	if(hnd->pending == (Blob::RlyManEvtFlags)0 || hnd->pending_grouped){
+		return false;
+	}
+	HOT_TRACE_D(_EXPR_, _MODULE_, "Acción sobre relé '%d' sustituida", cmd.action.id);
+	TRACE_LOG(Blob::RlyManTraceCoalesce, cmd.action.id, cmd.action.request, 0);
+	hnd->pending = cmd.action.request;
+	hnd->pending_ts = cmd.ts;
+	hnd->pending_deq = cmd.deq;
+	_cmd_stats.coalesced++;
+	return true;
+}
+
+
+//------------------------------------------------------------------------------------
+void RelayManager::notifySkipped(uint8_t id, Blob::RlyManEvtFlags action, bool grouped, uint32_t ts){
+	_cmd_stats.skipped++;
+	RELAY_PERF_ADD(&_relay_list[id], latency, us_ticker_read() - ts);
+
+	// si forma parte de una acción en grupo, se notificará de forma agregada
+	if(grouped){
+		if(action == Blob::RlyManOn){
+			_group_stat.onMask |= (1u << id);
+		}
+		else{
+			_group_stat.offMask |= (1u << id);
+		}
+		return;
+	}
+	_curr_action.id = id;
+	_curr_action.request = action;
+	HOT_TRACE_D(_EXPR_, _MODULE_, "Publicando resultado en '%s'", _topics.statValue);
+	TRACE_LOG(Blob::RlyManTracePublish, id, action, 0);
+	MQ::MQClient::publish(_topics.statValue, &_curr_action, sizeof(Blob::RlyManAction_t), &_publicationCb);
+}
+
+
+//------------------------------------------------------------------------------------
+void RelayManager::publishGroupStat(){
+	// notifica en una única publicación el resultado de las acciones en grupo
+	if((_group_stat.onMask | _group_stat.offMask) != 0){
+		HOT_TRACE_D(_EXPR_, _MODULE_, "Publicando resultado en '%s'", _topics.statGroup);
+		MQ::MQClient::publish(_topics.statGroup, &_group_stat, sizeof(Blob::RlyManGroupAction_t), &_publicationCb);
+		_group_stat = {0, 0};
+	}
+}
+
+
+//------------------------------------------------------------------------------------
+void RelayManager::collectCommands(){
+	for(;;){
+		osEvent oe = _queue.get(0);
+		if(oe.status != osEventMessage){
+			return;
+		}
+		State::Msg* msg = (State::Msg*)oe.value.p;
+		// los avisos de eventos ISR se descartan, ya que el evento queda registrado en _isr_events
+		if(msg == &_evt_token){
+			continue;
+		}
+		acceptMsg(msg);
+		// al ser extraído fuera de la máquina de estados, el mensaje se libera aquí
+		if(isCmdMsg(msg)){
+			freeCmdMsg((CmdMsg*)msg);
+		}
+		else{
+			if(msg->msg){
+				Heap::memFree(msg->msg);
+			}
+			Heap::memFree(msg);
+		}
+	}
+}
+
+
+//------------------------------------------------------------------------------------
+template <bool Sync>
+void RelayManager::startSyncImpl(){
+	if(!Sync){
+		return;
+	}
+
+	// activa permanentemente los eventos del zerocross propio o se suscribe a todas las fases del hub. Los flancos
+	// alimentan al estimador de red de cada fase y programan las acciones. Activa también la supervisión que detecta
+	// su pérdida
+	if(_hub){
+		_num_phases = _hub->getPhaseCount();
+	}
+	for(int p = 0; p < _num_phases; p++){
+		Zerocross::LogicLevel level = (_hub)? _hub->getLevel(p) : _zc_level;
+		_phases[p].edgesPerCycle = (level == Zerocross::EdgeActiveAreBoth)? 2 : 1;
+		_phases[p].lastUs = us_ticker_read();
+		if(_hub && !_hub->attach(p, callback(this, &RelayManager::isrPhaseEdge))){
+			DEBUG_TRACE_E(_EXPR_, _MODULE_, "ERR_HUB sin suscripción a la fase %d", p);
+		}
+	}
+	if(_zc){
+		_zc->enableEvents(_zc_level, callback(this, &RelayManager::isrZerocrossCb));
+	}
+	if(_num_phases > 0){
+		_zc_wdt.attach_us(callback(this, &RelayManager::isrZcWatchdogCb), ZcSupervisionUs);
+	}
+}
+template void RelayManager::startSyncImpl<false>();
+template void RelayManager::startSyncImpl<true>();
+
+
+//------------------------------------------------------------------------------------
+template <bool Fdb>
+void RelayManager::startBatchImpl(){
+	// no se inician lotes mientras haya una desconexión de emergencia en curso
+	if(_stage != StageIdle || _pending_count == 0 || _shed_active != 0){
+		return;
+	}
+
+	// incluye en el lote todas las acciones pendientes. Si algún relé utiliza un driver RelayFeedback, su captura
+	// se arma ahora y el lote espera la pre-captura completa antes de conmutar
+	static const uint32_t PreCaptureUs = RelayFeedback::DefaultPreviousCaptureTime * 1000;
+	_batch_arm_us = us_ticker_read();
+	uint32_t wait_us = 0;
+	_batch_unsync = false;
+	_batch_count = 0;
+	_batch_has_on = false;
+	for(int i = 0; i < _max_num_relays; i++){
+		RelayHandler* hnd = &_relay_list[i];
+		if(hnd->pending == (Blob::RlyManEvtFlags)0){
+			continue;
+		}
+		// si tras agrupar acciones el relé ya está en el estado solicitado, se notifica sin conmutar
+		if(hnd->pending == hnd->state){
+			notifySkipped(i, hnd->pending, hnd->pending_grouped, hnd->pending_ts);
+			hnd->pending = (Blob::RlyManEvtFlags)0;
+			continue;
+		}
+		hnd->action = hnd->pending;
+		hnd->grouped = hnd->pending_grouped;
+		hnd->action_ts = hnd->pending_ts;
+		hnd->deq_ts = hnd->pending_deq;
+		hnd->pending = (Blob::RlyManEvtFlags)0;
+		_batch_count++;
+		_batch_has_on = (hnd->action == Blob::RlyManOn)? true : _batch_has_on;
+		// el driver de feedback se arma para el lote y requiere la pre-captura. La entrada de feedback registra los
+		// flancos de forma continua, sólo se marca el comienzo del lote
+		if(Fdb){
+			if(hnd->fdb){
+				armFeedback(i);
+				wait_us = PreCaptureUs;
+			}
+			if(hnd->sense){
+				hnd->sense->mark = hnd->sense->count;
+			}
+		}
+	}
+	_pending_count = 0;
+	HOT_TRACE_D(_EXPR_, _MODULE_, "Iniciando lote de %d acciones", _batch_count);
+	TRACE_LOG(Blob::RlyManTraceBatchStart, TraceNoRelay, _batch_count, _batch_has_on);
+
+	// los comandos retenidos pasan en orden a pendientes, mientras no afecten a relés con acciones pendientes
+	while(_backlog_count > 0 && canBePending(_backlog[_backlog_head])){
+		setPending(_backlog[_backlog_head]);
+		_backlog_head = (_backlog_head + 1) % MaxQueueMessages;
+		_backlog_count--;
+	}
+
+	// si todas las acciones eran redundantes no hay nada que conmutar, se continúa con las siguientes
+	if(_batch_count == 0){
+		publishGroupStat();
+		startBatchImpl<Fdb>();
+		return;
+	}
+
+	// reparte los encendidos en semiciclos sucesivos para no superar el límite de corriente de pico
+	planInrush();
+
+	// espera la pre-captura del feedback sin bloquear la tarea
+	if(Fdb && wait_us > 0){
+		_stage = StageFeedbackArmed;
+		armStageTimer(FeedbackReadyFlag, (wait_us + 999) / 1000);
+		return;
+	}
+	awaitZerocross();
+}
+template void RelayManager::startBatchImpl<false>();
+template void RelayManager::startBatchImpl<true>();
+
+
+//------------------------------------------------------------------------------------
+void RelayManager::armFeedback(uint8_t id){
+	RelayHandler* hnd = &_relay_list[id];
+	if(hnd->fdb == NULL || hnd->burst.active){
+		return;
+	}
+	if(hnd->state == Blob::RlyManOn){
+		hnd->fdb->resume();
+	}
+	else{
+		if(hnd->fdb_armed){
+			hnd->fdb->stop();
+		}
+		hnd->fdb->start();
+	}
+	hnd->fdb_armed = true;
+}
+
+
+//------------------------------------------------------------------------------------
+void RelayManager::planInrush(){
+	for(int i = 0; i < _max_num_relays; i++){
+		_relay_list[i].slot = 0;
+	}
+	if(_inrush_budget == 0 || !_batch_has_on){
+		return;
+	}
+
+	// ordena los encendidos de mayor a menor carga (peso x duración), de forma que los picos mayores ocupen los
+	// primeros semiciclos y los menores rellenen los huecos restantes
+	uint8_t order[MaxGroupRelays];
+	uint8_t count = 0;
+	for(int i = 0; i < _max_num_relays && i < MaxGroupRelays; i++){
+		RelayHandler* hnd = &_relay_list[i];
+		if(hnd->action != Blob::RlyManOn){
+			continue;
+		}
+		uint32_t load = (uint32_t)hnd->inrush.weight * hnd->inrush.slots;
+		int n = count++;
+		while(n > 0 && ((uint32_t)_relay_list[order[n-1]].inrush.weight * _relay_list[order[n-1]].inrush.slots) < load){
+			order[n] = order[n-1];
+			n--;
+		}
+		order[n] = i;
+	}
+
+	// asigna a cada encendido el primer semiciclo en el que la suma de picos no supera el límite durante toda su
+	// duración. Si no cabe en ninguno (p.ej. un pico mayor que el límite) toma el de menor pico ya asignado.
+	uint32_t load[MaxInrushSlots];
+	memset(load, 0, sizeof(load));
+	uint8_t span = 0;
+	for(int n = 0; n < count; n++){
+		RelayHandler* hnd = &_relay_list[order[n]];
+		uint8_t slots = hnd->inrush.slots;
+		uint8_t best = 0;
+		uint32_t best_peak = 0xFFFFFFFF;
+		for(uint8_t k = 0; k + slots <= MaxInrushSlots; k++){
+			uint32_t peak = 0;
+			for(uint8_t t = k; t < k + slots; t++){
+				peak = (load[t] > peak)? load[t] : peak;
+			}
+			if(peak + hnd->inrush.weight <= _inrush_budget){
+				best = k;
+				break;
+			}
+			if(peak < best_peak){
+				best_peak = peak;
+				best = k;
+			}
+		}
+		hnd->slot = best;
+		for(uint8_t t = best; t < best + slots; t++){
+			load[t] += hnd->inrush.weight;
+		}
+		span = (best + slots > span)? (best + slots) : span;
+	}
+	HOT_TRACE_D(_EXPR_, _MODULE_, "Encendidos repartidos en %d semiciclos", span);
+	TRACE_LOG(Blob::RlyManTraceInrush, TraceNoRelay, span, 0);
+}
+
+
+//------------------------------------------------------------------------------------
+template <bool Sync>
+void RelayManager::awaitZerocrossImpl(){
+	_stage = StageAwaitingZc;
+	_batch_pending = _batch_count;
+
+	// agrupa los relés del lote por fase
+	uint32_t masks[ZerocrossHub::MaxPhases] = {0};
+	for(int i = 0; i < _max_num_relays; i++){
+		if(_relay_list[i].action != (Blob::RlyManEvtFlags)0){
+			masks[relayPhase(i)] |= (1u << i);
+		}
+	}
+
+	// sin zerocross (o con un hub aún sin fases), programa las conmutaciones sin esperar más
+	if(!Sync || _num_phases == 0){
+		scheduleBatch(masks[0], us_ticker_read(), DefaultInrushSlotUs);
+		return;
+	}
+
+	for(int p = 0; p < _num_phases; p++){
+		PhaseSync& ph = _phases[p];
+		if(masks[p] == 0){
+			continue;
+		}
+
+		// si se ha perdido el zerocross de la fase, las programa igualmente sin sincronizar
+		if(ph.lost){
+			if(!_batch_unsync){
+				_batch_unsync = true;
+				_sync_stat.unsyncBatches++;
+			}
+			scheduleBatch(masks[p], us_ticker_read(), DefaultInrushSlotUs);
+			continue;
+		}
+
+		// si el estimador de red está enganchado, programa las conmutaciones respecto del paso por cero predicho,
+		// de forma que la acción pueda completarse en el siguiente paso por cero sin esperar a un nuevo flanco
+		uint32_t now = us_ticker_read();
+		uint32_t edge_us, period_us;
+		if(pllGetLastEdge(p, now, &edge_us, &period_us)){
+			HOT_TRACE_D(_EXPR_, _MODULE_, "Programando acción sobre el zerocross predicho de la fase %d", p);
+			TRACE_LOG(Blob::RlyManTraceSchedule, TraceNoRelay, edge_us, period_us);
+			schedulePredicted(masks[p], now, edge_us, period_us);
+			continue;
+		}
+
+		// en otro caso, marca los relés pendientes del siguiente flanco de la fase
+		HOT_TRACE_D(_EXPR_, _MODULE_, "Esperando Zerocross de la fase %d para acción sincronizada", p);
+		TRACE_LOG(Blob::RlyManTraceAwaitZc, TraceNoRelay, p, 0);
+		core_util_critical_section_enter();
+		ph.pending = masks[p];
+		ph.flags |= ActionPending;
+		core_util_critical_section_exit();
+	}
+}
+template void RelayManager::awaitZerocrossImpl<false>();
+template void RelayManager::awaitZerocrossImpl<true>();
+
+
+//------------------------------------------------------------------------------------
+void RelayManager::startInrush(){
+	// espera única al pico de corriente del lote
+	HOT_TRACE_D(_EXPR_, _MODULE_, "Fín de las conmutaciones del lote");
+	_stage = StageInrush;
+	armStageTimer(MaxCurrTimeoutFlag, (_batch_has_on)? DefaultMaxCurrentTimeMs : (DefaultMaxCurrentTimeMs/2));
+}
+
+
+//------------------------------------------------------------------------------------
+template <bool Fdb>
+void RelayManager::completeBatchImpl(){
+	// detiene la captura del feedback para obtener el resultado: pausa tras un ON, detiene tras un OFF. Se arma
+	// de nuevo en el siguiente lote
+	_stage = StageHold;
+	for(int i = 0; Fdb && i < _max_num_relays; i++){
+		RelayHandler* hnd = &_relay_list[i];
+		if(hnd->action == (Blob::RlyManEvtFlags)0 || hnd->fdb == NULL){
+			continue;
+		}
+		if(hnd->action == Blob::RlyManOn){
+			hnd->fdb->pause();
+		}
+		else{
+			hnd->fdb->stop();
+		}
+		hnd->fdb_armed = false;
+	}
+
+	// realiza calibración de los retardos de On y Off en función del resultado obtenido del feedback
+	_stage = StageCalibrate;
+	for(int i = 0; Fdb && i < _max_num_relays; i++){
+		if(_relay_list[i].action != (Blob::RlyManEvtFlags)0){
+			feedbackUpdate(i);
+		}
+	}
+	uint32_t fdb_us = us_ticker_read();
+
+	// publica los resultados
+	_stage = StagePublish;
+	for(int i = 0; i < _max_num_relays; i++){
+		RelayHandler* hnd = &_relay_list[i];
+		if(hnd->action == (Blob::RlyManEvtFlags)0){
+			continue;
+		}
+
+		// registra la latencia desde la recepción del comando hasta la notificación del resultado, y su desglose
+		uint32_t pub_us = us_ticker_read();
+		RELAY_PERF_ADD(hnd, latency, pub_us - hnd->action_ts);
+		perfPhases(hnd, fdb_us, pub_us);
+
+		// si forma parte de una acción en grupo, se notificará de forma agregada
+		Blob::RlyManEvtFlags action = hnd->action;
+		hnd->action = (Blob::RlyManEvtFlags)0;
+		hnd->state = action;
+		hnd->switches++;
+		updateSnapshot(i);
+		if(hnd->grouped){
+			if(action == Blob::RlyManOn){
+				_group_stat.onMask |= (1u << i);
+			}
+			else{
+				_group_stat.offMask |= (1u << i);
+			}
+			continue;
+		}
+
+		// Notifica el cambio de estado
+		_curr_action.id = i;
+		_curr_action.request = action;
+		HOT_TRACE_D(_EXPR_, _MODULE_, "Publicando resultado en '%s'", _topics.statValue);
+		TRACE_LOG(Blob::RlyManTracePublish, i, action, 0);
+		MQ::MQClient::publish(_topics.statValue, &_curr_action, sizeof(Blob::RlyManAction_t), &_publicationCb);
+
+		// también habrá que notificar feedback disponible
+		if(Fdb && (hnd->fdb || hnd->sense)){
+			char msg = (action == Blob::RlyManOn)? '1' : '0';
+			HOT_TRACE_D(_EXPR_, _MODULE_, "Publicando resultado en '%s'", _topics.statFdbk);
+			MQ::MQClient::publish(_topics.statFdbk, &msg, sizeof(char), &_publicationCb);
+		}
+	}
+
+	publishGroupStat();
+	TRACE_LOG(Blob::RlyManTraceBatchDone, TraceNoRelay, _batch_count, 0);
+	_batch_count = 0;
+	_stage = StageIdle;
+}
+template void RelayManager::completeBatchImpl<false>();
+template void RelayManager::completeBatchImpl<true>();
+
+
+//------------------------------------------------------------------------------------
+void RelayManager::startShed(){
+	// si hay una desconexión en curso, la nueva solicitud se atenderá al finalizar
+	if(_shed_active != 0){
+		return;
+	}
+	core_util_critical_section_enter();
+	uint32_t mask = _shed_req;
+	uint32_t ts = _shed_req_ts;
+	_shed_req = 0;
+	core_util_critical_section_exit();
+
+	// se limita a los relés instalados
+	uint32_t valid = 0;
+	for(int i = 0; i < _max_num_relays && i < MaxGroupRelays; i++){
+		if(_relay_list[i].relay != NULL){
+			valid |= (1u << i);
+		}
+	}
+	mask &= valid;
+	if(mask == 0){
+		return;
+	}
+	DEBUG_TRACE_I(_EXPR_, _MODULE_, "Desconexión de emergencia de relés %x", mask);
+	TRACE_LOG(Blob::RlyManTraceShed, TraceNoRelay, mask, 0);
+	_shed_stats.requests++;
+	_shed_ts = ts;
+
+	// descarta las acciones pendientes y retenidas sobre los relés afectados, e interrumpe las que estén en curso
+	// incluido el modo ráfaga
+	dropActions(mask);
+	preemptBatch(mask);
+	for(int i = 0; i < _max_num_relays && i < MaxGroupRelays; i++){
+		if((mask & (1u << i)) != 0 && _relay_list[i].burst.active){
+			stopBurst(i);
+			publishBurstStat(i);
+		}
+	}
+
+	// sólo se apagan los relés que no estén ya apagados (los de estado desconocido se apagan por seguridad), y sólo
+	// los que estaban encendidos cuentan como una operación del contacto. Si no hay ninguno, finaliza sin esperar
+	_shed_active = mask;
+	_shed_on = 0;
+	uint32_t off_mask = 0;
+	for(int i = 0; i < _max_num_relays && i < MaxGroupRelays; i++){
+		if((mask & (1u << i)) == 0 || _relay_list[i].state == Blob::RlyManOff){
+			continue;
+		}
+		off_mask |= (1u << i);
+		_shed_on |= (_relay_list[i].state == Blob::RlyManOn)? (1u << i) : 0;
+	}
+	mask = off_mask;
+	_shed_pending = __builtin_popcount(mask);
+	if(mask == 0){
+		postIsrEvent(ShedDoneFlag);
+		return;
+	}
+
+	// apaga los relés en el siguiente paso por cero de su fase: de inmediato si no hay zerocross o se ha perdido,
+	// sobre el predicho si el estimador de red está enganchado o en otro caso en el siguiente flanco
+	if(_num_phases == 0){
+		scheduleShed(mask, us_ticker_read(), 0);
+		return;
+	}
+	for(int p = 0; p < _num_phases; p++){
+		PhaseSync& ph = _phases[p];
+		uint32_t phase_mask = 0;
+		for(int i = 0; i < _max_num_relays; i++){
+			phase_mask |= ((mask & (1u << i)) != 0 && relayPhase(i) == p)? (1u << i) : 0;
+		}
+		if(phase_mask == 0){
+			continue;
+		}
+		uint32_t edge_us, period_us;
+		if(ph.lost){
+			scheduleShed(phase_mask, us_ticker_read(), 0);
+		}
+		else if(pllGetLastEdge(p, us_ticker_read(), &edge_us, &period_us)){
+			scheduleShed(phase_mask, edge_us, period_us);
+		}
+		else{
+			core_util_critical_section_enter();
+			ph.shed = phase_mask;
+			ph.flags |= ShedPending;
+			core_util_critical_section_exit();
+		}
+	}
+}
+
+
+//------------------------------------------------------------------------------------
+void RelayManager::dropActions(uint32_t mask){
+	for(int i = 0; i < _max_num_relays && i < MaxGroupRelays; i++){
+		if((mask & (1u << i)) != 0 && _relay_list[i].pending != (Blob::RlyManEvtFlags)0){
+			_relay_list[i].pending = (Blob::RlyManEvtFlags)0;
+			_pending_count--;
+			_shed_stats.dropped++;
+		}
+	}
+
+	// compacta los comandos retenidos, eliminando los relés afectados de las acciones en grupo
+	uint32_t count = 0;
+	for(uint32_t n = 0; n < _backlog_count; n++){
+		PendingCmd cmd = _backlog[(_backlog_head + n) % MaxQueueMessages];
+		if(cmd.sig == RelayActionPendingFlag && cmd.action.id < MaxGroupRelays && (mask & (1u << cmd.action.id)) != 0){
+			_shed_stats.dropped++;
+			continue;
+		}
+		if(cmd.sig == GroupActionPendingFlag){
+			cmd.group.onMask &= ~mask;
+			cmd.group.offMask &= ~mask;
+			if((cmd.group.onMask | cmd.group.offMask) == 0){
+				_shed_stats.dropped++;
+				continue;
+			}
+		}
+		_backlog[(_backlog_head + count) % MaxQueueMessages] = cmd;
+		count++;
+	}
+	_backlog_count = count;
+}
+
+
+//------------------------------------------------------------------------------------
+void RelayManager::preemptBatch(uint32_t mask){
+	if(_stage == StageIdle){
+		return;
+	}
+	for(int i = 0; i < _max_num_relays && i < MaxGroupRelays; i++){
+		RelayHandler* hnd = &_relay_list[i];
+		if((mask & (1u << i)) == 0 || hnd->action == (Blob::RlyManEvtFlags)0){
+			continue;
+		}
+		// retira el relé del lote. Si aún no ha conmutado cancela su temporizador y lo descuenta del lote, como si
+		// hubiera conmutado
+		PhaseSync& ph = _phases[relayPhase(i)];
+		core_util_critical_section_enter();
+		bool not_switched = hnd->armed || (_stage == StageAwaitingZc && (ph.pending & (1u << i)) != 0) || _stage == StageFeedbackArmed;
+		if(hnd->armed){
+			hnd->sw_tmr.detach();
+			hnd->armed = false;
+		}
+		ph.pending &= ~(1u << i);
+		if(ph.pending == 0){
+			ph.flags &= ~ActionPending;
+		}
+		// si ya había conmutado, el relé queda en el estado de la acción y la conmutación cuenta como operación
+		if(!not_switched){
+			hnd->state = hnd->action;
+			hnd->switches++;
+		}
+		hnd->action = (Blob::RlyManEvtFlags)0;
+		_batch_count--;
+		bool done = false;
+		if(_stage == StageAwaitingZc && not_switched){
+			done = (--_batch_pending == 0);
+		}
+		core_util_critical_section_exit();
+		if(hnd->fdb){
+			hnd->fdb->stop();
+			hnd->fdb_armed = false;
+		}
+		_shed_stats.preempted++;
+		if(done && _batch_count > 0){
+			postIsrEvent(RelayChangedFlag);
+		}
+	}
+
+	// si el lote ha quedado vacío antes de conmutar, se aborta
+	if(_batch_count == 0 && (_stage == StageFeedbackArmed || _stage == StageAwaitingZc)){
+		HOT_TRACE_D(_EXPR_, _MODULE_, "Lote abortado por desconexión de emergencia");
+		core_util_critical_section_enter();
+		_stage_tmr.detach();
+		for(int p = 0; p < ZerocrossHub::MaxPhases; p++){
+			_phases[p].flags &= ~ActionPending;
+			_phases[p].pending = 0;
+		}
+		_batch_pending = 0;
+		core_util_critical_section_exit();
+		publishGroupStat();
+		_stage = StageIdle;
+	}
+}
+
+
+//------------------------------------------------------------------------------------
+void RelayManager::scheduleShed(uint32_t mask, uint32_t edge_us, uint32_t period_us){
+	uint32_t now = us_ticker_read();
+	while(mask != 0){
+		int i = __builtin_ctz(mask);
+		mask &= ~(1u << i);
+		RelayHandler* hnd = &_relay_list[i];
+		// sobre un flanco real descuenta el tiempo ya transcurrido, sobre el predicho busca el siguiente instante
+		uint32_t elapsed = now - edge_us;
+		int32_t fire_us = (period_us == 0)? (int32_t)((hnd->cfg.delayOffUs > elapsed)? (hnd->cfg.delayOffUs - elapsed) : 0) : predictFire(now, edge_us, hnd->cfg.delayOffUs, period_us);
+		hnd->sw_tmr.attach_us(callback(&RelayManager::isrShedCb, hnd), fire_us);
+	}
+}
+
+
+//------------------------------------------------------------------------------------
+void RelayManager::updateSync(){
+	bool changed = false;
+	for(int p = 0; p < _num_phases; p++){
+		PhaseSync& ph = _phases[p];
+		bool lost = ph.lost;
+		if(lost == ph.degraded){
+			continue;
+		}
+		ph.degraded = lost;
+		changed = true;
+		TRACE_LOG(Blob::RlyManTraceSync, TraceNoRelay, (lost)? 0 : 1, ph.lastUs);
+		if(!lost){
+			DEBUG_TRACE_I(_EXPR_, _MODULE_, "Zerocross de la fase %d recuperado, acciones sincronizadas", p);
+			continue;
+		}
+		DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_ZC sin flancos del zerocross de la fase %d, acciones sin sincronizar", p);
+		_sync_stat.losses++;
+
+		// las desconexiones y acciones que esperaban un flanco se programan ya, sin sincronizar. Los flags se
+		// borran en sección crítica, de forma que un flanco tardío no pueda programarlas de nuevo
+		core_util_critical_section_enter();
+		uint32_t flags = ph.flags;
+		uint32_t pending = ph.pending;
+		uint32_t shed = ph.shed;
+		ph.flags &= ~(ActionPending | ShedPending);
+		ph.pending = 0;
+		ph.shed = 0;
+		core_util_critical_section_exit();
+		if((flags & ShedPending) != 0){
+			scheduleShed(shed, us_ticker_read(), 0);
+		}
+		if((flags & ActionPending) != 0){
+			if(!_batch_unsync){
+				_batch_unsync = true;
+				_sync_stat.unsyncBatches++;
+			}
+			scheduleBatch(pending, us_ticker_read(), DefaultInrushSlotUs);
+		}
+
+		// el modo ráfaga requiere los flancos: finaliza dejando los relés apagados
+		for(int i = 0; i < _max_num_relays; i++){
+			RelayHandler* hnd = &_relay_list[i];
+			if(!hnd->burst.active || relayPhase(i) != p){
+				continue;
+			}
+			stopBurst(i);
+			if(hnd->state == Blob::RlyManOn){
+				hnd->relay->turnOff();
+				hnd->state = Blob::RlyManOff;
+				hnd->switches++;
+				hnd->sw_ts = us_ticker_read();
+				updateSnapshot(i);
+			}
+			publishBurstStat(i);
+		}
+	}
+	if(!changed){
+		return;
+	}
+
+	// sólo se considera sincronizado si lo están todas las fases
+	_sync_stat.synced = 1;
+	for(int p = 0; p < _num_phases; p++){
+		_sync_stat.synced = (_phases[p].degraded)? 0 : _sync_stat.synced;
+	}
+	Blob::RlyManSyncStat_t stat;
+	getSyncStat(&stat);
+	_sync_stat.lastEdgeUs = stat.lastEdgeUs;
+	DEBUG_TRACE_D(_EXPR_, _MODULE_, "Publicando resultado en '%s'", _topics.statSync);
+	MQ::MQClient::publish(_topics.statSync, &_sync_stat, sizeof(Blob::RlyManSyncStat_t), &_publicationCb);
+}
+
+
+//------------------------------------------------------------------------------------
+void RelayManager::completeShed(){
+	uint32_t latency = us_ticker_read() - _shed_ts;
+	perfAdd(&_perf.shedLatency, latency);
+	_shed_stats.lastLatencyUs = latency;
+	_shed_stats.maxLatencyUs = (latency > _shed_stats.maxLatencyUs)? latency : _shed_stats.maxLatencyUs;
+	DEBUG_TRACE_I(_EXPR_, _MODULE_, "Desconexión de emergencia completada en %d us", latency);
+	TRACE_LOG(Blob::RlyManTraceShedDone, TraceNoRelay, _shed_active, latency);
+
+	for(int i = 0; i < _max_num_relays && i < MaxGroupRelays; i++){
+		if((_shed_active & (1u << i)) == 0){
+			continue;
+		}
+		_relay_list[i].state = Blob::RlyManOff;
+		updateSnapshot(i);
+		// sólo los relés que estaban encendidos han conmutado
+		if((_shed_on & (1u << i)) != 0){
+			_relay_list[i].switches++;
+		}
+	}
+
+	// notifica en una única publicación los relés desconectados
+	_shed_stat.offMask = _shed_active;
+	_shed_active = 0;
+	_shed_on = 0;
+	HOT_TRACE_D(_EXPR_, _MODULE_, "Publicando resultado en '%s'", _topics.statShed);
+	MQ::MQClient::publish(_topics.statShed, &_shed_stat, sizeof(Blob::RlyManShedAction_t), &_publicationCb);
+}
+
+
+//------------------------------------------------------------------------------------
+void RelayManager::setBurst(const Blob::RlyManBurstAction_t& cmd){
+	if(cmd.id >= _max_num_relays || _relay_list[cmd.id].relay == NULL){
+		DEBUG_TRACE_E(_EXPR_, _MODULE_, "ERR_ID el relé '%d' no existe.", cmd.id);
+		return;
+	}
+	RelayHandler* hnd = &_relay_list[cmd.id];
+
+	// finaliza el modo ráfaga, apagando el relé en el siguiente lote
+	if(cmd.dutyPerMil == 0){
+		if(!hnd->burst.active){
+			return;
+		}
+		DEBUG_TRACE_D(_EXPR_, _MODULE_, "Finalizando modo ráfaga en relé '%d'", cmd.id);
+		stopBurst(cmd.id);
+		publishBurstStat(cmd.id);
+		PendingCmd off;
+		off.sig = RelayActionPendingFlag;
+		off.ts = us_ticker_read();
+		off.deq = off.ts;
+		off.action.id = cmd.id;
+		off.action.request = Blob::RlyManOff;
+		if(!skipRedundant(off)){
+			setPending(off);
+		}
+		return;
+	}
+
+	// sólo es posible con zerocross en la fase del relé, en relés sin acciones en curso, pendientes ni retenidas
+	PhaseSync& ph = _phases[relayPhase(cmd.id)];
+	if(_num_phases == 0 || ph.degraded){
+		DEBUG_TRACE_E(_EXPR_, _MODULE_, "ERR_MODE modo ráfaga no disponible sin zerocross.");
+		return;
+	}
+	if(!hnd->burst.active && (hnd->action != (Blob::RlyManEvtFlags)0 || hnd->pending != (Blob::RlyManEvtFlags)0 || findBacklog(cmd.id) >= 0 || (_shed_active & (1u << cmd.id)) != 0)){
+		DEBUG_TRACE_E(_EXPR_, _MODULE_, "ERR_BUSY el relé '%d' tiene acciones en curso.", cmd.id);
+		return;
+	}
+	uint8_t min_cycles = (cmd.minCycles > BurstMinCycles)? cmd.minCycles : BurstMinCycles;
+	if(cmd.dutyPerMil > 1000 || cmd.periodCycles > BurstMaxPeriodCycles || cmd.periodCycles < (2 * min_cycles)){
+		DEBUG_TRACE_E(_EXPR_, _MODULE_, "ERR_REQ parámetros de modo ráfaga no válidos.");
+		return;
+	}
+
+	// el modo ráfaga no utiliza el feedback: se detiene la captura si está en marcha
+	if(hnd->fdb && hnd->fdb_armed){
+		hnd->fdb->stop();
+		hnd->fdb_armed = false;
+	}
+
+	// los parámetros se aplican en flancos de zerocross, y comienzan con un nuevo periodo
+	uint8_t edges = ph.edgesPerCycle;
+	BurstState burst;
+	memset(&burst, 0, sizeof(BurstState));
+	burst.active = true;
+	burst.on = (hnd->burst.active)? hnd->burst.on : (hnd->state == Blob::RlyManOn);
+	burst.applied = (hnd->burst.active)? hnd->burst.applied : (hnd->state == Blob::RlyManOn);
+	burst.dutyPerMil = cmd.dutyPerMil;
+	burst.periodEdges = cmd.periodCycles * edges;
+	burst.minEdges = min_cycles * edges;
+	burst.edgesPerCycle = edges;
+	DEBUG_TRACE_D(_EXPR_, _MODULE_, "Modo ráfaga en relé '%d': duty=%d, periodo=%d", cmd.id, cmd.dutyPerMil, cmd.periodCycles);
+	core_util_critical_section_enter();
+	hnd->burst = burst;
+	ph.burst |= (1u << cmd.id);
+	core_util_critical_section_exit();
+	publishBurstStat(cmd.id);
+}
+
+
+//------------------------------------------------------------------------------------
+void RelayManager::stopBurst(uint8_t id){
+	RelayHandler* hnd = &_relay_list[id];
+	core_util_critical_section_enter();
+	hnd->burst.active = false;
+	_phases[relayPhase(id)].burst &= ~(1u << id);
+	hnd->sw_tmr.detach();
+	// el estado final es el último conmutado en el relé: una conmutación solicitada cuyo temporizador aún no había
+	// vencido queda cancelada
+	bool applied = hnd->burst.applied;
+	core_util_critical_section_exit();
+	hnd->state = (applied)? Blob::RlyManOn : Blob::RlyManOff;
+	updateSnapshot(id);
+}
+
+
+//------------------------------------------------------------------------------------
+void RelayManager::setTimed(const Blob::RlyManTimedAction_t& cmd){
+	if(cmd.tag >= MaxTimedActions){
+		DEBUG_TRACE_E(_EXPR_, _MODULE_, "ERR_TAG la acción temporizada '%d' excede el máximo.", cmd.tag);
+		return;
+	}
+
+	// descarta acciones inválidas sin afectar a la programada con el mismo identificador
+	uint32_t delay_ms = cmd.at;
+	if(cmd.request != (Blob::RlyManEvtFlags)0){
+		if(cmd.id >= _max_num_relays || _relay_list[cmd.id].relay == NULL){
+			DEBUG_TRACE_E(_EXPR_, _MODULE_, "ERR_ID el relé '%d' no existe.", cmd.id);
+			return;
+		}
+		if(cmd.request != Blob::RlyManOn && cmd.request != Blob::RlyManOff){
+			DEBUG_TRACE_E(_EXPR_, _MODULE_, "ERR_REQ la acción es desconocida.");
+			return;
+		}
+		if(cmd.periodMs > 0 && cmd.durationMs >= cmd.periodMs){
+			DEBUG_TRACE_E(_EXPR_, _MODULE_, "ERR_TIME la duración debe ser menor que el periodo.");
+			return;
+		}
+		// el instante absoluto requiere el reloj de tiempo real en hora. Los instantes pasados vencen en el
+		// siguiente tick
+		if((cmd.flags & Blob::RlyManTimedAbsolute) != 0){
+			int64_t delta_s = (int64_t)cmd.at - (int64_t)time(NULL);
+			if(delta_s > (int64_t)(0xFFFFFFFFul / 1000)){
+				DEBUG_TRACE_E(_EXPR_, _MODULE_, "ERR_TIME el instante de la acción temporizada '%d' está fuera de rango.", cmd.tag);
+				return;
+			}
+			delay_ms = (delta_s > 0)? (uint32_t)delta_s * 1000 : 0;
+		}
+	}
+
+	// una nueva acción con el mismo identificador sustituye a la anterior, dejando el relé en su estado actual
+	if(_timed_wheel.isPending(cmd.tag)){
+		_timed_wheel.cancel(cmd.tag);
+		_timed_stats.cancelled++;
+		_timed_stats.active--;
+	}
+	if(cmd.request == (Blob::RlyManEvtFlags)0){
+		DEBUG_TRACE_D(_EXPR_, _MODULE_, "Acción temporizada '%d' cancelada", cmd.tag);
+		timedArm();
+		return;
+	}
+
+	// lleva la rueda al instante actual, de forma que el retardo se cuente desde ahora
+	if(_timed_wheel.pending() == 0){
+		_timed_last_us = us_ticker_read();
+	}
+	else{
+		timedUpdate();
+	}
+
+	// el tick 'now()' se procesa al cumplirse el siguiente periodo de la rueda
+	TimedAction& ta = _timed[cmd.tag];
+	ta.action = cmd;
+	ta.startTick = _timed_wheel.now() + timedTicks(delay_ms) - 1;
+	ta.remaining = cmd.count;
+	ta.reverting = false;
+	_timed_wheel.insert(cmd.tag, ta.startTick);
+	_timed_stats.scheduled++;
+	_timed_stats.active++;
+	DEBUG_TRACE_D(_EXPR_, _MODULE_, "Acción temporizada '%d' sobre relé '%d' en %d ms", cmd.tag, cmd.id, delay_ms);
+	timedArm();
+}
+
+
+//------------------------------------------------------------------------------------
+void RelayManager::timedUpdate(){
+	static const uint32_t TickUs = TimedTickMs * 1000;
+	uint32_t now = us_ticker_read();
+	while(_timed_wheel.pending() > 0 && (now - _timed_last_us) >= TickUs){
+		_timed_last_us += TickUs;
+		for(uint16_t t = _timed_wheel.step(); t != TimerWheel::Nil; ){
+			// obtiene la siguiente antes de reprogramar la entrada
+			uint16_t next = _timed_wheel.next(t);
+			TimedAction& ta = _timed[t];
+			Blob::RlyManEvtFlags request = ta.action.request;
+			if(ta.reverting){
+				request = (request == Blob::RlyManOn)? Blob::RlyManOff : Blob::RlyManOn;
+			}
+			HOT_TRACE_D(_EXPR_, _MODULE_, "Acción temporizada '%d' sobre relé '%d' vencida", t, ta.action.id);
+			TRACE_LOG(Blob::RlyManTraceTimed, ta.action.id, t, request);
+			if((now - _timed_last_us) > _timed_stats.maxLagUs){
+				_timed_stats.maxLagUs = now - _timed_last_us;
+			}
+			_timed_stats.fired++;
+
+			// entra en el camino de las acciones individuales, con el vencimiento como instante de recepción
+			PendingCmd cmd;
+			cmd.sig = RelayActionPendingFlag;
+			cmd.ts = _timed_last_us;
+			cmd.deq = now;
+			cmd.action.id = ta.action.id;
+			cmd.action.request = request;
+			acceptCmd(cmd);
+
+			// reprograma la reversión y la siguiente repetición respecto del inicio, sin acumular deriva
+			if(!ta.reverting && ta.action.count > 0){
+				ta.remaining--;
+			}
+			bool repeat = (ta.action.periodMs > 0 && (ta.action.count == 0 || ta.remaining > 0));
+			if(!ta.reverting && ta.action.durationMs > 0){
+				ta.reverting = true;
+				_timed_wheel.insert(t, ta.startTick + timedTicks(ta.action.durationMs));
+			}
+			else if(repeat){
+				ta.reverting = false;
+				ta.startTick += timedTicks(ta.action.periodMs);
+				_timed_wheel.insert(t, ta.startTick);
+			}
+			else{
+				ta.reverting = false;
+				_timed_stats.active--;
+			}
+			t = next;
+		}
+	}
+}
+
+
+//------------------------------------------------------------------------------------
+void RelayManager::timedArm(){
+	static const uint32_t TickUs = TimedTickMs * 1000;
+	if(_timed_wheel.pending() == 0){
+		_timed_tmr.detach();
+		return;
+	}
+	uint32_t elapsed = us_ticker_read() - _timed_last_us;
+	_timed_tmr.attach_us(callback(this, &RelayManager::isrTimedTickCb), (elapsed < TickUs)? (TickUs - elapsed) : 1);
+}
+
+
+//------------------------------------------------------------------------------------
+void RelayManager::updateSnapshot(uint8_t id){
+	RelayHandler* hnd = &_relay_list[id];
+	Blob::RlyManRelayStat_t stat;
+	stat.id = id;
+	// en modo ráfaga el estado es el último conmutado en el relé
+	stat.state = (hnd->burst.active)? ((hnd->burst.applied)? Blob::RlyManOn : Blob::RlyManOff) : hnd->state;
+	stat.fdbStatus = (uint32_t)hnd->fdb_status;
+	stat.tOnUs = hnd->t_on_us;
+	stat.tOffUs = hnd->t_off_us;
+	stat.tScUs = hnd->t_sc_us;
+	stat.delayOnUs = hnd->cfg.delayOnUs;
+	stat.delayOffUs = hnd->cfg.delayOffUs;
+	stat.switches = hnd->switches;
+	stat.lastSwitchUs = hnd->sw_ts;
+	stat.updatedUs = us_ticker_read();
+
+	// escribe ambas copias, cada una con el contador indicando a los lectores la otra como estable. Así un lector
+	// que interrumpa a la escritura (p.ej. desde ISR) siempre encuentra una copia completa
+	RelaySnapshot& snap = hnd->snap;
+	snap.seq++;
+	__DMB();
+	snap.buf[0] = stat;
+	__DMB();
+	snap.seq++;
+	__DMB();
+	snap.buf[1] = stat;
+	__DMB();
+}
+
+
+//------------------------------------------------------------------------------------
+void RelayManager::burstStat(uint8_t id, const BurstState& burst, Blob::RlyManBurstStat_t* stat){
+	stat->id = id;
+	stat->dutyPerMil = (burst.active)? burst.dutyPerMil : 0;
+	stat->achievedPerMil = (burst.totalEdges > 0)? (uint16_t)(((uint64_t)burst.onEdges * 1000) / burst.totalEdges) : 0;
+	stat->cycles = (burst.edgesPerCycle > 0)? (burst.totalEdges / burst.edgesPerCycle) : 0;
+}
+
+
+//------------------------------------------------------------------------------------
+void RelayManager::publishBurstStat(uint8_t id){
+	core_util_critical_section_enter();
+	BurstState burst = _relay_list[id].burst;
+	core_util_critical_section_exit();
+	burstStat(id, burst, &_burst_stat);
+	DEBUG_TRACE_D(_EXPR_, _MODULE_, "Publicando resultado en '%s'", _topics.statBurst);
+	MQ::MQClient::publish(_topics.statBurst, &_burst_stat, sizeof(Blob::RlyManBurstStat_t), &_publicationCb);
+}
+
+
+//------------------------------------------------------------------------------------
+void RelayManager::publishPhaseJson(uint8_t id){
+	// se formatea en un buffer fijo, sin reservar memoria en cada consulta
+	int32_t n = getPhaseJson(id, _phase_json, PhaseJsonSize);
+	if(n <= 0){
+		DEBUG_TRACE_E(_EXPR_, _MODULE_, "ERR_ID el relé '%d' no existe.", id);
+		return;
+	}
+	DEBUG_TRACE_D(_EXPR_, _MODULE_, "Publicando resultado en '%s'", _topics.statPerf);
+	MQ::MQClient::publish(_topics.statPerf, _phase_json, n + 1, &_publicationCb);
+}
+
+
+#if defined(RELAYMANAGER_ENABLE_TRACELOG)
+//------------------------------------------------------------------------------------
+void RelayManager::traceLog(uint8_t evt, uint8_t id, uint32_t arg0, uint32_t arg1){
+	// reserva la posición de forma atómica, de forma que escritores concurrentes (tarea e ISR) nunca comparten
+	// registro. El número de secuencia permite al decodificador descartar registros a medio escribir.
+	uint32_t idx = core_util_atomic_incr_u32(&_trace_head, 1) - 1;
+	Blob::RlyManTraceRecord_t* rec = &_trace_buf[idx & (TraceLogSize - 1)];
+	rec->seq = (uint16_t)~idx;
+	__DMB();
+	rec->ts = us_ticker_read();
+	rec->evt = evt;
+	rec->id = id;
+	rec->arg0 = arg0;
+	rec->arg1 = arg1;
+	__DMB();
+	rec->seq = (uint16_t)idx;
+}
+#endif
+
+
+//------------------------------------------------------------------------------------
+void RelayManager::buildTopics(){
+	_topics.subSet = newTopic("set/+/%s", _sub_topic_base);
+	_topics.subGet = newTopic("get/+/%s", _sub_topic_base);
+	_topics.statValue = newTopic("stat/value/%s", _pub_topic_base);
+	_topics.statFdbk = newTopic("stat/fdbk/%s", _pub_topic_base);
+	_topics.statSnap = newTopic("stat/snap/%s", _pub_topic_base);
+	_topics.statGroup = newTopic("stat/group/%s", _pub_topic_base);
+	_topics.statShed = newTopic("stat/shed/%s", _pub_topic_base);
+	_topics.statBurst = newTopic("stat/burst/%s", _pub_topic_base);
+	_topics.statPerf = newTopic("stat/perf/%s", _pub_topic_base);
+	_topics.statTrace = newTopic("stat/trace/%s", _pub_topic_base);
+	_topics.statSync = newTopic("stat/sync/%s", _pub_topic_base);
+	_topics.statHealth = newTopic("stat/health/%s", _pub_topic_base);
+}
+
+
+//------------------------------------------------------------------------------------
+char* RelayManager::newTopic(const char* fmt, const char* base){
+	// reserva el tamaño exacto del topic, ya que se mantiene durante toda la vida del objeto
+	int len = snprintf(NULL, 0, fmt, base);
+	MBED_ASSERT(len > 0 && len < (int)MQ::MQClient::getMaxTopicLen());
+	char* topic = (char*)Heap::memAlloc(len + 1);
+	MBED_ASSERT(topic);
+	sprintf(topic, fmt, base);
+	return topic;
+}
+
+
+//------------------------------------------------------------------------------------
+void RelayManager::perfAdd(PerfStat* stat, uint32_t value){
+	// bucket logarítmico: el bucket 'b' contiene los valores en [2^b, 2^(b+1)), el último es abierto
+	uint8_t b = (value == 0)? 0 : (31 - __builtin_clz(value));
+	b = (b < PerfHistBuckets)? b : (PerfHistBuckets - 1);
+	if(stat->hist[b] < 0xFFFF){
+		stat->hist[b]++;
+	}
+	stat->min = (stat->count == 0 || value < stat->min)? value : stat->min;
+	stat->max = (value > stat->max)? value : stat->max;
+	stat->sum += value;
+	stat->count++;
+}
+
+
+//------------------------------------------------------------------------------------
+uint32_t RelayManager::perfPercentile(const PerfStat& stat, uint8_t pct){
+	if(stat.count == 0){
+		return 0;
+	}
+	// recorre el histograma hasta alcanzar el percentil, devolviendo el límite superior del bucket
+	uint32_t total = 0;
+	for(int b = 0; b < PerfHistBuckets; b++){
+		total += stat.hist[b];
+	}
+	uint32_t target = ((total * pct) + 99) / 100;
+	uint32_t acc = 0;
+	for(int b = 0; b < PerfHistBuckets; b++){
+		acc += stat.hist[b];
+		if(acc >= target){
+			uint32_t upper = (2u << b) - 1;
+			return (upper < stat.max)? upper : stat.max;
+		}
+	}
+	return stat.max;
+}
+
+
+//------------------------------------------------------------------------------------
+uint32_t RelayManager::printPerfStat(char* buf, uint32_t len, const PerfStat& stat){
+	return snprintf(buf, len, "{\"n\":%lu,\"min\":%lu,\"mean\":%lu,\"p50\":%lu,\"p99\":%lu,\"max\":%lu}",
+			(unsigned long)stat.count, (unsigned long)stat.min,
+			(unsigned long)((stat.count > 0)? (stat.sum / stat.count) : 0),
+			(unsigned long)perfPercentile(stat, 50), (unsigned long)perfPercentile(stat, 99), (unsigned long)stat.max);
+}
+
+
+//------------------------------------------------------------------------------------
+void RelayManager::perfPhases(RelayHandler* hnd, uint32_t fdb_us, uint32_t pub_us){
+#if RELAYMANAGER_RELAY_PERF
+	// instantes de cada hito, en orden. Las diferencias negativas (p.ej. conmutación sobre un paso por cero
+	// predicho anterior al inicio del lote) se registran como 0
+	uint32_t ts[PhaseCount + 1] = {hnd->action_ts, hnd->deq_ts, _batch_arm_us, hnd->zc_ts, hnd->sw_ts, fdb_us, pub_us};
+	for(int p = 0; p < PhaseCount; p++){
+		int32_t dt = (int32_t)(ts[p + 1] - ts[p]);
+		perfAdd(&hnd->perf.phase[p], (dt > 0)? (uint32_t)dt : 0);
+	}
+#endif
+}
+
+
+//------------------------------------------------------------------------------------
+void RelayManager::armStageTimer(uint32_t flag, uint32_t time_ms){
+	_stage_evt = flag;
+	_stage_tmr.attach_us(callback(this, &RelayManager::isrStageTimeoutCb), time_ms * 1000);
+}
+
+
+//------------------------------------------------------------------------------------
+void RelayManager::postIsrEvent(uint32_t flag){
+	core_util_critical_section_enter();
+	bool wake = (_isr_events == 0);
+	_isr_events |= flag;
+	core_util_critical_section_exit();
+	// despierta a la tarea sólo con el primer evento pendiente: los siguientes se atienden con el mismo aviso, de
+	// forma que los avisos no ocupan más de un hueco de la cola. Si está llena, el evento se atenderá igualmente al
+	// extraer el siguiente mensaje
+	if(wake){
+		_queue.put(&_evt_token, 0);
+	}
+}
+
+
+//------------------------------------------------------------------------------------
+uint32_t RelayManager::popIsrEvent(){
+	core_util_critical_section_enter();
+	uint32_t flag = _isr_events & (~_isr_events + 1);
+	_isr_events &= ~flag;
+	core_util_critical_section_exit();
+	return flag;
+}
+
+
+//------------------------------------------------------------------------------------
+osEvent RelayManager:: getOsEvent(){
+	osEvent oe;
+	for(;;){
+		// los eventos posteados desde ISR se entregan con prioridad
+		uint32_t flag = popIsrEvent();
+		if(flag != 0){
+			_isr_msg.sig = flag;
+			_internal_msg = &_isr_msg;
+			break;
+		}
+		oe = _queue.get();
+		if(oe.status != osEventMessage){
+			return oe;
+		}
+		// los avisos de eventos ISR sólo despiertan a la tarea
+		if(oe.value.p == &_evt_token){
+			continue;
+		}
+		// los comandos alojados en el pool se entregan como eventos internos
+		if(isCmdMsg((State::Msg*)oe.value.p)){
+			_internal_msg = (State::Msg*)oe.value.p;
+			break;
+		}
+		return oe;
+	}
+	// los eventos internos se entregan como eventos temporizados, sin mensaje asociado que liberar
+	oe.status = osEventTimeout;
+	oe.value.p = NULL;
+	return oe;
+}
+
+
+//------------------------------------------------------------------------------------
+void RelayManager::postCmdMsg(const char* topic, uint32_t sig, const void* data, uint16_t size){
+	MBED_ASSERT(size <= sizeof(((CmdMsg*)0)->data));
+
+	// obtiene un mensaje del pool estático, descartando el comando si está agotado
+	CmdMsg* op = allocCmdMsg();
+	if(!op){
+		core_util_atomic_incr_u32(&_pool_stats.poolDrops, 1);
+		DEBUG_TRACE_E(_EXPR_, _MODULE_, "ERR_POOL. Pool de comandos agotado, descartando %s", topic);
+		return;
+	}
+
+	// copia los datos y la marca de tiempo de recepción, y apunta el mensaje a ellos
+	op->ts = us_ticker_read();
+	memcpy(&op->data, data, size);
+	op->msg.sig = sig;
+	op->msg.msg = &op->data;
+
+	// postea en la cola de la máquina de estados, devolviendo el mensaje al pool si está llena
+	if(putMessage(&op->msg) != osOK){
+		freeCmdMsg(op);
+		core_util_atomic_incr_u32(&_pool_stats.queueDrops, 1);
+		DEBUG_TRACE_E(_EXPR_, _MODULE_, "ERR_QUEUE. Cola de comandos llena, descartando %s", topic);
+		return;
+	}
+	// las consultas no cuentan como comandos en las medidas de rendimiento
+	if(sig != PerfQueryFlag){
+		core_util_atomic_incr_u32(&_perf.commands, 1);
+	}
+}
+
+
+//------------------------------------------------------------------------------------
+RelayManager::CmdMsg* RelayManager::allocCmdMsg(){
+	// reserva sin bloqueo el primer slot libre de la máscara
+	uint32_t free_mask = _cmd_free;
+	uint32_t slot;
+	do{
+		if(free_mask == 0){
+			return NULL;
+		}
+		slot = free_mask & (~free_mask + 1);
+	}while(!core_util_atomic_cas_u32(&_cmd_free, &free_mask, free_mask & ~slot));
+	core_util_atomic_incr_u32(&_pool_stats.allocs, 1);
+
+	// actualiza el máximo de slots ocupados
+	uint32_t in_use = core_util_atomic_incr_u32(&_pool_stats.inUse, 1);
+	uint32_t max_in_use = _pool_stats.maxInUse;
+	while(in_use > max_in_use && !core_util_atomic_cas_u32(&_pool_stats.maxInUse, &max_in_use, in_use));
+
+	return &_cmd_pool[__builtin_ctz(slot)];
+}
+
+
+//------------------------------------------------------------------------------------
+void RelayManager::freeCmdMsg(CmdMsg* cmd){
+	uint32_t slot = (1u << (cmd - _cmd_pool));
+	uint32_t free_mask = _cmd_free;
+	while(!core_util_atomic_cas_u32(&_cmd_free, &free_mask, free_mask | slot));
+	core_util_atomic_decr_u32(&_pool_stats.inUse, 1);
+	core_util_atomic_incr_u32(&_pool_stats.frees, 1);
+}
+
+
+//------------------------------------------------------------------------------------
+bool RelayManager::isCmdMsg(State::Msg* msg){
+	return ((CmdMsg*)msg >= &_cmd_pool[0] && (CmdMsg*)msg < &_cmd_pool[MaxQueueMessages]);
+}
+
+
+//------------------------------------------------------------------------------------
+void RelayManager::isrStageTimeoutCb(){
+	postIsrEvent(_stage_evt);
+}
+
+
+//------------------------------------------------------------------------------------
+void RelayManager::isrTimedTickCb(){
+	postIsrEvent(TimedTickFlag);
+}
+
+
+//------------------------------------------------------------------------------------
+void RelayManager::publicationCb(const char* topic, int32_t result){
+
+}
+
+
+//------------------------------------------------------------------------------------
+bool RelayManager::checkIntegrity(){
+	for(int i=0; i<_max_num_relays; i++){
+		if(!checkConfig(_relay_list[i].cfg)){
+			return false;
+		}
+	}
+	return true;
+}
+
+
+//------------------------------------------------------------------------------------
+bool RelayManager::checkConfig(const Config_t& cfg){
+	if(cfg.delayOnUs < DefaultSwitchingDelay || cfg.delayOnUs >= MaxSwitchingDelay){
+		return false;
+	}
+	if(cfg.delayOffUs < DefaultSwitchingDelay || cfg.delayOffUs >= MaxSwitchingDelay){
+		return false;
+	}
+	if(cfg.deltaUs == 0){
+		return false;
+	}
+	if(cfg.phase >= ZerocrossHub::MaxPhases){
+		return false;
+	}
+	return true;
+}
+
+
+//------------------------------------------------------------------------------------
 void RelayManager::setDefaultConfig(){
 	for(int i=0; i<_max_num_relays; i++){
-		_relay_list[i].cfg.delayOnUs = DefaultSwitchingDelay;
-		_relay_list[i].cfg.delayOffUs = DefaultSwitchingDelay;
-		_relay_list[i].cfg.deltaUs = DefaultSwitchingDelta;
+		setDefaultRelayConfig(i);
+	}
+	saveConfig();
+}
+
+
+//------------------------------------------------------------------------------------
+void RelayManager::setDefaultRelayConfig(uint8_t id){
+	_relay_list[id].cfg.delayOnUs = DefaultSwitchingDelay;
+	_relay_list[id].cfg.delayOffUs = DefaultSwitchingDelay;
+	_relay_list[id].cfg.deltaUs = DefaultSwitchingDelta;
+	_relay_list[id].cfg.phase = 0;
+	memset(_relay_list[id].cfg.reserved, 0, sizeof(_relay_list[id].cfg.reserved));
+}
+
+
+//------------------------------------------------------------------------------------
+void RelayManager::restoreConfig(){
+	DEBUG_TRACE_D(_EXPR_, _MODULE_, "Recuperando datos de memoria NV...");
+	uint32_t t0 = us_ticker_read();
+
+	// recupera el bloque empaquetado con una única lectura
+	uint32_t size = sizeof(CfgBlobHeader) + (_max_num_relays * sizeof(CfgBlobEntry));
+	uint8_t* blob = (uint8_t*)Heap::memAlloc(size);
+	MBED_ASSERT(blob);
+	CfgBlobHeader* hdr = (CfgBlobHeader*)blob;
+	CfgBlobEntry* entries = (CfgBlobEntry*)(blob + sizeof(CfgBlobHeader));
+	bool rewrite = false;
+	bool legacy = false;
+	if(restoreParameter(CfgBlobKey, blob, size, NVSInterface::TypeBlob) && hdr->version == CfgBlobVersion && hdr->count == _max_num_relays){
+		DEBUG_TRACE_D(_EXPR_, _MODULE_, "Datos recuperados. Chequeando integridad...");
+		// chequea la integridad de cada relé por separado, de forma que un error sólo afecte al relé dañado
+		for(int i=0; i<_max_num_relays; i++){
+			if(crc16((uint8_t*)&entries[i].cfg, sizeof(Config_t)) != entries[i].crc || !checkConfig(entries[i].cfg)){
+				DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_CFG. Relé %d con datos corruptos, establece configuración por defecto", i);
+				setDefaultRelayConfig(i);
+				rewrite = true;
+				continue;
+			}
+			_relay_list[i].cfg = entries[i].cfg;
+		}
+	}
+	else if(restoreConfigV1()){
+		// bloque de la versión anterior, sin fase: se migra
+		DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_CFG. Bloque de configuración versión 1, migrando");
+		rewrite = true;
+	}
+	else if(restoreConfigResized()){
+		// bloque grabado con otro número de relés: se migran los relés comunes
+		DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_CFG. Bloque de configuración con otro número de relés, migrando");
+		rewrite = true;
+	}
+	else{
+		// si no existe el bloque empaquetado, migra los datos de las claves individuales de versiones anteriores
+		DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_NVS. No hay bloque de configuración, migrando claves individuales");
+		restoreLegacyConfig();
+		rewrite = true;
+		legacy = true;
+	}
+	Heap::memFree(blob);
+
+	if(rewrite){
+		// las claves individuales sólo se borran una vez grabado el bloque que las sustituye
+		if(!writeConfigBlob()){
+			DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_NVS grabando %s!", CfgBlobKey);
+		}
+		else if(legacy){
+			removeLegacyConfig();
+		}
+	}
+	_restore_us = us_ticker_read() - t0;
+	DEBUG_TRACE_D(_EXPR_, _MODULE_, "Configuración recuperada en %d us", _restore_us);
+}
+
+
+//------------------------------------------------------------------------------------
+bool RelayManager::restoreConfigV1(){
+	uint32_t size = sizeof(CfgBlobHeader) + (_max_num_relays * sizeof(CfgBlobEntryV1));
+	uint8_t* blob = (uint8_t*)Heap::memAlloc(size);
+	MBED_ASSERT(blob);
+	CfgBlobHeader* hdr = (CfgBlobHeader*)blob;
+	CfgBlobEntryV1* entries = (CfgBlobEntryV1*)(blob + sizeof(CfgBlobHeader));
+	bool found = (restoreParameter(CfgBlobKey, blob, size, NVSInterface::TypeBlob) && hdr->version == 1 && hdr->count == _max_num_relays);
+	for(int i=0; found && i<_max_num_relays; i++){
+		setDefaultRelayConfig(i);
+		if(crc16((uint8_t*)&entries[i].cfg, sizeof(ConfigV1_t)) != entries[i].crc){
+			DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_CFG. Relé %d con datos corruptos, establece configuración por defecto", i);
+			continue;
+		}
+		setConfigV1(i, entries[i].cfg);
+	}
+	Heap::memFree(blob);
+	return found;
+}
+
+
+//------------------------------------------------------------------------------------
+bool RelayManager::restoreConfigResized(){
+	// el tamaño del bloque depende del número de relés con que se grabó, por lo que se busca entre los posibles
+	uint32_t size = sizeof(CfgBlobHeader) + (MaxGroupRelays * sizeof(CfgBlobEntry));
+	uint8_t* blob = (uint8_t*)Heap::memAlloc(size);
+	MBED_ASSERT(blob);
+	CfgBlobHeader* hdr = (CfgBlobHeader*)blob;
+	CfgBlobEntry* entries = (CfgBlobEntry*)(blob + sizeof(CfgBlobHeader));
+	int count = 0;
+	for(int n = 1; count == 0 && n <= MaxGroupRelays; n++){
+		size = sizeof(CfgBlobHeader) + (n * sizeof(CfgBlobEntry));
+		if(n != _max_num_relays && restoreParameter(CfgBlobKey, blob, size, NVSInterface::TypeBlob) && hdr->version == CfgBlobVersion && hdr->count == n){
+			count = n;
+		}
+	}
+
+	// migra los relés comunes. El resto toma la configuración por defecto
+	for(int i=0; count > 0 && i<_max_num_relays; i++){
+		setDefaultRelayConfig(i);
+		if(i >= count){
+			continue;
+		}
+		if(crc16((uint8_t*)&entries[i].cfg, sizeof(Config_t)) != entries[i].crc || !checkConfig(entries[i].cfg)){
+			DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_CFG. Relé %d con datos corruptos, establece configuración por defecto", i);
+			continue;
+		}
+		_relay_list[i].cfg = entries[i].cfg;
+	}
+	Heap::memFree(blob);
+	return (count > 0);
+}
+
+
+//------------------------------------------------------------------------------------
+void RelayManager::restoreLegacyConfig(){
+	for(int i=0; i<_max_num_relays; i++){
 		char name[16];
 		sprintf(name, "RlyManCfg_%d", i);
-		saveParameter(name, &_relay_list[i].cfg, sizeof(Config_t), NVSInterface::TypeBlob);
+		ConfigV1_t cfg;
+		setDefaultRelayConfig(i);
+		if(!restoreParameter(name, &cfg, sizeof(ConfigV1_t), NVSInterface::TypeBlob)){
+			DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_NVS leyendo %s, establece configuración por defecto", name);
+			continue;
+		}
+		setConfigV1(i, cfg);
 	}
 }
 
 
 //------------------------------------------------------------------------------------
-void RelayManager::restoreConfig(){
-	DEBUG_TRACE_D(_EXPR_, _MODULE_, "Recuperando datos de memoria NV...");
-	bool success = true;
+void RelayManager::removeLegacyConfig(){
 	for(int i=0; i<_max_num_relays; i++){
 		char name[16];
 		sprintf(name, "RlyManCfg_%d", i);
-		if(!restoreParameter(name, &_relay_list[i].cfg, sizeof(Config_t), NVSInterface::TypeBlob)){
-			DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_NVS leyendo UpdFlags!");
-			success = false;
-		}
+		removeParameter(name);
 	}
+}
 
-	if(success){
-		DEBUG_TRACE_D(_EXPR_, _MODULE_, "Datos recuperados. Chequeando integridad...");
-    	// chequea la coherencia de los datos y en caso de algo no est bien, establece los datos por defecto
-    	// almacenndolos de nuevo en memoria NV.
-    	if(!checkIntegrity()){
-    		DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_CFG. Ha fallado el check de integridad.");
-    	}
-    	else{
-    		DEBUG_TRACE_D(_EXPR_, _MODULE_, "Check de integridad OK!");
-    		return;
-    	}
+
+//------------------------------------------------------------------------------------
+void RelayManager::setConfigV1(uint8_t id, const ConfigV1_t& cfg){
+	// las versiones anteriores no incluyen la fase, que queda en la fase 0
+	Config_t* dst = &_relay_list[id].cfg;
+	dst->delayOnUs = cfg.delayOnUs;
+	dst->delayOffUs = cfg.delayOffUs;
+	dst->deltaUs = cfg.deltaUs;
+	if(!checkConfig(*dst)){
+		DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_CFG. Relé %d con datos no válidos, establece configuración por defecto", id);
+		setDefaultRelayConfig(id);
 	}
-	DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_FS. Error en la recuperacin de datos. Establece configuracin por defecto");
-	setDefaultConfig();
 }
 
 
 //------------------------------------------------------------------------------------
 void RelayManager::saveConfig(){
 	DEBUG_TRACE_D(_EXPR_, _MODULE_, "Guardando datos en memoria NV...");
+	if(!writeConfigBlob()){
+		DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_NVS grabando %s!", CfgBlobKey);
+	}
+}
 
-	// almacena en el sistema de ficheros
+
+//------------------------------------------------------------------------------------
+bool RelayManager::writeConfigBlob(){
+	// empaqueta la configuración de todos los relés en un único bloque, con un CRC por relé
+	uint32_t size = sizeof(CfgBlobHeader) + (_max_num_relays * sizeof(CfgBlobEntry));
+	uint8_t* blob = (uint8_t*)Heap::memAlloc(size);
+	MBED_ASSERT(blob);
+	CfgBlobHeader* hdr = (CfgBlobHeader*)blob;
+	CfgBlobEntry* entries = (CfgBlobEntry*)(blob + sizeof(CfgBlobHeader));
+	hdr->version = CfgBlobVersion;
+	hdr->count = _max_num_relays;
+	hdr->reserved = 0;
 	for(int i=0; i<_max_num_relays; i++){
-		char name[16];
-		sprintf(name, "RlyManCfg_%d", i);
-		if(!saveParameter(name, &_relay_list[i].cfg, sizeof(Config_t), NVSInterface::TypeBlob)){
-			DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_NVS grabando UpdFlags!");
+		entries[i].cfg = _relay_list[i].cfg;
+		entries[i].crc = crc16((uint8_t*)&entries[i].cfg, sizeof(Config_t));
+	}
+	bool success = saveParameter(CfgBlobKey, blob, size, NVSInterface::TypeBlob);
+	Heap::memFree(blob);
+	if(!success){
+		return false;
+	}
+
+	// la configuración queda grabada
+	for(int i=0; i<_max_num_relays; i++){
+		_relay_list[i].saved_cfg = _relay_list[i].cfg;
+		_relay_list[i].dirty = false;
+	}
+	_persist.pendingWrites = 0;
+	return true;
+}
+
+
+//------------------------------------------------------------------------------------
+uint16_t RelayManager::crc16(const uint8_t* data, uint32_t size){
+	// CRC-16/CCITT-FALSE
+	uint16_t crc = 0xFFFF;
+	for(uint32_t i = 0; i < size; i++){
+		crc ^= (uint16_t)data[i] << 8;
+		for(int b = 0; b < 8; b++){
+			crc = ((crc & 0x8000) != 0)? ((crc << 1) ^ 0x1021) : (crc << 1);
 		}
 	}
+	return crc;
 }
 
 
 //------------------------------------------------------------------------------------
-void RelayManager::isrZerocrossCb(Zerocross::LogicLevel level){
+void RelayManager::markDirty(uint8_t id){
+	RelayHandler* hnd = &_relay_list[id];
+	// sólo se graban los cambios que superan el umbral respecto de lo ya grabado
+	uint32_t don = (hnd->cfg.delayOnUs > hnd->saved_cfg.delayOnUs)? (hnd->cfg.delayOnUs - hnd->saved_cfg.delayOnUs) : (hnd->saved_cfg.delayOnUs - hnd->cfg.delayOnUs);
+	uint32_t doff = (hnd->cfg.delayOffUs > hnd->saved_cfg.delayOffUs)? (hnd->cfg.delayOffUs - hnd->saved_cfg.delayOffUs) : (hnd->saved_cfg.delayOffUs - hnd->cfg.delayOffUs);
+	if(don < PersistThresholdUs && doff < PersistThresholdUs && hnd->cfg.phase == hnd->saved_cfg.phase){
+		_persist.skipped++;
+		return;
+	}
+	if(!hnd->dirty){
+		hnd->dirty = true;
+		if(_persist.pendingWrites++ == 0){
+			_persist.firstDirtyUs = us_ticker_read();
+		}
+	}
+	schedulePersist();
+}
 
-	// si hay acciones pendientes...
-	if((_flags & ActionPending) != 0){
-		if(_curr_action.request == Blob::RlyManOn){
-			_delay_tmr.start();
-			while(_delay_tmr.read_us() < _relay_list[_curr_action.id].cfg.delayOnUs);
-			_relay_list[_curr_action.id].relay->turnOn();
+
+//------------------------------------------------------------------------------------
+void RelayManager::schedulePersist(){
+	if(_persist.pendingWrites == 0){
+		return;
+	}
+	uint32_t now = us_ticker_read();
+
+	// en reposo espera un tiempo sin actividad, en otro caso hasta el plazo máximo desde el primer cambio
+	int32_t to_deadline = (int32_t)((_persist.firstDirtyUs + (PersistDeadlineMs * 1000)) - now);
+	int32_t wait = (_stage == StageIdle)? (int32_t)(PersistIdleMs * 1000) : to_deadline;
+	wait = (wait < to_deadline)? wait : to_deadline;
+
+	// respeta el intervalo mínimo entre grabaciones
+	if(_persist.flushes > 0){
+		int32_t to_allowed = (int32_t)((_persist.lastFlushUs + (PersistMinIntervalMs * 1000)) - now);
+		wait = (wait > to_allowed)? wait : to_allowed;
+	}
+	wait = (wait > 0)? wait : 0;
+	_persist_tmr.attach_us(callback(this, &RelayManager::isrPersistTimeoutCb), wait);
+}
+
+
+//------------------------------------------------------------------------------------
+void RelayManager::flushConfig(){
+	DEBUG_TRACE_D(_EXPR_, _MODULE_, "Grabando %d configuraciones pendientes en memoria NV...", _persist.pendingWrites);
+	uint32_t t0 = us_ticker_read();
+	uint32_t pending = _persist.pendingWrites;
+	if(writeConfigBlob()){
+		_persist.writes += pending;
+	}
+	else{
+		DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_NVS grabando %s", CfgBlobKey);
+		_persist.failures++;
+	}
+	uint32_t now = us_ticker_read();
+	_persist.lastFlushUs = now;
+	_persist.flushes++;
+	_persist.lastFlushLatencyUs = now - t0;
+	_persist.maxFlushLatencyUs = (_persist.lastFlushLatencyUs > _persist.maxFlushLatencyUs)? _persist.lastFlushLatencyUs : _persist.maxFlushLatencyUs;
+
+	// si la grabación ha fallado, se reintenta más tarde
+	if(_persist.pendingWrites > 0){
+		_persist.firstDirtyUs = now;
+		schedulePersist();
+	}
+}
+
+
+//------------------------------------------------------------------------------------
+void RelayManager::isrPersistTimeoutCb(){
+	postIsrEvent(PersistFlushFlag);
+}
+
+
+//------------------------------------------------------------------------------------
+void RelayManager::isrHealthTimeoutCb(){
+	postIsrEvent(HealthReportFlag);
+}
+
+
+//------------------------------------------------------------------------------------
+void RelayManager::healthRecord(uint8_t id, bool on, int32_t err_us){
+	RelayHandler* hnd = &_relay_list[id];
+	RelayHealth& rh = hnd->health;
+	uint8_t k = (on)? 0 : 1;
+	uint32_t abs_err = (err_us < 0)? (uint32_t)(-err_us) : (uint32_t)err_us;
+	if(abs_err > hnd->cfg.deltaUs){
+		rh.offZero++;
+	}
+	rh.errAvg[k] += ((err_us * HealthAvgScale) - rh.errAvg[k]) / HealthAvgGain;
+
+	// bucket logarítmico a partir de HealthHistBaseUs. Al saturar, se divide todo el histograma entre 2 de
+	// forma que mantenga la forma de la distribución dando más peso a las medidas recientes
+	uint32_t b = abs_err / HealthHistBaseUs;
+	b = (b == 0)? 0 : (32 - __builtin_clz(b));
+	b = (b < Blob::RlyManHealthBuckets)? b : (Blob::RlyManHealthBuckets - 1);
+	if(rh.errHist[k][b] == 0xFFFF){
+		for(int n = 0; n < Blob::RlyManHealthBuckets; n++){
+			rh.errHist[k][n] >>= 1;
+		}
+	}
+	rh.errHist[k][b]++;
+}
+
+
+//------------------------------------------------------------------------------------
+void RelayManager::healthReport(){
+	uint32_t ops = healthOperations();
+
+	// graba como mucho una vez cada HealthPersistPeriods publicaciones, y sólo si hay cambios
+	_health_periods++;
+	if(ops != _health_saved && _health_periods >= HealthPersistPeriods){
+		if(saveHealth()){
+			_health_saved = ops;
+			_health_periods = 0;
+		}
+		else{
+			DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_NVS grabando %s", HealthBlobKey);
+		}
+	}
+
+	// sin conmutaciones desde la última publicación no hay cambios que notificar
+	if(ops == _health_reported){
+		return;
+	}
+	uint8_t count = 0;
+	for(int i = 0; i < _max_num_relays; i++){
+		count += (_relay_list[i].relay != NULL)? 1 : 0;
+	}
+	if(count == 0){
+		return;
+	}
+	Blob::RlyManHealth_t* report = (Blob::RlyManHealth_t*)Heap::memAlloc(count * sizeof(Blob::RlyManHealth_t));
+	MBED_ASSERT(report);
+	uint8_t n = 0;
+	for(int i = 0; i < _max_num_relays; i++){
+		if(getHealth(i, &report[n])){
+			n++;
+		}
+	}
+	DEBUG_TRACE_D(_EXPR_, _MODULE_, "Publicando resultado en '%s'", _topics.statHealth);
+	MQ::MQClient::publish(_topics.statHealth, report, n * sizeof(Blob::RlyManHealth_t), &_publicationCb);
+	Heap::memFree(report);
+	_health_reported = ops;
+}
+
+
+//------------------------------------------------------------------------------------
+void RelayManager::restoreHealth(){
+	uint32_t size = sizeof(CfgBlobHeader) + (_max_num_relays * sizeof(HealthBlobEntry));
+	uint8_t* blob = (uint8_t*)Heap::memAlloc(size);
+	MBED_ASSERT(blob);
+	CfgBlobHeader* hdr = (CfgBlobHeader*)blob;
+	HealthBlobEntry* entries = (HealthBlobEntry*)(blob + sizeof(CfgBlobHeader));
+	bool found = (restoreParameter(HealthBlobKey, blob, size, NVSInterface::TypeBlob) && hdr->version == HealthBlobVersion && hdr->count == _max_num_relays);
+	if(!found){
+		DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_NVS. No hay telemetría de salud, se inicia de cero");
+	}
+	for(int i=0; i<_max_num_relays; i++){
+		RelayHealth& rh = _relay_list[i].health;
+		if(found && crc16((uint8_t*)&entries[i].health, sizeof(RelayHealth)) == entries[i].crc){
+			rh = entries[i].health;
+			continue;
 		}
-		else if(_curr_action.request == Blob::RlyManOff){
-			_delay_tmr.start();
-			while(_delay_tmr.read_us() < _relay_list[_curr_action.id].cfg.delayOffUs);
-			_relay_list[_curr_action.id].relay->turnOff();
+		if(found){
+			DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_CFG. Relé %d con telemetría corrupta, se inicia de cero", i);
 		}
+		memset(&rh, 0, sizeof(RelayHealth));
+		rh.baseOnUs = _relay_list[i].cfg.delayOnUs;
+		rh.baseOffUs = _relay_list[i].cfg.delayOffUs;
+	}
+	Heap::memFree(blob);
+	_health_reported = healthOperations();
+	_health_saved = _health_reported;
+}
+
+
+//------------------------------------------------------------------------------------
+bool RelayManager::saveHealth(){
+	uint32_t size = sizeof(CfgBlobHeader) + (_max_num_relays * sizeof(HealthBlobEntry));
+	uint8_t* blob = (uint8_t*)Heap::memAlloc(size);
+	MBED_ASSERT(blob);
+	CfgBlobHeader* hdr = (CfgBlobHeader*)blob;
+	HealthBlobEntry* entries = (HealthBlobEntry*)(blob + sizeof(CfgBlobHeader));
+	hdr->version = HealthBlobVersion;
+	hdr->count = _max_num_relays;
+	hdr->reserved = 0;
+	for(int i=0; i<_max_num_relays; i++){
+		// se graban las conmutaciones acumuladas incluyendo las del arranque en curso
+		entries[i].health = _relay_list[i].health;
+		entries[i].health.operations += _relay_list[i].switches;
+		entries[i].crc = crc16((uint8_t*)&entries[i].health, sizeof(RelayHealth));
+	}
+	bool success = saveParameter(HealthBlobKey, blob, size, NVSInterface::TypeBlob);
+	Heap::memFree(blob);
+	return success;
+}
+
+
+//------------------------------------------------------------------------------------
+uint32_t RelayManager::healthOperations(){
+	uint32_t ops = 0;
+	for(int i=0; i<_max_num_relays; i++){
+		ops += _relay_list[i].health.operations + _relay_list[i].switches;
+	}
+	return ops;
+}
+
+
+//------------------------------------------------------------------------------------
+void RelayManager::isrZerocrossCb(Zerocross::LogicLevel level){
+	// el zerocross propio es la única fase
+	isrPhaseEdge(0, us_ticker_read());
+}
+
+
+//------------------------------------------------------------------------------------
+void RelayManager::isrPhaseEdge(uint8_t phase, uint32_t ts){
+	PhaseSync& ph = _phases[phase];
+
+	// actualiza el estimador de red de la fase
+	pllUpdate(ph.pll, ts);
+	uint32_t walked = 0;
+
+	// tras una pérdida, recupera la sincronización al engancharse de nuevo el estimador de red
+	ph.lastUs = ts;
+	if(ph.lost && ph.pll.goodEdges >= PllLockEdges){
+		ph.lost = false;
+		postIsrEvent(SyncUpdateFlag);
+	}
+
+	// avanza los relés en modo ráfaga de la fase
+	if(ph.burst != 0){
+		burstUpdate(phase, ts);
+	}
+
+	// si hay una desconexión de emergencia pendiente, la programa antes que el resto de acciones
+	if((ph.flags & ShedPending) != 0){
+		scheduleShed(ph.shed, ts, 0);
+		walked += __builtin_popcount(ph.shed);
+		ph.shed = 0;
+		ph.flags &= ~ShedPending;
+	}
+
+	// si hay acciones pendientes...
+	if((ph.flags & ActionPending) != 0){
+		// programa en una única pasada la conmutación de los relés del lote pendientes de esta fase
+		uint32_t slot_us = (ph.pll.periodUs != 0)? ph.pll.periodUs : DefaultInrushSlotUs;
+		scheduleBatch(ph.pending, ts, slot_us);
+		walked += __builtin_popcount(ph.pending);
 
 		// habilita tester del zero cross
 		if(_zc_test_cb != (Callback<void()>)NULL){
 			_zc_test_cb.call();
 		}
 
-		// borra el flag de operacin pendiente
-		_flags = (Flags)(_flags & ~ActionPending);
+		// borra el flag de operación pendiente, para no reprogramar en los siguientes flancos
+		ph.pending = 0;
+		ph.flags &= ~ActionPending;
+	}
+
+	// registra el tiempo de ocupación de la ISR y los relés recorridos en los flancos que programan conmutaciones
+	if(walked > 0){
+		perfAdd(&_perf.isrTime, us_ticker_read() - ts);
+		_perf.isrRelays += walked;
+	}
+}
+
+
+//------------------------------------------------------------------------------------
+void RelayManager::scheduleBatch(uint32_t mask, uint32_t edge_us, uint32_t slot_us){
+	// cada relé conmuta con su retardo calibrado respecto del flanco, descontando el tiempo ya transcurrido y
+	// desplazando los semiciclos asignados por el reparto de encendidos
+	_zc_ts_us = edge_us;
+	uint32_t elapsed = us_ticker_read() - edge_us;
+	while(mask != 0){
+		int i = __builtin_ctz(mask);
+		mask &= ~(1u << i);
+		RelayHandler* hnd = &_relay_list[i];
+		uint32_t delay_us = (hnd->action == Blob::RlyManOn)? hnd->cfg.delayOnUs : hnd->cfg.delayOffUs;
+		hnd->armed = true;
+		hnd->zc_ts = edge_us + (hnd->slot * slot_us);
+		hnd->sw_tmr.attach_us(callback(&RelayManager::isrSwitchCb, hnd), ((delay_us > elapsed)? (delay_us - elapsed) : 0) + (hnd->slot * slot_us));
+	}
+}
 
-		// libera el semforo de bloqueo
-		_sem.release();
 
+//------------------------------------------------------------------------------------
+void RelayManager::schedulePredicted(uint32_t mask, uint32_t now, uint32_t edge_us, uint32_t period_us){
+	_zc_ts_us = edge_us;
+	while(mask != 0){
+		int i = __builtin_ctz(mask);
+		mask &= ~(1u << i);
+		RelayHandler* hnd = &_relay_list[i];
+		uint32_t delay_us = (hnd->action == Blob::RlyManOn)? hnd->cfg.delayOnUs : hnd->cfg.delayOffUs;
+		int32_t fire_us = predictFire(now, edge_us, delay_us, period_us) + (hnd->slot * period_us);
+		hnd->armed = true;
+		hnd->zc_ts = now + fire_us - delay_us;
+		hnd->sw_tmr.attach_us(callback(&RelayManager::isrSwitchCb, hnd), fire_us);
 	}
-}        
+}
 
 
 //------------------------------------------------------------------------------------
-void RelayManager::feedbackUpdate(){
+int32_t RelayManager::predictFire(uint32_t now, uint32_t edge_us, uint32_t delay_us, uint32_t period_us){
+	// parte del último flanco predicho y busca el primer instante de conmutación que aún no ha pasado,
+	// que puede corresponder a un flanco anterior si el retardo es mayor que el periodo
+	int32_t fire_us = (int32_t)(edge_us + delay_us - now);
+	while(fire_us - (int32_t)period_us >= (int32_t)PllMinLeadUs){
+		fire_us -= period_us;
+	}
+	while(fire_us < (int32_t)PllMinLeadUs){
+		fire_us += period_us;
+	}
+	return fire_us;
+}
 
-	// chequea si hay feedback habilitado
-	if(_relay_list[_curr_action.id].fdb){
-		// Obtiene el resultado de la ltima conmutacin
-		uint32_t ton, toff, tsc;
-		RelayFeedback::Status result = _relay_list[_curr_action.id].fdb->getResult(&ton, &toff, &tsc, _relay_list[_curr_action.id].cfg.deltaUs);
 
-		// actualizo el delta
-		_relay_list[_curr_action.id].cfg.deltaUs = (uint32_t)(((100 - RelayFeedback::DefaultDeltaPercent) * tsc)/100);
-		DEBUG_TRACE_D(_EXPR_, _MODULE_, "Feedback check Ton=%d, Toff=%d, Tsc=%d, delta=%d", ton, toff, tsc, _relay_list[_curr_action.id].cfg.deltaUs);
+//------------------------------------------------------------------------------------
+void RelayManager::isrSwitchCb(RelayHandler* hnd){
+	RelayManager* me = hnd->owner;
+	hnd->armed = false;
+	if(hnd->action == Blob::RlyManOn){
+		hnd->relay->turnOn();
+	}
+	else if(hnd->action == Blob::RlyManOff){
+		hnd->relay->turnOff();
+	}
+	me->_sw_ts_us = us_ticker_read();
+	hnd->sw_ts = me->_sw_ts_us;
+#if defined(RELAYMANAGER_ENABLE_TRACELOG)
+	me->traceLog(Blob::RlyManTraceSwitch, (uint8_t)(hnd - me->_relay_list), hnd->action, hnd->slot);
+#endif
+
+	// notifica a la tarea al completar la última conmutación del lote
+	if(--me->_batch_pending == 0){
+		me->postIsrEvent(RelayChangedFlag);
+	}
+}
+
+
+//------------------------------------------------------------------------------------
+void RelayManager::burstUpdate(uint8_t phase, uint32_t edge_us){
+	uint32_t mask = _phases[phase].burst;
+	while(mask != 0){
+		int i = __builtin_ctz(mask);
+		mask &= ~(1u << i);
+		RelayHandler* hnd = &_relay_list[i];
+		BurstState& b = hnd->burst;
+
+		// al inicio de cada periodo calcula los flancos en On. El error de redondeo, incluido el debido a los
+		// mínimos de ciclos consecutivos, se acumula al siguiente periodo para que el ciclo conseguido converja
+		if(b.pos == 0){
+			int32_t target = ((int32_t)b.dutyPerMil * b.periodEdges) + b.carry;
+			int32_t on = (target + 500) / 1000;
+			on = (on < 0)? 0 : ((on > b.periodEdges)? b.periodEdges : on);
+			// ciclos enteros, respetando los mínimos en On y en Off
+			on -= on % b.edgesPerCycle;
+			if(on < b.minEdges){
+				on = 0;
+			}
+			else if((b.periodEdges - on) < b.minEdges){
+				on = b.periodEdges;
+			}
+			b.carry = target - (on * 1000);
+			b.periodOnEdges = on;
+		}
+
+		// conmuta con su retardo calibrado respecto del flanco sólo cuando cambia el estado
+		bool want = (b.pos < b.periodOnEdges);
+		if(want != b.on){
+			uint32_t delay_us = (want)? hnd->cfg.delayOnUs : hnd->cfg.delayOffUs;
+			uint32_t elapsed = us_ticker_read() - edge_us;
+			b.on = want;
+			hnd->sw_tmr.attach_us(callback(&RelayManager::isrBurstCb, hnd), (delay_us > elapsed)? (delay_us - elapsed) : 0);
+		}
+		b.onEdges += (want)? 1 : 0;
+		b.totalEdges++;
+		b.pos = (b.pos + 1 < b.periodEdges)? (b.pos + 1) : 0;
+	}
+}
+
+
+//------------------------------------------------------------------------------------
+void RelayManager::isrBurstCb(RelayHandler* hnd){
+	bool on = hnd->burst.on;
+	if(on){
+		hnd->relay->turnOn();
+	}
+	else{
+		hnd->relay->turnOff();
+	}
+	hnd->burst.applied = on;
+	// las conmutaciones del modo ráfaga también desgastan los contactos. Se cuentan desde ISR, por lo que el
+	// incremento es atómico frente a las lecturas de la tarea
+	core_util_atomic_incr_u32(&hnd->switches, 1);
+}
+
+
+//------------------------------------------------------------------------------------
+void RelayManager::isrShedCb(RelayHandler* hnd){
+	RelayManager* me = hnd->owner;
+	hnd->relay->turnOff();
+	hnd->sw_ts = us_ticker_read();
+
+	// notifica a la tarea al completar la última desconexión
+	if(--me->_shed_pending == 0){
+		me->postIsrEvent(ShedDoneFlag);
+	}
+}
+
+
+//------------------------------------------------------------------------------------
+void RelayManager::isrFdbRiseCb(FdbSense* sense){
+	uint32_t n = sense->count % FdbRingSize;
+	sense->ts[n] = us_ticker_read();
+	sense->level[n] = 1;
+	sense->count++;
+}
+
+
+//------------------------------------------------------------------------------------
+void RelayManager::isrFdbFallCb(FdbSense* sense){
+	uint32_t n = sense->count % FdbRingSize;
+	sense->ts[n] = us_ticker_read();
+	sense->level[n] = 0;
+	sense->count++;
+}
+
+
+//------------------------------------------------------------------------------------
+void RelayManager::isrZcWatchdogCb(){
+	uint32_t now = us_ticker_read();
+	for(int p = 0; p < _num_phases; p++){
+		PhaseSync& ph = _phases[p];
+		if(!ph.lost && (now - ph.lastUs) > ZcLossTimeoutUs){
+			ph.lost = true;
+			postIsrEvent(SyncUpdateFlag);
+		}
+	}
+	_zc_wdt.attach_us(callback(this, &RelayManager::isrZcWatchdogCb), ZcSupervisionUs);
+}
 
-		// si hay error por exceso de tiempo de on, lo decremento
-		bool updated = false;
-		if((result & RelayFeedback::ErrorTimeOnHigh) != 0){
-			DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_FEEDBACK ErrorTimeOnHigh");
-			_relay_list[_curr_action.id].cfg.delayOnUs -= _relay_list[_curr_action.id].cfg.deltaUs;
-			updated = true;
+
+//------------------------------------------------------------------------------------
+void RelayManager::pllUpdate(MainsPll& pll, uint32_t ts){
+
+	// primer flanco: toma la referencia
+	if(!pll.hasEdge){
+		pll.edgeUs = ts;
+		pll.hasEdge = true;
+		return;
+	}
+
+	uint32_t dt = ts - pll.edgeUs;
+
+	// sin periodo estimado: lo inicializa con el intervalo entre flancos si es plausible, con la ventana de
+	// aceptación abierta hasta la tolerancia máxima
+	if(pll.periodUs == 0){
+		if(dt >= PllMinPeriodUs && dt <= PllMaxPeriodUs){
+			pll.periodUs = dt;
+			pll.goodEdges = 1;
+			pll.jitterUs = (int32_t)((dt * PllGlitchTolerance) / 100);
 		}
-		// si es por defecto lo incremento
-		if((result & RelayFeedback::ErrorTimeOnLow) != 0){
-			DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_FEEDBACK ErrorTimeOnLow");
-			_relay_list[_curr_action.id].cfg.delayOnUs += _relay_list[_curr_action.id].cfg.deltaUs;
-			updated = true;
+		pll.edgeUs = ts;
+		return;
+	}
+
+	// calcula el número de periodos transcurridos y el error de fase respecto del flanco predicho
+	uint32_t n = (dt + (pll.periodUs / 2)) / pll.periodUs;
+	int32_t err = (int32_t)(dt - (n * pll.periodUs));
+
+	// la ventana de aceptación se ajusta al error de fase medio observado, dentro de la tolerancia máxima, de
+	// forma que los flancos espurios próximos al paso por cero no arrastren la fase más allá del propio jitter
+	int32_t tol = (int32_t)((pll.periodUs * PllGlitchTolerance) / 100);
+	int32_t gate = PllGateFactor * pll.jitterUs;
+	gate = (gate < PllMinGateUs)? PllMinGateUs : ((gate > tol)? tol : gate);
+
+	// rechaza flancos espurios (demasiado cercanos o fuera de fase). Si se acumulan demasiados rechazos o se han
+	// perdido demasiados flancos, reinicia la estimación
+	if(n == 0 || n > PllMaxMissedEdges || err > gate || err < -gate){
+		pll.rejectedEdges++;
+		if(n > PllMaxMissedEdges || ++pll.consecutiveRejects >= PllMaxRejects){
+			pll.edgeUs = ts;
+			pll.periodUs = 0;
+			pll.goodEdges = 0;
+			pll.consecutiveRejects = 0;
 		}
-		if((result & RelayFeedback::ErrorTimeOffHigh) != 0){
-			DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_FEEDBACK ErrorTimeOffHigh");
-			_relay_list[_curr_action.id].cfg.delayOffUs += _relay_list[_curr_action.id].cfg.deltaUs;
-			updated = true;
+		return;
+	}
+
+	// corrige fase y periodo con ganancias fijas (filtro de segundo orden)
+	pll.consecutiveRejects = 0;
+	pll.jitterUs += (((err < 0)? -err : err) - pll.jitterUs) / PllJitterGain;
+	pll.edgeUs += (n * pll.periodUs) + (err / PllPhaseGain);
+	pll.periodUs += err / (int32_t)(n * PllPeriodGain);
+	if(pll.goodEdges < PllLockEdges){
+		pll.goodEdges++;
+	}
+}
+
+
+//------------------------------------------------------------------------------------
+bool RelayManager::pllGetLastEdge(uint8_t phase, uint32_t now, uint32_t* edge_us, uint32_t* period_us){
+	core_util_critical_section_enter();
+	MainsPll pll = _phases[phase].pll;
+	core_util_critical_section_exit();
+
+	// sólo predice si está enganchado y el último flanco aceptado es reciente
+	if(pll.goodEdges < PllLockEdges){
+		return false;
+	}
+	uint32_t k = (now - pll.edgeUs) / pll.periodUs;
+	if(k > PllMaxMissedEdges){
+		return false;
+	}
+	*edge_us = pll.edgeUs + (k * pll.periodUs);
+	*period_us = pll.periodUs;
+	return true;
+}
+
+
+//------------------------------------------------------------------------------------
+void RelayManager::feedbackUpdate(uint8_t id){
+	RelayHandler* hnd = &_relay_list[id];
+
+	// chequea si hay feedback habilitado
+	if(hnd->fdb || hnd->sense){
+		// Obtiene el resultado de la última conmutación, del driver o del registro de flancos de la entrada
+		uint32_t ton = hnd->t_on_us;
+		uint32_t toff = hnd->t_off_us;
+		uint32_t tsc;
+		RelayFeedback::Status result = (hnd->sense)? senseResult(id, &ton, &toff, &tsc) : hnd->fdb->getResult(&ton, &toff, &tsc, hnd->cfg.deltaUs);
+		hnd->fdb_status = result;
+		hnd->t_on_us = ton;
+		hnd->t_off_us = toff;
+		hnd->t_sc_us = tsc;
+		if(tsc == 0){
+			HOT_TRACE_W(_EXPR_, _MODULE_, "ERR_FEEDBACK sin medida del semiciclo");
+			return;
 		}
-		if((result & RelayFeedback::ErrorTimeOffLow) != 0){
-			DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_FEEDBACK ErrorTimeOffLow");
-			_relay_list[_curr_action.id].cfg.delayOffUs -= _relay_list[_curr_action.id].cfg.deltaUs;
-			updated = true;
+
+		// actualizo el delta
+		hnd->cfg.deltaUs = (uint32_t)(((100 - RelayFeedback::DefaultDeltaPercent) * tsc)/100);
+		HOT_TRACE_D(_EXPR_, _MODULE_, "Feedback check Ton=%d, Toff=%d, Tsc=%d, delta=%d, result=%x", ton, toff, tsc, hnd->cfg.deltaUs, result);
+		TRACE_LOG(Blob::RlyManTraceFeedback, id, result, ((ton & 0xFFFF) << 16) | (toff & 0xFFFF));
+
+		// en un lote sin sincronizar las medidas no son relativas al paso por cero, no se registran ni se calibra
+		if(_batch_unsync){
+			return;
 		}
 
-		//si no hay errores en alguna conmutacin, guardo los parmetros en memoria NV
-		if(result == (RelayFeedback::Status)0 && updated){
-			char name[16];
-			sprintf(name, "RlyManCfg_%d", _curr_action.id);
-			saveParameter(name, &_relay_list[_curr_action.id].cfg, sizeof(Config_t), NVSInterface::TypeBlob);
+		// registra el tiempo medido desde el zerocross hasta la conmutación del contacto
+		bool on = (hnd->action == Blob::RlyManOn);
+		uint32_t t = (on)? ton : toff;
+		RELAY_PERF_ADD(hnd, zcToContact, t);
+
+		// obtiene el error de fase con signo (positivo si el contacto conmuta tarde). Ton se mide desde el paso por
+		// cero hasta el contacto y Toff desde el contacto hasta el paso por cero, ambos módulo el semiciclo
+		int32_t err = (t < (tsc / 2))? (int32_t)t : ((int32_t)t - (int32_t)tsc);
+		err = (on)? err : -err;
+		healthRecord(id, on, err);
+
+		// actualiza la estimación del retardo óptimo y lo aplica
+		bool updated = (on)? calUpdate(&hnd->cal.on, &hnd->cfg.delayOnUs, err, tsc) : calUpdate(&hnd->cal.off, &hnd->cfg.delayOffUs, err, tsc);
+		HOT_TRACE_D(_EXPR_, _MODULE_, "Calibración relé %d: err=%d, Ton=%d, Toff=%d", id, err, hnd->cfg.delayOnUs, hnd->cfg.delayOffUs);
+		TRACE_LOG(Blob::RlyManTraceCalib, id, hnd->cfg.delayOnUs, hnd->cfg.delayOffUs);
+
+		// si se ha modificado algún retardo, programa su grabación diferida en memoria NV
+		if(updated){
+			markDirty(id);
 		}
 
 	}
 }
 
 
+//------------------------------------------------------------------------------------
+RelayFeedback::Status RelayManager::senseResult(uint8_t id, uint32_t* t_on_us, uint32_t* t_off_us, uint32_t* t_sc_us){
+	RelayHandler* hnd = &_relay_list[id];
+	FdbSense* sense = hnd->sense;
+	*t_sc_us = 0;
+
+	// copia los flancos retenidos. Si se han registrado más de los que caben desde el inicio del lote, el primer
+	// cambio del contacto puede haberse sobrescrito
+	uint32_t ts[FdbRingSize];
+	uint8_t level[FdbRingSize];
+	core_util_critical_section_enter();
+	uint32_t count = sense->count;
+	memcpy(ts, sense->ts, sizeof(ts));
+	memcpy(level, sense->level, sizeof(level));
+	core_util_critical_section_exit();
+	if((count - sense->mark) > FdbRingSize){
+		sense->overruns++;
+		HOT_TRACE_W(_EXPR_, _MODULE_, "ERR_FEEDBACK registro de flancos desbordado, %d flancos en el lote", count - sense->mark);
+		return NoFeedbackStatus;
+	}
+
+	// primer flanco hacia el estado de la acción posterior a la orden, los siguientes son rebotes
+	bool on = (hnd->action == Blob::RlyManOn);
+	uint32_t n = sense->mark;
+	while(n != count && (level[n % FdbRingSize] != ((on)? 1 : 0) || (int32_t)(ts[n % FdbRingSize] - hnd->sw_ts) < 0)){
+		n++;
+	}
+	PhaseSync& ph = _phases[relayPhase(id)];
+	uint32_t tsc = (ph.pll.periodUs * ph.edgesPerCycle) / 2;
+	if(n == count || tsc == 0){
+		return NoFeedbackStatus;
+	}
+
+	// Ton desde el paso por cero hasta el cierre, Toff desde la apertura hasta el paso por cero siguiente
+	uint32_t t = (ts[n % FdbRingSize] - hnd->zc_ts) % tsc;
+	*t_sc_us = tsc;
+	uint32_t status = 0;
+	uint32_t delta = hnd->cfg.deltaUs;
+	if(on){
+		*t_on_us = t;
+		if(t > delta && (tsc - t) > delta){
+			status |= (t < tsc / 2)? RelayFeedback::ErrorTimeOnHigh : RelayFeedback::ErrorTimeOnLow;
+		}
+	}
+	else{
+		*t_off_us = (tsc - t) % tsc;
+		if(*t_off_us > delta && (tsc - *t_off_us) > delta){
+			status |= (*t_off_us < tsc / 2)? RelayFeedback::ErrorTimeOffLow : RelayFeedback::ErrorTimeOffHigh;
+		}
+	}
+	return (RelayFeedback::Status)status;
+}
+
+
+//------------------------------------------------------------------------------------
+bool RelayManager::calUpdate(CalEstimate* est, uint32_t* delay_us, int32_t err_us, uint32_t tsc){
+	// el retardo que habría conmutado justo en el paso por cero es la medida del filtro
+	float meas = (float)*delay_us - (float)err_us;
+	if(est->samples == 0){
+		est->delayUs = (float)*delay_us;
+		est->var = CalInitialVar;
+	}
+
+	// el retardo óptimo está definido módulo el semiciclo, se toma el representante más cercano a la estimación
+	float half = (float)tsc / 2;
+	while(meas - est->delayUs > half){
+		meas -= tsc;
+	}
+	while(est->delayUs - meas > half){
+		meas += tsc;
+	}
+
+	// rechaza medidas anómalas una vez hay suficientes muestras. Si se rechazan varias consecutivas, se asume un
+	// cambio real en el relé y se reinicia la incertidumbre de la estimación
+	float innov = meas - est->delayUs;
+	float s = est->var + CalMeasVar;
+	if(est->samples >= CalMinSamples && (innov * innov) > (CalOutlierSigma * CalOutlierSigma * s)){
+		est->outliers++;
+		if(++est->consecutiveOutliers < CalMaxOutliers){
+			HOT_TRACE_W(_EXPR_, _MODULE_, "ERR_FEEDBACK medida anómala descartada, innov=%d", (int)innov);
+			TRACE_LOG(Blob::RlyManTraceCalibReject, TraceNoRelay, (int32_t)innov, 0);
+			return false;
+		}
+		est->var = CalInitialVar;
+		s = est->var + CalMeasVar;
+	}
+	est->consecutiveOutliers = 0;
+
+	// filtro de Kalman escalar con ruido de proceso para seguir la deriva del relé
+	float k = est->var / s;
+	est->delayUs += k * innov;
+	est->var = ((1 - k) * est->var) + CalProcessVar;
+	if(est->samples < 0xFFFF){
+		est->samples++;
+	}
+
+	// mantiene la estimación dentro del rango admitido desplazándola un semiciclo si es necesario. El retardo
+	// aplicado se desplaza con ella, ya que conmuta en la misma fase, de forma que el paso acotado sólo limite la
+	// corrección y no recorra el semiciclo
+	int32_t wrap = 0;
+	if(est->delayUs < (float)DefaultSwitchingDelay){
+		est->delayUs += tsc;
+		wrap = (int32_t)tsc;
+	}
+	else if(est->delayUs >= (float)MaxSwitchingDelay){
+		est->delayUs -= tsc;
+		wrap = -(int32_t)tsc;
+	}
 
+	// aplica la estimación con un paso acotado
+	int32_t base = (int32_t)*delay_us + wrap;
+	int32_t step = (int32_t)(est->delayUs + 0.5f) - base;
+	int32_t max_step = (int32_t)(tsc / CalMaxStepDiv);
+	step = (step > max_step)? max_step : ((step < -max_step)? -max_step : step);
+	int32_t delay = base + step;
+	delay = (delay < (int32_t)DefaultSwitchingDelay)? (int32_t)DefaultSwitchingDelay : delay;
+	delay = (delay >= (int32_t)MaxSwitchingDelay)? (int32_t)(MaxSwitchingDelay - 1) : delay;
+	if((uint32_t)delay == *delay_us){
+		return false;
+	}
+	*delay_us = (uint32_t)delay;
+	return true;
+}
@@ -4,19 +4,60 @@
  *  Created on: Sep 2017
  *      Author: raulMrello
  *
- *	RelayManager es el mdulo encargado de gestionar las actuaciones sobre un grupo de rels (class Relay). Para dicha funcin
- *	hace uso de un objeto zerocross (class Zerocross) instalando una callback en los eventos ISR del paso por cero. Adems para
- *	asegurar que la conmutacin siempre se sita cercana al paso por cero real, utiliza un objeto de adaptacin (class RelayFeedback)
- *	capaz de medir los retardos desde que se produce la ISR del zerocross hasta obtener la conmutacin fsica del rel en su
- *	contacto de salida, tanto para la conmutacin de On como para la de Off.
+ *	RelayManager es el módulo encargado de gestionar las actuaciones sobre un grupo de relés (class Relay). Para dicha función
+ *	hace uso de un objeto zerocross (class Zerocross) instalando una callback en los eventos ISR del paso por cero. Además para
+ *	asegurar que la conmutación siempre se sitúa cercana al paso por cero real, utiliza un objeto de adaptación (class RelayFeedback)
+ *	capaz de medir los retardos desde que se produce la ISR del zerocross hasta obtener la conmutación física del relé en su
+ *	contacto de salida, tanto para la conmutación de On como para la de Off.
  *
  *	RelayManager se integra en el sistema MQLib, registrando unos topics base $BASE para realizar las publicaciones y suscripciones,
- *	as escuchar comandos de actuacin sobre los rels en $BASE/value/cmd siendo el mensaje asociado del tipo Blob::RlyManAction_t
+ *	así escuchará comandos de actuación sobre los relés en $BASE/value/cmd siendo el mensaje asociado del tipo Blob::RlyManAction_t
  *
- *	Por otro lado, cuando se realice una conmutacin, publicar su estado en el topic $BASE/value/stat con un mensaje del mismo
+ *	Por otro lado, cuando se realice una conmutación, publicará su estado en el topic $BASE/value/stat con un mensaje del mismo
  *	tipo.
- *	Adems, una vez que se calcule el feedback de conmutacin, se publicar un mensaje en el topic $BASE/fdbk/stat con el mensaje
- *	siendo un caracter: '1' para indicar feedback disponible tras conmutacin a On y '0' tras la conmutacin a Off.
+ *	También escuchará acciones en grupo en $BASE/group/cmd, con un mensaje del tipo Blob::RlyManGroupAction_t, que se aplican de
+ *	forma atómica en el mismo flanco de zerocross y se notifican con una única publicación agregada en $BASE/group/stat.
+ *	El modo ráfaga (burst firing) de un relé se configura en $BASE/burst/cmd con un mensaje del tipo Blob::RlyManBurstAction_t,
+ *	ejecutándose de forma autónoma desde la ISR del zerocross. Cada cambio de configuración o finalización se notifica en
+ *	$BASE/burst/stat con el ciclo de trabajo conseguido (Blob::RlyManBurstStat_t).
+ *	Las consultas en $BASE/value/get y $BASE/fdbk/get (con el identificador del relé, uint8_t) se responden directamente desde
+ *	una instantánea por relé, sin pasar por la tarea, en $BASE/value/stat (Blob::RlyManAction_t) y $BASE/snap/stat
+ *	(Blob::RlyManRelayStat_t) respectivamente.
+ *	Las consultas en $BASE/perf/get (con el identificador del relé) se responden en $BASE/perf/stat con el desglose por fases de
+ *	la latencia de sus acciones, en formato JSON.
+ *	En placas trifásicas, varios RelayManager comparten las entradas de zerocross a través de un ZerocrossHub, con una
+ *	única ISR por flanco y fase. Cada relé se asocia a una fase mediante su configuración (setRelayPhase) y se sincroniza
+ *	con los flancos de esa fase, que sólo recorren los relés de la fase con acciones pendientes.
+ *	Si dejan de llegar flancos del zerocross durante ZcLossTimeoutUs (alimentación en continua, fallo del optoacoplador...),
+ *	las acciones pasan a ejecutarse sin sincronizar y se notifica el modo degradado en $BASE/sync/stat
+ *	(Blob::RlyManSyncStat_t). Las acciones que esperaban un flanco se ejecutan en ese momento, de forma que la espera al
+ *	zerocross queda acotada por ZcLossTimeoutUs + ZcSupervisionUs. Al volver los flancos y engancharse el estimador de
+ *	red, se recupera la sincronización y se notifica de nuevo. En modo degradado no se calibran los retardos.
+ *	Si se compila con RELAYMANAGER_ENABLE_TRACELOG, los eventos del camino crítico se registran en un log binario en RAM
+ *	(Blob::RlyManTraceRecord_t) en lugar de generar trazas formateadas, y las consultas en $BASE/trace/get se responden
+ *	en $BASE/trace/stat con su volcado, decodificable con tools/rlyman_trace.py.
+ *	La telemetría de desgaste y calidad de conmutación de cada relé (conmutaciones, distribución del error respecto del
+ *	paso por cero y deriva de los retardos calibrados) se acumula en RAM, se graba en memoria NV cada
+ *	HealthPersistPeriods publicaciones y se publica cada HealthPeriodMs en $BASE/health/stat, con un único mensaje
+ *	para todos los relés (array de Blob::RlyManHealth_t).
+ *	Las acciones temporizadas se reciben en $BASE/timed/cmd, con un mensaje del tipo Blob::RlyManTimedAction_t. Se
+ *	mantienen en una rueda de temporización (TimerWheel) con inserción, cancelación y vencimiento en O(1), y al vencer
+ *	entran en el mismo camino que las acciones individuales, sincronizadas con el zerocross. Admiten reversión tras un
+ *	tiempo (ej. On durante N ms y después Off) y repetición periódica sin deriva.
+ *	Las desconexiones de emergencia se reciben en $BASE/shed/cmd, con un mensaje del tipo Blob::RlyManShedAction_t. No pasan
+ *	por la cola de comandos: descartan las acciones pendientes sobre los relés afectados, interrumpen las que estén en curso y
+ *	apagan los relés en el siguiente paso por cero, notificándose en $BASE/shed/stat. La latencia máxima queda acotada por el
+ *	procesado del evento en curso, un periodo de red y el retardo de apagado calibrado (< MaxSwitchingDelay).
+ *	La captura de un driver RelayFeedback se arma al iniciar cada lote y se detiene al obtener su resultado, de forma que
+ *	nunca queda en marcha entre acciones. Como limitación, todo lote con algún relé con driver espera la pre-captura
+ *	completa (RelayFeedback::DefaultPreviousCaptureTime) antes de conmutar: añade ese tiempo a la latencia de cada
+ *	comando, y los comandos que llegan durante la espera pasan al lote siguiente, por lo que se completa como mucho un
+ *	lote, y una muestra de calibración por relé, en cada pre-captura más la espera del zerocross. Alternativamente, el contacto de cada relé puede leerse en una entrada digital
+ *	(addRelayHandler con el pin de feedback): sus flancos se registran continuamente en un registro circular acotado de
+ *	FdbRingSize flancos y Ton/Toff/Tsc se extraen tras el lote, sin pre-captura en el camino de los comandos y calibrando
+ *	a la vez todos los relés que conmutan juntos.
+ *	Además, una vez que se calcule el feedback de conmutación, se publicará un mensaje en el topic $BASE/fdbk/stat con el mensaje
+ *	siendo un caracter: '1' para indicar feedback disponible tras conmutación a On y '0' tras la conmutación a Off.
  *
  */
  
@@ -27,56 +68,182 @@
 #include "ActiveModule.h"
 #include "Relay.h"
 #include "Zerocross.h"
+#include "ZerocrossHub.h"
 #include "RelayFeedback.h"
 #include "RelayManagerBlob.h"
+#include "TimerWheel.h"
+
+
+/** Número de acciones temporizadas simultáneas (identificadores 0..N-1) */
+#ifndef RELAYMANAGER_MAX_TIMED_ACTIONS
+#define RELAYMANAGER_MAX_TIMED_ACTIONS	16
+#endif
+
+/** Medidas de rendimiento por relé (RelayPerf: latencia, error zerocross-contacto y desglose por fases). Con 0 sólo
+ *  se mantienen las medidas globales, reduciendo la tabla de relés en sizeof(RelayPerf) por relé */
+#ifndef RELAYMANAGER_RELAY_PERF
+#define RELAYMANAGER_RELAY_PERF	1
+#endif
+
+
+template <uint8_t NumRelays, bool HasZerocross, uint32_t StackSize, bool HasFeedback> class StaticRelayManager;
 
    
 class RelayManager : public ActiveModule {
   public:
 
+    /** Tamaño de la pila de la tarea asociada (bytes) */
+    static const uint32_t DefaultStackSize = 3096;
+
+    /** Estado de la calibración adaptativa de un relé */
+    struct CalibrationInfo{
+        uint32_t delayOnUs;         /// Retardo de On aplicado
+        uint32_t delayOffUs;        /// Retardo de Off aplicado
+        uint32_t stdDevOnUs;        /// Desviación típica estimada del retardo óptimo de On
+        uint32_t stdDevOffUs;       /// Desviación típica estimada del retardo óptimo de Off
+        uint16_t samplesOn;         /// Número de medidas de On aceptadas
+        uint16_t samplesOff;        /// Número de medidas de Off aceptadas
+        uint16_t outliers;          /// Número de medidas anómalas descartadas
+        uint32_t fdbOverruns;       /// Conmutaciones sin medida por flancos sobrescritos en el registro de feedback
+    };
+
+    /** Contadores de la grabación diferida de la configuración */
+    struct PersistStats{
+        uint32_t pendingWrites;         /// Número de relés con cambios pendientes de grabar
+        uint32_t writes;                /// Número de grabaciones de relés realizadas
+        uint32_t flushes;               /// Número de volcados realizados
+        uint32_t failures;              /// Número de grabaciones fallidas
+        uint32_t skipped;               /// Número de cambios no grabados por no superar el umbral
+        uint32_t lastFlushLatencyUs;    /// Duración del último volcado
+        uint32_t maxFlushLatencyUs;     /// Duración máxima de un volcado
+        uint32_t firstDirtyUs;          /// Instante del primer cambio pendiente
+        uint32_t lastFlushUs;           /// Instante del último volcado
+    };
+
+    /** Número de buckets logarítmicos (potencias de 2 en us) de los histogramas de rendimiento */
+    static const uint8_t PerfHistBuckets = 16;
+
+    /** Fases en las que se descompone la latencia de una acción */
+    enum Phase{
+        PhaseQueue = 0,             /// Desde la recepción del comando hasta su extracción de la cola
+        PhaseBatch,                 /// Desde la extracción hasta el inicio del lote y la activación del feedback
+        PhaseZcWait,                /// Desde la activación del feedback hasta el paso por cero de referencia
+        PhaseSwitch,                /// Desde el paso por cero hasta la conmutación del relé
+        PhaseFeedback,              /// Desde la conmutación hasta la obtención del resultado del feedback y la calibración
+        PhasePublish,               /// Desde el resultado del feedback hasta la publicación
+        PhaseCount
+    };
+
+    /** Resumen del histograma de una fase */
+    struct PhaseStats{
+        uint32_t count;                     /// Número de muestras
+        uint32_t min;                       /// Valor mínimo (us)
+        uint32_t mean;                      /// Valor medio (us)
+        uint32_t p50;                       /// Percentil 50 (us)
+        uint32_t p99;                       /// Percentil 99 (us)
+        uint32_t max;                       /// Valor máximo (us)
+        uint16_t hist[PerfHistBuckets];     /// Histograma: el bucket 'b' contiene los valores en [2^b, 2^(b+1)) us
+    };
+
+    /** Contadores de comandos resueltos sin conmutación */
+    struct CmdStats{
+        uint32_t coalesced;         /// Acciones sustituidas por una posterior sobre el mismo relé
+        uint32_t skipped;           /// Acciones notificadas sin conmutar, al estar el relé ya en el estado solicitado
+    };
+
+    /** Contadores de las desconexiones de emergencia */
+    struct ShedStats{
+        uint32_t requests;          /// Desconexiones realizadas
+        uint32_t preempted;         /// Acciones en curso interrumpidas
+        uint32_t dropped;           /// Acciones pendientes o retenidas descartadas
+        uint32_t lastLatencyUs;     /// Latencia de la última desconexión, desde la solicitud al apagado
+        uint32_t maxLatencyUs;      /// Latencia máxima registrada
+    };
+
+    /** Contadores de las acciones temporizadas */
+    struct TimedStats{
+        uint32_t scheduled;         /// Acciones programadas
+        uint32_t cancelled;         /// Acciones canceladas o sustituidas antes de finalizar
+        uint32_t fired;             /// Vencimientos ejecutados (inicios, reversiones y repeticiones)
+        uint32_t active;            /// Acciones programadas actualmente
+        uint32_t maxLagUs;          /// Retraso máximo en el procesado de un tick de la rueda
+    };
+
+    /** Contadores del pool estático de mensajes de comando */
+    struct PoolStats{
+        uint32_t allocs;            /// Número de reservas realizadas
+        uint32_t frees;             /// Número de liberaciones realizadas
+        uint32_t poolDrops;         /// Comandos descartados por pool agotado
+        uint32_t queueDrops;        /// Comandos descartados por cola de la tarea llena
+        uint32_t inUse;             /// Número de mensajes reservados actualmente
+        uint32_t maxInUse;          /// Máximo número de mensajes reservados simultáneamente
+    };
+
     
-    /** Crea un manejador de rels asociando por defecto la entrada de zerocross, los flancos que utilizar
-     *  as como el mximo nmero de rels soportados
+    /** Crea un manejador de relés asociando por defecto la entrada de zerocross, los flancos que utilizará
+     *  así como el máximo número de relés soportados
      *  @param zc Entrada de zerocross
-     *  @param zc_level Nivel de activacin de eventos del zerocross (flancos activos)
-     *  @param num_relays Nmero mximo de rels
+     *  @param zc_level Nivel de activación de eventos del zerocross (flancos activos)
+     *  @param num_relays Número máximo de relés
      * 	@param fs Objeto FSManager para operaciones de backup
-     * 	@param defdbg Flag para habilitar depuracin por defecto
+     * 	@param defdbg Flag para habilitar depuración por defecto
      */
     RelayManager(PinName zc, Zerocross::LogicLevel zc_level, uint8_t num_relays, FSManager* fs, bool defdbg = false);
 
     
-    /** Crea un manejador de rels sin control de zerocross, y por lo tanto sin feedback.
-     *  @param num_relays Nmero mximo de rels
+    /** Crea un manejador de relés sin control de zerocross, y por lo tanto sin feedback.
+     *  @param num_relays Número máximo de relés
      * 	@param fs Objeto FSManager para operaciones de backup
-     * 	@param defdbg Flag para habilitar depuracin por defecto
+     * 	@param defdbg Flag para habilitar depuración por defecto
      */
     RelayManager(uint8_t num_relays, FSManager* fs, bool defdbg = false);
 
 
+    /** Crea un manejador de relés sincronizado con los flancos de las fases de un hub de zerocross compartido con
+     *  otros manejadores. Las fases deben registrarse en el hub antes de iniciar el módulo.
+     *  @param hub Hub de zerocross
+     *  @param num_relays Número máximo de relés (hasta MaxGroupRelays)
+     * 	@param fs Objeto FSManager para operaciones de backup
+     * 	@param defdbg Flag para habilitar depuración por defecto
+     */
+    RelayManager(ZerocrossHub* hub, uint8_t num_relays, FSManager* fs, bool defdbg = false);
+
+
     /** Destructor */
     ~RelayManager(){}
 
 
-    /** Aade un manejador de rel a la lista
+    /** Añade un manejador de relé a la lista
      *
      *  @param relay Objeto Relay
      *  @param fdb Objeto RelayFeedback o NULL si no hay feedback asociado
-     *  @return Identificador creado (igual al 'id') o valor < 0 en caso de error
+     *  @return Identificador creado (igual al 'id') o valor < 0 en caso de error (-3 si se asocia feedback en una
+     *          variante sin feedback)
      */
     int32_t addRelayHandler(Relay* relay, RelayFeedback* fdb = NULL);
 
 
-    /** Interfaz para postear un mensaje de la mquina de estados en el Mailbox de la clase heredera
+    /** Añade un manejador de relé cuyo contacto se lee en una entrada digital (nivel alto con el contacto cerrado). Los
+     *  flancos de la entrada se registran continuamente desde ISR en un registro circular de FdbRingSize flancos, del
+     *  que se extrae el resultado del feedback tras cada conmutación
+     *
+     *  @param relay Objeto Relay
+     *  @param fdb_pin Entrada de lectura del contacto
+     *  @return Identificador creado (igual al 'id') o valor < 0 en caso de error (-3 en una variante sin feedback)
+     */
+    int32_t addRelayHandler(Relay* relay, PinName fdb_pin);
+
+
+    /** Interfaz para postear un mensaje de la máquina de estados en el Mailbox de la clase heredera
      *  @param msg Mensaje a postear
      *  @return Resultado
      */
     virtual osStatus putMessage(State::Msg *msg);
 
 
-    /** Obtiene el resultado de la ltima operacin del feedback integrado en el rel 'id'
+    /** Obtiene el resultado de la última operación del feedback integrado en el relé 'id'
      *
-     *	@param id Identificador del rel del que se solicita la consulta
+     *	@param id Identificador del relé del que se solicita la consulta (obtenido de su instantánea)
      *  @param t_on_us Recibe el tiempo de ON en microseg
      *  @param t_off_us Recibe el tiempo de OFF en microseg
      *  @param t_sc_us Recibe el tiempo del semiciclo en microseg
@@ -85,7 +252,188 @@ class RelayManager : public ActiveModule {
     RelayFeedback::Status getFeedbackResult(uint8_t id, uint32_t* t_on_us, uint32_t* t_off_us, uint32_t *t_sc_us);
 
 
-    /** Rutina para instalar un tester del flanco exacto del zerocross en el que se incia el proceso de conmutacin
+    /** Obtiene la instantánea del estado, último feedback y calibración del relé 'id'. Puede invocarse desde
+     *  cualquier hilo o ISR sin bloqueos.
+     *
+     *  @param id Identificador del relé
+     *  @param stat Recibe la instantánea
+     *  @return True si el relé existe
+     */
+    bool getRelayStat(uint8_t id, Blob::RlyManRelayStat_t* stat);
+
+
+    /** Obtiene el estado de la calibración adaptativa del relé 'id'
+     *
+     *  @param id Identificador del relé
+     *  @param info Recibe el estado de la calibración
+     *  @return True si el relé existe
+     */
+    bool getCalibrationInfo(uint8_t id, CalibrationInfo* info);
+
+
+    /** Obtiene los contadores de la grabación diferida de la configuración
+     *
+     *  @param stats Recibe los contadores
+     */
+    void getPersistStats(PersistStats* stats);
+
+
+    /** Obtiene la duración de la recuperación de la configuración en el arranque
+     *
+     *  @return Duración en microseg
+     */
+    uint32_t getRestoreTime(){
+    	return _restore_us;
+    }
+
+
+    /** Obtiene el estado del estimador de red (periodo entre flancos activos del zerocross) de una fase
+     *
+     *  @param period_us Recibe el periodo estimado en microseg (0 si no hay estimación)
+     *  @param rejected_edges Recibe el número de flancos espurios rechazados
+     *  @param phase Fase
+     *  @return True si el estimador está enganchado y las acciones se programan sobre el zerocross predicho
+     */
+    bool getMainsEstimation(uint32_t* period_us, uint32_t* rejected_edges, uint8_t phase = 0);
+
+
+    /** Asocia un relé a una fase del hub de zerocross. Forma parte de la configuración del relé: se aplica en el
+     *  arranque sobre la configuración recuperada y se graba en memoria NV si ha cambiado. Si no se establece, se
+     *  mantiene la fase grabada. Debe establecerse antes de iniciar el módulo.
+     *
+     *  @param id Identificador del relé
+     *  @param phase Fase (las fases no registradas en el hub se sincronizan con la fase 0)
+     *  @return True si el relé existe y la fase es válida
+     */
+    bool setRelayPhase(uint8_t id, uint8_t phase);
+
+
+    /** Obtiene las medidas de rendimiento en formato JSON: comandos recibidos y su tasa, tiempo de ocupación de
+     *  la ISR de zerocross y, por relé, el tiempo del zerocross al contacto y la latencia desde la recepción del
+     *  comando hasta la publicación del resultado (sin RELAYMANAGER_RELAY_PERF, la lista de relés queda vacía).
+     *  Cada medida incluye n, min, mean, p50, p99 y max.
+     *
+     *  @param buf Buffer de destino
+     *  @param len Tamaño del buffer
+     *  @return Número de caracteres escritos o -1 si el buffer es insuficiente
+     */
+    int32_t getPerfJson(char* buf, uint32_t len);
+
+
+    /** Reinicia las medidas de rendimiento
+     */
+    void resetPerfStats();
+
+
+    /** Obtiene el histograma de una fase de la latencia de las acciones sobre un relé
+     *
+     *  @param id Identificador del relé
+     *  @param phase Fase
+     *  @param stats Recibe el resumen y el histograma
+     *  @return True si el relé y la fase existen (false sin RELAYMANAGER_RELAY_PERF)
+     */
+    bool getPhaseStats(uint8_t id, Phase phase, PhaseStats* stats);
+
+
+    /** Obtiene los histogramas de las fases de la latencia de un relé en formato JSON. Se publica también en
+     *  $BASE/perf/stat como respuesta a $BASE/perf/get (con el identificador del relé, uint8_t).
+     *
+     *  @param id Identificador del relé
+     *  @param buf Buffer de destino
+     *  @param len Tamaño del buffer
+     *  @return Número de caracteres escritos o -1 si el buffer es insuficiente o el relé no existe (siempre -1 sin
+     *          RELAYMANAGER_RELAY_PERF)
+     */
+    int32_t getPhaseJson(uint8_t id, char* buf, uint32_t len);
+
+
+    /** Vuelca el log binario de trazas: cabecera Blob::RlyManTraceHeader_t seguida de los registros
+     *  Blob::RlyManTraceRecord_t, del más antiguo al más reciente. Se publica también en $BASE/trace/stat como
+     *  respuesta a $BASE/trace/get. Sólo disponible si se compila con RELAYMANAGER_ENABLE_TRACELOG.
+     *
+     *  @param buf Buffer de destino
+     *  @param len Tamaño del buffer. Si no caben todos los registros, se vuelcan los más recientes
+     *  @return Número de bytes escritos o -1 si el log no está disponible o el buffer no admite la cabecera
+     */
+    int32_t getTraceLog(uint8_t* buf, uint32_t len);
+
+
+    /** Obtiene los contadores del pool de mensajes de comando
+     *
+     *  @param stats Recibe los contadores
+     */
+    void getPoolStats(PoolStats* stats);
+
+
+    /** Establece el límite de la suma de corrientes de pico de los encendidos simultáneos. Los encendidos de un
+     *  mismo lote se reparten en semiciclos sucesivos de forma que la suma de los pesos de los relés que están en
+     *  su pico no supere el límite, minimizando el tiempo total. Debe establecerse antes de iniciar el módulo.
+     *
+     *  @param budget Límite, en las mismas unidades que los pesos de los relés (0: sin límite)
+     */
+    void setInrushBudget(uint32_t budget){
+    	_inrush_budget = budget;
+    }
+
+
+    /** Establece el perfil de la corriente de pico en el encendido de un relé. Debe establecerse antes de iniciar
+     *  el módulo.
+     *
+     *  @param id Identificador del relé
+     *  @param slots Duración del pico en semiciclos (1 .. MaxInrushSlots)
+     *  @param weight Peso del pico (p.ej. corriente en décimas de amperio)
+     *  @return True si el perfil es válido
+     */
+    bool setInrushProfile(uint8_t id, uint8_t slots, uint16_t weight);
+
+
+    /** Obtiene el estado del modo ráfaga de un relé
+     *
+     *  @param id Identificador del relé
+     *  @param info Recibe el ciclo de trabajo solicitado (0 si no está en modo ráfaga), el conseguido y los ciclos
+     *  @return True si el relé existe
+     */
+    bool getBurstInfo(uint8_t id, Blob::RlyManBurstStat_t* info);
+
+
+    /** Obtiene los contadores de acciones agrupadas y de acciones redundantes descartadas
+     *
+     *  @param stats Recibe los contadores
+     */
+    void getCmdStats(CmdStats* stats);
+
+
+    /** Obtiene los contadores y la latencia de las desconexiones de emergencia
+     *
+     *  @param stats Recibe los contadores
+     */
+    void getShedStats(ShedStats* stats);
+
+
+    /** Obtiene el estado de sincronización con el zerocross
+     *
+     *  @param stat Recibe el estado
+     */
+    void getSyncStat(Blob::RlyManSyncStat_t* stat);
+
+
+    /** Obtiene la telemetría de desgaste y calidad de conmutación del relé 'id'
+     *
+     *  @param id Identificador del relé
+     *  @param health Recibe la telemetría
+     *  @return True si el relé existe
+     */
+    bool getHealth(uint8_t id, Blob::RlyManHealth_t* health);
+
+
+    /** Obtiene los contadores de las acciones temporizadas
+     *
+     *  @param stats Recibe los contadores
+     */
+    void getTimedStats(TimedStats* stats);
+
+
+    /** Rutina para instalar un tester del flanco exacto del zerocross en el que se incia el proceso de conmutación
      *  tanto para On como para Off.
      * @param zcTestCb Callback instalada
      */
@@ -96,32 +444,184 @@ class RelayManager : public ActiveModule {
 
   private:
 
-    /** Tiempo por defecto de la duracin del pico de corriente antes de bajar a mantenimiento (en millis) */
+    /** Las variantes de tamaño fijo proporcionan su propio almacenamiento estático */
+    template <uint8_t NumRelays, bool HasZerocross, uint32_t StackSize, bool HasFeedback> friend class StaticRelayManager;
+
+#if defined(RELAYMANAGER_HOST_SIM)
+    /** Acceso de los tests del banco de simulación en el host (test/host) al estado interno. Sólo lo define el
+     *  Makefile del banco, de forma que no forma parte de la interfaz en el target */
+    friend class RelayManagerProbe;
+#endif
+
+    /** Fase no solicitada en la configuración de un relé */
+    static const uint8_t NoPhaseRequest = 0xFF;
+
+    /** Resultado del feedback cuando no está disponible: todos los errores marcados */
+    static const RelayFeedback::Status NoFeedbackStatus = (RelayFeedback::Status)(RelayFeedback::ErrorTimeOnHigh | RelayFeedback::ErrorTimeOnLow | RelayFeedback::ErrorTimeOffHigh | RelayFeedback::ErrorTimeOffLow);
+
+    /** Flancos retenidos por el registro circular de la entrada de feedback de cada relé: el cambio del contacto y
+     *  sus rebotes en una conmutación */
+    static const uint8_t FdbRingSize = 8;
+
+    /** Tiempo por defecto de la duración del pico de corriente antes de bajar a mantenimiento (en millis) */
     static const uint32_t DefaultMaxCurrentTimeMs = 100;
 
-    /** Mximo retardo permitido en las conmutaciones (50ms) */
+    /** Máximo retardo permitido en las conmutaciones (50ms) */
     static const uint32_t MaxSwitchingDelay = 50000;
 
     /** Retardo por defecto en las conmutaciones (8ms) */
     static const uint32_t DefaultSwitchingDelay = 8000;
 
-    /** Delta para la validacin de la conmutacin en las conmutaciones (5% Tsc = 500us) */
+    /** Delta para la validación de la conmutación en las conmutaciones (5% Tsc = 500us) */
     static const uint32_t DefaultSwitchingDelta = 500;
 
-    /** Mximo nmero de mensajes alojables en la cola asociada a la mquina de estados */
+    /** Rango admisible del periodo entre flancos activos del zerocross (semiciclo a 65Hz .. ciclo a 45Hz) */
+    static const uint32_t PllMinPeriodUs = 7000;
+    static const uint32_t PllMaxPeriodUs = 22500;
+
+    /** Error de fase máximo admitido en un flanco, en % del periodo. Por encima se rechaza como espurio */
+    static const uint32_t PllGlitchTolerance = 10;
+
+    /** Ventana de aceptación de flancos: múltiplo del error de fase medio y mínimo (us). Un flanco espurio cercano
+     *  al paso por cero sólo puede desplazar la fase dentro de esta ventana */
+    static const int32_t PllGateFactor = 4;
+    static const int32_t PllMinGateUs = 100;
+
+    /** Ganancia (divisor) del promedio del error de fase de los flancos aceptados */
+    static const int32_t PllJitterGain = 8;
+
+    /** Ganancias (divisores) de corrección de fase y de periodo del estimador de red */
+    static const int32_t PllPhaseGain = 4;
+    static const int32_t PllPeriodGain = 16;
+
+    /** Flancos consecutivos aceptados para considerar enganchado el estimador de red */
+    static const uint8_t PllLockEdges = 8;
+
+    /** Rechazos consecutivos y flancos perdidos tras los que se reinicia el estimador de red */
+    static const uint8_t PllMaxRejects = 8;
+    static const uint32_t PllMaxMissedEdges = 10;
+
+    /** Antelación mínima para programar una conmutación sobre el zerocross predicho (us) */
+    static const uint32_t PllMinLeadUs = 200;
+
+    /** Pérdida del zerocross: tiempo sin flancos tras el que se pasa a modo degradado (más de 4 periodos a 45Hz)
+     *  y periodo de supervisión (us) */
+    static const uint32_t ZcLossTimeoutUs = 100000;
+    static const uint32_t ZcSupervisionUs = 20000;
+
+    /** Versión del bloque empaquetado con la configuración de todos los relés */
+    static const uint16_t CfgBlobVersion = 2;
+
+    /** Grabación diferida de la configuración: umbral de cambio en los retardos para requerir grabación (us),
+     *  tiempo en reposo tras el que se graba, plazo máximo desde el primer cambio e intervalo mínimo entre
+     *  grabaciones (ms) */
+    static const uint32_t PersistThresholdUs = 100;
+    static const uint32_t PersistIdleMs = 2000;
+    static const uint32_t PersistDeadlineMs = 60000;
+    static const uint32_t PersistMinIntervalMs = 10000;
+
+    /** Telemetría de salud: periodo de publicación (ms), publicaciones entre grabaciones en memoria NV, límite del
+     *  primer bucket de los histogramas de error (us), ganancia (divisor) y escala de la media móvil del error, y
+     *  versión del bloque grabado */
+    static const uint32_t HealthPeriodMs = 60000;
+    static const uint32_t HealthPersistPeriods = 60;
+    static const uint32_t HealthHistBaseUs = 64;
+    static const int32_t HealthAvgGain = 16;
+    static const int32_t HealthAvgScale = 16;
+    static const uint16_t HealthBlobVersion = 1;
+
+    /** Parámetros del filtro de calibración: varianzas inicial, de medida y de proceso (us^2), umbral de
+     *  rechazo de medidas anómalas (en desviaciones típicas), muestras mínimas antes de rechazar, rechazos
+     *  consecutivos que reinician la estimación y paso máximo por conmutación (fracción del semiciclo) */
+    static constexpr float CalInitialVar = 1000000.0f;
+    static constexpr float CalMeasVar = 90000.0f;
+    static constexpr float CalProcessVar = 2500.0f;
+    static constexpr float CalOutlierSigma = 3.0f;
+    static const uint16_t CalMinSamples = 3;
+    static const uint8_t CalMaxOutliers = 3;
+    static const uint32_t CalMaxStepDiv = 4;
+
+    /** Reparto de encendidos: número máximo de semiciclos de la planificación, duración por defecto del pico de
+     *  un relé (semiciclos) y duración del semiciclo mientras no haya estimación de red (us) */
+    static const uint8_t MaxInrushSlots = 64;
+    static const uint8_t DefaultInrushSlots = 10;
+    static const uint32_t DefaultInrushSlotUs = 10000;
+
+    /** Modo ráfaga: mínimo de ciclos consecutivos en On y en Off, y máximo periodo (ciclos de red) */
+    static const uint8_t BurstMinCycles = 2;
+    static const uint16_t BurstMaxPeriodCycles = 3000;
+
+    /** Tamaño del buffer de la respuesta JSON en $BASE/perf/stat */
+    static const uint32_t PhaseJsonSize = 768;
+
+    /** Log binario de trazas: número de registros (potencia de 2), marca y versión del formato del volcado */
+    static const uint32_t TraceLogSize = 128;
+    static const uint32_t TraceMagic = 0x54594C52;
+    static const uint16_t TraceVersion = 1;
+    MBED_STATIC_ASSERT((TraceLogSize & (TraceLogSize - 1)) == 0, "TraceLogSize debe ser potencia de 2");
+
+    /** Acciones temporizadas: número de acciones y resolución de la rueda de temporización (ms) */
+    static const uint16_t MaxTimedActions = RELAYMANAGER_MAX_TIMED_ACTIONS;
+    static const uint32_t TimedTickMs = 10;
+    MBED_STATIC_ASSERT(MaxTimedActions > 0 && MaxTimedActions <= 256, "RELAYMANAGER_MAX_TIMED_ACTIONS fuera de rango");
+
+    /** Máximo número de relés direccionables en una acción en grupo (ancho de las máscaras) */
+    static const uint8_t MaxGroupRelays = 32;
+
+    /** Máximo número de mensajes alojables en la cola asociada a la máquina de estados. Dimensiona también el
+     *  pool de mensajes de comando, cuya máscara de slots libres es de 32 bits */
     static const uint32_t MaxQueueMessages = 16;
+    MBED_STATIC_ASSERT(MaxQueueMessages <= 32, "MaxQueueMessages excede el tamaño del pool de comandos");
 
     /** Flags de operaciones a realizar por la tarea */
     enum MsgEventFlags{
-        RelayActionPendingFlag  = (State::EV_RESERVED_USER << 0),       /// Indica que se ha solicitado un cambio en algn rel
+        RelayActionPendingFlag  = (State::EV_RESERVED_USER << 0),       /// Indica que se ha solicitado un cambio en algún relé
         MaxCurrTimeoutFlag 		= (State::EV_RESERVED_USER << 1),       /// Indica que ha finalizado el tiempo de corriente de pico
-        RelayChangedFlag        = (State::EV_RESERVED_USER << 2),       /// Indica que un rel ha cambiado de estado
-        SyncUpdateFlag          = (State::EV_RESERVED_USER << 3),       /// Indica que se solicita una resincronizacin con el nuevo retardo enviado
-        RelayToLowLevel         = (State::EV_RESERVED_USER << 4),       /// Indica que algn rel debe bajar a corriente de mantenimiento
+        RelayChangedFlag        = (State::EV_RESERVED_USER << 2),       /// Indica que los relés del lote en curso han cambiado de estado
+        SyncUpdateFlag          = (State::EV_RESERVED_USER << 3),       /// Indica que ha cambiado la sincronización con el zerocross (pérdida o recuperación)
+        RelayToLowLevel         = (State::EV_RESERVED_USER << 4),       /// Indica que algún relé debe bajar a corriente de mantenimiento
+        GroupActionPendingFlag  = (State::EV_RESERVED_USER << 5),       /// Indica que se ha solicitado una acción en grupo
+        FeedbackReadyFlag       = (State::EV_RESERVED_USER << 6),       /// Indica que ha finalizado la pre-captura del feedback
+        PersistFlushFlag        = (State::EV_RESERVED_USER << 7),       /// Indica que se debe evaluar la grabación diferida de la configuración
+        ShedPendingFlag         = (State::EV_RESERVED_USER << 8),       /// Indica que se ha solicitado una desconexión de emergencia
+        ShedDoneFlag            = (State::EV_RESERVED_USER << 9),       /// Indica que ha finalizado la desconexión de emergencia
+        BurstActionPendingFlag  = (State::EV_RESERVED_USER << 10),      /// Indica que se ha solicitado una configuración del modo ráfaga
+        TimedActionPendingFlag  = (State::EV_RESERVED_USER << 11),      /// Indica que se ha solicitado una acción temporizada
+        TimedTickFlag           = (State::EV_RESERVED_USER << 12),      /// Indica que ha vencido el tick de la rueda de temporización
+        HealthReportFlag        = (State::EV_RESERVED_USER << 13),      /// Indica que se debe publicar la telemetría de salud
+        PerfQueryFlag           = (State::EV_RESERVED_USER << 14),      /// Indica que se ha solicitado el desglose por fases de un relé
+    };
+
+
+    /** Etapas por las que pasa un lote de acciones. Las transiciones se producen por eventos posteados desde
+     *  los temporizadores y las ISR, de forma que la tarea nunca queda bloqueada durante una acción.
+     */
+    enum ActionStage{
+        StageIdle = 0,              /// Sin lote en curso
+        StageFeedbackArmed,         /// Feedback activado, esperando el tiempo de pre-captura
+        StageAwaitingZc,            /// Esperando el flanco de zerocross y las conmutaciones programadas
+        StageInrush,                /// Esperando el fin del pico de corriente
+        StageHold,                  /// Relés en mantenimiento, deteniendo la captura del feedback
+        StageCalibrate,             /// Calibrando los retardos de conmutación
+        StagePublish,               /// Publicando los resultados del lote
+    };
+
+
+    /** Comando aceptado pendiente de incluirse en un lote. Almacena una copia de los datos del mensaje
+     *  recibido, ya que éste se libera tras su procesado en la máquina de estados.
+     */
+    struct PendingCmd{
+        uint32_t sig;                               /// Tipo de comando (RelayActionPendingFlag o GroupActionPendingFlag)
+        uint32_t ts;                                /// Instante de recepción del comando (us)
+        uint32_t deq;                               /// Instante de extracción de la cola (us)
+        union{
+            Blob::RlyManAction_t action;            /// Acción individual
+            Blob::RlyManGroupAction_t group;        /// Acción en grupo
+        };
     };
 
 
-    /** Cola de mensajes de la mquina de estados */
+    /** Cola de mensajes de la máquina de estados */
     Queue<State::Msg, MaxQueueMessages> _queue;
 
 
@@ -129,53 +629,438 @@ class RelayManager : public ActiveModule {
      *
      */
     enum Flags{
-        ActionPending = (1 << 0),       /// Flag para indicar accin en curso pendiente
+        ActionPending = (1 << 0),       /// Flag para indicar acción en curso pendiente
+        ShedPending = (1 << 1),         /// Flag para indicar desconexión de emergencia pendiente del siguiente flanco
     };
 
 
-    /** Estructura de configuracin con los parmetros de la calibracin de retardos de conmutacin
+    /** Estructura de configuración con los parámetros de la calibración de retardos de conmutación
      *  para el ajuste preciso al zerocross
      */
     struct Config_t {
     	uint32_t delayOnUs;				//!< Retardo en el encendido en us
 		uint32_t delayOffUs;			//!< Retardo en el apagado en us
-		uint32_t deltaUs;				//!< Delta de comparacin en us
+		uint32_t deltaUs;				//!< Delta de comparación en us
+		uint8_t phase;					//!< Fase del zerocross a la que está conectado el relé
+		uint8_t reserved[3];			//!< Sin uso (a 0), evita bytes de relleno en el cálculo del CRC
+    };
+
+
+    /** Configuración de un relé en versiones anteriores (claves individuales y bloque empaquetado versión 1) */
+    struct __packed ConfigV1_t {
+    	uint32_t delayOnUs;
+		uint32_t delayOffUs;
+		uint32_t deltaUs;
+    };
+
+
+    /** Acumulador estadístico con histograma logarítmico para las medidas de rendimiento */
+    struct PerfStat{
+        uint32_t count;                     /// Número de muestras
+        uint32_t min;                       /// Valor mínimo
+        uint32_t max;                       /// Valor máximo
+        uint64_t sum;                       /// Suma de las muestras
+        uint16_t hist[PerfHistBuckets];     /// Histograma (saturado a 0xFFFF por bucket)
+    };
+
+
+    /** Medidas de rendimiento de cada relé */
+    struct RelayPerf{
+        PerfStat zcToContact;               /// Tiempo medido por el feedback desde el zerocross al contacto
+        PerfStat latency;                   /// Latencia desde la recepción del comando a la publicación del resultado
+        PerfStat phase[PhaseCount];         /// Desglose de la latencia por fases
+    };
+
+
+    /** Cabecera del bloque empaquetado de configuración */
+    struct __packed CfgBlobHeader{
+        uint16_t version;               /// Versión del formato
+        uint8_t count;                  /// Número de relés incluidos
+        uint8_t reserved;
+    };
+
+
+    /** Entrada de un relé en el bloque empaquetado de configuración, con su propio CRC */
+    struct __packed CfgBlobEntry{
+        Config_t cfg;                   /// Configuración del relé
+        uint16_t crc;                   /// CRC-16 de la configuración
     };
 
 
-    /** Estructura de datos que facilita el manejo de los eventos y estados relativos a cada rel
+    /** Entrada de un relé en el bloque empaquetado de configuración versión 1 */
+    struct __packed CfgBlobEntryV1{
+        ConfigV1_t cfg;                 /// Configuración del relé
+        uint16_t crc;                   /// CRC-16 de la configuración
+    };
+
+
+    /** Telemetría de salud de un relé, grabada tal cual en memoria NV. Los contadores de conmutaciones del arranque
+     *  en curso se suman a los grabados al publicar y al grabar */
+    struct __packed RelayHealth{
+        uint32_t operations;            /// Conmutaciones acumuladas hasta el arranque en curso
+        uint32_t offZero;               /// Conmutaciones con |error| > deltaUs
+        uint32_t baseOnUs;              /// Retardo de On de referencia para la deriva
+        uint32_t baseOffUs;             /// Retardo de Off de referencia para la deriva
+        int32_t errAvg[2];              /// Media móvil del error de On y de Off (us x HealthAvgScale)
+        uint16_t errHist[2][Blob::RlyManHealthBuckets];   /// Histogramas del error absoluto de On y de Off
+    };
+
+
+    /** Entrada de un relé en el bloque de telemetría de salud, con su propio CRC */
+    struct __packed HealthBlobEntry{
+        RelayHealth health;             /// Telemetría del relé
+        uint16_t crc;                   /// CRC-16 de la telemetría
+    };
+
+
+    /** Perfil de la corriente de pico en el encendido de un relé */
+    struct InrushProfile{
+        uint8_t slots;                      /// Duración del pico en semiciclos
+        uint16_t weight;                    /// Peso del pico
+    };
+
+
+    /** Estado del modo ráfaga de un relé, actualizado desde la ISR del zerocross. Las posiciones y duraciones se
+     *  expresan en flancos activos del zerocross */
+    struct BurstState{
+        bool active;                        /// Indica si el modo ráfaga está activo
+        bool on;                            /// Último estado solicitado en un flanco
+        volatile bool applied;              /// Último estado conmutado en el relé (lo escribe isrBurstCb)
+        uint16_t dutyPerMil;                /// Ciclo de trabajo solicitado (tanto por mil)
+        uint16_t periodEdges;               /// Duración del periodo
+        uint16_t minEdges;                  /// Mínimo de flancos consecutivos en On o en Off
+        uint8_t edgesPerCycle;              /// Flancos activos por ciclo de red
+        uint16_t pos;                       /// Posición en el periodo en curso
+        uint16_t periodOnEdges;             /// Flancos en On del periodo en curso
+        int32_t carry;                      /// Error acumulado (flancos x 1000)
+        uint32_t onEdges;                   /// Flancos en On desde el inicio
+        uint32_t totalEdges;                /// Flancos desde el inicio
+    };
+
+
+    /** Instantánea del estado de un relé, escrita únicamente por la tarea. Mantiene dos copias y un contador cuyo
+     *  bit de menor peso indica la copia estable, de forma que los lectores nunca bloquean ni esperan a la tarea */
+    struct RelaySnapshot{
+        volatile uint32_t seq;                  /// Contador de actualizaciones
+        Blob::RlyManRelayStat_t buf[2];         /// Copias
+    };
+
+
+    /** Entrada de lectura del contacto de un relé y registro circular de sus flancos, escrito desde ISR. 'count'
+     *  cuenta todos los flancos registrados, de forma que el lector detecta los que se han sobrescrito */
+    struct FdbSense{
+        InterruptIn in;                     /// Entrada del contacto
+        uint32_t ts[FdbRingSize];           /// Instante de cada flanco
+        uint8_t level[FdbRingSize];         /// Nivel de la entrada tras cada flanco
+        volatile uint32_t count;            /// Flancos registrados desde la instalación
+        uint32_t mark;                      /// Flancos registrados al iniciar el lote en curso
+        uint32_t overruns;                  /// Conmutaciones sin medida por flancos sobrescritos
+        FdbSense(PinName pin) : in(pin), count(0), mark(0), overruns(0){}
+    };
+
+
+    /** Estimación del retardo óptimo de conmutación (On u Off) de un relé */
+    struct CalEstimate{
+        float delayUs;                      /// Retardo óptimo estimado
+        float var;                          /// Varianza de la estimación (us^2)
+        uint16_t samples;                   /// Medidas aceptadas
+        uint16_t outliers;                  /// Medidas anómalas descartadas
+        uint8_t consecutiveOutliers;        /// Medidas anómalas consecutivas
+    };
+
+
+    /** Estimaciones de calibración de un relé */
+    struct RelayCal{
+        CalEstimate on;                     /// Retardo de On
+        CalEstimate off;                    /// Retardo de Off
+    };
+
+
+    /** Estructura de datos que facilita el manejo de los eventos y estados relativos a cada relé
      *
      */
     struct RelayHandler{
-        Relay* relay;               /// Rel asociado
+        Relay* relay;               /// Relé asociado
         RelayFeedback* fdb;			/// Feedback asociado
-        Config_t cfg;				/// Parmetros de configuracin del rel
+        FdbSense* sense;			/// Lectura directa del contacto (NULL si no se utiliza)
+        Config_t cfg;				/// Parámetros de configuración del relé
+        Timeout sw_tmr;				/// Temporizador one-shot que ejecuta la conmutación tras el zerocross
+        RelayManager* owner;		/// Gestor propietario (accesible desde la callback del temporizador)
+        Blob::RlyManEvtFlags action;	/// Acción asignada en el lote en curso (0 si no participa)
+        bool grouped;				/// Indica si la acción forma parte de una acción en grupo
+        Blob::RlyManEvtFlags pending;	/// Acción aceptada pendiente del siguiente lote (0 si no hay)
+        bool pending_grouped;		/// Indica si la acción pendiente forma parte de una acción en grupo
+        uint32_t pending_ts;		/// Instante de recepción del comando pendiente
+        uint32_t action_ts;			/// Instante de recepción del comando en curso
+        uint32_t pending_deq;		/// Instante de extracción de la cola del comando pendiente
+        uint32_t deq_ts;			/// Instante de extracción de la cola del comando en curso
+        uint32_t zc_ts;				/// Paso por cero de referencia de la conmutación en curso
+#if RELAYMANAGER_RELAY_PERF
+        RelayPerf perf;				/// Medidas de rendimiento
+#endif
+        RelayCal cal;				/// Estimaciones de la calibración adaptativa
+        Config_t saved_cfg;			/// Última configuración grabada en memoria NV
+        bool dirty;					/// Indica si hay cambios pendientes de grabar
+        Blob::RlyManEvtFlags state;	/// Último estado aplicado (0 si aún se desconoce)
+        volatile bool armed;		/// Indica si el temporizador de conmutación del lote está programado
+        InrushProfile inrush;		/// Perfil de la corriente de pico en el encendido
+        uint8_t slot;				/// Semiciclo asignado a la conmutación en el lote en curso
+        BurstState burst;			/// Estado del modo ráfaga
+        RelayFeedback::Status fdb_status;	/// Resultado del último feedback
+        uint32_t t_on_us;			/// Tiempo de ON del último feedback
+        uint32_t t_off_us;			/// Tiempo de OFF del último feedback
+        uint32_t t_sc_us;			/// Duración del semiciclo del último feedback
+        volatile uint32_t switches;	/// Número de conmutaciones realizadas
+        volatile uint32_t sw_ts;	/// Instante de la última conmutación
+        RelaySnapshot snap;			/// Instantánea para los lectores
+        uint8_t phase_req;			/// Fase solicitada antes del arranque (NoPhaseRequest si no se ha solicitado)
+        RelayHealth health;			/// Telemetría de desgaste y calidad de conmutación
+        bool fdb_armed;				/// Indica si la captura del feedback está en marcha para el lote en curso
+    };
+
+    /** Caminos del lote especializados en compilación según haya sincronización con el zerocross (propio o de un hub)
+     *  y feedback. Cada variante utiliza una tabla constante, de forma que el enlazador descarta los caminos que no
+     *  utiliza y los que utiliza no comprueban en cada lote si hay zerocross o feedback */
+    struct HotPaths{
+        void (RelayManager::*startSync)();          /// Activa la sincronización con el zerocross en el arranque
+        void (RelayManager::*startBatch)();         /// Inicia un lote
+        void (RelayManager::*awaitZerocross)();     /// Programa las conmutaciones del lote
+        void (RelayManager::*completeBatch)();      /// Finaliza el lote
+        bool feedback;                              /// Indica si se admite feedback
+    };
+
+
+    /** Obtiene la tabla de caminos de una variante
+     *  @return Tabla constante
+     */
+    template <bool Sync, bool Fdb>
+    static const HotPaths* hotPaths(){
+        static const HotPaths paths = {&RelayManager::startSyncImpl<Sync>, &RelayManager::startBatchImpl<Fdb>,
+                                       &RelayManager::awaitZerocrossImpl<Sync>, &RelayManager::completeBatchImpl<Fdb>, Fdb};
+        return &paths;
+    }
+
+
+    /** Almacenamiento estático de la lista de relés de las variantes de tamaño fijo */
+    template <uint8_t N>
+    struct HandlerStorage{
+        RelayHandler handlers[N];
     };
 
-    /** Variables de flags de estado */
-    Flags _flags;
 
-    /** Nmero de rels controlables por este componente */
+    /** Almacenamiento estático del zerocross de las variantes de tamaño fijo */
+    struct ZerocrossStorage{
+        Zerocross zcross;
+        ZerocrossStorage(PinName pin) : zcross(pin){}
+    };
+
+    /** Número de relés controlables por este componente */
     uint8_t		_max_num_relays;
 
-    /** Lista de rels */
+    /** Lista de relés */
     RelayHandler *_relay_list;
 
-    /** Manejador del zerocross, flanco activo */
+    /** Manejador del zerocross propio y flanco activo, o hub de zerocross compartido (NULL si no se utilizan) */
     Zerocross *_zc;
     Zerocross::LogicLevel _zc_level;
+    ZerocrossHub* _hub;
+
+    /** Caminos del lote de la variante */
+    const HotPaths* _paths;
     
     /** Callback para testear los flancos de zerocross en los que se inician las conmutaciones */
     Callback<void()> _zc_test_cb;
 
-    /** Semforo para sincronizar acciones pendientes */
-    Semaphore _sem{0, 1};
-
-    /** Accin en curso */
+    /** Acción notificada en la última publicación */
     Blob::RlyManAction_t _curr_action;
 
-    /** Timer asociado a los retardos en la conmutacin para ajuste al zerocross */
-    Timer _delay_tmr;
+    /** Etapa del lote en curso */
+    ActionStage _stage;
+
+    /** Número de acciones incluidas en el lote en curso */
+    uint8_t _batch_count;
+
+    /** Flag para indicar si el lote en curso incluye alguna acción de On */
+    bool _batch_has_on;
+
+    /** Número de conmutaciones del lote pendientes de ejecutar por los temporizadores */
+    volatile uint8_t _batch_pending;
+
+    /** Número de relés con acciones pendientes del siguiente lote */
+    uint8_t _pending_count;
+
+    /** Comandos retenidos en orden de llegada, por afectar a relés que ya tienen una acción pendiente */
+    PendingCmd _backlog[MaxQueueMessages];
+    uint8_t _backlog_head;
+    uint8_t _backlog_count;
+
+    /** Temporizador de las etapas del lote y evento que postea al vencer */
+    Timeout _stage_tmr;
+    uint32_t _stage_evt;
+
+    /** Eventos pendientes posteados desde ISR y mensaje de aviso utilizado para despertar a la tarea */
+    volatile uint32_t _isr_events;
+    State::Msg _evt_token;
+
+    /** Mensaje utilizado para despachar los eventos ISR y evento interno pendiente de despachar */
+    State::Msg _isr_msg;
+    State::Msg* _internal_msg;
+
+    /** Mensaje de comando alojado en el pool estático: mensaje de la máquina de estados y sus datos */
+    struct CmdMsg{
+        State::Msg msg;                             /// Mensaje (debe ser el primer miembro)
+        uint32_t ts;                                /// Instante de recepción (us)
+        union{
+            Blob::RlyManAction_t action;            /// Acción individual
+            Blob::RlyManGroupAction_t group;        /// Acción en grupo
+            Blob::RlyManBurstAction_t burst;        /// Configuración del modo ráfaga
+            Blob::RlyManTimedAction_t timed;        /// Acción temporizada
+            uint8_t id;                             /// Relé consultado en get/perf
+        }data;
+    };
+
+    /** Pool estático de mensajes de comando, máscara de slots libres y contadores */
+    CmdMsg _cmd_pool[MaxQueueMessages];
+    volatile uint32_t _cmd_free;
+    PoolStats _pool_stats;
+
+    /** Contadores de acciones agrupadas y redundantes */
+    CmdStats _cmd_stats;
+
+    /** Límite de la suma de corrientes de pico en los encendidos (0: sin límite) */
+    uint32_t _inrush_budget;
+
+    /** Estado del modo ráfaga notificado */
+    Blob::RlyManBurstStat_t _burst_stat;
+
+    /** Desconexión de emergencia: relés solicitados aún no atendidos y el instante de la primera solicitud,
+     *  relés en desconexión y los que estaban encendidos, desconexiones aún no realizadas, instante de la solicitud
+     *  en curso, resultado y contadores */
+    volatile uint32_t _shed_req;
+    uint32_t _shed_req_ts;
+    uint32_t _shed_active;
+    uint32_t _shed_on;
+    volatile uint8_t _shed_pending;
+    uint32_t _shed_ts;
+    Blob::RlyManShedAction_t _shed_stat;
+    ShedStats _shed_stats;
+
+    /** Instante de inicio del lote en curso y activación del feedback */
+    uint32_t _batch_arm_us;
+
+    /** Indica si el lote en curso se ha programado sin sincronizar con el zerocross */
+    bool _batch_unsync;
+
+    /** Supervisión del zerocross: temporizador de supervisión y estado notificado */
+    Timeout _zc_wdt;
+    Blob::RlyManSyncStat_t _sync_stat;
+
+    /** Acción temporizada programada. Cada acción ocupa la entrada de la rueda de su mismo índice */
+    struct TimedAction{
+        Blob::RlyManTimedAction_t action;   /// Acción solicitada
+        uint32_t startTick;                 /// Tick del último inicio, base de la reversión y de la repetición
+        uint16_t remaining;                 /// Ejecuciones restantes con repetición limitada
+        bool reverting;                     /// Indica si el siguiente vencimiento es la reversión
+    };
+
+    /** Acciones temporizadas: acciones, entradas y rueda de temporización, temporizador del tick, instante del
+     *  último tick procesado y contadores */
+    TimedAction _timed[MaxTimedActions];
+    TimerWheel::Node _timed_nodes[MaxTimedActions];
+    TimerWheel _timed_wheel;
+    Timeout _timed_tmr;
+    uint32_t _timed_last_us;
+    TimedStats _timed_stats;
+
+    /** Resultado agregado de las acciones en grupo del lote en curso */
+    Blob::RlyManGroupAction_t _group_stat;
+
+    /** Topics utilizados en suscripciones y publicaciones, construidos una única vez en el arranque */
+    struct Topics{
+        char* subSet;               /// set/+/$BASE
+        char* subGet;               /// get/+/$BASE
+        char* statValue;            /// stat/value/$BASE
+        char* statFdbk;             /// stat/fdbk/$BASE
+        char* statSnap;             /// stat/snap/$BASE
+        char* statGroup;            /// stat/group/$BASE
+        char* statShed;             /// stat/shed/$BASE
+        char* statBurst;            /// stat/burst/$BASE
+        char* statPerf;             /// stat/perf/$BASE
+        char* statTrace;            /// stat/trace/$BASE
+        char* statSync;             /// stat/sync/$BASE
+        char* statHealth;           /// stat/health/$BASE
+    };
+    Topics _topics;
+
+    /** Estimador de red (PLL software) alimentado por las marcas de tiempo de los flancos del zerocross */
+    struct MainsPll{
+        uint32_t edgeUs;                /// Instante estimado del último flanco aceptado
+        uint32_t periodUs;              /// Periodo estimado entre flancos activos (0 si no hay estimación)
+        uint32_t rejectedEdges;         /// Número total de flancos espurios rechazados
+        int32_t jitterUs;               /// Error de fase medio de los flancos aceptados
+        uint8_t goodEdges;              /// Flancos aceptados desde el último reinicio (saturado a PllLockEdges)
+        uint8_t consecutiveRejects;     /// Rechazos consecutivos
+        bool hasEdge;                   /// Indica si hay un flanco de referencia
+    };
+
+
+    /** Sincronización con una fase del zerocross. Los relés se indexan por fase (máscaras de bits por identificador),
+     *  de forma que cada flanco sólo recorre los relés de su fase con acciones pendientes */
+    struct PhaseSync{
+        MainsPll pll;                   /// Estimador de red de la fase
+        uint8_t edgesPerCycle;          /// Flancos activos por ciclo de red
+        volatile uint32_t flags;        /// Operaciones pendientes del siguiente flanco (Flags)
+        volatile uint32_t pending;      /// Relés del lote en curso pendientes del siguiente flanco
+        volatile uint32_t shed;         /// Relés en desconexión pendientes del siguiente flanco
+        volatile uint32_t burst;        /// Relés en modo ráfaga
+        volatile uint32_t lastUs;       /// Instante del último flanco recibido
+        volatile bool lost;             /// Pérdida de flancos detectada por la supervisión
+        bool degraded;                  /// Pérdida ya procesada por la tarea
+    };
+    PhaseSync _phases[ZerocrossHub::MaxPhases];
+
+    /** Número de fases sincronizadas (0 si no hay zerocross) */
+    uint8_t _num_phases;
+
+    /** Duración de la recuperación de la configuración en el arranque (us) */
+    uint32_t _restore_us;
+
+    /** Estado de la grabación diferida y temporizador asociado */
+    PersistStats _persist;
+    Timeout _persist_tmr;
+
+    /** Telemetría de salud: temporizador de publicación, conmutaciones totales en la última publicación y en la
+     *  última grabación, y publicaciones desde la última grabación */
+    Timeout _health_tmr;
+    uint32_t _health_reported;
+    uint32_t _health_saved;
+    uint32_t _health_periods;
+
+    /** Medidas de rendimiento globales */
+    struct Perf{
+        uint32_t startUs;                   /// Instante de inicio de las medidas
+        uint32_t commands;                  /// Número de comandos recibidos
+        PerfStat isrTime;                   /// Tiempo de ocupación de la ISR de zerocross al programar conmutaciones
+        uint64_t isrRelays;                 /// Relés recorridos por la ISR de zerocross al programar conmutaciones
+        PerfStat shedLatency;               /// Latencia de las desconexiones de emergencia
+    };
+    Perf _perf;
+
+    /** Respuesta JSON a las consultas en get/perf. Sólo la escribe la tarea, que atiende las consultas recibidas a
+     *  través del pool de comandos, por lo que un único buffer basta aunque las consultas lleguen desde varios hilos */
+    char _phase_json[PhaseJsonSize];
+
+    /** Marca de tiempo (us) del último flanco de zerocross que inició una conmutación */
+    volatile uint32_t _zc_ts_us;
+
+    /** Marca de tiempo (us) de la última conmutación ejecutada por el temporizador */
+    volatile uint32_t _sw_ts_us;
+
+#if defined(RELAYMANAGER_ENABLE_TRACELOG)
+    /** Log binario de trazas: registros y número total de registros reservados (el índice de escritura) */
+    Blob::RlyManTraceRecord_t _trace_buf[TraceLogSize];
+    volatile uint32_t _trace_head;
+#endif
 
 
     /** Interfaz para obtener un evento osEvent de la clase heredera
@@ -184,87 +1069,787 @@ class RelayManager : public ActiveModule {
     virtual osEvent getOsEvent();
 
 
- 	/** Interfaz para manejar los eventos en la mquina de estados por defecto
+ 	/** Interfaz para manejar los eventos en la máquina de estados por defecto
       *  @param se Evento a manejar
       *  @return State::StateResult Resultado del manejo del evento
       */
     virtual State::StateResult Init_EventHandler(State::StateEvent* se);
 
 
- 	/** Callback invocada al recibir una actualizacin de un topic local al que est suscrito
+ 	/** Callback invocada al recibir una actualización de un topic local al que está suscrito
       *  @param topic Identificador del topic
       *  @param msg Mensaje recibido
-      *  @param msg_len Tamao del mensaje
+      *  @param msg_len Tamaño del mensaje
       */
     virtual void subscriptionCb(const char* topic, void* msg, uint16_t msg_len);
 
 
- 	/** Callback invocada al finalizar una publicacin local
+ 	/** Callback invocada al finalizar una publicación local
       *  @param topic Identificador del topic
-      *  @param result Resultado de la publicacin
+      *  @param result Resultado de la publicación
       */
     virtual void publicationCb(const char* topic, int32_t result);
 
 
-   	/** Chequea la integridad de los datos de configuracin <_cfg>. En caso de que algo no sea
+   	/** Chequea la integridad de los datos de configuración <_cfg>. En caso de que algo no sea
    	 * 	coherente, restaura a los valores por defecto y graba en memoria NV.
    	 * 	@return True si la integridad es correcta, False si es incorrecta
 	 */
 	virtual bool checkIntegrity();
 
 
-   	/** Establece la configuracin por defecto grabndola en memoria NV
+   	/** Chequea la integridad de la configuración de un relé
+   	 * 	@param cfg Configuración del relé
+   	 * 	@return True si la integridad es correcta, False si es incorrecta
+	 */
+	bool checkConfig(const Config_t& cfg);
+
+
+   	/** Establece la configuración por defecto grabándola en memoria NV
 	 */
 	virtual void setDefaultConfig();
 
 
-   	/** Recupera la configuracin de memoria NV
+   	/** Establece la configuración por defecto de un relé, sin grabarla
+   	 * 	@param id Identificador del relé
+	 */
+	void setDefaultRelayConfig(uint8_t id);
+
+
+   	/** Recupera la configuración de memoria NV con una única lectura del bloque empaquetado. Los relés cuyos
+   	 * 	datos no superen el chequeo de integridad toman la configuración por defecto de forma individual.
 	 */
 	virtual void restoreConfig();
 
 
-   	/** Graba la configuracin en memoria NV
+   	/** Recupera la configuración del bloque empaquetado versión 1
+   	 *  @return True si existe el bloque versión 1
 	 */
-	virtual void saveConfig();
+	bool restoreConfigV1();
 
 
-	/** Graba un parmetro en la memoria NV
-	 * 	@param param_id Identificador del parmetro
-	 * 	@param data Datos asociados
-	 * 	@param size Tamao de los datos
-	 * 	@param type Tipo de los datos
-	 * 	@return True: xito, False: no se pudo recuperar
+   	/** Recupera la configuración de un bloque empaquetado de la versión actual grabado con otro número de relés. Se
+   	 *  migran los relés comunes y el resto toma la configuración por defecto
+   	 *  @return True si existe el bloque
 	 */
-	virtual bool saveParameter(const char* param_id, void* data, size_t size, NVSInterface::KeyValueType type){
-		return ActiveModule::saveParameter(param_id, data, size, type);
-	}
+	bool restoreConfigResized();
 
 
-	/** Recupera un parmetro de la memoria NV
-	 * 	@param param_id Identificador del parmetro
-	 * 	@param data Receptor de los datos asociados
-	 * 	@param size Tamao de los datos a recibir
-	 * 	@param type Tipo de los datos
-	 * 	@return True: xito, False: no se pudo recuperar
+   	/** Recupera la configuración de las claves individuales por relé de versiones anteriores
 	 */
-	virtual bool restoreParameter(const char* param_id, void* data, size_t size, NVSInterface::KeyValueType type){
-		return ActiveModule::restoreParameter(param_id, data, size, type);
+	void restoreLegacyConfig();
+
+
+   	/** Borra las claves individuales por relé de versiones anteriores, una vez migradas al bloque empaquetado
+	 */
+	void removeLegacyConfig();
+
+
+   	/** Aplica a un relé una configuración de versiones anteriores, o la de por defecto si no es válida
+   	 *  @param id Identificador del relé
+   	 *  @param cfg Configuración
+	 */
+	void setConfigV1(uint8_t id, const ConfigV1_t& cfg);
+
+
+   	/** Graba la configuración en memoria NV
+	 */
+	virtual void saveConfig();
+
+
+   	/** Graba en memoria NV el bloque empaquetado con la configuración de todos los relés
+   	 * 	@return True: éxito, False: error
+	 */
+	bool writeConfigBlob();
+
+
+   	/** Calcula el CRC-16/CCITT de un bloque de datos
+   	 * 	@param data Datos
+   	 * 	@param size Tamaño de los datos
+   	 * 	@return CRC calculado
+	 */
+	static uint16_t crc16(const uint8_t* data, uint32_t size);
+
+
+	/** Graba un parámetro en la memoria NV
+	 * 	@param param_id Identificador del parámetro
+	 * 	@param data Datos asociados
+	 * 	@param size Tamaño de los datos
+	 * 	@param type Tipo de los datos
+	 * 	@return True: éxito, False: no se pudo recuperar
+	 */
+	virtual bool saveParameter(const char* param_id, void* data, size_t size, NVSInterface::KeyValueType type){
+		return ActiveModule::saveParameter(param_id, data, size, type);
+	}
+
+
+	/** Recupera un parámetro de la memoria NV
+	 * 	@param param_id Identificador del parámetro
+	 * 	@param data Receptor de los datos asociados
+	 * 	@param size Tamaño de los datos a recibir
+	 * 	@param type Tipo de los datos
+	 * 	@return True: éxito, False: no se pudo recuperar
+	 */
+	virtual bool restoreParameter(const char* param_id, void* data, size_t size, NVSInterface::KeyValueType type){
+		return ActiveModule::restoreParameter(param_id, data, size, type);
 	}
     
 
-	/** Callback invocada al recibir un evento de zerocross. Se ejecuta en contexto ISR. Se deber actuar sobre los
-     *  rels lo ms rpidamente posible, para estar sincronizado con el zc.
+	/** Callback invocada al recibir un evento del zerocross propio. Se ejecuta en contexto ISR. Toma la marca de
+     *  tiempo del flanco y lo procesa como un flanco de la fase 0.
      *
-     *  @param level Identificador del flanco activo en el zerocross que gener la interrupcin
+     *  @param level Identificador del flanco activo en el zerocross que generó la interrupción
      */
-    void isrZerocrossCb(Zerocross::LogicLevel level);        
-    
+    void isrZerocrossCb(Zerocross::LogicLevel level);
+
+
+	/** Callback invocada en cada flanco de una fase. Se ejecuta en contexto ISR. No realiza esperas, sólo
+     *  actualiza el estimador de red de la fase y, si hay acciones pendientes, programa los temporizadores one-shot
+     *  de los relés de la fase con su retardo calibrado.
+     *
+     *  @param phase Fase
+     *  @param ts Instante del flanco
+     */
+    void isrPhaseEdge(uint8_t phase, uint32_t ts);
+
+
+    /** Programa las conmutaciones del lote en curso respecto de un flanco ya producido
+     *  @param mask Relés a programar
+     *  @param edge_us Instante del flanco
+     *  @param slot_us Duración del semiciclo para el reparto de encendidos
+     */
+    void scheduleBatch(uint32_t mask, uint32_t edge_us, uint32_t slot_us);
+
+
+    /** Programa las conmutaciones del lote en curso respecto del zerocross predicho por el estimador de red,
+     *  en el primer instante de conmutación que aún no ha pasado
+     *  @param mask Relés a programar
+     *  @param now Instante actual
+     *  @param edge_us Último flanco predicho
+     *  @param period_us Periodo estimado
+     */
+    void schedulePredicted(uint32_t mask, uint32_t now, uint32_t edge_us, uint32_t period_us);
+
+
+    /** Obtiene la fase con la que se sincroniza un relé
+     *  @param id Identificador del relé
+     *  @return Fase
+     */
+    uint8_t relayPhase(uint8_t id){
+    	return (_relay_list[id].cfg.phase < _num_phases)? _relay_list[id].cfg.phase : 0;
+    }
+
+
+    /** Actualiza el estimador de red con un nuevo flanco, rechazando los flancos espurios
+     *  @param pll Estimador de la fase
+     *  @param ts Instante del flanco
+     */
+    void pllUpdate(MainsPll& pll, uint32_t ts);
+
+
+    /** Obtiene el último flanco predicho por el estimador de red de una fase
+     *  @param phase Fase
+     *  @param now Instante actual
+     *  @param edge_us Recibe el instante del último flanco predicho (anterior o igual a 'now')
+     *  @param period_us Recibe el periodo estimado
+     *  @return True si el estimador está enganchado y la predicción es válida
+     */
+    bool pllGetLastEdge(uint8_t phase, uint32_t now, uint32_t* edge_us, uint32_t* period_us);
+
+
+    /** Calcula el primer instante de conmutación, respecto del último flanco predicho, que aún no ha pasado
+     *  @param now Instante actual
+     *  @param edge_us Último flanco predicho
+     *  @param delay_us Retardo de conmutación
+     *  @param period_us Periodo estimado
+     *  @return Tiempo hasta la conmutación (us)
+     */
+    int32_t predictFire(uint32_t now, uint32_t edge_us, uint32_t delay_us, uint32_t period_us);
+
+
+	/** Callback invocada al vencer el temporizador de conmutación de un relé. Se ejecuta en contexto ISR y
+     *  realiza la conmutación física del relé. Al completar la última conmutación del lote postea RelayChangedFlag.
+     *
+     *  @param hnd Manejador del relé cuyo temporizador ha vencido
+     */
+    static void isrSwitchCb(RelayHandler* hnd);
+
+
+	/** Callback invocada al vencer el temporizador de apagado de emergencia de un relé. Se ejecuta en contexto
+     *  ISR. Al completar el último apagado postea ShedDoneFlag.
+     *
+     *  @param hnd Manejador del relé cuyo temporizador ha vencido
+     */
+    static void isrShedCb(RelayHandler* hnd);
+
+
+	/** Callbacks invocadas en los flancos de la entrada de feedback de un relé. Se ejecutan en contexto ISR y
+     *  registran el instante y el nivel del flanco en el registro circular
+     *
+     *  @param sense Entrada y registro del relé
+     */
+    static void isrFdbRiseCb(FdbSense* sense);
+    static void isrFdbFallCb(FdbSense* sense);
+
+
+	/** Callback invocada al vencer el tick de la rueda de temporización. Se ejecuta en contexto ISR y postea
+     *  TimedTickFlag.
+     */
+    void isrTimedTickCb();
+
+
+	/** Callback periódica de supervisión del zerocross. Se ejecuta en contexto ISR. Si no se han recibido flancos
+     *  durante ZcLossTimeoutUs, marca la pérdida y postea SyncUpdateFlag.
+     */
+    void isrZcWatchdogCb();
+
+
+	/** Callback invocada al vencer el temporizador de conmutación de un relé en modo ráfaga. Se ejecuta en
+     *  contexto ISR y aplica el último estado calculado.
+     *
+     *  @param hnd Manejador del relé cuyo temporizador ha vencido
+     */
+    static void isrBurstCb(RelayHandler* hnd);
+
 
-    /** Realiza calibracin de los retados de On y Off en funcin de los datos obtenidos del feedback en la ltima
-     *  conmutacin
+	/** Callback invocada al vencer el temporizador de etapa. Se ejecuta en contexto ISR y postea el evento
+     *  asociado a la etapa en curso.
+     */
+    void isrStageTimeoutCb();
+
+
+    /** Postea un evento a la tarea desde cualquier contexto (incluido ISR) sin reservar memoria
+     *  @param flag Evento a postear (MsgEventFlags)
+     */
+    void postIsrEvent(uint32_t flag);
+
+
+    /** Extrae el siguiente evento posteado desde ISR
+     *  @return Evento extraído o 0 si no hay ninguno
+     */
+    uint32_t popIsrEvent();
+
+
+    /** Copia un comando o una consulta recibidos en un mensaje del pool y lo postea en la cola de la tarea. Si el pool está agotado
+     *  o la cola llena, descarta el comando y lo contabiliza en PoolStats.
+     *  @param topic Topic recibido (para las trazas)
+     *  @param sig Señal del mensaje
+     *  @param data Datos del comando
+     *  @param size Tamaño de los datos
+     */
+    void postCmdMsg(const char* topic, uint32_t sig, const void* data, uint16_t size);
+
+
+    /** Reserva sin bloqueo un mensaje del pool de comandos. Puede invocarse desde cualquier contexto.
+     *  @return Mensaje reservado o NULL si el pool está agotado
+     */
+    CmdMsg* allocCmdMsg();
+
+
+    /** Libera un mensaje del pool de comandos
+     *  @param cmd Mensaje a liberar
+     */
+    void freeCmdMsg(CmdMsg* cmd);
+
+
+    /** Chequea si un mensaje pertenece al pool de comandos
+     *  @param msg Mensaje
+     *  @return True si pertenece al pool
+     */
+    bool isCmdMsg(State::Msg* msg);
+
+
+    /** Construye los topics de suscripción y publicación a partir de los topics base
+     */
+    void buildTopics();
+
+
+    /** Reserva y construye un topic
+     *  @param fmt Formato del topic
+     *  @param base Topic base
+     *  @return Topic construido
+     */
+    char* newTopic(const char* fmt, const char* base);
+
+
+    /** Añade una muestra a un acumulador de rendimiento
+     *  @param stat Acumulador
+     *  @param value Muestra
+     */
+    static void perfAdd(PerfStat* stat, uint32_t value);
+
+
+    /** Obtiene un percentil aproximado (límite superior del bucket) de un acumulador de rendimiento
+     *  @param stat Acumulador
+     *  @param pct Percentil (0..100)
+     *  @return Valor del percentil
+     */
+    static uint32_t perfPercentile(const PerfStat& stat, uint8_t pct);
+
+
+    /** Imprime un acumulador de rendimiento en formato JSON
+     *  @param buf Buffer de destino
+     *  @param len Tamaño del buffer
+     *  @param stat Acumulador
+     *  @return Número de caracteres que requiere la impresión
+     */
+    static uint32_t printPerfStat(char* buf, uint32_t len, const PerfStat& stat);
+
+
+    /** Registra el desglose por fases de la latencia de la acción en curso de un relé
+     *  @param hnd Manejador del relé
+     *  @param fdb_us Instante de obtención del resultado del feedback
+     *  @param pub_us Instante de publicación
+     */
+    void perfPhases(RelayHandler* hnd, uint32_t fdb_us, uint32_t pub_us);
+
+
+    /** Programa el temporizador de etapa
+     *  @param flag Evento a postear al vencer
+     *  @param time_ms Tiempo en milisegundos
+     */
+    void armStageTimer(uint32_t flag, uint32_t time_ms);
+
+
+    /** Acepta un comando recibido, dejándolo pendiente del siguiente lote o retenido si afecta a algún relé
+     *  que ya tiene una acción pendiente. Los comandos inválidos se descartan.
+     *  @param msg Mensaje con el comando
+     */
+    void acceptMsg(State::Msg* msg);
+
+
+    /** Acepta un comando, resolviéndolo sin conmutar, agrupándolo con uno anterior, reteniéndolo o dejándolo
+     *  pendiente del siguiente lote. Los comandos inválidos se descartan.
+     *  @param cmd Comando
+     */
+    void acceptCmd(const PendingCmd& cmd);
+
+
+    /** Chequea si un comando es válido
+     *  @param cmd Comando
+     *  @return True si es válido
+     */
+    bool isValidCmd(const PendingCmd& cmd);
+
+
+    /** Chequea si un comando puede quedar pendiente del siguiente lote
+     *  @param cmd Comando
+     *  @return True si ninguno de los relés afectados tiene ya una acción pendiente
+     */
+    bool canBePending(const PendingCmd& cmd);
+
+
+    /** Deja un comando pendiente del siguiente lote
+     *  @param cmd Comando
+     */
+    void setPending(const PendingCmd& cmd);
+
+
+    /** Busca el último comando retenido que afecta a un relé
+     *  @param id Identificador del relé
+     *  @return Posición en la lista de retenidos o -1 si no hay ninguno
+     */
+    int32_t findBacklog(uint8_t id);
+
+
+    /** Resuelve sin conmutar una acción individual si el relé ya está en el estado solicitado y no tiene otras
+     *  acciones en curso, pendientes o retenidas
+     *  @param cmd Comando
+     *  @return True si la acción se ha resuelto
+     */
+    bool skipRedundant(const PendingCmd& cmd);
+
+
+    /** Sustituye la última acción individual pendiente o retenida sobre el mismo relé (gana la última)
+     *  @param cmd Comando
+     *  @return True si la acción se ha agrupado con una anterior
+     */
+    bool coalesceCmd(const PendingCmd& cmd);
+
+
+    /** Notifica una acción resuelta sin conmutar
+     *  @param id Identificador del relé
+     *  @param action Acción solicitada
+     *  @param grouped Indica si forma parte de una acción en grupo (se notifica de forma agregada)
+     *  @param ts Instante de recepción del comando
+     */
+    void notifySkipped(uint8_t id, Blob::RlyManEvtFlags action, bool grouped, uint32_t ts);
+
+
+    /** Publica el resultado agregado de las acciones en grupo, si lo hay
+     */
+    void publishGroupStat();
+
+
+    /** Arma la captura del driver de feedback de un relé para la acción del lote en curso según su estado: tras un
+     *  On la reanuda, conservando la medida del On, en otro caso inicia una nueva captura. Se detiene al obtener el
+     *  resultado, de forma que sólo está en marcha durante el lote.
+     *  @param id Identificador del relé
+     */
+    void armFeedback(uint8_t id);
+
+
+    /** Extrae del registro de flancos de la entrada de feedback el resultado de la conmutación en curso: el primer
+     *  cambio del contacto hacia el estado de la acción posterior a la orden (descartando rebotes), respecto del paso
+     *  por cero de referencia y del semiciclo estimado de su fase. Sólo actualiza el tiempo (Ton o Toff) de la acción.
+     *  Si se han sobrescrito flancos desde el inicio del lote, no hay medida y se contabiliza el desbordamiento
+     *  @param id Identificador del relé
+     *  @param t_on_us Recibe el tiempo de ON en microseg
+     *  @param t_off_us Recibe el tiempo de OFF en microseg
+     *  @param t_sc_us Recibe el tiempo del semiciclo en microseg (0 si no hay medida)
+     *  @return Status con los flags de resultado
      */
-    void feedbackUpdate();
+    RelayFeedback::Status senseResult(uint8_t id, uint32_t* t_on_us, uint32_t* t_off_us, uint32_t* t_sc_us);
 
+
+    /** Asigna a cada encendido del lote el semiciclo en el que conmutará, de forma que la suma de los picos no
+     *  supere el límite establecido. Los apagados conmutan siempre en el primer semiciclo.
+     */
+    void planInrush();
+
+
+    /** Configura o finaliza el modo ráfaga de un relé
+     *  @param cmd Configuración solicitada
+     */
+    void setBurst(const Blob::RlyManBurstAction_t& cmd);
+
+
+    /** Detiene el modo ráfaga de un relé, cancelando la conmutación programada
+     *  @param id Identificador del relé
+     */
+    void stopBurst(uint8_t id);
+
+
+    /** Obtiene el estado notificable del modo ráfaga
+     *  @param id Identificador del relé
+     *  @param burst Estado del modo ráfaga
+     *  @param stat Recibe el estado notificable
+     */
+    void burstStat(uint8_t id, const BurstState& burst, Blob::RlyManBurstStat_t* stat);
+
+
+    /** Publica el estado del modo ráfaga de un relé
+     *  @param id Identificador del relé
+     */
+    void publishBurstStat(uint8_t id);
+
+
+    /** Publica en stat/perf el desglose por fases de la latencia de un relé. Sólo se invoca desde la tarea
+     *  @param id Identificador del relé
+     */
+    void publishPhaseJson(uint8_t id);
+
+#if defined(RELAYMANAGER_ENABLE_TRACELOG)
+    /** Añade un registro al log binario de trazas. No bloquea y puede invocarse desde contexto ISR: la posición
+     *  se reserva de forma atómica y, si el log está lleno, sobrescribe el registro más antiguo.
+     *  @param evt Evento (Blob::RlyManTraceEvent)
+     *  @param id Identificador del relé (0xFF si no aplica)
+     *  @param arg0 Primer argumento
+     *  @param arg1 Segundo argumento
+     */
+    void traceLog(uint8_t evt, uint8_t id, uint32_t arg0, uint32_t arg1);
+#endif
+
+
+    /** Avanza los relés en modo ráfaga de una fase en un flanco del zerocross, programando sus conmutaciones. Se
+     *  ejecuta en contexto ISR.
+     *  @param phase Fase
+     *  @param edge_us Instante del flanco
+     */
+    void burstUpdate(uint8_t phase, uint32_t edge_us);
+
+
+    /** Actualiza la instantánea de un relé con su estado actual
+     *  @param id Identificador del relé
+     */
+    void updateSnapshot(uint8_t id);
+
+
+    /** Inicia la desconexión de emergencia solicitada, si no hay otra en curso
+     */
+    void startShed();
+
+
+    /** Descarta las acciones pendientes y retenidas sobre los relés indicados
+     *  @param mask Máscara de relés
+     */
+    void dropActions(uint32_t mask);
+
+
+    /** Retira del lote en curso los relés indicados, cancelando sus conmutaciones aún no realizadas. Si el lote
+     *  queda vacío antes de conmutar, se aborta.
+     *  @param mask Máscara de relés
+     */
+    void preemptBatch(uint32_t mask);
+
+
+    /** Programa el apagado de relés en desconexión respecto de un flanco de zerocross
+     *  @param mask Relés a programar
+     *  @param edge_us Instante del flanco (real, o predicho si period_us != 0)
+     *  @param period_us Periodo estimado para programar sobre el flanco predicho, o 0 si el flanco es real
+     */
+    void scheduleShed(uint32_t mask, uint32_t edge_us, uint32_t period_us);
+
+
+    /** Programa, sustituye o cancela una acción temporizada
+     *  @param cmd Acción temporizada
+     */
+    void setTimed(const Blob::RlyManTimedAction_t& cmd);
+
+
+    /** Avanza la rueda de temporización hasta el instante actual, aceptando como comandos las acciones vencidas y
+     *  reprogramando sus reversiones y repeticiones
+     */
+    void timedUpdate();
+
+
+    /** Programa el temporizador del siguiente tick de la rueda, o lo detiene si no hay acciones programadas
+     */
+    void timedArm();
+
+
+    /** Convierte un tiempo a ticks de la rueda de temporización, redondeando al alza
+     *  @param time_ms Tiempo en milisegundos
+     *  @return Ticks
+     */
+    static uint32_t timedTicks(uint32_t time_ms){
+    	return (time_ms + TimedTickMs - 1) / TimedTickMs;
+    }
+
+
+    /** Procesa un cambio en la sincronización con el zerocross. Al perderse, programa sin sincronizar las acciones
+     *  y desconexiones que esperaban un flanco y finaliza el modo ráfaga. Notifica el nuevo estado.
+     */
+    void updateSync();
+
+
+    /** Finaliza la desconexión de emergencia registrando su latencia y publicando el resultado
+     */
+    void completeShed();
+
+
+    /** Extrae sin bloqueo los comandos encolados y los acepta
+     */
+    void collectCommands();
+
+
+    /** Activa los eventos del zerocross propio o la suscripción a las fases del hub, y su supervisión. Sin
+     *  sincronización no hace nada.
+     */
+    template <bool Sync>
+    void startSyncImpl();
+
+
+    /** Inicia un nuevo lote con las acciones pendientes, si no hay otro en curso, por el camino de la variante
+     */
+    void startBatch(){
+    	(this->*_paths->startBatch)();
+    }
+
+
+    /** Inicia un nuevo lote con las acciones pendientes, si no hay otro en curso. Con feedback, lo activa en los
+     *  relés del lote y programa la espera de pre-captura si algún driver la requiere.
+     */
+    template <bool Fdb>
+    void startBatchImpl();
+
+
+    /** Programa las conmutaciones del lote en curso por el camino de la variante
+     */
+    void awaitZerocross(){
+    	(this->*_paths->awaitZerocross)();
+    }
+
+
+    /** Programa las conmutaciones del lote en curso: con sincronización, sobre el paso por cero predicho o el
+     *  siguiente flanco de la fase de cada relé. Sin ella, tras el retardo desde este instante.
+     */
+    template <bool Sync>
+    void awaitZerocrossImpl();
+
+
+    /** Inicia la espera del pico de corriente tras las conmutaciones del lote
+     */
+    void startInrush();
+
+
+    /** Finaliza el lote en curso por el camino de la variante
+     */
+    void completeBatch(){
+    	(this->*_paths->completeBatch)();
+    }
+
+
+    /** Finaliza el lote en curso: con feedback, lo detiene y calibra los retardos. Publica los resultados
+     */
+    template <bool Fdb>
+    void completeBatchImpl();
+
+
+    /** Realiza calibración de los retados de On y Off en función de los datos obtenidos del feedback en la última
+     *  conmutación
+     *  @param id Identificador del relé
+     */
+    void feedbackUpdate(uint8_t id);
+
+
+    /** Marca la configuración de un relé como pendiente de grabar, si el cambio respecto de la configuración
+     *  grabada supera el umbral
+     *  @param id Identificador del relé
+     */
+    void markDirty(uint8_t id);
+
+
+    /** Programa el temporizador de la grabación diferida: tras un tiempo en reposo o al vencer el plazo máximo,
+     *  respetando el intervalo mínimo entre grabaciones
+     */
+    void schedulePersist();
+
+
+    /** Graba en memoria NV las configuraciones pendientes
+     */
+    void flushConfig();
+
+
+	/** Callback invocada al vencer el temporizador de la grabación diferida. Se ejecuta en contexto ISR.
+     */
+    void isrPersistTimeoutCb();
+
+
+	/** Callback invocada al vencer el periodo de publicación de la telemetría de salud. Se ejecuta en contexto ISR.
+     */
+    void isrHealthTimeoutCb();
+
+
+    /** Registra en la telemetría de salud el error de fase de una conmutación sincronizada
+     *  @param id Identificador del relé
+     *  @param on True si la conmutación es de On
+     *  @param err_us Error de fase medido (positivo si el contacto conmutó tarde)
+     */
+    void healthRecord(uint8_t id, bool on, int32_t err_us);
+
+
+    /** Publica la telemetría de salud de todos los relés si ha habido conmutaciones desde la publicación
+     *  anterior, grabándola cada HealthPersistPeriods publicaciones
+     */
+    void healthReport();
+
+
+    /** Recupera la telemetría de salud de memoria NV. Los relés sin telemetría válida parten de cero, con los
+     *  retardos recuperados como referencia de la deriva
+     */
+    void restoreHealth();
+
+
+    /** Graba la telemetría de salud de todos los relés en memoria NV
+     *  @return True si se ha grabado correctamente
+     */
+    bool saveHealth();
+
+
+    /** Obtiene el número total de conmutaciones de todos los relés, acumuladas y del arranque en curso
+     *  @return Conmutaciones
+     */
+    uint32_t healthOperations();
+
+
+    /** Actualiza la estimación del retardo óptimo con el error de fase medido y aplica el nuevo retardo con
+     *  un paso acotado
+     *  @param est Estimación a actualizar
+     *  @param delay_us Retardo aplicado, recibe el nuevo retardo
+     *  @param err_us Error de fase medido (positivo si el contacto conmutó tarde)
+     *  @param tsc Duración del semiciclo
+     *  @return True si se ha modificado el retardo
+     */
+    bool calUpdate(CalEstimate* est, uint32_t* delay_us, int32_t err_us, uint32_t tsc);
+
+
+    /** Crea un manejador de relés sobre un almacenamiento proporcionado externamente, utilizado por las
+     *  variantes de tamaño fijo (StaticRelayManager)
+     *  @param relay_list Lista de relés, con capacidad para 'num_relays'
+     *  @param num_relays Número máximo de relés
+     *  @param zc Zerocross o NULL si no hay control de zerocross
+     *  @param zc_level Nivel de activación de eventos del zerocross (flancos activos)
+     *  @param hub Hub de zerocross compartido o NULL si no se utiliza
+     *  @param paths Caminos del lote de la variante
+     * 	@param fs Objeto FSManager para operaciones de backup
+     * 	@param defdbg Flag para habilitar depuración por defecto
+     * 	@param stack_size Tamaño de la pila de la tarea asociada
+     */
+    RelayManager(RelayHandler* relay_list, uint8_t num_relays, Zerocross* zc, Zerocross::LogicLevel zc_level, ZerocrossHub* hub, const HotPaths* paths, FSManager* fs, bool defdbg, uint32_t stack_size);
+
+
+    /** Inicializa el estado del gestor, común a todos los constructores
+     *  @param relay_list Lista de relés
+     *  @param num_relays Número máximo de relés
+     *  @param zc Zerocross o NULL si no hay control de zerocross
+     *  @param zc_level Nivel de activación de eventos del zerocross (flancos activos)
+     *  @param hub Hub de zerocross compartido o NULL si no se utiliza
+     *  @param paths Caminos del lote de la variante
+     */
+    void init(RelayHandler* relay_list, uint8_t num_relays, Zerocross* zc, Zerocross::LogicLevel zc_level, ZerocrossHub* hub, const HotPaths* paths);
+
+};
+
+
+/** Variante de RelayManager con número de relés fijado en compilación. La lista de relés y el zerocross se
+ *  alojan junto al propio objeto, sin reservas en heap, y el tamaño de pila de la tarea se fija también en
+ *  compilación, de forma que el consumo de memoria queda determinado (sizeof(StaticRelayManager<N, Z>) + StackSize).
+ *
+ *  Los caminos del lote se especializan en compilación según haya sincronización (zerocross propio o hub) y
+ *  feedback (HasFeedback), de forma que no comprueban en cada lote si hay zerocross o feedback y el enlazador
+ *  descarta los que la variante no utiliza. Sin feedback, addRelayHandler rechaza los relés con feedback.
+ *
+ *  El almacenamiento se hereda antes que RelayManager para que esté construido cuando éste lo inicializa.
+ *
+ *  Ej: StaticRelayManager<4, true> rlyman(PA_0, Zerocross::EdgeActiveAreBoth, fs);
+ *      StaticRelayManager<2, false, 2048, false> rlyman_nozc(fs);
+ */
+template <uint8_t NumRelays, bool HasZerocross, uint32_t StackSize = RelayManager::DefaultStackSize, bool HasFeedback = true>
+class StaticRelayManager;
+
+
+/** Variante con control de zerocross */
+template <uint8_t NumRelays, uint32_t StackSize, bool HasFeedback>
+class StaticRelayManager<NumRelays, true, StackSize, HasFeedback> : private RelayManager::HandlerStorage<NumRelays>, private RelayManager::ZerocrossStorage, public RelayManager {
+  public:
+    MBED_STATIC_ASSERT(NumRelays > 0 && NumRelays <= RelayManager::MaxGroupRelays, "NumRelays fuera de rango");
+
+    /** Crea un manejador de relés con zerocross
+     *  @param zc Entrada de zerocross
+     *  @param zc_level Nivel de activación de eventos del zerocross (flancos activos)
+     * 	@param fs Objeto FSManager para operaciones de backup
+     * 	@param defdbg Flag para habilitar depuración por defecto
+     */
+    StaticRelayManager(PinName zc, Zerocross::LogicLevel zc_level, FSManager* fs, bool defdbg = false) :
+        RelayManager::HandlerStorage<NumRelays>(),
+        RelayManager::ZerocrossStorage(zc),
+        RelayManager(this->handlers, NumRelays, &this->zcross, zc_level, NULL, RelayManager::hotPaths<true, HasFeedback>(), fs, defdbg, StackSize){}
+};
+
+
+/** Variante sin zerocross propio: sin control de zerocross o sincronizada con un hub de zerocross compartido */
+template <uint8_t NumRelays, uint32_t StackSize, bool HasFeedback>
+class StaticRelayManager<NumRelays, false, StackSize, HasFeedback> : private RelayManager::HandlerStorage<NumRelays>, public RelayManager {
+  public:
+    MBED_STATIC_ASSERT(NumRelays > 0 && NumRelays <= RelayManager::MaxGroupRelays, "NumRelays fuera de rango");
+
+    /** Crea un manejador de relés sin zerocross
+     * 	@param fs Objeto FSManager para operaciones de backup
+     * 	@param defdbg Flag para habilitar depuración por defecto
+     */
+    StaticRelayManager(FSManager* fs, bool defdbg = false) :
+        RelayManager::HandlerStorage<NumRelays>(),
+        RelayManager(this->handlers, NumRelays, NULL, (Zerocross::LogicLevel)0, NULL, RelayManager::hotPaths<false, HasFeedback>(), fs, defdbg, StackSize){}
+
+    /** Crea un manejador de relés sincronizado con un hub de zerocross compartido
+     *  @param hub Hub de zerocross
+     * 	@param fs Objeto FSManager para operaciones de backup
+     * 	@param defdbg Flag para habilitar depuración por defecto
+     */
+    StaticRelayManager(ZerocrossHub* hub, FSManager* fs, bool defdbg = false) :
+        RelayManager::HandlerStorage<NumRelays>(),
+        RelayManager(this->handlers, NumRelays, NULL, (Zerocross::LogicLevel)0, hub, RelayManager::hotPaths<true, HasFeedback>(), fs, defdbg, StackSize){}
 };
      
 #endif /*__RelayManager__H */
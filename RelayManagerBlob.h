@@ -4,9 +4,9 @@
  *  Created on: Ene 2018
  *      Author: raulMrello
  *
- *	RelayManagerBlob es el componente del mdulo RelayManager en el que se definen los objetos y tipos relativos a
- *	los objetos BLOB de este mdulo.
- *	Todos los tipos definidos en este componente estn asociados al namespace "Blob", de forma que puedan ser
+ *	RelayManagerBlob es el componente del módulo RelayManager en el que se definen los objetos y tipos relativos a
+ *	los objetos BLOB de este módulo.
+ *	Todos los tipos definidos en este componente están asociados al namespace "Blob", de forma que puedan ser
  *	accesibles mediante el uso de: "Blob::"  e importando este archivo de cabecera.
  */
  
@@ -23,15 +23,15 @@ namespace Blob {
  /** Flags de evento que utiliza RelayManager para notificar un cambio de estado
   */
  enum RlyManEvtFlags{
-	 RlyManOff  	= (1 << 0),		//!< Evento al cambiar un rel a Off
-	 RlyManOn 		= (1 << 1),		//!< Evento al cambiar un rel a On
+	 RlyManOff  	= (1 << 0),		//!< Evento al cambiar un relé a Off
+	 RlyManOn 		= (1 << 1),		//!< Evento al cambiar un relé a On
  };
 
 
  /** Estructura de datos para la solicitud de acciones
   * 	Se forma por:
-  * 	@var id Identificador del rel sobre el que actuar
-  * 	@var request Accin a realizar
+  * 	@var id Identificador del relé sobre el que actuar
+  * 	@var request Acción a realizar
   */
 struct __packed RlyManAction_t{
  	uint8_t id;
@@ -39,6 +39,240 @@ struct __packed RlyManAction_t{
  };
 
 
+ /** Estructura de datos para la solicitud de acciones en grupo, aplicadas de forma atómica en el mismo
+  *  flanco de zerocross. El bit 'n' de cada máscara corresponde al relé con identificador 'n'.
+  * 	Se forma por:
+  * 	@var onMask Máscara de relés a encender
+  * 	@var offMask Máscara de relés a apagar
+  */
+struct __packed RlyManGroupAction_t{
+ 	uint32_t onMask;
+ 	uint32_t offMask;
+ };
+
+
+ /** Estructura de datos para la solicitud de desconexiones de emergencia, con prioridad sobre el resto de acciones.
+  *  Se aplica en el siguiente paso por cero, interrumpiendo las acciones en curso sobre los relés afectados. El bit 'n'
+  *  corresponde al relé con identificador 'n' (0xFFFFFFFF desconecta todos los relés).
+  * 	Se forma por:
+  * 	@var offMask Máscara de relés a apagar
+  */
+struct __packed RlyManShedAction_t{
+ 	uint32_t offMask;
+ };
+
+
+ /** Estructura de datos con el estado de un relé, su último resultado de feedback y su calibración. Se entrega como
+  *  respuesta a las consultas en $BASE/fdbk/get (la consulta es el identificador del relé, uint8_t), publicada en
+  *  $BASE/snap/stat.
+  * 	Se forma por:
+  * 	@var id Identificador del relé
+  * 	@var state Último estado aplicado (0 si aún se desconoce)
+  * 	@var fdbStatus Flags de resultado del último feedback (RelayFeedback::Status)
+  * 	@var tOnUs Tiempo de ON medido en el último feedback
+  * 	@var tOffUs Tiempo de OFF medido en el último feedback
+  * 	@var tScUs Duración del semiciclo medida en el último feedback
+  * 	@var delayOnUs Retardo de encendido calibrado
+  * 	@var delayOffUs Retardo de apagado calibrado
+  * 	@var switches Número de conmutaciones realizadas
+  * 	@var lastSwitchUs Instante de la última conmutación (us)
+  * 	@var updatedUs Instante de la última actualización (us)
+  */
+struct __packed RlyManRelayStat_t{
+ 	uint8_t id;
+ 	RlyManEvtFlags state;
+ 	uint32_t fdbStatus;
+ 	uint32_t tOnUs;
+ 	uint32_t tOffUs;
+ 	uint32_t tScUs;
+ 	uint32_t delayOnUs;
+ 	uint32_t delayOffUs;
+ 	uint32_t switches;
+ 	uint32_t lastSwitchUs;
+ 	uint32_t updatedUs;
+ };
+
+ /** Estructura de datos para la configuración del modo ráfaga (burst firing) de un relé. El relé se enciende y apaga
+  *  de forma autónoma sincronizado con el zerocross, permaneciendo encendido durante ciclos de red completos en una
+  *  proporción igual al ciclo de trabajo solicitado dentro de cada periodo.
+  * 	Se forma por:
+  * 	@var id Identificador del relé
+  * 	@var dutyPerMil Ciclo de trabajo en tanto por mil (0: finaliza el modo ráfaga y apaga el relé)
+  * 	@var periodCycles Periodo en ciclos de red
+  * 	@var minCycles Mínimo número de ciclos consecutivos encendido o apagado, para limitar el desgaste de los contactos
+  */
+struct __packed RlyManBurstAction_t{
+ 	uint8_t id;
+ 	uint16_t dutyPerMil;
+ 	uint16_t periodCycles;
+ 	uint8_t minCycles;
+ };
+
+
+ /** Estructura de datos para la notificación del estado del modo ráfaga de un relé
+  * 	Se forma por:
+  * 	@var id Identificador del relé
+  * 	@var dutyPerMil Ciclo de trabajo solicitado en tanto por mil (0 si el modo ráfaga ha finalizado)
+  * 	@var achievedPerMil Ciclo de trabajo conseguido en tanto por mil
+  * 	@var cycles Número de ciclos de red transcurridos en modo ráfaga
+  */
+struct __packed RlyManBurstStat_t{
+ 	uint8_t id;
+ 	uint16_t dutyPerMil;
+ 	uint16_t achievedPerMil;
+ 	uint32_t cycles;
+ };
+
+
+ /** Estructura de datos para la notificación del estado de sincronización con el zerocross. Cuando dejan de llegar
+  *  flancos, las acciones se ejecutan sin sincronizar (modo degradado) hasta que el estimador de red vuelve a
+  *  engancharse.
+  * 	Se forma por:
+  * 	@var synced 1 si las acciones se sincronizan con el zerocross, 0 en modo degradado
+  * 	@var losses Número de pérdidas del zerocross detectadas
+  * 	@var unsyncBatches Número de lotes de acciones ejecutados sin sincronizar
+  * 	@var lastEdgeUs Instante del último flanco recibido (us)
+  */
+struct __packed RlyManSyncStat_t{
+ 	uint8_t synced;
+ 	uint32_t losses;
+ 	uint32_t unsyncBatches;
+ 	uint32_t lastEdgeUs;
+ };
+
+
+ /** Número de buckets de los histogramas del error de conmutación en la telemetría de salud */
+ static const uint8_t RlyManHealthBuckets = 8;
+
+
+ /** Estructura de datos con la telemetría de desgaste y calidad de conmutación de un relé, acumulada durante toda su
+  *  vida y persistida en memoria NV. Se publica periódicamente en $BASE/health/stat como un array con una entrada por
+  *  relé instalado, y sólo si ha habido conmutaciones desde la publicación anterior.
+  * 	Se forma por:
+  * 	@var id Identificador del relé
+  * 	@var operations Número total de conmutaciones
+  * 	@var offZero Conmutaciones con un error respecto del paso por cero superior al delta de validación
+  * 	@var errMeanOnUs Media móvil del error de fase en el encendido (us, positivo si conmuta tarde)
+  * 	@var errMeanOffUs Media móvil del error de fase en el apagado (us, positivo si conmuta tarde)
+  * 	@var errHistOn Histograma del error absoluto en el encendido: el bucket 0 contiene los errores menores de
+  * 			64us y el bucket 'b' los errores en [64*2^(b-1), 64*2^b) us, siendo el último abierto. Al saturar
+  * 			un bucket se dividen todos entre 2, conservando la forma de la distribución
+  * 	@var errHistOff Histograma del error absoluto en el apagado
+  * 	@var delayOnUs Retardo de encendido calibrado
+  * 	@var delayOffUs Retardo de apagado calibrado
+  * 	@var driftOnUs Deriva del retardo de encendido respecto del de referencia (el del primer arranque)
+  * 	@var driftOffUs Deriva del retardo de apagado respecto del de referencia
+  */
+struct __packed RlyManHealth_t{
+ 	uint8_t id;
+ 	uint32_t operations;
+ 	uint32_t offZero;
+ 	int16_t errMeanOnUs;
+ 	int16_t errMeanOffUs;
+ 	uint16_t errHistOn[RlyManHealthBuckets];
+ 	uint16_t errHistOff[RlyManHealthBuckets];
+ 	uint32_t delayOnUs;
+ 	uint32_t delayOffUs;
+ 	int32_t driftOnUs;
+ 	int32_t driftOffUs;
+ };
+
+
+ /** Flags de las acciones temporizadas
+  */
+ enum RlyManTimedFlags{
+	 RlyManTimedAbsolute	= (1 << 0),		//!< El instante de ejecución es absoluto (segundos desde epoch, time(NULL))
+ };
+
+
+ /** Estructura de datos para la solicitud de acciones temporizadas, ejecutadas en un instante relativo o absoluto
+  *  con posible reversión y repetición (ej. On durante N ms y después Off, cada M ms). Al vencer, la acción entra en
+  *  el mismo camino que las acciones individuales, sincronizada con el zerocross. La resolución es
+  *  RelayManager::TimedTickMs.
+  * 	Se forma por:
+  * 	@var tag Identificador de la acción (< RELAYMANAGER_MAX_TIMED_ACTIONS). Una nueva acción con el mismo
+  * 			 identificador sustituye a la anterior
+  * 	@var id Identificador del relé sobre el que actuar
+  * 	@var request Acción a realizar (0: cancela la acción 'tag', dejando el relé en su estado actual)
+  * 	@var flags Flags de la acción (RlyManTimedFlags)
+  * 	@var at Instante de ejecución: ms desde la recepción, o segundos desde epoch con RlyManTimedAbsolute
+  * 	@var durationMs Tiempo tras el que se aplica la acción contraria (0: sin reversión)
+  * 	@var periodMs Periodo de repetición (0: una única ejecución). Debe superar a durationMs
+  * 	@var count Número de ejecuciones con repetición (0: indefinidas)
+  */
+struct __packed RlyManTimedAction_t{
+ 	uint8_t tag;
+ 	uint8_t id;
+ 	RlyManEvtFlags request;
+ 	uint8_t flags;
+ 	uint32_t at;
+ 	uint32_t durationMs;
+ 	uint32_t periodMs;
+ 	uint16_t count;
+ };
+
+
+ /** Identificadores de los eventos del registro binario de trazas (RELAYMANAGER_ENABLE_TRACELOG). Los argumentos
+  *  de cada registro dependen del evento y se describen junto a cada identificador.
+  */
+ enum RlyManTraceEvent{
+	 RlyManTraceCmd = 1,			//!< Comando aceptado: arg0=acción (o máscara On), arg1=máscara Off en grupo
+	 RlyManTraceCoalesce,			//!< Acción pendiente sustituida: arg0=acción nueva
+	 RlyManTraceSkip,				//!< Acción descartada por redundante: arg0=estado actual
+	 RlyManTraceBatchStart,			//!< Inicio de lote: arg0=número de acciones, arg1=con encendidos
+	 RlyManTraceAwaitZc,			//!< Esperando el flanco real de zerocross
+	 RlyManTraceSchedule,			//!< Conmutaciones programadas sobre el flanco predicho: arg0=flanco (us)
+	 RlyManTraceSwitch,				//!< Conmutación ejecutada: arg0=acción, arg1=semiciclo asignado
+	 RlyManTraceInrush,				//!< Encendidos repartidos: arg0=semiciclos ocupados
+	 RlyManTraceFeedback,			//!< Resultado del feedback: arg0=flags de resultado, arg1=Ton(16b alto) | Toff(16b bajo)
+	 RlyManTraceCalib,				//!< Calibración: arg0=retardo On, arg1=retardo Off
+	 RlyManTraceCalibReject,		//!< Medida de calibración descartada: arg0=innovación (us, con signo)
+	 RlyManTraceBatchDone,			//!< Fin de lote: arg0=número de acciones
+	 RlyManTraceShed,				//!< Desconexión de emergencia iniciada: arg0=máscara de relés
+	 RlyManTraceShedDone,			//!< Desconexión de emergencia completada: arg0=máscara, arg1=latencia (us)
+	 RlyManTracePublish,			//!< Publicación de resultado: arg0=estado publicado
+	 RlyManTraceSync,				//!< Cambio de sincronización: arg0=sincronizado, arg1=último flanco (us)
+	 RlyManTraceTimed,				//!< Acción temporizada vencida: arg0=identificador de la acción, arg1=acción
+ };
+
+
+ /** Registro del log binario de trazas, de tamaño fijo. Se decodifica fuera de línea con tools/rlyman_trace.py
+  * 	Se forma por:
+  * 	@var ts Instante del evento (us)
+  * 	@var seq Número de secuencia (16b bajos del índice de escritura), permite detectar registros sobrescritos
+  * 	@var evt Identificador del evento (RlyManTraceEvent)
+  * 	@var id Identificador del relé (0xFF si el evento no es de un relé)
+  * 	@var arg0 Primer argumento
+  * 	@var arg1 Segundo argumento
+  */
+struct __packed RlyManTraceRecord_t{
+ 	uint32_t ts;
+ 	uint16_t seq;
+ 	uint8_t evt;
+ 	uint8_t id;
+ 	uint32_t arg0;
+ 	uint32_t arg1;
+ };
+
+
+ /** Cabecera del volcado del log binario de trazas, seguida de 'count' registros del más antiguo al más reciente.
+  *  Se entrega como respuesta a las consultas en $BASE/trace/get.
+  * 	Se forma por:
+  * 	@var magic Marca 'RLYT' (0x54594C52 en little-endian)
+  * 	@var version Versión del formato
+  * 	@var recSize Tamaño de cada registro
+  * 	@var written Número total de registros escritos (los anteriores a written-count se han perdido)
+  * 	@var count Número de registros incluidos
+  */
+struct __packed RlyManTraceHeader_t{
+ 	uint32_t magic;
+ 	uint16_t version;
+ 	uint16_t recSize;
+ 	uint32_t written;
+ 	uint32_t count;
+ };
+
+
 
 
 }
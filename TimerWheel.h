@@ -0,0 +1,227 @@
+/*
+ * TimerWheel.h
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ *
+ *	TimerWheel es una rueda de temporización jerárquica de 4 niveles de 64 posiciones, con coste O(1) en la inserción,
+ *	la cancelación y el avance de cada tick (las entradas de los niveles superiores se redistribuyen una única vez por
+ *	nivel). Cubre 2^24 ticks; las entradas más lejanas se reubican al llegar al último nivel.
+ *
+ *	Las entradas (Node) las proporciona el propietario y se identifican por su índice, de forma que no se reserva
+ *	memoria y los datos asociados a cada entrada se guardan en un array paralelo. Se enlazan en listas doblemente
+ *	enlazadas por índices de 16 bits, admitiendo hasta 65535 entradas.
+ *
+ *	No depende de mbed ni es reentrante: todas las operaciones se realizan desde el mismo contexto.
+ *
+ *	Ej:
+ *		TimerWheel::Node nodes[N];
+ *		TimerWheel wheel(nodes, N);
+ *		wheel.insert(3, wheel.now() + 100);
+ *		for(uint16_t i = wheel.step(); i != TimerWheel::Nil; ){
+ *			uint16_t next = wheel.next(i);
+ *			// procesa la entrada 'i', que puede volver a insertarse
+ *			i = next;
+ *		}
+ */
+
+#ifndef __TimerWheel__H
+#define __TimerWheel__H
+
+#include <stdint.h>
+
+
+class TimerWheel {
+  public:
+
+    /** Geometría de la rueda: niveles y posiciones por nivel */
+    static const uint8_t Levels = 4;
+    static const uint8_t SlotBits = 6;
+    static const uint16_t Slots = (1 << SlotBits);
+    static const uint32_t MaxTicks = (1ul << (Levels * SlotBits)) - 1;
+
+    /** Índice nulo */
+    static const uint16_t Nil = 0xFFFF;
+
+    /** Entrada de la rueda */
+    struct Node{
+        uint32_t expires;               /// Tick de vencimiento
+        uint16_t next;                  /// Siguiente entrada de la lista
+        uint16_t prev;                  /// Entrada anterior de la lista
+        uint16_t list;                  /// Lista en la que está enlazada (Nil si no está pendiente)
+    };
+
+
+    /** Crea una rueda vacía sobre un array de entradas
+     *  @param nodes Entradas
+     *  @param count Número de entradas (< Nil)
+     */
+    TimerWheel(Node* nodes, uint16_t count) : _nodes(nodes){
+    	for(uint16_t i = 0; i < count; i++){
+    		_nodes[i].list = Nil;
+    	}
+    	for(uint16_t i = 0; i < Levels * Slots; i++){
+    		_heads[i] = Nil;
+    	}
+    	_now = 0;
+    	_pending = 0;
+    }
+
+
+    /** Tick actual
+     *  @return Tick
+     */
+    uint32_t now() const {
+    	return _now;
+    }
+
+
+    /** Número de entradas pendientes
+     *  @return Entradas
+     */
+    uint32_t pending() const {
+    	return _pending;
+    }
+
+
+    /** Indica si una entrada está pendiente
+     *  @param idx Entrada
+     *  @return True si está pendiente
+     */
+    bool isPending(uint16_t idx) const {
+    	return (_nodes[idx].list != Nil);
+    }
+
+
+    /** Siguiente entrada de una lista de vencidas
+     *  @param idx Entrada
+     *  @return Siguiente entrada o Nil
+     */
+    uint16_t next(uint16_t idx) const {
+    	return _nodes[idx].next;
+    }
+
+
+    /** Inserta una entrada, cancelándola antes si ya estaba pendiente. Si el vencimiento ya ha pasado, vence en el
+     *  siguiente tick.
+     *  @param idx Entrada
+     *  @param expires Tick de vencimiento
+     */
+    void insert(uint16_t idx, uint32_t expires){
+    	if(_nodes[idx].list != Nil){
+    		cancel(idx);
+    	}
+    	_nodes[idx].expires = expires;
+    	link(idx);
+    	_pending++;
+    }
+
+
+    /** Cancela una entrada pendiente
+     *  @param idx Entrada
+     */
+    void cancel(uint16_t idx){
+    	Node& n = _nodes[idx];
+    	if(n.list == Nil){
+    		return;
+    	}
+    	if(n.prev != Nil){
+    		_nodes[n.prev].next = n.next;
+    	}
+    	else{
+    		_heads[n.list] = n.next;
+    	}
+    	if(n.next != Nil){
+    		_nodes[n.next].prev = n.prev;
+    	}
+    	n.list = Nil;
+    	_pending--;
+    }
+
+
+    /** Avanza un tick
+     *  @return Lista de entradas vencidas (recorrer con next() antes de reinsertarlas) o Nil
+     */
+    uint16_t step(){
+    	uint16_t index = _now & (Slots - 1);
+
+    	// al completar una vuelta de un nivel, redistribuye la posición en curso del nivel superior
+    	for(uint8_t level = 1, carry = index; level < Levels && carry == 0; level++){
+    		carry = (_now >> (level * SlotBits)) & (Slots - 1);
+    		cascade((level * Slots) + carry);
+    	}
+    	_now++;
+
+    	// desengancha la lista de vencidas
+    	uint16_t head = _heads[index];
+    	_heads[index] = Nil;
+    	for(uint16_t i = head; i != Nil; i = _nodes[i].next){
+    		_nodes[i].list = Nil;
+    		_pending--;
+    	}
+    	return head;
+    }
+
+  private:
+
+    /** Entradas */
+    Node* _nodes;
+
+    /** Cabeceras de las listas de cada posición de cada nivel */
+    uint16_t _heads[Levels * Slots];
+
+    /** Tick actual y entradas pendientes */
+    uint32_t _now;
+    uint32_t _pending;
+
+
+    /** Enlaza una entrada en la posición que le corresponde según su vencimiento
+     *  @param idx Entrada
+     */
+    void link(uint16_t idx){
+    	Node& n = _nodes[idx];
+    	int32_t delta = (int32_t)(n.expires - _now);
+    	uint32_t expires = n.expires;
+    	uint16_t list;
+    	if(delta < 0){
+    		list = _now & (Slots - 1);
+    	}
+    	else{
+    		// las entradas más lejanas que la rueda se ubican en su último nivel y se reubican al llegar a él
+    		if((uint32_t)delta > MaxTicks){
+    			expires = _now + MaxTicks;
+    			delta = MaxTicks;
+    		}
+    		uint8_t level = 0;
+    		while(level < (Levels - 1) && (uint32_t)delta >= (1ul << ((level + 1) * SlotBits))){
+    			level++;
+    		}
+    		list = (level * Slots) + ((expires >> (level * SlotBits)) & (Slots - 1));
+    	}
+    	n.list = list;
+    	n.prev = Nil;
+    	n.next = _heads[list];
+    	if(n.next != Nil){
+    		_nodes[n.next].prev = idx;
+    	}
+    	_heads[list] = idx;
+    }
+
+
+    /** Redistribuye las entradas de una posición en los niveles inferiores
+     *  @param list Posición
+     */
+    void cascade(uint16_t list){
+    	uint16_t i = _heads[list];
+    	_heads[list] = Nil;
+    	while(i != Nil){
+    		uint16_t next = _nodes[i].next;
+    		link(i);
+    		i = next;
+    	}
+    }
+};
+
+#endif /*__TimerWheel__H */
+
+/**** END OF FILE ****/
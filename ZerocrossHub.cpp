@@ -0,0 +1,104 @@
+/*
+ * ZerocrossHub.cpp
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ */
+
+#include "ZerocrossHub.h"
+
+
+
+//------------------------------------------------------------------------------------
+//-- PUBLIC METHODS IMPLEMENTATION ---------------------------------------------------
+//------------------------------------------------------------------------------------
+
+
+//------------------------------------------------------------------------------------
+ZerocrossHub::ZerocrossHub(){
+	_num_phases = 0;
+	for(int i = 0; i < MaxPhases; i++){
+		_phases[i].zc = NULL;
+		_phases[i].level = (Zerocross::LogicLevel)0;
+		_phases[i].owned = false;
+		_phases[i].id = i;
+		_phases[i].count = 0;
+		_phases[i].edges = 0;
+	}
+}
+
+
+//------------------------------------------------------------------------------------
+ZerocrossHub::~ZerocrossHub(){
+	for(int i = 0; i < _num_phases; i++){
+		if(_phases[i].count > 0){
+			_phases[i].zc->disableEvents(_phases[i].level);
+		}
+		if(_phases[i].owned){
+			delete(_phases[i].zc);
+		}
+	}
+}
+
+
+//------------------------------------------------------------------------------------
+int8_t ZerocrossHub::addPhase(PinName zc, Zerocross::LogicLevel level){
+	if(_num_phases >= MaxPhases){
+		return -1;
+	}
+	Zerocross* zcross = new Zerocross(zc);
+	MBED_ASSERT(zcross);
+	int8_t phase = addPhase(zcross, level);
+	_phases[phase].owned = true;
+	return phase;
+}
+
+
+//------------------------------------------------------------------------------------
+int8_t ZerocrossHub::addPhase(Zerocross* zc, Zerocross::LogicLevel level){
+	MBED_ASSERT(zc);
+	if(_num_phases >= MaxPhases){
+		return -1;
+	}
+	Phase* ph = &_phases[_num_phases];
+	ph->zc = zc;
+	ph->level = level;
+	ph->owned = false;
+	return (int8_t)_num_phases++;
+}
+
+
+//------------------------------------------------------------------------------------
+bool ZerocrossHub::attach(uint8_t phase, Callback<void(uint8_t, uint32_t)> cb){
+	if(phase >= _num_phases || _phases[phase].count >= MaxListeners){
+		return false;
+	}
+	// el suscriptor queda completo antes de hacerse visible a la ISR
+	Phase* ph = &_phases[phase];
+	core_util_critical_section_enter();
+	ph->listeners[ph->count] = cb;
+	ph->count++;
+	core_util_critical_section_exit();
+
+	// activa los eventos del zerocross con el primer suscriptor
+	if(ph->count == 1){
+		ph->zc->enableEvents(ph->level, callback(ph, &Phase::isrEdge));
+	}
+	return true;
+}
+
+
+//------------------------------------------------------------------------------------
+//-- PRIVATE METHODS IMPLEMENTATION --------------------------------------------------
+//------------------------------------------------------------------------------------
+
+
+//------------------------------------------------------------------------------------
+void ZerocrossHub::Phase::isrEdge(Zerocross::LogicLevel level){
+	// marca el instante del flanco una única vez para todos los suscriptores
+	uint32_t ts = us_ticker_read();
+	edges++;
+	for(uint8_t i = 0; i < count; i++){
+		listeners[i].call(id, ts);
+	}
+}
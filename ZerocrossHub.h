@@ -0,0 +1,126 @@
+/*
+ * ZerocrossHub.h
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ *
+ *	ZerocrossHub es el módulo que reparte los flancos del zerocross entre varios gestores de relés (class RelayManager).
+ *	Cada fase de red tiene su propia entrada de zerocross y una única ISR por flanco, que marca el instante del flanco
+ *	una sola vez y lo entrega a todos los gestores suscritos a esa fase. Así, varios gestores y relés conectados a
+ *	distintas fases comparten las interrupciones en lugar de competir por ellas.
+ *
+ *	Las fases se registran antes de iniciar los gestores, y éstos se suscriben a todas las fases del hub en su arranque.
+ *
+ *	Ej:
+ *		ZerocrossHub hub;
+ *		hub.addPhase(PA_0, Zerocross::EdgeActiveAreBoth);	// fase 0 (L1)
+ *		hub.addPhase(PA_1, Zerocross::EdgeActiveAreBoth);	// fase 1 (L2)
+ *		hub.addPhase(PA_4, Zerocross::EdgeActiveAreBoth);	// fase 2 (L3)
+ *		RelayManager rlyman_a(&hub, 8, fs);
+ *		RelayManager rlyman_b(&hub, 8, fs);
+ */
+
+#ifndef __ZerocrossHub__H
+#define __ZerocrossHub__H
+
+#include "mbed.h"
+#include "Zerocross.h"
+
+
+class ZerocrossHub {
+  public:
+
+    /** Máximo número de fases y de suscriptores por fase */
+    static const uint8_t MaxPhases = 3;
+    static const uint8_t MaxListeners = 4;
+
+
+    /** Crea un hub sin fases */
+    ZerocrossHub();
+
+
+    /** Destructor, libera los zerocross creados por el hub */
+    ~ZerocrossHub();
+
+
+    /** Registra una fase con su propia entrada de zerocross
+     *
+     *  @param zc Entrada de zerocross
+     *  @param level Nivel de activación de eventos del zerocross (flancos activos)
+     *  @return Identificador de la fase o -1 si no admite más fases
+     */
+    int8_t addPhase(PinName zc, Zerocross::LogicLevel level);
+
+
+    /** Registra una fase con un zerocross ya creado, que sigue siendo propiedad del llamante
+     *
+     *  @param zc Zerocross
+     *  @param level Nivel de activación de eventos del zerocross (flancos activos)
+     *  @return Identificador de la fase o -1 si no admite más fases
+     */
+    int8_t addPhase(Zerocross* zc, Zerocross::LogicLevel level);
+
+
+    /** Suscribe una callback a los flancos de una fase. Se invoca en contexto ISR con el identificador de la fase y
+     *  el instante del flanco (us). Los eventos del zerocross se activan con el primer suscriptor.
+     *
+     *  @param phase Identificador de la fase
+     *  @param cb Callback
+     *  @return True si se ha suscrito
+     */
+    bool attach(uint8_t phase, Callback<void(uint8_t, uint32_t)> cb);
+
+
+    /** Obtiene el número de fases registradas
+     *  @return Número de fases
+     */
+    uint8_t getPhaseCount(){
+    	return _num_phases;
+    }
+
+
+    /** Obtiene el nivel de activación de eventos de una fase
+     *  @param phase Identificador de la fase
+     *  @return Flancos activos
+     */
+    Zerocross::LogicLevel getLevel(uint8_t phase){
+    	MBED_ASSERT(phase < _num_phases);
+    	return _phases[phase].level;
+    }
+
+
+    /** Obtiene el número de flancos recibidos en una fase
+     *  @param phase Identificador de la fase
+     *  @return Flancos recibidos
+     */
+    uint32_t getEdges(uint8_t phase){
+    	MBED_ASSERT(phase < _num_phases);
+    	return _phases[phase].edges;
+    }
+
+  private:
+
+    /** Estado de una fase. La ISR del zerocross de la fase invoca a isrEdge */
+    struct Phase{
+        Zerocross* zc;                                          /// Zerocross de la fase
+        Zerocross::LogicLevel level;                            /// Flancos activos
+        bool owned;                                             /// Indica si el zerocross lo ha creado el hub
+        uint8_t id;                                             /// Identificador de la fase
+        Callback<void(uint8_t, uint32_t)> listeners[MaxListeners];   /// Suscriptores
+        volatile uint8_t count;                                 /// Número de suscriptores
+        volatile uint32_t edges;                                /// Flancos recibidos
+
+        /** Callback invocada en cada flanco activo, en contexto ISR
+         *  @param level Flanco
+         */
+        void isrEdge(Zerocross::LogicLevel level);
+    };
+
+    /** Fases registradas */
+    Phase _phases[MaxPhases];
+    uint8_t _num_phases;
+};
+
+#endif /*__ZerocrossHub__H */
+
+/**** END OF FILE ****/
@@ -0,0 +1,187 @@
+/*
+ * ActiveModule.h
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ *
+ *	Capa ActiveModule/StateMachine/MQLib del banco de simulación en el host. Reproduce el contrato que utiliza
+ *	RelayManager: la tarea extrae eventos con getOsEvent(), los mensajes (osEventMessage) se despachan con su
+ *	señal como evento y se liberan tras el despacho con Heap::memFree (el mensaje y sus datos), y los
+ *	osEventTimeout se despachan como EV_TIMED. El EV_ENTRY se entrega una vez fijados los topics base. El bus MQ entrega las publicaciones de forma síncrona a los suscriptores y las registra para su
+ *	inspección, y saveParameter/restoreParameter/removeParameter trabajan sobre la memoria NV simulada.
+ */
+
+#ifndef __HOST_ACTIVEMODULE__H
+#define __HOST_ACTIVEMODULE__H
+
+#include "mbed.h"
+#include "Heap.h"
+
+
+//------------------------------------------------------------------------------------
+//-- TRAZAS --------------------------------------------------------------------------
+//------------------------------------------------------------------------------------
+
+#define DEBUG_TRACE_I(expr, mod, ...)	do{ if(expr){ printf("%s ", mod); printf(__VA_ARGS__); printf("\n"); } }while(0)
+#define DEBUG_TRACE_D(expr, mod, ...)	do{ if(expr){ printf("%s ", mod); printf(__VA_ARGS__); printf("\n"); } }while(0)
+#define DEBUG_TRACE_W(expr, mod, ...)	do{ if(expr){ printf("%s ", mod); printf(__VA_ARGS__); printf("\n"); } }while(0)
+#define DEBUG_TRACE_E(expr, mod, ...)	do{ if(expr){ printf("%s ", mod); printf(__VA_ARGS__); printf("\n"); } }while(0)
+
+
+//------------------------------------------------------------------------------------
+//-- MEMORIA NV ----------------------------------------------------------------------
+//------------------------------------------------------------------------------------
+
+/** Sistema de ficheros. En el host sólo identifica el espacio de claves en la memoria NV simulada */
+class FSManager {
+  public:
+	FSManager(const char* name = "fs") : _name(name){}
+	const char* getName() const {
+		return _name;
+	}
+  private:
+	const char* _name;
+};
+
+namespace NVSInterface {
+enum KeyValueType {
+	TypeUint8 = 0,
+	TypeUint16,
+	TypeUint32,
+	TypeBlob,
+};
+}
+
+
+//------------------------------------------------------------------------------------
+//-- MÁQUINA DE ESTADOS --------------------------------------------------------------
+//------------------------------------------------------------------------------------
+
+namespace State {
+
+enum EventType {
+	EV_INVALID = 0,
+	EV_ENTRY,
+	EV_EXIT,
+	EV_TIMED,
+	EV_RESERVED_USER = (1 << 8),
+};
+
+enum StateResult {
+	HANDLED = 0,
+	IGNORED,
+	TRANSITION,
+};
+
+struct Msg {
+	uint32_t sig;
+	void* msg;
+};
+
+struct StateEvent {
+	EventType evt;
+	osEvent* oe;
+};
+
+}
+
+
+//------------------------------------------------------------------------------------
+//-- MQLIB ---------------------------------------------------------------------------
+//------------------------------------------------------------------------------------
+
+namespace MQ {
+
+enum ErrorResult {
+	SUCCESS = 0,
+	NULL_POINTER = -1,
+	OUT_OF_MEMORY = -2,
+	NOT_FOUND = -3,
+};
+
+typedef Callback<void(const char*, void*, uint16_t)> SubscribeCallback;
+typedef Callback<void(const char*, int32_t)> PublishCallback;
+
+class MQClient {
+  public:
+	/** Indica si 'root' es el comienzo de 'topic' hasta un separador de nivel */
+	static bool isTokenRoot(const char* topic, const char* root);
+	/** Suscribe la callback a un topic, admitiendo los comodines '+' y '#' */
+	static int32_t subscribe(const char* topic, SubscribeCallback* subscriber);
+	/** Entrega el mensaje a los suscriptores y lo registra en el bus simulado */
+	static int32_t publish(const char* topic, void* data, uint32_t datasize, PublishCallback* publisher);
+	static uint16_t getMaxTopicLen(){
+		return 64;
+	}
+};
+
+}
+
+
+//------------------------------------------------------------------------------------
+//-- ACTIVE MODULE -------------------------------------------------------------------
+//------------------------------------------------------------------------------------
+
+class ActiveModule {
+  public:
+
+	/** Tiempo de espera por defecto al insertar en la cola (ms) */
+	static const uint32_t DefaultPutTimeout = 100;
+
+	ActiveModule(const char* name, osPriority priority, uint32_t stack_size, FSManager* fs = NULL, bool defdbg = false);
+	virtual ~ActiveModule();
+
+	/** Fija el topic base de las publicaciones */
+	void setPublicationBase(const char* pub_topic);
+
+	/** Fija el topic base de las suscripciones */
+	void setSubscriptionBase(const char* sub_topic);
+
+	/** Indica si ya se ha procesado el EV_ENTRY */
+	bool ready() const {
+		return _ready;
+	}
+
+	/** Despacha un evento de la tarea. Devuelve false si no había nada que hacer (la tarea quedaría bloqueada) */
+	bool dispatch();
+
+	/** Nombre del módulo */
+	const char* getName() const {
+		return _name;
+	}
+
+	virtual osStatus putMessage(State::Msg* msg) = 0;
+
+  protected:
+
+	virtual osEvent getOsEvent() = 0;
+	virtual State::StateResult Init_EventHandler(State::StateEvent* se) = 0;
+	virtual void subscriptionCb(const char* topic, void* msg, uint16_t msg_len) = 0;
+	virtual void publicationCb(const char* topic, int32_t result) = 0;
+	virtual bool checkIntegrity() = 0;
+	virtual void setDefaultConfig() = 0;
+	virtual void restoreConfig() = 0;
+	virtual void saveConfig() = 0;
+
+	/** Acceso a la memoria NV simulada */
+	bool saveParameter(const char* param_id, void* data, size_t size, NVSInterface::KeyValueType type);
+	bool restoreParameter(const char* param_id, void* data, size_t size, NVSInterface::KeyValueType type);
+	bool removeParameter(const char* param_id);
+
+	/** Sin transiciones en el host: el módulo permanece en su único estado */
+	void nextState(){}
+
+	const char* _name;
+	FSManager* _fs;
+	bool _defdbg;
+	char* _pub_topic_base;
+	char* _sub_topic_base;
+	MQ::PublishCallback _publicationCb;
+
+  private:
+	bool _ready;
+};
+
+#endif /*__HOST_ACTIVEMODULE__H */
+
+/**** END OF FILE ****/
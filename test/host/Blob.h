@@ -0,0 +1,18 @@
+/*
+ * Blob.h
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ *
+ *	Blob.h del banco de simulación en el host. Las definiciones de RelayManager están en RelayManagerBlob.h, sin
+ *	dependencias de la librería original.
+ */
+
+#ifndef __HOST_BLOB__H
+#define __HOST_BLOB__H
+
+#include <stdint.h>
+
+#endif /*__HOST_BLOB__H */
+
+/**** END OF FILE ****/
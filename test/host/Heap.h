@@ -0,0 +1,33 @@
+/*
+ * Heap.h
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ *
+ *	Heap del banco de simulación en el host. Contabiliza las reservas vivas para comprobar que los caminos sin
+ *	reserva dinámica no crecen.
+ */
+
+#ifndef __HOST_HEAP__H
+#define __HOST_HEAP__H
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace Heap {
+
+void* memAlloc(size_t size);
+void memFree(void* ptr);
+
+/** Número de reservas realizadas desde el arranque */
+uint32_t allocCount();
+
+/** Número de bloques y bytes reservados actualmente */
+uint32_t liveBlocks();
+size_t liveBytes();
+
+}
+
+#endif /*__HOST_HEAP__H */
+
+/**** END OF FILE ****/
@@ -0,0 +1,917 @@
+/*
+ * HostSim.cpp
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ *
+ *	Implementación del banco de simulación en el host: reloj virtual y planificador, capas mbed, Heap, MQLib y
+ *	ActiveModule, y modelos de red, relé y feedback.
+ */
+
+#include "HostSim.h"
+#include "Relay.h"
+#include "RelayFeedback.h"
+#include "Zerocross.h"
+#include <math.h>
+#include <time.h>
+#include <set>
+#include <tuple>
+
+
+//------------------------------------------------------------------------------------
+//-- PRIVATE TYPEDEFS ----------------------------------------------------------------
+//------------------------------------------------------------------------------------
+
+/** Temporizadores pendientes ordenados por vencimiento y orden de programación */
+typedef std::tuple<uint64_t, uint64_t, Timeout*> TimerKey;
+
+/** Suscripción en el bus simulado */
+struct Subscription {
+	std::string topic;
+	MQ::SubscribeCallback* cb;
+};
+
+/** Máximo número de eventos despachados sin avanzar el reloj antes de considerar que una tarea no se bloquea */
+static const uint32_t MaxDispatchesPerInstant = 1000000;
+
+/** Estado de la simulación */
+static uint64_t s_now = 0;
+static bool s_isr = false;
+static bool s_queue_empty = false;
+static uint64_t s_seq = 0;
+static uint64_t s_fired = 0;
+static std::set<TimerKey> s_timers;
+static std::vector<ActiveModule*> s_modules;
+static std::vector<Subscription> s_subscriptions;
+static std::vector<HostSim::Publication> s_publications;
+static bool s_recording = true;
+static std::map<std::string, std::vector<uint8_t> > s_nvs;
+static bool s_nvs_fail = false;
+static uint32_t s_nvs_writes = 0;
+static uint32_t s_heap_allocs = 0;
+static uint32_t s_heap_blocks = 0;
+static size_t s_heap_bytes = 0;
+static Zerocross* s_zc_list = NULL;
+static InterruptIn* s_in_list = NULL;
+static uint32_t s_checks = 0;
+static uint32_t s_failures = 0;
+
+
+//------------------------------------------------------------------------------------
+//-- NÚCLEO DE SIMULACIÓN ------------------------------------------------------------
+//------------------------------------------------------------------------------------
+
+namespace HostSim {
+
+//------------------------------------------------------------------------------------
+uint64_t now(){
+	return s_now;
+}
+
+
+//------------------------------------------------------------------------------------
+bool inIsr(){
+	return s_isr;
+}
+
+
+//------------------------------------------------------------------------------------
+void schedule(Timeout* tmr, uint64_t due){
+	if(tmr->_scheduled){
+		cancel(tmr);
+	}
+	tmr->_due = due;
+	tmr->_seq = ++s_seq;
+	tmr->_scheduled = true;
+	s_timers.insert(TimerKey(due, tmr->_seq, tmr));
+}
+
+
+//------------------------------------------------------------------------------------
+void cancel(Timeout* tmr){
+	s_timers.erase(TimerKey(tmr->_due, tmr->_seq, tmr));
+	tmr->_scheduled = false;
+}
+
+
+//------------------------------------------------------------------------------------
+void noteQueueEmpty(){
+	s_queue_empty = true;
+}
+
+
+//------------------------------------------------------------------------------------
+void reset(){
+	for(std::set<TimerKey>::iterator it = s_timers.begin(); it != s_timers.end(); ++it){
+		std::get<2>(*it)->_scheduled = false;
+	}
+	s_timers.clear();
+	s_now = 0;
+	s_isr = false;
+	s_seq = 0;
+	s_fired = 0;
+	s_subscriptions.clear();
+	s_publications.clear();
+	s_recording = true;
+	s_nvs.clear();
+	s_nvs_fail = false;
+	s_nvs_writes = 0;
+}
+
+
+//------------------------------------------------------------------------------------
+void settle(){
+	uint32_t count = 0;
+	bool busy = true;
+	while(busy){
+		busy = false;
+		std::vector<ActiveModule*> mods = s_modules;
+		for(size_t i = 0; i < mods.size(); i++){
+			while(mods[i]->dispatch()){
+				busy = true;
+				if(++count > MaxDispatchesPerInstant){
+					fprintf(stderr, "HostSim: el módulo %s no se bloquea en t=%llu\n", mods[i]->getName(), (unsigned long long)s_now);
+					abort();
+				}
+			}
+		}
+	}
+}
+
+
+//------------------------------------------------------------------------------------
+void runUntil(uint64_t t_us){
+	settle();
+	while(!s_timers.empty() && std::get<0>(*s_timers.begin()) <= t_us){
+		Timeout* tmr = std::get<2>(*s_timers.begin());
+		s_now = std::get<0>(*s_timers.begin());
+		s_timers.erase(s_timers.begin());
+		tmr->_scheduled = false;
+		s_fired++;
+		s_isr = true;
+		tmr->fire();
+		s_isr = false;
+		settle();
+	}
+	s_now = (t_us > s_now)? t_us : s_now;
+	settle();
+}
+
+
+//------------------------------------------------------------------------------------
+void runFor(uint64_t us){
+	runUntil(s_now + us);
+}
+
+
+//------------------------------------------------------------------------------------
+uint64_t firedTimers(){
+	return s_fired;
+}
+
+
+//------------------------------------------------------------------------------------
+void addModule(ActiveModule* mod){
+	s_modules.push_back(mod);
+}
+
+
+//------------------------------------------------------------------------------------
+void removeModule(ActiveModule* mod){
+	for(size_t i = 0; i < s_modules.size(); i++){
+		if(s_modules[i] == mod){
+			s_modules.erase(s_modules.begin() + i);
+			return;
+		}
+	}
+}
+
+
+//------------------------------------------------------------------------------------
+std::vector<Publication>& publications(){
+	return s_publications;
+}
+
+
+//------------------------------------------------------------------------------------
+const Publication* lastPublication(const char* topic, uint64_t since_us){
+	for(size_t i = s_publications.size(); i > 0; i--){
+		const Publication& p = s_publications[i-1];
+		if(p.t < since_us){
+			return NULL;
+		}
+		if(p.topic == topic){
+			return &p;
+		}
+	}
+	return NULL;
+}
+
+
+//------------------------------------------------------------------------------------
+uint32_t countPublications(const char* topic, uint64_t since_us){
+	uint32_t count = 0;
+	for(size_t i = 0; i < s_publications.size(); i++){
+		if(s_publications[i].t >= since_us && s_publications[i].topic == topic){
+			count++;
+		}
+	}
+	return count;
+}
+
+
+//------------------------------------------------------------------------------------
+void setRecording(bool enable){
+	s_recording = enable;
+}
+
+
+//------------------------------------------------------------------------------------
+std::map<std::string, std::vector<uint8_t> >& nvs(){
+	return s_nvs;
+}
+
+
+//------------------------------------------------------------------------------------
+void setNvsWriteFailure(bool fail){
+	s_nvs_fail = fail;
+}
+
+
+//------------------------------------------------------------------------------------
+uint32_t nvsWrites(){
+	return s_nvs_writes;
+}
+
+
+//------------------------------------------------------------------------------------
+bool check(bool ok, const char* expr, const char* file, int line){
+	s_checks++;
+	if(!ok){
+		s_failures++;
+		printf("FALLO %s:%d: %s (t=%llu us)\n", file, line, expr, (unsigned long long)s_now);
+	}
+	return ok;
+}
+
+
+//------------------------------------------------------------------------------------
+uint32_t failures(){
+	return s_failures;
+}
+
+
+//------------------------------------------------------------------------------------
+int report(const char* name){
+	printf("%s: %u comprobaciones, %u fallos\n", name, s_checks, s_failures);
+	return (s_failures == 0)? 0 : 1;
+}
+
+}
+
+
+//------------------------------------------------------------------------------------
+extern "C" uint32_t us_ticker_read(){
+	return (uint32_t)s_now;
+}
+
+
+//------------------------------------------------------------------------------------
+//-- HEAP ----------------------------------------------------------------------------
+//------------------------------------------------------------------------------------
+
+/** Cabecera de cada bloque, con su tamaño, manteniendo la alineación */
+union HeapHeader {
+	size_t size;
+	max_align_t align;
+};
+
+
+//------------------------------------------------------------------------------------
+void* Heap::memAlloc(size_t size){
+	HeapHeader* hdr = (HeapHeader*)malloc(sizeof(HeapHeader) + size);
+	if(!hdr){
+		return NULL;
+	}
+	hdr->size = size;
+	s_heap_allocs++;
+	s_heap_blocks++;
+	s_heap_bytes += size;
+	return hdr + 1;
+}
+
+
+//------------------------------------------------------------------------------------
+void Heap::memFree(void* ptr){
+	if(!ptr){
+		return;
+	}
+	HeapHeader* hdr = ((HeapHeader*)ptr) - 1;
+	s_heap_blocks--;
+	s_heap_bytes -= hdr->size;
+	free(hdr);
+}
+
+
+//------------------------------------------------------------------------------------
+uint32_t Heap::allocCount(){
+	return s_heap_allocs;
+}
+
+
+//------------------------------------------------------------------------------------
+uint32_t Heap::liveBlocks(){
+	return s_heap_blocks;
+}
+
+
+//------------------------------------------------------------------------------------
+size_t Heap::liveBytes(){
+	return s_heap_bytes;
+}
+
+
+//------------------------------------------------------------------------------------
+//-- MQLIB ---------------------------------------------------------------------------
+//------------------------------------------------------------------------------------
+
+/** Compara un topic con un filtro de suscripción con comodines '+' (un nivel) y '#' (resto) */
+static bool topicMatches(const char* filter, const char* topic){
+	while(*filter){
+		if(*filter == '#'){
+			return true;
+		}
+		if(*filter == '+'){
+			while(*topic && *topic != '/'){
+				topic++;
+			}
+			filter++;
+			continue;
+		}
+		if(*filter != *topic){
+			return false;
+		}
+		filter++;
+		topic++;
+	}
+	return (*topic == 0);
+}
+
+
+//------------------------------------------------------------------------------------
+bool MQ::MQClient::isTokenRoot(const char* topic, const char* root){
+	size_t len = strlen(root);
+	return (strncmp(topic, root, len) == 0 && (topic[len] == '/' || topic[len] == 0));
+}
+
+
+//------------------------------------------------------------------------------------
+int32_t MQ::MQClient::subscribe(const char* topic, SubscribeCallback* subscriber){
+	if(!topic || !subscriber){
+		return MQ::NULL_POINTER;
+	}
+	Subscription s = {topic, subscriber};
+	s_subscriptions.push_back(s);
+	return MQ::SUCCESS;
+}
+
+
+//------------------------------------------------------------------------------------
+int32_t MQ::MQClient::publish(const char* topic, void* data, uint32_t datasize, PublishCallback* publisher){
+	if(!topic){
+		return MQ::NULL_POINTER;
+	}
+	if(s_recording){
+		HostSim::Publication p;
+		p.t = s_now;
+		p.topic = topic;
+		p.data.assign((uint8_t*)data, ((uint8_t*)data) + datasize);
+		s_publications.push_back(p);
+	}
+	// los suscriptores pueden suscribirse o publicar a su vez
+	std::vector<Subscription> subs = s_subscriptions;
+	for(size_t i = 0; i < subs.size(); i++){
+		if(topicMatches(subs[i].topic.c_str(), topic)){
+			subs[i].cb->call(topic, data, (uint16_t)datasize);
+		}
+	}
+	if(publisher && *publisher){
+		publisher->call(topic, MQ::SUCCESS);
+	}
+	return MQ::SUCCESS;
+}
+
+
+//------------------------------------------------------------------------------------
+//-- ACTIVE MODULE -------------------------------------------------------------------
+//------------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------------
+ActiveModule::ActiveModule(const char* name, osPriority priority, uint32_t stack_size, FSManager* fs, bool defdbg) :
+		_name(name), _fs(fs), _defdbg(defdbg), _pub_topic_base(NULL), _sub_topic_base(NULL), _ready(false){
+	(void)priority;
+	(void)stack_size;
+	HostSim::addModule(this);
+}
+
+
+//------------------------------------------------------------------------------------
+ActiveModule::~ActiveModule(){
+	HostSim::removeModule(this);
+	free(_pub_topic_base);
+	free(_sub_topic_base);
+}
+
+
+//------------------------------------------------------------------------------------
+void ActiveModule::setPublicationBase(const char* pub_topic){
+	free(_pub_topic_base);
+	_pub_topic_base = strdup(pub_topic);
+}
+
+
+//------------------------------------------------------------------------------------
+void ActiveModule::setSubscriptionBase(const char* sub_topic){
+	free(_sub_topic_base);
+	_sub_topic_base = strdup(sub_topic);
+}
+
+
+//------------------------------------------------------------------------------------
+bool ActiveModule::dispatch(){
+	osEvent oe;
+
+	// la tarea arranca al fijarse los topics base
+	if(!_ready){
+		if(!_pub_topic_base || !_sub_topic_base){
+			return false;
+		}
+		_ready = true;
+		oe.status = osOK;
+		oe.value.p = NULL;
+		State::StateEvent se = {State::EV_ENTRY, &oe};
+		Init_EventHandler(&se);
+		return true;
+	}
+
+	// extrae el siguiente evento. Si la cola estaba vacía, la tarea se bloquearía
+	s_queue_empty = false;
+	oe = getOsEvent();
+	if(oe.status == osEventMessage){
+		State::Msg* msg = (State::Msg*)oe.value.p;
+		State::StateEvent se = {(State::EventType)msg->sig, &oe};
+		Init_EventHandler(&se);
+		if(msg->msg){
+			Heap::memFree(msg->msg);
+		}
+		Heap::memFree(msg);
+		return true;
+	}
+	if(s_queue_empty){
+		return false;
+	}
+	State::StateEvent se = {State::EV_TIMED, &oe};
+	Init_EventHandler(&se);
+	return true;
+}
+
+
+//------------------------------------------------------------------------------------
+bool ActiveModule::saveParameter(const char* param_id, void* data, size_t size, NVSInterface::KeyValueType type){
+	(void)type;
+	if(s_nvs_fail){
+		return false;
+	}
+	std::string key = std::string((_fs)? _fs->getName() : "nofs") + "/" + param_id;
+	s_nvs[key].assign((uint8_t*)data, ((uint8_t*)data) + size);
+	s_nvs_writes++;
+	return true;
+}
+
+
+//------------------------------------------------------------------------------------
+bool ActiveModule::restoreParameter(const char* param_id, void* data, size_t size, NVSInterface::KeyValueType type){
+	(void)type;
+	std::string key = std::string((_fs)? _fs->getName() : "nofs") + "/" + param_id;
+	std::map<std::string, std::vector<uint8_t> >::iterator it = s_nvs.find(key);
+	if(it == s_nvs.end() || it->second.size() != size){
+		return false;
+	}
+	memcpy(data, &it->second[0], size);
+	return true;
+}
+
+
+//------------------------------------------------------------------------------------
+bool ActiveModule::removeParameter(const char* param_id){
+	std::string key = std::string((_fs)? _fs->getName() : "nofs") + "/" + param_id;
+	return (s_nvs.erase(key) > 0);
+}
+
+
+//------------------------------------------------------------------------------------
+//-- ENTRADAS ------------------------------------------------------------------------
+//------------------------------------------------------------------------------------
+
+InterruptIn::InterruptIn(PinName pin) : _pin(pin), _level(0), _next(s_in_list){
+	s_in_list = this;
+}
+
+
+//------------------------------------------------------------------------------------
+InterruptIn::~InterruptIn(){
+	for(InterruptIn** p = &s_in_list; *p; p = &(*p)->_next){
+		if(*p == this){
+			*p = _next;
+			break;
+		}
+	}
+}
+
+
+//------------------------------------------------------------------------------------
+void InterruptIn::set(int level){
+	level = (level != 0)? 1 : 0;
+	if(level == _level){
+		return;
+	}
+	_level = level;
+	const Callback<void()>& cb = (level)? _rise : _fall;
+	if(cb){
+		cb.call();
+	}
+}
+
+
+//------------------------------------------------------------------------------------
+InterruptIn* InterruptIn::find(PinName pin){
+	for(InterruptIn* in = s_in_list; in; in = in->_next){
+		if(in->_pin == pin){
+			return in;
+		}
+	}
+	return NULL;
+}
+
+
+//------------------------------------------------------------------------------------
+//-- ZEROCROSS -----------------------------------------------------------------------
+//------------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------------
+Zerocross::Zerocross(PinName pin) : _pin(pin), _level(EdgeInactive), _next(s_zc_list){
+	s_zc_list = this;
+}
+
+
+//------------------------------------------------------------------------------------
+Zerocross::~Zerocross(){
+	for(Zerocross** p = &s_zc_list; *p; p = &(*p)->_next){
+		if(*p == this){
+			*p = _next;
+			break;
+		}
+	}
+}
+
+
+//------------------------------------------------------------------------------------
+void Zerocross::enableEvents(LogicLevel level, Callback<void(LogicLevel)> cb){
+	_level = (LogicLevel)(_level | level);
+	_cb = cb;
+}
+
+
+//------------------------------------------------------------------------------------
+void Zerocross::disableEvents(LogicLevel level){
+	_level = (LogicLevel)(_level & ~level);
+}
+
+
+//------------------------------------------------------------------------------------
+void Zerocross::edge(LogicLevel level){
+	if((_level & level) != 0 && _cb){
+		struct timespec t0, t1;
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		_cb.call(level);
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		_isr_ns.push_back((uint32_t)(((t1.tv_sec - t0.tv_sec) * 1000000000ll) + (t1.tv_nsec - t0.tv_nsec)));
+	}
+}
+
+
+//------------------------------------------------------------------------------------
+Zerocross* Zerocross::find(PinName pin){
+	for(Zerocross* zc = s_zc_list; zc; zc = zc->_next){
+		if(zc->_pin == pin){
+			return zc;
+		}
+	}
+	return NULL;
+}
+
+
+//------------------------------------------------------------------------------------
+//-- GENERADOR DE RED ----------------------------------------------------------------
+//------------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------------
+ZcGenerator::ZcGenerator(PinName pin, float freq_hz) : _pin(pin), _half_us(500000.0 / freq_hz), _t0(0), _k(0), _running(false),
+		_detector_us(0), _jitter_us(0), _glitch_per_mil(0), _drop_from(0), _drop_to(0), _seed(0x2545F491), _edges(0), _glitches(0){
+}
+
+
+//------------------------------------------------------------------------------------
+ZcGenerator::~ZcGenerator(){
+	stop();
+}
+
+
+//------------------------------------------------------------------------------------
+void ZcGenerator::start(uint32_t phase_us){
+	_t0 = (double)HostSim::now() + phase_us;
+	_k = 0;
+	_running = true;
+	isrCrossing();
+}
+
+
+//------------------------------------------------------------------------------------
+void ZcGenerator::stop(){
+	_running = false;
+	_tmr.detach();
+	_glitch_tmr.detach();
+}
+
+
+//------------------------------------------------------------------------------------
+double ZcGenerator::lastCrossing(double t) const {
+	return _t0 + (floor((t - _t0) / _half_us) * _half_us);
+}
+
+
+//------------------------------------------------------------------------------------
+double ZcGenerator::nextCrossing(double t) const {
+	return lastCrossing(t) + _half_us;
+}
+
+
+//------------------------------------------------------------------------------------
+double ZcGenerator::crossingError(double t) const {
+	double d = t - lastCrossing(t);
+	return (d > (_half_us / 2))? (d - _half_us) : d;
+}
+
+
+//------------------------------------------------------------------------------------
+uint32_t ZcGenerator::rnd(){
+	_seed ^= _seed << 13;
+	_seed ^= _seed >> 17;
+	_seed ^= _seed << 5;
+	return _seed;
+}
+
+
+//------------------------------------------------------------------------------------
+void ZcGenerator::isrCrossing(){
+	if(!_running){
+		return;
+	}
+	// entrega el flanco del paso por cero programado (salvo la primera llamada, desde start)
+	uint64_t now = HostSim::now();
+	if(_k > 0){
+		double crossing = _t0 + ((_k - 1) * _half_us);
+		if(!(crossing >= (double)_drop_from && crossing < (double)_drop_to)){
+			deliver(((_k - 1) % 2 == 0)? Zerocross::EdgeActiveIsRise : Zerocross::EdgeActiveIsFall);
+		}
+		// flanco espurio entre este paso por cero y el siguiente
+		if(_glitch_per_mil > 0 && (rnd() % 1000) < _glitch_per_mil){
+			_glitch_tmr.attach_us(callback(this, &ZcGenerator::isrGlitch), 1 + (rnd() % (uint32_t)(_half_us - 1)));
+		}
+	}
+
+	// programa el siguiente con el retardo del detector y el jitter
+	double crossing = _t0 + (_k * _half_us);
+	double jitter = (_jitter_us > 0)? ((double)(rnd() % ((2 * _jitter_us) + 1)) - _jitter_us) : 0;
+	double at = crossing + _detector_us + jitter;
+	uint64_t due = (at > (double)now)? (uint64_t)llround(at) : now;
+	_k++;
+	_tmr.attach_us(callback(this, &ZcGenerator::isrCrossing), due - now);
+}
+
+
+//------------------------------------------------------------------------------------
+void ZcGenerator::isrGlitch(){
+	uint64_t now = HostSim::now();
+	if(now >= _drop_from && now < _drop_to){
+		return;
+	}
+	_glitches++;
+	deliver((rnd() & 1)? Zerocross::EdgeActiveIsRise : Zerocross::EdgeActiveIsFall);
+}
+
+
+//------------------------------------------------------------------------------------
+void ZcGenerator::deliver(Zerocross::LogicLevel level){
+	Zerocross* zc = Zerocross::find(_pin);
+	_edges++;
+	if(zc){
+		zc->edge(level);
+	}
+}
+
+
+//------------------------------------------------------------------------------------
+//-- RELAY ---------------------------------------------------------------------------
+//------------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------------
+Relay::Relay(uint32_t id, uint32_t on_latency_us, uint32_t off_latency_us) : _id(id), _on_us(on_latency_us), _off_us(off_latency_us),
+		_jitter_us(0), _on_drift(0), _off_drift(0), _bounces(0), _bounce_us(0), _seed(0x9E3779B9 ^ (id + 1)), _cmd_on(false),
+		_closed(false), _commands(0), _sense_pin(NC){
+}
+
+
+//------------------------------------------------------------------------------------
+void Relay::turnOn(){
+	command(true);
+}
+
+
+//------------------------------------------------------------------------------------
+void Relay::turnOff(){
+	command(false);
+}
+
+
+//------------------------------------------------------------------------------------
+uint32_t Relay::rnd(){
+	_seed ^= _seed << 13;
+	_seed ^= _seed >> 17;
+	_seed ^= _seed << 5;
+	return _seed;
+}
+
+
+//------------------------------------------------------------------------------------
+void Relay::command(bool on){
+	_commands++;
+	if(on == _cmd_on){
+		return;
+	}
+	_cmd_on = on;
+
+	// latencia mecánica con jitter, que deriva tras cada operación
+	uint64_t now = HostSim::now();
+	int32_t lat = (int32_t)((on)? _on_us : _off_us);
+	if(_jitter_us > 0){
+		lat += (int32_t)(rnd() % ((2 * _jitter_us) + 1)) - (int32_t)_jitter_us;
+	}
+	lat = (lat > 0)? lat : 0;
+	if(on){
+		_on_us = (uint32_t)((int32_t)_on_us + _on_drift);
+	}
+	else{
+		_off_us = (uint32_t)((int32_t)_off_us + _off_drift);
+	}
+	uint64_t t = now + (uint32_t)lat;
+	if(!_edges.empty() && t <= _edges.back().t){
+		t = _edges.back().t + 1;
+	}
+	Operation op = {now, t, on};
+	_history.push_back(op);
+
+	// cambio del contacto y rebotes al cerrar
+	ContactEdge e = {t, on};
+	_edges.push_back(e);
+	for(uint8_t b = 1; on && b <= _bounces; b++){
+		ContactEdge open = {t + ((2 * b) - 1) * _bounce_us, false};
+		ContactEdge close = {t + (2 * b) * _bounce_us, true};
+		_edges.push_back(open);
+		_edges.push_back(close);
+	}
+	if(!_tmr._scheduled){
+		_tmr.attach_us(callback(this, &Relay::isrContact), _edges.front().t - now);
+	}
+}
+
+
+//------------------------------------------------------------------------------------
+void Relay::isrContact(){
+	uint64_t now = HostSim::now();
+	while(!_edges.empty() && _edges.front().t <= now){
+		ContactEdge e = _edges.front();
+		_edges.pop_front();
+		_closed = e.closed;
+		InterruptIn* in = (_sense_pin != NC)? InterruptIn::find(_sense_pin) : NULL;
+		if(in){
+			in->set(e.closed);
+		}
+		for(size_t i = 0; i < _observers.size(); i++){
+			_observers[i].call(e.closed, e.t);
+		}
+	}
+	if(!_edges.empty()){
+		_tmr.attach_us(callback(this, &Relay::isrContact), _edges.front().t - now);
+	}
+}
+
+
+//------------------------------------------------------------------------------------
+//-- RELAY FEEDBACK ------------------------------------------------------------------
+//------------------------------------------------------------------------------------
+
+/** Ventana de filtrado de rebotes del detector de feedback */
+static const uint64_t FeedbackDebounceUs = 3000;
+
+
+//------------------------------------------------------------------------------------
+RelayFeedback::RelayFeedback(Relay* relay, ZcGenerator* mains) : _relay(relay), _mains(mains), _running(false), _last_closed(false),
+		_has_make(false), _has_break(false), _make_us(0), _break_us(0), _outlier_us(0){
+	_relay->addObserver(callback(this, &RelayFeedback::contactChanged));
+}
+
+
+//------------------------------------------------------------------------------------
+void RelayFeedback::start(){
+	_running = true;
+	_has_make = false;
+	_has_break = false;
+	_last_closed = _relay->isClosed();
+}
+
+
+//------------------------------------------------------------------------------------
+void RelayFeedback::pause(){
+	_running = false;
+}
+
+
+//------------------------------------------------------------------------------------
+void RelayFeedback::resume(){
+	_running = true;
+	_last_closed = _relay->isClosed();
+}
+
+
+//------------------------------------------------------------------------------------
+void RelayFeedback::stop(){
+	_running = false;
+}
+
+
+//------------------------------------------------------------------------------------
+void RelayFeedback::contactChanged(bool closed, uint64_t t){
+	if(!_running || closed == _last_closed){
+		return;
+	}
+	// filtra los rebotes tras cada cambio registrado
+	uint64_t last = (_make_us > _break_us)? _make_us : _break_us;
+	if((_has_make || _has_break) && (t - last) < FeedbackDebounceUs){
+		return;
+	}
+	_last_closed = closed;
+	if(closed){
+		_has_make = true;
+		_make_us = t;
+	}
+	else{
+		_has_break = true;
+		_break_us = t;
+	}
+}
+
+
+//------------------------------------------------------------------------------------
+RelayFeedback::Status RelayFeedback::getResult(uint32_t* t_on_us, uint32_t* t_off_us, uint32_t* t_sc_us, uint32_t delta_us){
+	*t_on_us = 0;
+	*t_off_us = 0;
+	*t_sc_us = 0;
+	if(!_has_make && !_has_break){
+		return (Status)(ErrorTimeOnHigh | ErrorTimeOnLow | ErrorTimeOffHigh | ErrorTimeOffLow);
+	}
+	double tsc = _mains->halfPeriodUs();
+	double ton = (_has_make)? ((double)_make_us - _mains->lastCrossing((double)_make_us)) : 0;
+	double toff = (_has_break)? (_mains->nextCrossing((double)_break_us) - (double)_break_us) : 0;
+	if(_outlier_us != 0){
+		ton = fmod(ton + _outlier_us + tsc, tsc);
+		toff = fmod(toff - _outlier_us + tsc, tsc);
+		_outlier_us = 0;
+	}
+	*t_on_us = (uint32_t)llround(ton);
+	*t_off_us = (uint32_t)llround(toff);
+	*t_sc_us = (uint32_t)llround(tsc);
+
+	// fuera de margen si el contacto conmuta a más de delta del paso por cero
+	uint32_t status = 0;
+	uint32_t sc = *t_sc_us;
+	if(_has_make && *t_on_us > delta_us && (sc - *t_on_us) > delta_us){
+		status |= (*t_on_us < sc / 2)? ErrorTimeOnHigh : ErrorTimeOnLow;
+	}
+	if(_has_break && *t_off_us > delta_us && (sc - *t_off_us) > delta_us){
+		status |= (*t_off_us < sc / 2)? ErrorTimeOffLow : ErrorTimeOffHigh;
+	}
+	return (Status)status;
+}
+
+/**** END OF FILE ****/
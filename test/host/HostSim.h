@@ -0,0 +1,91 @@
+/*
+ * HostSim.h
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ *
+ *	Núcleo del banco de simulación en el host. Mantiene el reloj virtual (us) y los temporizadores pendientes, y hace
+ *	avanzar la simulación de evento en evento: en cada instante ejecuta en contexto ISR los temporizadores vencidos
+ *	(Timeout, flancos del generador de red, contactos de los relés) y después despacha los eventos de las tareas de
+ *	todos los módulos hasta que quedan bloqueadas. El tiempo de proceso de las tareas es nulo, de forma que las
+ *	medidas son reproducibles y sólo dependen de la lógica del componente y de los modelos.
+ *
+ *	También da acceso al bus MQ simulado (publicaciones registradas) y a la memoria NV en RAM.
+ */
+
+#ifndef __HOST_HOSTSIM__H
+#define __HOST_HOSTSIM__H
+
+#include "mbed.h"
+#include "ActiveModule.h"
+#include <string>
+#include <vector>
+#include <map>
+
+
+namespace HostSim {
+
+/** Publicación registrada en el bus */
+struct Publication {
+	uint64_t t;
+	std::string topic;
+	std::vector<uint8_t> data;
+};
+
+/** Reinicia la simulación: reloj a 0, sin temporizadores, suscripciones, publicaciones ni datos en memoria NV */
+void reset();
+
+/** Despacha los eventos de todas las tareas hasta que quedan bloqueadas, sin avanzar el reloj */
+void settle();
+
+/** Avanza la simulación hasta el instante 't_us' */
+void runUntil(uint64_t t_us);
+
+/** Avanza la simulación 'us' microsegundos */
+void runFor(uint64_t us);
+
+/** Número de temporizadores ejecutados desde el último reinicio */
+uint64_t firedTimers();
+
+/** Registro de módulos activos (lo gestiona ActiveModule) */
+void addModule(ActiveModule* mod);
+void removeModule(ActiveModule* mod);
+
+/** Publicaciones registradas en el bus */
+std::vector<Publication>& publications();
+
+/** Busca la última publicación en el topic indicado desde el instante 'since_us'. Devuelve NULL si no hay */
+const Publication* lastPublication(const char* topic, uint64_t since_us = 0);
+
+/** Cuenta las publicaciones en el topic indicado desde el instante 'since_us' */
+uint32_t countPublications(const char* topic, uint64_t since_us = 0);
+
+/** Habilita el registro de publicaciones (por defecto habilitado) */
+void setRecording(bool enable);
+
+/** Memoria NV: claves "<fs>/<clave>" */
+std::map<std::string, std::vector<uint8_t> >& nvs();
+
+/** Provoca el fallo de las siguientes grabaciones en memoria NV */
+void setNvsWriteFailure(bool fail);
+
+/** Número de grabaciones en memoria NV realizadas */
+uint32_t nvsWrites();
+
+/** Registra el resultado de una comprobación de un test. Los fallos se notifican y se acumulan */
+bool check(bool ok, const char* expr, const char* file, int line);
+
+/** Número de comprobaciones fallidas */
+uint32_t failures();
+
+/** Notifica el resultado final y devuelve el código de salida del test */
+int report(const char* name);
+
+}
+
+/** Comprobación de los tests, que continúan tras un fallo */
+#define SIM_CHECK(expr)	HostSim::check((expr), #expr, __FILE__, __LINE__)
+
+#endif /*__HOST_HOSTSIM__H */
+
+/**** END OF FILE ****/
@@ -0,0 +1,124 @@
+/*
+ * Relay.h
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ *
+ *	Driver Relay del banco de simulación en el host, con un modelo mecánico del relé: el contacto cierra o abre tras
+ *	una latencia configurable (con jitter y deriva por operación) y puede rebotar. Cada cambio del contacto se
+ *	registra y se notifica a los observadores (modelos de feedback), en contexto ISR.
+ */
+
+#ifndef __HOST_RELAY__H
+#define __HOST_RELAY__H
+
+#include "mbed.h"
+#include <vector>
+#include <deque>
+
+
+class Relay {
+  public:
+
+	/** Operación del relé: instante de la orden y del primer cambio del contacto */
+	struct Operation {
+		uint64_t cmdUs;
+		uint64_t contactUs;
+		bool on;
+	};
+
+	/** Crea un relé con las latencias mecánicas de cierre y apertura indicadas */
+	Relay(uint32_t id, uint32_t on_latency_us = 9000, uint32_t off_latency_us = 7000);
+
+	uint32_t getId(){
+		return _id;
+	}
+
+	/** Órdenes del driver, invocables en contexto ISR */
+	void turnOn();
+	void turnOff();
+
+	/** Parámetros del modelo mecánico */
+	void setLatency(uint32_t on_us, uint32_t off_us){
+		_on_us = on_us;
+		_off_us = off_us;
+	}
+	void setJitter(uint32_t jitter_us){
+		_jitter_us = jitter_us;
+	}
+	/** Deriva de las latencias por operación (us) */
+	void setDrift(int32_t on_us_per_op, int32_t off_us_per_op){
+		_on_drift = on_us_per_op;
+		_off_drift = off_us_per_op;
+	}
+	/** Rebotes al cerrar: número de aperturas espurias y duración de cada una */
+	void setBounce(uint8_t count, uint32_t width_us){
+		_bounces = count;
+		_bounce_us = width_us;
+	}
+	/** Entrada digital que sigue el estado del contacto (nivel alto con el contacto cerrado) */
+	void setSensePin(PinName pin){
+		_sense_pin = pin;
+	}
+	void setSeed(uint32_t seed){
+		_seed = (seed != 0)? seed : 1;
+	}
+	uint32_t onLatency() const {
+		return _on_us;
+	}
+	uint32_t offLatency() const {
+		return _off_us;
+	}
+
+	/** Estado ordenado y estado del contacto */
+	bool isOn() const {
+		return _cmd_on;
+	}
+	bool isClosed() const {
+		return _closed;
+	}
+
+	/** Órdenes recibidas y operaciones realizadas */
+	uint32_t commands() const {
+		return _commands;
+	}
+	const std::vector<Operation>& history() const {
+		return _history;
+	}
+
+	/** Registra un observador de los cambios del contacto (closed, instante) */
+	void addObserver(Callback<void(bool, uint64_t)> cb){
+		_observers.push_back(cb);
+	}
+
+  private:
+	struct ContactEdge {
+		uint64_t t;
+		bool closed;
+	};
+	void command(bool on);
+	void isrContact();
+	uint32_t rnd();
+
+	uint32_t _id;
+	uint32_t _on_us;
+	uint32_t _off_us;
+	uint32_t _jitter_us;
+	int32_t _on_drift;
+	int32_t _off_drift;
+	uint8_t _bounces;
+	uint32_t _bounce_us;
+	uint32_t _seed;
+	bool _cmd_on;
+	bool _closed;
+	uint32_t _commands;
+	std::vector<Operation> _history;
+	std::deque<ContactEdge> _edges;
+	std::vector<Callback<void(bool, uint64_t)> > _observers;
+	PinName _sense_pin;
+	Timeout _tmr;
+};
+
+#endif /*__HOST_RELAY__H */
+
+/**** END OF FILE ****/
@@ -0,0 +1,74 @@
+/*
+ * RelayFeedback.h
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ *
+ *	Driver RelayFeedback del banco de simulación en el host. Observa el contacto del relé mientras la captura está en
+ *	marcha y mide, respecto de los pasos por cero reales del generador de red, el retardo desde el paso por cero
+ *	hasta el cierre (Ton) y desde la apertura hasta el paso por cero siguiente (Toff), junto con el semiciclo (Tsc).
+ *	Se pueden inyectar medidas anómalas para probar el rechazo de la calibración.
+ */
+
+#ifndef __HOST_RELAYFEEDBACK__H
+#define __HOST_RELAYFEEDBACK__H
+
+#include "mbed.h"
+#include "Relay.h"
+#include "Zerocross.h"
+
+
+class RelayFeedback {
+  public:
+
+	enum Status {
+		ErrorTimeOnHigh = (1 << 0),
+		ErrorTimeOnLow = (1 << 1),
+		ErrorTimeOffHigh = (1 << 2),
+		ErrorTimeOffLow = (1 << 3),
+	};
+
+	/** Tiempo de pre-captura necesario antes de una conmutación (ms) */
+	static const uint32_t DefaultPreviousCaptureTime = 50;
+
+	/** Porcentaje del semiciclo fuera del margen de conmutación */
+	static const uint32_t DefaultDeltaPercent = 95;
+
+	RelayFeedback(Relay* relay, ZcGenerator* mains);
+
+	/** Control de la captura */
+	void start();
+	void pause();
+	void resume();
+	void stop();
+
+	/** Resultado de la captura: Tsc es 0 si no se ha capturado ninguna conmutación */
+	Status getResult(uint32_t* t_on_us, uint32_t* t_off_us, uint32_t* t_sc_us, uint32_t delta_us);
+
+	/** Suma 'offset_us' a la siguiente medida obtenida */
+	void injectOutlier(int32_t offset_us){
+		_outlier_us = offset_us;
+	}
+
+	/** Indica si la captura está en marcha */
+	bool capturing() const {
+		return _running;
+	}
+
+  private:
+	void contactChanged(bool closed, uint64_t t);
+
+	Relay* _relay;
+	ZcGenerator* _mains;
+	bool _running;
+	bool _last_closed;
+	bool _has_make;
+	bool _has_break;
+	uint64_t _make_us;
+	uint64_t _break_us;
+	int32_t _outlier_us;
+};
+
+#endif /*__HOST_RELAYFEEDBACK__H */
+
+/**** END OF FILE ****/
@@ -0,0 +1,105 @@
+/*
+ * RelayManagerProbe.h
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ *
+ *	Acceso de los tests en el host a las constantes y al estado interno de RelayManager (clase amiga).
+ */
+
+#ifndef __HOST_RELAYMANAGERPROBE__H
+#define __HOST_RELAYMANAGERPROBE__H
+
+#include "RelayManager.h"
+
+
+class RelayManagerProbe {
+  public:
+	typedef RelayManager::MainsPll MainsPll;
+	typedef RelayManager::CalEstimate CalEstimate;
+
+	static const uint32_t DefaultSwitchingDelay = RelayManager::DefaultSwitchingDelay;
+	static const uint32_t DefaultSwitchingDelta = RelayManager::DefaultSwitchingDelta;
+	static const uint32_t MaxSwitchingDelay = RelayManager::MaxSwitchingDelay;
+	static const uint32_t PersistIdleMs = RelayManager::PersistIdleMs;
+	static const uint32_t PersistMinIntervalMs = RelayManager::PersistMinIntervalMs;
+	static const uint8_t MaxGroupRelays = RelayManager::MaxGroupRelays;
+	static const uint32_t MaxQueueMessages = RelayManager::MaxQueueMessages;
+	static const uint32_t TimedTickFlag = RelayManager::TimedTickFlag;
+	static const uint32_t HealthReportFlag = RelayManager::HealthReportFlag;
+	static const uint32_t ZcLossTimeoutUs = RelayManager::ZcLossTimeoutUs;
+	static const uint32_t ZcSupervisionUs = RelayManager::ZcSupervisionUs;
+	static const uint8_t PllLockEdges = RelayManager::PllLockEdges;
+	static const uint8_t PllMaxRejects = RelayManager::PllMaxRejects;
+	static const uint32_t PllMaxMissedEdges = RelayManager::PllMaxMissedEdges;
+	static const uint32_t PllMinLeadUs = RelayManager::PllMinLeadUs;
+	static const uint16_t CalMinSamples = RelayManager::CalMinSamples;
+	static const uint8_t CalMaxOutliers = RelayManager::CalMaxOutliers;
+	static const uint32_t CalMaxStepDiv = RelayManager::CalMaxStepDiv;
+	static const uint8_t FdbRingSize = RelayManager::FdbRingSize;
+
+	/** Tamaño de la entrada de un relé en la tabla y de sus componentes principales (RelayPerf es 0 sin
+	 *  RELAYMANAGER_RELAY_PERF) */
+	static const size_t HandlerSize = sizeof(RelayManager::RelayHandler);
+	static const size_t RelayPerfSize = (RELAYMANAGER_RELAY_PERF)? sizeof(RelayManager::RelayPerf) : 0;
+	static const size_t SnapshotSize = sizeof(RelayManager::RelaySnapshot);
+	static const size_t HealthSize = sizeof(RelayManager::RelayHealth);
+
+	/** Publica un evento como lo haría una ISR */
+	static void postIsrEvent(RelayManager* mgr, uint32_t flag){
+		mgr->postIsrEvent(flag);
+	}
+
+	/** Mensajes en la cola de la tarea */
+	static uint32_t queueCount(RelayManager* mgr){
+		return mgr->_queue.count();
+	}
+
+	/** Reserva y libera un mensaje del pool de comandos */
+	static void* allocCmdMsg(RelayManager* mgr){
+		return mgr->allocCmdMsg();
+	}
+	static void freeCmdMsg(RelayManager* mgr, void* cmd){
+		mgr->freeCmdMsg((RelayManager::CmdMsg*)cmd);
+	}
+
+	/** Fija los retardos de conmutación aplicados a un relé */
+	static void setDelays(RelayManager* mgr, uint8_t id, uint32_t on_us, uint32_t off_us){
+		mgr->_relay_list[id].cfg.delayOnUs = on_us;
+		mgr->_relay_list[id].cfg.delayOffUs = off_us;
+	}
+
+	/** Graba la configuración de todos los relés en memoria NV */
+	static bool writeConfig(RelayManager* mgr){
+		return mgr->writeConfigBlob();
+	}
+
+	/** Estimador de red de una fase */
+	static MainsPll pll(RelayManager* mgr, uint8_t phase = 0){
+		return mgr->_phases[phase].pll;
+	}
+
+	/** Descarta la estimación de red de una fase */
+	static void resetPll(RelayManager* mgr, uint8_t phase = 0){
+		core_util_critical_section_enter();
+		memset(&mgr->_phases[phase].pll, 0, sizeof(MainsPll));
+		core_util_critical_section_exit();
+	}
+
+	/** Estimador de red y calibración sobre estados proporcionados por el test */
+	static void pllUpdate(RelayManager* mgr, MainsPll& pll, uint32_t ts){
+		mgr->pllUpdate(pll, ts);
+	}
+	static bool calUpdate(RelayManager* mgr, CalEstimate* est, uint32_t* delay_us, int32_t err_us, uint32_t tsc){
+		return mgr->calUpdate(est, delay_us, err_us, tsc);
+	}
+
+	/** Comandos aceptados en la cola */
+	static uint32_t commands(RelayManager* mgr){
+		return mgr->_perf.commands;
+	}
+};
+
+#endif /*__HOST_RELAYMANAGERPROBE__H */
+
+/**** END OF FILE ****/
@@ -0,0 +1,92 @@
+/*
+ * SimRig.h
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ *
+ *	Montaje común de los tests en el host: red sintética con su entrada zerocross, un grupo de relés con su feedback
+ *	y un RelayManager conectado al bus simulado con el topic base "rlyman".
+ */
+
+#ifndef __HOST_SIMRIG__H
+#define __HOST_SIMRIG__H
+
+#include "HostSim.h"
+#include "RelayManagerProbe.h"
+#include <math.h>
+
+
+class SimRig {
+  public:
+
+	/** Pin de la entrada zerocross simulada */
+	static const PinName ZcPin = 1;
+
+	/** Primer pin de las entradas de lectura del contacto (una por relé) */
+	static const PinName SensePin = 16;
+
+	/** Crea el montaje. Sin zerocross (zc = false) el RelayManager conmuta sin sincronizar. Con sense = true el
+	 *  contacto de cada relé se lee en una entrada digital (SensePin + id) en lugar de con el driver de feedback */
+	SimRig(uint8_t num_relays, float freq_hz = 50.0f, bool zc = true, bool feedback = true, bool sense = false) : mains(ZcPin, freq_hz), fs("sim"), _count(num_relays){
+		HostSim::reset();
+		mgr = (zc)? new RelayManager(ZcPin, Zerocross::EdgeActiveAreBoth, num_relays, &fs) : new RelayManager(num_relays, &fs);
+		for(uint8_t i = 0; i < num_relays; i++){
+			relay[i] = new Relay(i);
+			fdb[i] = (feedback && !sense)? new RelayFeedback(relay[i], &mains) : NULL;
+			if(sense){
+				relay[i]->setSensePin(SensePin + i);
+				mgr->addRelayHandler(relay[i], SensePin + i);
+			}
+			else{
+				mgr->addRelayHandler(relay[i], fdb[i]);
+			}
+		}
+	}
+
+	~SimRig(){
+		delete mgr;
+		for(uint8_t i = 0; i < _count; i++){
+			delete fdb[i];
+			delete relay[i];
+		}
+	}
+
+	/** Arranca la red y el módulo, y deja que el estimador de red se enganche */
+	void start(uint32_t phase_us = 3000, uint32_t settle_ms = 300){
+		mains.start(phase_us);
+		mgr->setPublicationBase("rlyman");
+		mgr->setSubscriptionBase("rlyman");
+		HostSim::runFor(settle_ms * 1000);
+	}
+
+	/** Solicita una acción sobre un relé */
+	void send(uint8_t id, Blob::RlyManEvtFlags request){
+		Blob::RlyManAction_t action = {id, request};
+		MQ::MQClient::publish("set/value/rlyman", &action, sizeof(action), NULL);
+	}
+
+	/** Solicita una desconexión de emergencia */
+	void shed(uint32_t mask){
+		Blob::RlyManShedAction_t action = {mask};
+		MQ::MQClient::publish("set/shed/rlyman", &action, sizeof(action), NULL);
+	}
+
+	/** Error (us) del último cambio del contacto de un relé respecto del paso por cero real más cercano */
+	double lastContactError(uint8_t id){
+		const std::vector<Relay::Operation>& h = relay[id]->history();
+		return (h.empty())? 1e9 : mains.crossingError((double)h.back().contactUs);
+	}
+
+	ZcGenerator mains;
+	FSManager fs;
+	RelayManager* mgr;
+	Relay* relay[RelayManagerProbe::MaxGroupRelays];
+	RelayFeedback* fdb[RelayManagerProbe::MaxGroupRelays];
+
+  private:
+	uint8_t _count;
+};
+
+#endif /*__HOST_SIMRIG__H */
+
+/**** END OF FILE ****/
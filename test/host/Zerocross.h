@@ -0,0 +1,156 @@
+/*
+ * Zerocross.h
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ *
+ *	Driver Zerocross del banco de simulación en el host y generador sintético de la red (ZcGenerator). El generador
+ *	produce los pasos por cero de una red de frecuencia dada y entrega los flancos, en contexto ISR, a la entrada
+ *	Zerocross del mismo pin, con retardo del detector, jitter, flancos espurios y cortes configurables. Conoce los
+ *	pasos por cero reales, que sirven de referencia a los modelos de feedback y a las medidas de los tests.
+ */
+
+#ifndef __HOST_ZEROCROSS__H
+#define __HOST_ZEROCROSS__H
+
+#include "mbed.h"
+#include <vector>
+
+
+//------------------------------------------------------------------------------------
+//-- ZEROCROSS -----------------------------------------------------------------------
+//------------------------------------------------------------------------------------
+
+class Zerocross {
+  public:
+
+	enum LogicLevel {
+		EdgeInactive = 0,
+		EdgeActiveIsRise = 1,
+		EdgeActiveIsFall = 2,
+		EdgeActiveAreBoth = 3,
+	};
+
+	Zerocross(PinName pin);
+	~Zerocross();
+
+	/** Habilita los eventos en los flancos indicados */
+	void enableEvents(LogicLevel level, Callback<void(LogicLevel)> cb);
+
+	/** Deshabilita los eventos en los flancos indicados */
+	void disableEvents(LogicLevel level);
+
+	/** Entrega un flanco de la entrada (invocado por el generador, en contexto ISR) */
+	void edge(LogicLevel level);
+
+	/** Busca la entrada asociada a un pin */
+	static Zerocross* find(PinName pin);
+
+	/** Tiempo de proceso en el host (ns) de cada callback de flanco entregada, para las medidas de rendimiento */
+	const std::vector<uint32_t>& isrTimes() const {
+		return _isr_ns;
+	}
+	void clearIsrTimes(){
+		_isr_ns.clear();
+	}
+
+  private:
+	PinName _pin;
+	LogicLevel _level;
+	Callback<void(LogicLevel)> _cb;
+	Zerocross* _next;
+	std::vector<uint32_t> _isr_ns;
+};
+
+
+//------------------------------------------------------------------------------------
+//-- GENERADOR DE RED ----------------------------------------------------------------
+//------------------------------------------------------------------------------------
+
+class ZcGenerator {
+  public:
+
+	/** Crea un generador para la entrada zerocross del pin indicado, con la frecuencia de red dada */
+	ZcGenerator(PinName pin, float freq_hz = 50.0f);
+	~ZcGenerator();
+
+	/** Inicia los pasos por cero en el instante actual más 'phase_us' */
+	void start(uint32_t phase_us = 0);
+
+	/** Detiene la generación */
+	void stop();
+
+	/** Retardo fijo del detector desde el paso por cero real hasta el flanco */
+	void setDetectorDelay(uint32_t delay_us){
+		_detector_us = delay_us;
+	}
+
+	/** Jitter uniforme del flanco en +-jitter_us */
+	void setJitter(uint32_t jitter_us){
+		_jitter_us = jitter_us;
+	}
+
+	/** Probabilidad (por mil) de un flanco espurio entre dos pasos por cero */
+	void setGlitchRate(uint32_t per_mil){
+		_glitch_per_mil = per_mil;
+	}
+
+	/** Suprime los flancos entre 'from_us' y 'to_us' (tiempo absoluto de simulación) */
+	void setDropout(uint64_t from_us, uint64_t to_us){
+		_drop_from = from_us;
+		_drop_to = to_us;
+	}
+
+	/** Semilla del generador pseudoaleatorio */
+	void setSeed(uint32_t seed){
+		_seed = (seed != 0)? seed : 1;
+	}
+
+	/** Semiperiodo de la red (us, fraccionario) */
+	double halfPeriodUs() const {
+		return _half_us;
+	}
+
+	/** Último paso por cero real anterior o igual a 't' (sin límite inferior: extrapola antes del inicio) */
+	double lastCrossing(double t) const;
+
+	/** Siguiente paso por cero real estrictamente posterior a 't' */
+	double nextCrossing(double t) const;
+
+	/** Distancia con signo de 't' al paso por cero real más cercano */
+	double crossingError(double t) const;
+
+	/** Flancos entregados y suprimidos */
+	uint32_t edges() const {
+		return _edges;
+	}
+	uint32_t glitches() const {
+		return _glitches;
+	}
+
+  private:
+	uint32_t rnd();
+	void isrCrossing();
+	void isrGlitch();
+	void deliver(Zerocross::LogicLevel level);
+
+	PinName _pin;
+	double _half_us;
+	double _t0;
+	uint64_t _k;
+	bool _running;
+	uint32_t _detector_us;
+	uint32_t _jitter_us;
+	uint32_t _glitch_per_mil;
+	uint64_t _drop_from;
+	uint64_t _drop_to;
+	uint32_t _seed;
+	uint32_t _edges;
+	uint32_t _glitches;
+	Timeout _tmr;
+	Timeout _glitch_tmr;
+};
+
+#endif /*__HOST_ZEROCROSS__H */
+
+/**** END OF FILE ****/
@@ -0,0 +1,108 @@
+/*
+ * bench_pool.cpp
+ *
+ *	Medida del pool estático de mensajes de comando: coste de reserva y liberación frente al heap, y un millón de
+ *	comandos por el camino subscriptionCb -> cola -> Init_EventHandler comprobando que no se reserva memoria
+ *	dinámica en ese camino y que el heap no crece (las tareas periódicas, como el informe de salud, reservan y
+ *	liberan sus propios buffers).
+ *
+ *	make -C test/host bench
+ */
+
+#include "SimRig.h"
+#include <time.h>
+
+
+/** Tiempo de proceso en ns */
+static uint64_t cpuNs(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+/** Reserva y liberación de un mensaje del pool frente al par memAlloc/memFree que sustituye */
+static void benchAllocFree(){
+	static const uint32_t Loops = 10000000;
+	SimRig rig(1, 50.0f, false, false);
+	volatile uintptr_t sink = 0;
+
+	uint64_t t0 = cpuNs();
+	for(uint32_t n = 0; n < Loops; n++){
+		void* cmd = RelayManagerProbe::allocCmdMsg(rig.mgr);
+		sink += (uintptr_t)cmd;
+		RelayManagerProbe::freeCmdMsg(rig.mgr, cmd);
+	}
+	double pool_ns = (double)(cpuNs() - t0) / Loops;
+
+	t0 = cpuNs();
+	for(uint32_t n = 0; n < Loops; n++){
+		State::Msg* msg = (State::Msg*)Heap::memAlloc(sizeof(State::Msg));
+		msg->msg = Heap::memAlloc(sizeof(Blob::RlyManAction_t));
+		sink += (uintptr_t)msg;
+		Heap::memFree(msg->msg);
+		Heap::memFree(msg);
+	}
+	double heap_ns = (double)(cpuNs() - t0) / Loops;
+
+	RelayManager::PoolStats stats;
+	rig.mgr->getPoolStats(&stats);
+	SIM_CHECK(stats.allocs == Loops && stats.frees == Loops && stats.inUse == 0 && stats.poolDrops == 0 && stats.queueDrops == 0);
+	printf("pool alloc+free: %.1f ns/par, heap memAlloc+memFree (mensaje y datos): %.1f ns/par\n", pool_ns, heap_ns);
+}
+
+
+/** Un millón de comandos en ráfagas de 8 sin reservas dinámicas ni crecimiento del heap */
+static void benchMillionCommands(){
+	static const uint32_t Commands = 1000000;
+	static const uint8_t Relays = 8;
+	SimRig rig(Relays, 50.0f, false, false);
+	rig.start();
+	HostSim::setRecording(false);
+
+	// primera ráfaga fuera de la medida, para que los contenedores del banco alcancen su tamaño de régimen
+	for(uint8_t i = 0; i < Relays; i++){
+		rig.send(i, Blob::RlyManOn);
+	}
+	HostSim::runFor(150000);
+
+	uint32_t blocks = Heap::liveBlocks();
+	size_t bytes = Heap::liveBytes();
+	uint32_t cmd_allocs = 0;
+	uint32_t allocs = Heap::allocCount();
+	uint32_t cmds = RelayManagerProbe::commands(rig.mgr);
+	uint64_t t0 = cpuNs();
+	for(uint32_t n = 0; n < Commands; n += Relays){
+		Blob::RlyManEvtFlags req = (((n / Relays) & 1) == 0)? Blob::RlyManOff : Blob::RlyManOn;
+		// camino del comando: publicación, admisión en la cola y despacho hasta el inicio del lote
+		uint32_t a = Heap::allocCount();
+		for(uint8_t i = 0; i < Relays; i++){
+			rig.send(i, req);
+		}
+		HostSim::settle();
+		cmd_allocs += Heap::allocCount() - a;
+		HostSim::runFor(150000);
+	}
+	double secs = (double)(cpuNs() - t0) / 1e9;
+
+	RelayManager::PoolStats stats;
+	rig.mgr->getPoolStats(&stats);
+	SIM_CHECK(RelayManagerProbe::commands(rig.mgr) - cmds == Commands);
+	SIM_CHECK(cmd_allocs == 0);
+	SIM_CHECK(Heap::liveBlocks() == blocks && Heap::liveBytes() == bytes);
+	SIM_CHECK(stats.inUse == 0 && stats.poolDrops == 0 && stats.queueDrops == 0 && stats.maxInUse <= Relays);
+	for(uint8_t i = 0; i < Relays; i++){
+		SIM_CHECK(rig.relay[i]->isOn() == ((((Commands / Relays) - 1) & 1) != 0));
+	}
+	printf("%u comandos en %.2f s (%.0f comandos/s con la simulación), reservas heap en el camino del comando: %u, "
+		   "en tareas periódicas: %u, heap vivo: %u bloques/%zu bytes -> %u bloques/%zu bytes, pool maxInUse: %u\n",
+		   Commands, secs, Commands / secs, cmd_allocs, Heap::allocCount() - allocs - cmd_allocs, blocks, bytes,
+		   Heap::liveBlocks(), Heap::liveBytes(), stats.maxInUse);
+}
+
+
+int main(){
+	benchAllocFree();
+	benchMillionCommands();
+	return HostSim::report("bench_pool");
+}
@@ -0,0 +1,208 @@
+/*
+ * bench_switching.cpp
+ *
+ *	Medidas de conmutación por relé y por modelo de carga, en formato JSON para poder compararlas entre versiones:
+ *
+ *	- error del cambio del contacto respecto del paso por cero real (media con signo y percentiles 50/99 y máximo
+ *	  del valor absoluto), medido sobre la simulación y no sobre la estimación del propio módulo.
+ *	- latencia de extremo a extremo desde la publicación del comando hasta la de su stat/value, por separado para el
+ *	  encendido y el apagado.
+ *	- comandos/s por el camino subscriptionCb -> cola -> Init_EventHandler (tiempo de proceso en el host).
+ *	- tiempo de proceso en el host de isrZerocrossCb por flanco.
+ *
+ *	Cada modelo de carga fija la mecánica de los relés (latencias con una dispersión del 5% entre relés, jitter,
+ *	rebotes y deriva por desgaste) y la calidad de la red (frecuencia, jitter del detector y flancos espurios). El
+ *	JSON se escribe en el fichero indicado como primer argumento (por defecto bench_switching.json) e incluye también
+ *	la salida de getPerfJson() del módulo.
+ *
+ *	make -C test/host bench
+ */
+
+#include "SimRig.h"
+#include <time.h>
+#include <algorithm>
+#include <numeric>
+
+
+/** Modelo de carga */
+struct LoadModel {
+	const char* name;
+	float freqHz;
+	uint32_t onUs;
+	uint32_t offUs;
+	uint32_t jitterUs;
+	int32_t driftOnUs;
+	int32_t driftOffUs;
+	uint8_t bounces;
+	uint32_t bounceUs;
+	uint32_t zcJitterUs;
+	uint32_t zcGlitchPerMil;
+};
+
+static const LoadModel Models[] = {
+	{"resistive", 50.0f, 9000, 7000, 50, 0, 0, 0, 0, 0, 0},
+	{"motor", 50.0f, 11000, 8500, 150, 0, 0, 2, 300, 0, 0},
+	{"worn", 50.0f, 9000, 7000, 100, 6, -4, 0, 0, 0, 0},
+	{"noisy-mains", 50.0f, 9000, 7000, 50, 0, 0, 0, 0, 150, 100},
+	{"resistive-60hz", 60.0f, 9000, 7000, 50, 0, 0, 0, 0, 0, 0},
+};
+
+/** Relés por montaje, operaciones por relé (las primeras sin medir, mientras converge la calibración) y ráfagas de
+ *  comandos para la medida de comandos/s */
+static const uint8_t Relays = 4;
+static const int Operations = 200;
+static const int WarmupOperations = 20;
+static const int ThroughputBursts = 5000;
+
+
+/** Tiempo de proceso en ns */
+static uint64_t cpuNs(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+/** Generador pseudoaleatorio de la fase de los comandos */
+static uint32_t s_seed = 0x2545F491;
+static uint32_t random(uint32_t range){
+	s_seed ^= s_seed << 13;
+	s_seed ^= s_seed >> 17;
+	s_seed ^= s_seed << 5;
+	return s_seed % range;
+}
+
+
+/** Percentil 'p' (0..1) del valor absoluto de un conjunto de muestras */
+static double absPercentile(std::vector<double> v, double p){
+	if(v.empty()){
+		return 0;
+	}
+	for(size_t i = 0; i < v.size(); i++){
+		v[i] = fabs(v[i]);
+	}
+	std::sort(v.begin(), v.end());
+	return v[(size_t)(p * (v.size() - 1))];
+}
+
+
+/** Escribe la media con signo y los percentiles del valor absoluto de un conjunto de muestras */
+static void printStats(FILE* f, const std::vector<double>& v){
+	double mean = (v.empty())? 0 : (std::accumulate(v.begin(), v.end(), 0.0) / v.size());
+	fprintf(f, "{\"n\":%zu,\"mean\":%.1f,\"p50\":%.1f,\"p99\":%.1f,\"max\":%.1f}", v.size(), mean,
+			absPercentile(v, 0.5), absPercentile(v, 0.99), absPercentile(v, 1.0));
+}
+
+
+/** Ejecuta un modelo de carga y escribe su objeto JSON */
+static void benchModel(FILE* f, const LoadModel& m){
+	SimRig rig(Relays, m.freqHz);
+	for(uint8_t i = 0; i < Relays; i++){
+		// dispersión de fabricación del 5% entre relés
+		uint32_t k = 100 + (5 * i);
+		rig.relay[i]->setLatency((m.onUs * k) / 100, (m.offUs * k) / 100);
+		rig.relay[i]->setJitter(m.jitterUs);
+		rig.relay[i]->setDrift(m.driftOnUs, m.driftOffUs);
+		rig.relay[i]->setBounce(m.bounces, m.bounceUs);
+		rig.relay[i]->setSeed(i + 1);
+	}
+	rig.mains.setJitter(m.zcJitterUs);
+	rig.mains.setGlitchRate(m.zcGlitchPerMil);
+	rig.start();
+	Zerocross* zc = Zerocross::find(SimRig::ZcPin);
+	zc->clearIsrTimes();
+
+	// precisión y latencia: un comando por relé en cada ronda, con una fase aleatoria respecto de la red
+	std::vector<double> contact[Relays];
+	std::vector<double> latency[2][Relays];
+	for(int n = 0; n < Operations; n++){
+		HostSim::runFor(random(20000));
+		uint64_t t_cmd = HostSim::now();
+		size_t first_pub = HostSim::publications().size();
+		for(uint8_t i = 0; i < Relays; i++){
+			rig.send(i, ((n & 1) == 0)? Blob::RlyManOn : Blob::RlyManOff);
+		}
+		HostSim::runFor(300000);
+		if(n < WarmupOperations){
+			continue;
+		}
+		bool stat[Relays] = {false};
+		const std::vector<HostSim::Publication>& pubs = HostSim::publications();
+		for(size_t p = first_pub; p < pubs.size(); p++){
+			if(pubs[p].topic != "stat/value/rlyman"){
+				continue;
+			}
+			const Blob::RlyManAction_t* s = (const Blob::RlyManAction_t*)&pubs[p].data[0];
+			if(s->id < Relays && !stat[s->id]){
+				stat[s->id] = true;
+				latency[n & 1][s->id].push_back((double)(pubs[p].t - t_cmd));
+			}
+		}
+		for(uint8_t i = 0; i < Relays; i++){
+			SIM_CHECK(stat[i] && rig.relay[i]->isOn() == ((n & 1) == 0));
+			contact[i].push_back(rig.lastContactError(i));
+		}
+	}
+
+	// comandos/s: sólo se mide la publicación y el despacho hasta el inicio del lote, no la ejecución simulada
+	HostSim::setRecording(false);
+	uint32_t cmds = RelayManagerProbe::commands(rig.mgr);
+	uint64_t busy_ns = 0;
+	for(int n = 0; n < ThroughputBursts; n++){
+		uint64_t t0 = cpuNs();
+		for(uint8_t i = 0; i < Relays; i++){
+			rig.send(i, ((n & 1) == 0)? Blob::RlyManOn : Blob::RlyManOff);
+		}
+		HostSim::settle();
+		busy_ns += cpuNs() - t0;
+		HostSim::runFor(150000);
+	}
+	SIM_CHECK(RelayManagerProbe::commands(rig.mgr) - cmds == (uint32_t)(ThroughputBursts * Relays));
+	double cmd_per_sec = (ThroughputBursts * Relays) / ((double)busy_ns / 1e9);
+
+	std::vector<double> isr(zc->isrTimes().begin(), zc->isrTimes().end());
+	static char perf[2048];
+	int32_t perf_len = rig.mgr->getPerfJson(perf, sizeof(perf));
+	SIM_CHECK(perf_len > 0 && perf_len < (int32_t)sizeof(perf));
+
+	fprintf(f, "{\"model\":\"%s\",\"freqHz\":%.0f,\"zcJitterUs\":%u,\"zcGlitchPerMil\":%u,\"cmdPerSec\":%.0f,\"isrNs\":",
+			m.name, m.freqHz, m.zcJitterUs, m.zcGlitchPerMil, cmd_per_sec);
+	printStats(f, isr);
+	fprintf(f, ",\"relays\":[");
+	double max_p99 = 0;
+	for(uint8_t i = 0; i < Relays; i++){
+		fprintf(f, "%s{\"id\":%u,\"onUs\":%u,\"offUs\":%u,\"zcToContactUs\":", (i == 0)? "" : ",", i,
+				rig.relay[i]->onLatency(), rig.relay[i]->offLatency());
+		printStats(f, contact[i]);
+		fprintf(f, ",\"cmdToStatOnUs\":");
+		printStats(f, latency[0][i]);
+		fprintf(f, ",\"cmdToStatOffUs\":");
+		printStats(f, latency[1][i]);
+		fprintf(f, "}");
+		max_p99 = std::max(max_p99, absPercentile(contact[i], 0.99));
+	}
+	fprintf(f, "],\"componentPerf\":%s}", perf);
+	printf("%s: p99 del error del contacto (peor relé) %.0f us, %.0f comandos/s, ISR %.0f ns/flanco de media en %zu flancos\n",
+		   m.name, max_p99, cmd_per_sec, (isr.empty())? 0 : (std::accumulate(isr.begin(), isr.end(), 0.0) / isr.size()),
+		   isr.size());
+}
+
+
+int main(int argc, char* argv[]){
+	const char* path = (argc > 1)? argv[1] : "bench_switching.json";
+	FILE* f = fopen(path, "w");
+	if(f == NULL){
+		printf("bench_switching: no se puede crear %s\n", path);
+		return 1;
+	}
+	fprintf(f, "{\"bench\":\"bench_switching\",\"relaysPerModel\":%u,\"operationsPerRelay\":%d,\"warmupOperations\":%d,"
+			"\"models\":[", Relays, Operations, WarmupOperations);
+	for(size_t m = 0; m < sizeof(Models)/sizeof(Models[0]); m++){
+		fprintf(f, "%s", (m == 0)? "" : ",");
+		benchModel(f, Models[m]);
+	}
+	fprintf(f, "]}\n");
+	fclose(f);
+	printf("resultados en %s\n", path);
+	return HostSim::report("bench_switching");
+}
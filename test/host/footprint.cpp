@@ -0,0 +1,71 @@
+/*
+ * footprint.cpp
+ *
+ *	Aplicación mínima sobre una variante de tamaño fijo, para medir su consumo de RAM y de código:
+ *
+ *	- FOOTPRINT_RELAYS: número de relés.
+ *	- FOOTPRINT_ZC: 1 con zerocross propio, 0 sin zerocross.
+ *	- FOOTPRINT_FDB: 1 con feedback (un driver RelayFeedback por relé), 0 sin feedback.
+ *
+ *	Conmuta una vez cada relé, de forma que todos los caminos que utiliza la variante quedan enlazados, y escribe
+ *	sizeof de la variante y de sus componentes. El código enlazado lo mide "make footprint" sobre el ejecutable.
+ */
+
+#include "SimRig.h"
+
+#ifndef FOOTPRINT_RELAYS
+#define FOOTPRINT_RELAYS	4
+#endif
+#ifndef FOOTPRINT_ZC
+#define FOOTPRINT_ZC		1
+#endif
+#ifndef FOOTPRINT_FDB
+#define FOOTPRINT_FDB		1
+#endif
+
+
+/** Variante medida */
+typedef StaticRelayManager<FOOTPRINT_RELAYS, FOOTPRINT_ZC, RelayManager::DefaultStackSize, FOOTPRINT_FDB> Variant;
+
+
+int main(){
+	HostSim::reset();
+	ZcGenerator mains(SimRig::ZcPin);
+	FSManager fs("sim");
+	Relay* relay[FOOTPRINT_RELAYS];
+	RelayFeedback* fdb[FOOTPRINT_RELAYS];
+#if FOOTPRINT_ZC
+	Variant* mgr = new Variant(SimRig::ZcPin, Zerocross::EdgeActiveAreBoth, &fs);
+#else
+	Variant* mgr = new Variant(&fs);
+#endif
+	for(uint8_t i = 0; i < FOOTPRINT_RELAYS; i++){
+		relay[i] = new Relay(i);
+		fdb[i] = (FOOTPRINT_FDB)? new RelayFeedback(relay[i], &mains) : NULL;
+		mgr->addRelayHandler(relay[i], fdb[i]);
+	}
+	mains.start(3000);
+	mgr->setPublicationBase("rlyman");
+	mgr->setSubscriptionBase("rlyman");
+	HostSim::runFor(300000);
+	for(uint8_t i = 0; i < FOOTPRINT_RELAYS; i++){
+		Blob::RlyManAction_t action = {i, Blob::RlyManOn};
+		MQ::MQClient::publish("set/value/rlyman", &action, sizeof(action), NULL);
+	}
+	HostSim::runFor(300000);
+	bool ok = true;
+	for(uint8_t i = 0; i < FOOTPRINT_RELAYS; i++){
+		ok = ok && relay[i]->isOn();
+	}
+
+	printf("relays=%d zc=%d fdb=%d relayPerf=%d sizeof=%zu handler=%zu perf=%zu snap=%zu health=%zu timeout=%zu%s\n",
+		   FOOTPRINT_RELAYS, FOOTPRINT_ZC, FOOTPRINT_FDB, RELAYMANAGER_RELAY_PERF, sizeof(Variant),
+		   RelayManagerProbe::HandlerSize, RelayManagerProbe::RelayPerfSize, RelayManagerProbe::SnapshotSize,
+		   RelayManagerProbe::HealthSize, sizeof(Timeout), (ok)? "" : " FALLO");
+	delete mgr;
+	for(uint8_t i = 0; i < FOOTPRINT_RELAYS; i++){
+		delete fdb[i];
+		delete relay[i];
+	}
+	return (ok)? 0 : 1;
+}
@@ -0,0 +1,415 @@
+/*
+ * mbed.h
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ *
+ *	Capa mbed del banco de simulación en el host. Sólo declara la parte del API que utiliza RelayManager (ver la
+ *	sección "Platform dependencies" del README), implementada sobre el reloj virtual y el planificador de HostSim:
+ *	us_ticker_read() devuelve el reloj virtual, los Timeout se ejecutan al avanzar la simulación en contexto ISR y las
+ *	colas son FIFO acotadas sin bloqueo. La simulación es de un único hilo, por lo que las secciones críticas y las
+ *	operaciones atómicas no necesitan protección.
+ */
+
+#ifndef __HOST_MBED__H
+#define __HOST_MBED__H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <functional>
+
+
+//------------------------------------------------------------------------------------
+//-- TIPOS BÁSICOS -------------------------------------------------------------------
+//------------------------------------------------------------------------------------
+
+typedef int PinName;
+static const PinName NC = -1;
+
+typedef uint64_t us_timestamp_t;
+
+typedef enum {
+	osOK = 0,
+	osEventSignal = 0x08,
+	osEventMessage = 0x10,
+	osEventMail = 0x20,
+	osEventTimeout = 0x40,
+	osErrorResource = -3,
+	osErrorTimeout = -2,
+} osStatus;
+
+typedef enum {
+	osPriorityLow = -2,
+	osPriorityBelowNormal = -1,
+	osPriorityNormal = 0,
+	osPriorityAboveNormal = 1,
+	osPriorityHigh = 2,
+} osPriority;
+
+#define osWaitForever	0xFFFFFFFFu
+
+typedef struct {
+	osStatus status;
+	union {
+		uint32_t v;
+		void* p;
+		int32_t signals;
+	} value;
+} osEvent;
+
+/** Las aserciones fallidas abortan la simulación con su localización */
+#define MBED_ASSERT(expr)	do{ if(!(expr)){ fprintf(stderr, "MBED_ASSERT(%s) en %s:%d\n", #expr, __FILE__, __LINE__); abort(); } }while(0)
+#define MBED_STATIC_ASSERT(expr, msg)	static_assert(expr, msg)
+
+#define __packed	__attribute__((packed))
+#define __DMB()		__sync_synchronize()
+
+
+//------------------------------------------------------------------------------------
+//-- NÚCLEO DE SIMULACIÓN ------------------------------------------------------------
+//------------------------------------------------------------------------------------
+
+class Timeout;
+
+namespace HostSim {
+
+/** Instante actual del reloj virtual (us) */
+uint64_t now();
+
+/** Indica si se está ejecutando una callback de temporizador o de entrada (contexto ISR) */
+bool inIsr();
+
+/** Programa (o reprograma) un temporizador para que venza en 'due' */
+void schedule(Timeout* tmr, uint64_t due);
+
+/** Cancela un temporizador programado */
+void cancel(Timeout* tmr);
+
+/** Notifica que una cola se ha consultado estando vacía */
+void noteQueueEmpty();
+
+}
+
+/** Fuente de tiempo única: reloj virtual truncado a 32 bits, como el ticker del micro */
+extern "C" uint32_t us_ticker_read();
+
+#define IS_ISR()	(HostSim::inIsr())
+
+
+//------------------------------------------------------------------------------------
+//-- CALLBACKS -----------------------------------------------------------------------
+//------------------------------------------------------------------------------------
+
+template <typename F> class Callback;
+
+/** Callback compatible con la de mbed: función libre, método de un objeto o función con argumento ligado */
+template <typename R, typename... A>
+class Callback<R(A...)> {
+  public:
+	Callback(R(*f)(A...) = 0){
+		if(f){
+			_f = f;
+		}
+	}
+	template <typename T, typename U>
+	Callback(U* obj, R(T::*method)(A...)){
+		T* o = obj;
+		_f = [o, method](A... a)->R { return (o->*method)(a...); };
+	}
+	template <typename T, typename U>
+	Callback(R(*f)(T*, A...), U* arg){
+		T* o = arg;
+		_f = [f, o](A... a)->R { return f(o, a...); };
+	}
+	R call(A... a) const {
+		return _f(a...);
+	}
+	R operator()(A... a) const {
+		return _f(a...);
+	}
+	operator bool() const {
+		return (bool)_f;
+	}
+	/** Sólo se compara con NULL (callbacks vacías) */
+	bool operator==(const Callback& other) const {
+		return ((bool)_f == (bool)other._f);
+	}
+	bool operator!=(const Callback& other) const {
+		return !(*this == other);
+	}
+  private:
+	std::function<R(A...)> _f;
+};
+
+template <typename T, typename U, typename R, typename... A>
+Callback<R(A...)> callback(U* obj, R(T::*method)(A...)){
+	return Callback<R(A...)>(obj, method);
+}
+
+template <typename T, typename U, typename R, typename... A>
+Callback<R(A...)> callback(R(*f)(T*, A...), U* arg){
+	return Callback<R(A...)>(f, arg);
+}
+
+template <typename R, typename... A>
+Callback<R(A...)> callback(R(*f)(A...)){
+	return Callback<R(A...)>(f);
+}
+
+
+//------------------------------------------------------------------------------------
+//-- TEMPORIZADORES ------------------------------------------------------------------
+//------------------------------------------------------------------------------------
+
+class NonCopyable {
+  protected:
+	NonCopyable(){}
+	~NonCopyable(){}
+  private:
+	NonCopyable(const NonCopyable&);
+	NonCopyable& operator=(const NonCopyable&);
+};
+
+
+/** Temporizador one-shot sobre el reloj virtual. La callback se ejecuta en contexto ISR */
+class Timeout : private NonCopyable {
+  public:
+	Timeout() : _scheduled(false), _due(0), _seq(0){}
+	virtual ~Timeout(){
+		detach();
+	}
+	void attach_us(Callback<void()> f, us_timestamp_t t){
+		_cb = f;
+		HostSim::schedule(this, HostSim::now() + t);
+	}
+	void attach(Callback<void()> f, float t){
+		attach_us(f, (us_timestamp_t)(t * 1000000.0f));
+	}
+	void detach(){
+		if(_scheduled){
+			HostSim::cancel(this);
+		}
+	}
+
+	/** Datos gestionados por el planificador */
+	Callback<void()> _cb;
+	bool _scheduled;
+	uint64_t _due;
+	uint64_t _seq;
+
+	/** Invocada por el planificador al vencer */
+	virtual void fire(){
+		_cb.call();
+	}
+};
+
+
+/** Temporizador periódico sobre el reloj virtual */
+class Ticker : public Timeout {
+  public:
+	Ticker() : _period(0){}
+	void attach_us(Callback<void()> f, us_timestamp_t t){
+		_period = t;
+		Timeout::attach_us(f, t);
+	}
+	virtual void fire(){
+		HostSim::schedule(this, _due + _period);
+		_cb.call();
+	}
+  private:
+	us_timestamp_t _period;
+};
+
+
+/** Cronómetro sobre el reloj virtual */
+class Timer : private NonCopyable {
+  public:
+	Timer() : _start(0), _acc(0), _running(false){}
+	void start(){
+		if(!_running){
+			_start = HostSim::now();
+			_running = true;
+		}
+	}
+	void stop(){
+		if(_running){
+			_acc += HostSim::now() - _start;
+			_running = false;
+		}
+	}
+	void reset(){
+		_acc = 0;
+		_start = HostSim::now();
+	}
+	us_timestamp_t read_high_resolution_us(){
+		return _acc + ((_running)? (HostSim::now() - _start) : 0);
+	}
+	int read_us(){
+		return (int)read_high_resolution_us();
+	}
+	int read_ms(){
+		return (int)(read_high_resolution_us() / 1000);
+	}
+  private:
+	uint64_t _start;
+	uint64_t _acc;
+	bool _running;
+};
+
+
+//------------------------------------------------------------------------------------
+//-- ENTRADAS ------------------------------------------------------------------------
+//------------------------------------------------------------------------------------
+
+/** Entrada digital con interrupciones por flanco. Los modelos del banco la excitan con set(), p.ej. el contacto de
+ *  un relé (Relay::setSensePin) */
+class InterruptIn : private NonCopyable {
+  public:
+	InterruptIn(PinName pin);
+	~InterruptIn();
+	void rise(Callback<void()> cb){
+		_rise = cb;
+	}
+	void fall(Callback<void()> cb){
+		_fall = cb;
+	}
+	int read(){
+		return _level;
+	}
+	operator int(){
+		return _level;
+	}
+
+	/** Fija el nivel de la entrada e invoca la callback del flanco si cambia */
+	void set(int level);
+
+	/** Busca la entrada asociada a un pin */
+	static InterruptIn* find(PinName pin);
+
+  private:
+	PinName _pin;
+	int _level;
+	Callback<void()> _rise;
+	Callback<void()> _fall;
+	InterruptIn* _next;
+};
+
+
+//------------------------------------------------------------------------------------
+//-- RTOS ----------------------------------------------------------------------------
+//------------------------------------------------------------------------------------
+
+/** Cola acotada de punteros. Al ser de un único hilo no bloquea: put falla si está llena y get devuelve
+ *  osEventTimeout si está vacía */
+template <typename T, uint32_t N>
+class Queue : private NonCopyable {
+  public:
+	Queue() : _head(0), _count(0), _max(0){}
+	osStatus put(T* data, uint32_t millisec = 0, uint8_t prio = 0){
+		(void)millisec;
+		(void)prio;
+		if(_count >= N){
+			return osErrorResource;
+		}
+		_buf[(_head + _count) % N] = data;
+		_count++;
+		_max = (_count > _max)? _count : _max;
+		return osOK;
+	}
+	osEvent get(uint32_t millisec = osWaitForever){
+		(void)millisec;
+		osEvent oe;
+		if(_count == 0){
+			HostSim::noteQueueEmpty();
+			oe.status = osEventTimeout;
+			oe.value.p = NULL;
+			return oe;
+		}
+		oe.status = osEventMessage;
+		oe.value.p = _buf[_head];
+		_head = (_head + 1) % N;
+		_count--;
+		return oe;
+	}
+	bool empty() const {
+		return (_count == 0);
+	}
+	bool full() const {
+		return (_count >= N);
+	}
+	uint32_t count() const {
+		return _count;
+	}
+	/** Ocupación máxima alcanzada (sólo en el host) */
+	uint32_t maxCount() const {
+		return _max;
+	}
+  private:
+	T* _buf[N];
+	uint32_t _head;
+	uint32_t _count;
+	uint32_t _max;
+};
+
+
+class Mutex {
+  public:
+	osStatus lock(uint32_t millisec = osWaitForever){
+		(void)millisec;
+		return osOK;
+	}
+	osStatus unlock(){
+		return osOK;
+	}
+};
+
+
+class Semaphore {
+  public:
+	Semaphore(int32_t count = 0, uint16_t max_count = 1) : _count(count){
+		(void)max_count;
+	}
+	int32_t wait(uint32_t millisec = osWaitForever){
+		(void)millisec;
+		return (_count > 0)? _count-- : 0;
+	}
+	osStatus release(){
+		_count++;
+		return osOK;
+	}
+  private:
+	int32_t _count;
+};
+
+
+//------------------------------------------------------------------------------------
+//-- SECCIONES CRÍTICAS Y OPERACIONES ATÓMICAS ----------------------------------------
+//------------------------------------------------------------------------------------
+
+inline void core_util_critical_section_enter(){}
+inline void core_util_critical_section_exit(){}
+
+inline bool core_util_atomic_cas_u32(volatile uint32_t* ptr, uint32_t* expected, uint32_t desired){
+	if(*ptr == *expected){
+		*ptr = desired;
+		return true;
+	}
+	*expected = *ptr;
+	return false;
+}
+
+inline uint32_t core_util_atomic_incr_u32(volatile uint32_t* ptr, uint32_t delta){
+	return (*ptr += delta);
+}
+
+inline uint32_t core_util_atomic_decr_u32(volatile uint32_t* ptr, uint32_t delta){
+	return (*ptr -= delta);
+}
+
+#endif /*__HOST_MBED__H */
+
+/**** END OF FILE ****/
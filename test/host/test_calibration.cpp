@@ -0,0 +1,244 @@
+/*
+ * test_calibration.cpp
+ *
+ *	Pruebas de la calibración adaptativa del retardo de conmutación: convergencia desde un retardo inicial erróneo,
+ *	seguimiento de la deriva del relé, rechazo de medidas anómalas y readquisición tras un cambio real, paso del
+ *	retardo por el extremo del rango admitido (equivalencia módulo el semiciclo) y convergencia de extremo a extremo
+ *	con el modelo de relé y de feedback. Se compara con el ajuste por pasos fijos de +-delta que sustituye.
+ */
+
+#include "SimRig.h"
+
+
+/** Semiciclo de la red de 50 Hz */
+static const uint32_t Tsc = 10000;
+
+/** Ruido aproximadamente gaussiano (suma de tres uniformes) de desviación típica 'sigma' */
+static uint32_t s_seed = 0x9E3779B9;
+static double noise(double sigma){
+	double sum = 0;
+	for(int i = 0; i < 3; i++){
+		s_seed ^= s_seed << 13;
+		s_seed ^= s_seed >> 17;
+		s_seed ^= s_seed << 5;
+		sum += ((double)(s_seed % 20001) / 10000.0) - 1.0;
+	}
+	return sum * sigma;
+}
+
+
+/** Error de fase medido por el feedback con un retardo aplicado frente al óptimo real: positivo si el contacto
+ *  conmuta tarde, módulo el semiciclo */
+static double phaseError(double delay_us, double opt_us){
+	double e = fmod(delay_us - opt_us, (double)Tsc);
+	e = (e < -(double)Tsc/2)? (e + Tsc) : ((e >= (double)Tsc/2)? (e - Tsc) : e);
+	return e;
+}
+
+
+/** Calibración sobre un estado inicial: retardo aplicado y estimación vacía */
+struct Cal {
+	RelayManagerProbe::CalEstimate est;
+	uint32_t delay;
+	Cal(uint32_t delay_us) : delay(delay_us){
+		memset(&est, 0, sizeof(est));
+	}
+	/** Aplica una medida y devuelve el error de fase de la conmutación medida */
+	double step(RelayManager* mgr, double opt_us, double sigma, double outlier = 0){
+		double e = phaseError(delay, opt_us);
+		int32_t meas = (int32_t)floor(phaseError(delay + noise(sigma) + outlier, opt_us) + 0.5);
+		RelayManagerProbe::calUpdate(mgr, &est, &delay, meas, Tsc);
+		return e;
+	}
+};
+
+
+/** Ajuste por pasos fijos de +-delta de la calibración anterior, como referencia */
+static double bangBangStep(uint32_t* delay, double opt_us, double sigma){
+	double e = phaseError(*delay, opt_us);
+	double meas = e + noise(sigma);
+	if(meas > RelayManagerProbe::DefaultSwitchingDelta){
+		*delay -= RelayManagerProbe::DefaultSwitchingDelta;
+	}
+	else if(meas < -(double)RelayManagerProbe::DefaultSwitchingDelta){
+		*delay += RelayManagerProbe::DefaultSwitchingDelta;
+	}
+	return e;
+}
+
+
+/** Desde un retardo inicial erróneo converge en pocas operaciones y queda con un error residual del orden del
+ *  ruido de medida, frente a las decenas de operaciones y la oscilación del ajuste por pasos fijos */
+static void testConvergence(){
+	static const double Offsets[] = {3130, -2470, 4410, -4380, 790};
+	SimRig rig(1, 50.0f, false, false);
+	for(int o = 0; o < 5; o++){
+		double opt = 14230;
+		Cal cal((uint32_t)(opt + Offsets[o]));
+		uint32_t bb = (uint32_t)(opt + Offsets[o]);
+		int conv = -1;
+		int bb_conv = -1;
+		double rms = 0;
+		double bb_rms = 0;
+		for(int k = 0; k < 200; k++){
+			double e = cal.step(rig.mgr, opt, 100);
+			double bb_e = bangBangStep(&bb, opt, 100);
+			conv = (fabs(e) > 200)? -1 : ((conv < 0)? k : conv);
+			bb_conv = (fabs(bb_e) > 200)? -1 : ((bb_conv < 0)? k : bb_conv);
+			if(k >= 100){
+				rms += e * e;
+				bb_rms += bb_e * bb_e;
+			}
+		}
+		rms = sqrt(rms / 100);
+		bb_rms = sqrt(bb_rms / 100);
+		SIM_CHECK(conv >= 0 && conv <= 8);
+		SIM_CHECK(rms < 100);
+		SIM_CHECK(cal.est.var < 2 * 90000.0f);
+		char bb_ops[16];
+		snprintf(bb_ops, sizeof(bb_ops), (bb_conv >= 0)? "%d" : "más de 200", bb_conv);
+		printf("calibración desde %+.0f us: dentro de 200 us en %d operaciones, error eficaz %.0f us "
+			   "(pasos fijos: %s operaciones, %.0f us)\n", Offsets[o], conv, rms, bb_ops, bb_rms);
+	}
+}
+
+
+/** Sigue una deriva continua del relé (desgaste) con un error acotado */
+static void testDriftTracking(){
+	SimRig rig(1, 50.0f, false, false);
+	double opt = 12000;
+	Cal cal((uint32_t)opt);
+	double max_err = 0;
+	for(int k = 0; k < 400; k++){
+		double e = cal.step(rig.mgr, opt, 100);
+		if(k > 20){
+			max_err = (fabs(e) > max_err)? fabs(e) : max_err;
+		}
+		// +10 us por operación: 4 ms a lo largo de la prueba
+		opt += 10;
+	}
+	SIM_CHECK(max_err < 500);
+	printf("seguimiento de una deriva de 10 us/operación: error máximo %.0f us\n", max_err);
+}
+
+
+/** Las medidas anómalas aisladas no modifican el retardo. Varias seguidas se toman como un cambio real del relé,
+ *  que se readquiere en pocas operaciones */
+static void testOutliersAndStepChange(){
+	SimRig rig(1, 50.0f, false, false);
+	double opt = 16000;
+	Cal cal((uint32_t)opt + 1500);
+	for(int k = 0; k < 30; k++){
+		cal.step(rig.mgr, opt, 100);
+	}
+	uint16_t outliers = 0;
+	for(int k = 0; k < 100; k++){
+		uint32_t before = cal.delay;
+		bool outlier = ((k % 10) == 5);
+		double e = cal.step(rig.mgr, opt, 100, (outlier)? ((k & 1)? 3000 : -3500) : 0);
+		if(outlier){
+			outliers++;
+			SIM_CHECK(cal.delay == before);
+		}
+		SIM_CHECK(fabs(e) < 400);
+	}
+	SIM_CHECK(cal.est.outliers == outliers);
+
+	// cambio real del relé: tras CalMaxOutliers medidas rechazadas se acepta y converge de nuevo
+	opt += 2200;
+	int conv = -1;
+	for(int k = 0; k < 40; k++){
+		double e = cal.step(rig.mgr, opt, 100);
+		conv = (fabs(e) > 200)? -1 : ((conv < 0)? k : conv);
+	}
+	SIM_CHECK(conv >= 0 && conv <= RelayManagerProbe::CalMaxOutliers + 8);
+	printf("%u medidas anómalas rechazadas, cambio real de 2200 us readquirido en %d operaciones\n", outliers, conv);
+}
+
+
+/** El retardo óptimo está definido módulo el semiciclo: si cae fuera del rango admitido se calibra el equivalente
+ *  un semiciclo más allá, sin saltos al cruzar el extremo ni confusiones con errores cercanos a medio semiciclo */
+static void testHalfCycleWrap(){
+	SimRig rig(1, 50.0f, false, false);
+
+	// óptimo por debajo del mínimo: se calibra un semiciclo después
+	double opt = RelayManagerProbe::DefaultSwitchingDelay - 600;
+	Cal low(RelayManagerProbe::DefaultSwitchingDelay + 900);
+	double e = 0;
+	for(int k = 0; k < 40; k++){
+		e = low.step(rig.mgr, opt, 80);
+		SIM_CHECK(low.delay >= RelayManagerProbe::DefaultSwitchingDelay && low.delay < RelayManagerProbe::MaxSwitchingDelay);
+	}
+	SIM_CHECK(fabs(e) < 200 && fabs((double)low.delay - (opt + Tsc)) < 200);
+
+	// óptimo por encima del máximo: se calibra un semiciclo antes
+	opt = RelayManagerProbe::MaxSwitchingDelay + 700;
+	Cal high(RelayManagerProbe::MaxSwitchingDelay - 1200);
+	for(int k = 0; k < 40; k++){
+		e = high.step(rig.mgr, opt, 80);
+		SIM_CHECK(high.delay >= RelayManagerProbe::DefaultSwitchingDelay && high.delay < RelayManagerProbe::MaxSwitchingDelay);
+	}
+	SIM_CHECK(fabs(e) < 200 && fabs((double)high.delay - (opt - Tsc)) < 200);
+
+	// óptimo que deriva cruzando el mínimo: pasa al equivalente sin perder la sincronización
+	opt = RelayManagerProbe::DefaultSwitchingDelay + 1000;
+	Cal drift((uint32_t)opt);
+	double max_err = 0;
+	for(int k = 0; k < 300; k++){
+		e = drift.step(rig.mgr, opt, 80);
+		max_err = (k > 5 && fabs(e) > max_err)? fabs(e) : max_err;
+		opt -= 8;
+	}
+	SIM_CHECK(drift.delay > opt + (Tsc / 2));
+	SIM_CHECK(max_err < 500);
+
+	// error inicial cercano a medio semiciclo: converge a uno de los dos equivalentes, sin oscilar entre ambos
+	opt = 20000;
+	Cal half((uint32_t)opt + (Tsc / 2) - 100);
+	for(int k = 0; k < 60; k++){
+		e = half.step(rig.mgr, opt, 100);
+	}
+	SIM_CHECK(fabs(e) < 300);
+	printf("paso por los extremos del rango: error máximo %.0f us durante la deriva a través del mínimo\n", max_err);
+}
+
+
+/** De extremo a extremo: relé con deriva, jitter y medidas anómalas del feedback. El contacto converge al paso por
+ *  cero en pocas operaciones y lo sigue */
+static void testEndToEndConvergence(){
+	SimRig rig(1);
+	rig.relay[0]->setLatency(12500, 6000);
+	rig.relay[0]->setJitter(80);
+	rig.relay[0]->setDrift(4, -3);
+	rig.start();
+	int conv = -1;
+	double max_err = 0;
+	for(int n = 0; n < 80; n++){
+		if(n > 30 && (n % 9) == 0){
+			rig.fdb[0]->injectOutlier(3500);
+		}
+		rig.send(0, ((n % 2) == 0)? Blob::RlyManOn : Blob::RlyManOff);
+		HostSim::runFor(300000);
+		double err = fabs(rig.lastContactError(0));
+		conv = (err > 300)? -1 : ((conv < 0)? n : conv);
+		max_err = (n > 20 && err > max_err)? err : max_err;
+	}
+	RelayManager::CalibrationInfo info;
+	SIM_CHECK(rig.mgr->getCalibrationInfo(0, &info));
+	SIM_CHECK(conv >= 0 && conv <= 12);
+	SIM_CHECK(max_err < 400);
+	SIM_CHECK(info.outliers > 0);
+	printf("de extremo a extremo: contacto a menos de 300 us del paso por cero desde la operación %d, error máximo "
+		   "posterior %.0f us, desviación estimada On/Off %u/%u us, %u medidas anómalas\n", conv, max_err,
+		   info.stdDevOnUs, info.stdDevOffUs, info.outliers);
+}
+
+
+int main(){
+	testConvergence();
+	testDriftTracking();
+	testOutliersAndStepChange();
+	testHalfCycleWrap();
+	testEndToEndConvergence();
+	return HostSim::report("test_calibration");
+}
@@ -0,0 +1,152 @@
+/*
+ * test_feedback.cpp
+ *
+ *	Pruebas de la captura del feedback: con la entrada de lectura del contacto los flancos se registran de forma
+ *	continua en un registro circular acotado, los comandos no esperan pre-captura y los relés que conmutan juntos se
+ *	calibran a la vez. Los flancos antiguos no se confunden con los del lote, el desbordamiento del registro se
+ *	detecta y no calibra, y la captura del driver RelayFeedback sólo está en marcha durante el lote.
+ */
+
+#include "SimRig.h"
+
+
+/** Latencia desde el comando hasta la orden al relé */
+static double commandLatency(SimRig& rig, uint8_t id, uint64_t t_cmd){
+	const std::vector<Relay::Operation>& h = rig.relay[id]->history();
+	return (h.empty())? 1e9 : (double)(h.back().cmdUs - t_cmd);
+}
+
+
+/** Con la entrada de feedback no hay espera de pre-captura: la orden se da en el primer paso por cero predicho
+ *  que permite conmutar. Con el driver se espera la pre-captura antes de cada lote */
+static void testNoPreCaptureWait(){
+	double lat[2] = {0, 0};
+	for(int sense = 0; sense < 2; sense++){
+		SimRig rig(1, 50.0f, true, true, sense != 0);
+		rig.start();
+		for(int n = 0; n < 10; n++){
+			HostSim::runFor(1370 * n);
+			uint64_t t_cmd = HostSim::now();
+			rig.send(0, ((n & 1) == 0)? Blob::RlyManOn : Blob::RlyManOff);
+			HostSim::runFor(300000);
+			double l = commandLatency(rig, 0, t_cmd);
+			lat[sense] = (l > lat[sense])? l : lat[sense];
+		}
+	}
+	double half = 10000;
+	SIM_CHECK(lat[1] < RelayManagerProbe::PllMinLeadUs + half + RelayManagerProbe::DefaultSwitchingDelay + 1);
+	SIM_CHECK(lat[0] >= RelayFeedback::DefaultPreviousCaptureTime * 1000);
+	printf("latencia máxima comando-orden: %.1f ms con la entrada de feedback, %.1f ms con el driver (pre-captura)\n",
+		   lat[1] / 1000, lat[0] / 1000);
+}
+
+
+/** Cuatro relés con latencias distintas y rebotes que conmutan siempre juntos convergen a la vez */
+static void testConcurrentCalibration(){
+	static const uint32_t OnUs[] = {12500, 9300, 15100, 7200};
+	static const uint32_t OffUs[] = {6000, 8800, 4100, 11700};
+	SimRig rig(4, 50.0f, true, true, true);
+	for(uint8_t i = 0; i < 4; i++){
+		rig.relay[i]->setLatency(OnUs[i], OffUs[i]);
+		rig.relay[i]->setJitter(80);
+		rig.relay[i]->setBounce(2, 300);
+		rig.relay[i]->setSeed(i + 7);
+	}
+	rig.start();
+	double max_err = 0;
+	for(int n = 0; n < 40; n++){
+		for(uint8_t i = 0; i < 4; i++){
+			rig.send(i, ((n & 1) == 0)? Blob::RlyManOn : Blob::RlyManOff);
+		}
+		HostSim::runFor(300000);
+		for(uint8_t i = 0; i < 4; i++){
+			double err = fabs(rig.lastContactError(i));
+			max_err = (n >= 12 && err > max_err)? err : max_err;
+		}
+	}
+	for(uint8_t i = 0; i < 4; i++){
+		RelayManager::CalibrationInfo info;
+		SIM_CHECK(rig.mgr->getCalibrationInfo(i, &info));
+		SIM_CHECK(info.samplesOn >= 19 && info.samplesOff >= 19 && info.fdbOverruns == 0);
+	}
+	SIM_CHECK(max_err < 300);
+	printf("calibración simultánea de 4 relés con rebotes: error máximo %.0f us desde la operación 12\n", max_err);
+}
+
+
+/** Los flancos anteriores al lote no se toman como medida. Si el lote produce más flancos de los que retiene el
+ *  registro, la conmutación queda sin medida y sin calibrar, y se contabiliza el desbordamiento */
+static void testStaleEdgesAndOverrun(){
+	SimRig rig(1, 50.0f, true, true, true);
+	rig.start();
+	InterruptIn* in = InterruptIn::find(SimRig::SensePin);
+	SIM_CHECK(in != NULL);
+
+	// ruido en la entrada con el relé en reposo, terminando en el nivel del contacto abierto
+	for(int n = 0; n < 100; n++){
+		in->set(((n & 1) == 0)? 1 : 0);
+		HostSim::runFor(1000);
+	}
+	rig.send(0, Blob::RlyManOn);
+	HostSim::runFor(300000);
+	uint32_t ton, toff, tsc;
+	RelayFeedback::Status st = rig.mgr->getFeedbackResult(0, &ton, &toff, &tsc);
+	const Relay::Operation& op = rig.relay[0]->history().back();
+	double real_ton = (double)op.contactUs - rig.mains.lastCrossing((double)op.contactUs);
+	SIM_CHECK(tsc == 10000 && fabs((double)ton - real_ton) <= 2.0);
+	SIM_CHECK((st & (RelayFeedback::ErrorTimeOffHigh | RelayFeedback::ErrorTimeOffLow)) == 0);
+
+	// rebotes que desbordan el registro: sin medida ni calibración
+	rig.relay[0]->setBounce(RelayManagerProbe::FdbRingSize, 200);
+	RelayManager::CalibrationInfo before, after;
+	SIM_CHECK(rig.mgr->getCalibrationInfo(0, &before));
+	rig.send(0, Blob::RlyManOff);
+	HostSim::runFor(300000);
+	rig.send(0, Blob::RlyManOn);
+	HostSim::runFor(300000);
+	SIM_CHECK(rig.mgr->getCalibrationInfo(0, &after));
+	SIM_CHECK(after.fdbOverruns == 1 && after.samplesOn == before.samplesOn && after.delayOnUs == before.delayOnUs);
+	SIM_CHECK(after.samplesOff == before.samplesOff + 1);
+	st = rig.mgr->getFeedbackResult(0, &ton, &toff, &tsc);
+	SIM_CHECK(tsc == 0);
+
+	// con los rebotes dentro del registro vuelve a medir
+	rig.relay[0]->setBounce(2, 300);
+	rig.send(0, Blob::RlyManOff);
+	HostSim::runFor(300000);
+	rig.send(0, Blob::RlyManOn);
+	HostSim::runFor(300000);
+	SIM_CHECK(rig.mgr->getCalibrationInfo(0, &after));
+	SIM_CHECK(after.fdbOverruns == 1 && after.samplesOn == before.samplesOn + 1);
+	printf("entrada de feedback: 100 flancos previos al lote ignorados, %u desbordamiento detectado con %u rebotes\n",
+		   after.fdbOverruns, RelayManagerProbe::FdbRingSize);
+}
+
+
+/** La captura del driver se arma al iniciar el lote y se detiene al obtener el resultado: no queda en marcha entre
+ *  acciones */
+static void testDriverCaptureBounded(){
+	SimRig rig(1);
+	rig.start();
+	SIM_CHECK(!rig.fdb[0]->capturing());
+	for(int n = 0; n < 4; n++){
+		rig.send(0, ((n & 1) == 0)? Blob::RlyManOn : Blob::RlyManOff);
+		HostSim::runFor(10000);
+		SIM_CHECK(rig.fdb[0]->capturing());
+		HostSim::runFor(300000);
+		SIM_CHECK(!rig.fdb[0]->capturing());
+		HostSim::runFor(5000000);
+		SIM_CHECK(!rig.fdb[0]->capturing());
+	}
+	RelayManager::CalibrationInfo info;
+	SIM_CHECK(rig.mgr->getCalibrationInfo(0, &info) && info.samplesOn == 2 && info.samplesOff == 2);
+}
+
+
+int main(){
+	testNoPreCaptureWait();
+	testConcurrentCalibration();
+	testStaleEdgesAndOverrun();
+	testDriverCaptureBounded();
+	return HostSim::report("test_feedback");
+}
@@ -0,0 +1,141 @@
+/*
+ * test_pipeline.cpp
+ *
+ *	Pruebas del camino de eventos de la tarea: avisos de eventos ISR en la cola, admisión de comandos mientras la
+ *	tarea está ocupada, liberación de los comandos del pool, y topics y reservas de memoria de las respuestas.
+ */
+
+#include "SimRig.h"
+
+
+/** Los eventos ISR repetidos mientras la tarea está ocupada (p.ej. en un volcado a NV) ocupan un único hueco de la
+ *  cola, y los comandos recibidos en ese tiempo se siguen admitiendo */
+static void testIsrEventsDoNotFillQueue(){
+	SimRig rig(8);
+	rig.start();
+	SIM_CHECK(RelayManagerProbe::queueCount(rig.mgr) == 0);
+
+	// sin despachar la tarea: ticks de la rueda y otros eventos repetidos
+	for(int n = 0; n < 100; n++){
+		RelayManagerProbe::postIsrEvent(rig.mgr, RelayManagerProbe::TimedTickFlag);
+		RelayManagerProbe::postIsrEvent(rig.mgr, RelayManagerProbe::HealthReportFlag);
+	}
+	SIM_CHECK(RelayManagerProbe::queueCount(rig.mgr) == 1);
+
+	// el resto de la cola queda para los comandos
+	uint32_t cmds = RelayManagerProbe::commands(rig.mgr);
+	for(uint32_t n = 0; n < RelayManagerProbe::MaxQueueMessages - 1; n++){
+		rig.send(n % 8, ((n / 8) == 0)? Blob::RlyManOn : Blob::RlyManOff);
+	}
+	SIM_CHECK(RelayManagerProbe::commands(rig.mgr) - cmds == RelayManagerProbe::MaxQueueMessages - 1);
+
+	// al reanudarse la tarea se atienden los eventos y los comandos
+	HostSim::runFor(500000);
+	SIM_CHECK(RelayManagerProbe::queueCount(rig.mgr) == 0);
+	for(int i = 0; i < 8; i++){
+		SIM_CHECK(rig.relay[i]->isOn() == (i >= 7));
+	}
+}
+
+
+/** Las consultas de la instantánea se responden en stat/snap, y stat/fdbk sólo lleva el aviso de feedback disponible */
+static void testSnapshotTopic(){
+	SimRig rig(2);
+	rig.start();
+	uint64_t t0 = HostSim::now();
+	rig.send(1, Blob::RlyManOn);
+	HostSim::runFor(300000);
+	const HostSim::Publication* p = HostSim::lastPublication("stat/fdbk/rlyman", t0);
+	SIM_CHECK(p != NULL && p->data.size() == 1 && p->data[0] == '1');
+
+	t0 = HostSim::now();
+	uint8_t id = 1;
+	MQ::MQClient::publish("get/fdbk/rlyman", &id, sizeof(id), NULL);
+	SIM_CHECK(HostSim::countPublications("stat/fdbk/rlyman", t0) == 0);
+	p = HostSim::lastPublication("stat/snap/rlyman", t0);
+	SIM_CHECK(p != NULL && p->data.size() == sizeof(Blob::RlyManRelayStat_t));
+	if(p){
+		Blob::RlyManRelayStat_t* stat = (Blob::RlyManRelayStat_t*)&p->data[0];
+		SIM_CHECK(stat->id == 1 && stat->state == Blob::RlyManOn && stat->switches == 1);
+	}
+}
+
+
+/** Las consultas en get/perf se responden desde la tarea a través del pool de comandos, sin reservar memoria */
+static void testPerfQueryWithoutHeap(){
+	SimRig rig(2);
+	rig.start();
+	rig.send(0, Blob::RlyManOn);
+	HostSim::runFor(300000);
+	uint64_t t0 = HostSim::now();
+	uint32_t allocs = Heap::allocCount();
+	for(int n = 0; n < 100; n++){
+		uint8_t id = n % 2;
+		MQ::MQClient::publish("get/perf/rlyman", &id, sizeof(id), NULL);
+		HostSim::settle();
+	}
+	SIM_CHECK(Heap::allocCount() == allocs);
+	RelayManager::PoolStats stats;
+	rig.mgr->getPoolStats(&stats);
+	SIM_CHECK(stats.inUse == 0 && stats.poolDrops == 0);
+	SIM_CHECK(HostSim::countPublications("stat/perf/rlyman", t0) == 100);
+	const HostSim::Publication* p = HostSim::lastPublication("stat/perf/rlyman", t0);
+	SIM_CHECK(p != NULL && p->data.size() > 2 && p->data[0] == '{' && p->data.back() == 0);
+}
+
+
+/** Los comandos del pool vuelven al pool tras su despacho, sin reservar memoria */
+static void testPoolCommandsReleasedAfterDispatch(){
+	SimRig rig(4, 50.0f, false, false);
+	rig.start();
+	RelayManager::PoolStats before;
+	rig.mgr->getPoolStats(&before);
+	uint32_t allocs = Heap::allocCount();
+	for(int n = 0; n < 250; n++){
+		for(uint8_t i = 0; i < 4; i++){
+			rig.send(i, ((n & 1) == 0)? Blob::RlyManOn : Blob::RlyManOff);
+		}
+		HostSim::settle();
+		HostSim::runFor(150000);
+	}
+	RelayManager::PoolStats after;
+	rig.mgr->getPoolStats(&after);
+	SIM_CHECK(after.allocs - before.allocs == 1000 && after.frees - before.frees == 1000);
+	SIM_CHECK(after.inUse == 0 && after.poolDrops == 0 && after.queueDrops == 0);
+	SIM_CHECK(Heap::allocCount() == allocs);
+	for(uint8_t i = 0; i < 4; i++){
+		SIM_CHECK(!rig.relay[i]->isOn() && rig.relay[i]->commands() == 250);
+	}
+}
+
+
+/** Con el pool agotado los comandos se descartan y se contabilizan, y el pool se recupera tras el despacho */
+static void testPoolExhaustedDropsCounted(){
+	SimRig rig(2, 50.0f, false, false);
+	rig.start();
+	RelayManager::PoolStats before;
+	rig.mgr->getPoolStats(&before);
+	const uint32_t sent = RelayManagerProbe::MaxQueueMessages + 4;
+	for(uint32_t n = 0; n < sent; n++){
+		rig.send(n % 2, ((n / 2) & 1)? Blob::RlyManOff : Blob::RlyManOn);
+	}
+	RelayManager::PoolStats full;
+	rig.mgr->getPoolStats(&full);
+	SIM_CHECK(full.inUse == RelayManagerProbe::MaxQueueMessages && full.poolDrops - before.poolDrops == 4);
+	HostSim::settle();
+	HostSim::runFor(150000);
+	RelayManager::PoolStats after;
+	rig.mgr->getPoolStats(&after);
+	SIM_CHECK(after.inUse == 0 && after.queueDrops == before.queueDrops);
+	SIM_CHECK(after.frees - before.frees == RelayManagerProbe::MaxQueueMessages);
+}
+
+
+int main(){
+	testIsrEventsDoNotFillQueue();
+	testSnapshotTopic();
+	testPerfQueryWithoutHeap();
+	testPoolCommandsReleasedAfterDispatch();
+	testPoolExhaustedDropsCounted();
+	return HostSim::report("test_pipeline");
+}
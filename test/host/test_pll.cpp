@@ -0,0 +1,244 @@
+/*
+ * test_pll.cpp
+ *
+ *	Pruebas del estimador de red (PLL software) con flancos sintéticos de 50/60 Hz: enganche, error de predicción
+ *	del paso por cero con jitter del detector, rechazo de flancos espurios, flancos perdidos y reinicio de la
+ *	estimación, seguimiento de variaciones de frecuencia y error de actuación sobre el paso por cero predicho.
+ */
+
+#include "SimRig.h"
+
+
+/** Generador pseudoaleatorio de los flancos sintéticos */
+static uint32_t s_seed = 0x1234567;
+static int32_t jitter(uint32_t amplitude_us){
+	s_seed ^= s_seed << 13;
+	s_seed ^= s_seed >> 17;
+	s_seed ^= s_seed << 5;
+	return (amplitude_us == 0)? 0 : (int32_t)(s_seed % ((2 * amplitude_us) + 1)) - (int32_t)amplitude_us;
+}
+
+
+/** Error de la predicción del siguiente paso por cero respecto del real */
+static double predictionError(const RelayManagerProbe::MainsPll& pll, double next_crossing){
+	uint32_t n = (uint32_t)(((next_crossing - pll.edgeUs) / pll.periodUs) + 0.5);
+	return ((double)pll.edgeUs + ((double)n * pll.periodUs)) - next_crossing;
+}
+
+
+/** Resultado de una secuencia de flancos */
+struct PllRun {
+	int lockEdge;
+	double maxErr;
+	double meanErr;
+};
+
+
+/** Alimenta el estimador con 'edges' flancos de una red de 'freq_hz' (ambos flancos) con el jitter indicado y
+ *  mide el error de predicción del paso por cero siguiente una vez enganchado */
+static PllRun runPll(RelayManager* mgr, double freq_hz, uint32_t jitter_us, int edges){
+	RelayManagerProbe::MainsPll pll;
+	memset(&pll, 0, sizeof(pll));
+	double half = 500000.0 / freq_hz;
+	double t0 = 1000.0;
+	PllRun r = {-1, 0, 0};
+	int samples = 0;
+	for(int k = 0; k < edges; k++){
+		RelayManagerProbe::pllUpdate(mgr, pll, (uint32_t)(t0 + (k * half) + jitter(jitter_us)));
+		if(r.lockEdge < 0 && pll.goodEdges >= RelayManagerProbe::PllLockEdges){
+			r.lockEdge = k;
+		}
+		// tras el transitorio de enganche, mide la predicción del siguiente paso por cero real
+		if(r.lockEdge >= 0 && k >= r.lockEdge + 50){
+			double err = fabs(predictionError(pll, t0 + ((k + 1) * half)));
+			r.maxErr = (err > r.maxErr)? err : r.maxErr;
+			r.meanErr += err;
+			samples++;
+		}
+	}
+	r.meanErr = (samples > 0)? (r.meanErr / samples) : 0;
+	return r;
+}
+
+
+/** Enganche y error de predicción a 50 y 60 Hz con distintos niveles de jitter */
+static void testLockAndPredictionError(){
+	static const double Freqs[] = {50.0, 60.0};
+	static const uint32_t Jitters[] = {0, 50, 200, 500};
+	SimRig rig(1, 50.0f, false, false);
+	for(int f = 0; f < 2; f++){
+		for(int j = 0; j < 4; j++){
+			PllRun r = runPll(rig.mgr, Freqs[f], Jitters[j], 2000);
+			// con poco jitter se engancha en cuanto acumula los flancos necesarios. Con mucho jitter el primer periodo
+			// estimado puede ser malo y la estimación se reinicia alguna vez, pero se engancha en menos de un segundo
+			SIM_CHECK(r.lockEdge >= 0 && r.lockEdge <= ((Jitters[j] <= 50)? (RelayManagerProbe::PllLockEdges + 1) : 100));
+			// la predicción queda dentro del jitter, más el redondeo del periodo a us enteros (60 Hz)
+			SIM_CHECK(r.maxErr <= 5.0 + (1.25 * Jitters[j]));
+			SIM_CHECK(r.meanErr <= 5.0 + (Jitters[j] / 2.0));
+			printf("PLL %.0f Hz, jitter +-%u us: enganche en el flanco %d, error de predicción medio %.1f us, máximo %.1f us\n",
+				   Freqs[f], Jitters[j], r.lockEdge, r.meanErr, r.maxErr);
+		}
+	}
+}
+
+
+/** Los flancos espurios entre pasos por cero se rechazan sin perder el enganche ni la precisión */
+static void testGlitchRejection(){
+	SimRig rig(1, 50.0f, false, false);
+	RelayManagerProbe::MainsPll pll;
+	memset(&pll, 0, sizeof(pll));
+	double half = 10000.0;
+	double t0 = 1000.0;
+	uint32_t glitches = 0;
+	double max_err = 0;
+	for(int k = 0; k < 1000; k++){
+		RelayManagerProbe::pllUpdate(rig.mgr, pll, (uint32_t)(t0 + (k * half) + jitter(50)));
+		// un flanco espurio en uno de cada cuatro semiciclos, fuera de la tolerancia de fase
+		if(k > 20 && (k % 4) == 0){
+			RelayManagerProbe::pllUpdate(rig.mgr, pll, (uint32_t)(t0 + (k * half) + 2000 + (jitter(3000) + 3000)));
+			glitches++;
+		}
+		if(k > 100){
+			SIM_CHECK(pll.goodEdges >= RelayManagerProbe::PllLockEdges);
+			double err = fabs(predictionError(pll, t0 + ((k + 1) * half)));
+			max_err = (err > max_err)? err : max_err;
+		}
+	}
+	SIM_CHECK(pll.rejectedEdges == glitches);
+	SIM_CHECK(max_err <= 55.0);
+	printf("PLL con %u flancos espurios rechazados: error de predicción máximo %.1f us\n", glitches, max_err);
+}
+
+
+/** Un flanco espurio justo antes del paso por cero, dentro de la tolerancia máxima de fase, ocupa el lugar del
+ *  flanco real. La ventana de aceptación ajustada al jitter observado limita el desplazamiento de fase que provoca */
+static void testGlitchNearCrossing(){
+	SimRig rig(1, 50.0f, false, false);
+	RelayManagerProbe::MainsPll pll;
+	memset(&pll, 0, sizeof(pll));
+	double half = 10000.0;
+	double t0 = 1000.0;
+	double max_err = 0;
+	for(int k = 0; k < 1000; k++){
+		// un flanco espurio entre 100 y 900 us antes del paso por cero en uno de cada cinco semiciclos
+		if(k > 20 && (k % 5) == 0){
+			RelayManagerProbe::pllUpdate(rig.mgr, pll, (uint32_t)(t0 + (k * half) - 500 + jitter(400)));
+		}
+		RelayManagerProbe::pllUpdate(rig.mgr, pll, (uint32_t)(t0 + (k * half) + jitter(50)));
+		if(k > 100){
+			SIM_CHECK(pll.goodEdges >= RelayManagerProbe::PllLockEdges);
+			double err = fabs(predictionError(pll, t0 + ((k + 1) * half)));
+			max_err = (err > max_err)? err : max_err;
+		}
+	}
+	SIM_CHECK(max_err <= 100.0);
+	printf("PLL con flancos espurios próximos al paso por cero: error de predicción máximo %.1f us\n", max_err);
+}
+
+
+/** Unos pocos flancos perdidos no afectan al enganche. Demasiados flancos perdidos o espurios seguidos reinician
+ *  la estimación, que se engancha de nuevo con los flancos siguientes */
+static void testMissedEdgesAndReset(){
+	SimRig rig(1, 60.0f, false, false);
+	RelayManagerProbe::MainsPll pll;
+	memset(&pll, 0, sizeof(pll));
+	double half = 500000.0 / 60;
+	double t = 1000.0;
+	for(int k = 0; k < 100; k++, t += half){
+		RelayManagerProbe::pllUpdate(rig.mgr, pll, (uint32_t)t);
+	}
+	uint32_t period = pll.periodUs;
+	SIM_CHECK(pll.goodEdges >= RelayManagerProbe::PllLockEdges && period >= 8332 && period <= 8334);
+
+	// tres flancos perdidos: el siguiente se acepta
+	t += 3 * half;
+	RelayManagerProbe::pllUpdate(rig.mgr, pll, (uint32_t)t);
+	SIM_CHECK(pll.goodEdges >= RelayManagerProbe::PllLockEdges && pll.rejectedEdges == 0);
+	SIM_CHECK(fabs(predictionError(pll, t + half)) <= 8.0);
+	t += half;
+
+	// más de PllMaxMissedEdges flancos perdidos: reinicia y vuelve a engancharse
+	t += (RelayManagerProbe::PllMaxMissedEdges + 2) * half;
+	RelayManagerProbe::pllUpdate(rig.mgr, pll, (uint32_t)t);
+	SIM_CHECK(pll.periodUs == 0 && pll.goodEdges == 0);
+	int relock = -1;
+	for(int k = 1; k < 50; k++){
+		RelayManagerProbe::pllUpdate(rig.mgr, pll, (uint32_t)(t + (k * half)));
+		if(relock < 0 && pll.goodEdges >= RelayManagerProbe::PllLockEdges){
+			relock = k;
+		}
+	}
+	SIM_CHECK(relock > 0 && relock <= RelayManagerProbe::PllLockEdges + 1);
+	t += 50 * half;
+
+	// una ráfaga de flancos fuera de fase (p.ej. ruido en la entrada) reinicia la estimación
+	for(int k = 0; k < RelayManagerProbe::PllMaxRejects; k++){
+		RelayManagerProbe::pllUpdate(rig.mgr, pll, (uint32_t)(t + (k * half) + (half / 2)));
+	}
+	SIM_CHECK(pll.periodUs == 0 && pll.goodEdges == 0);
+}
+
+
+/** La estimación sigue una variación lenta de la frecuencia de red */
+static void testFrequencyTracking(){
+	SimRig rig(1, 50.0f, false, false);
+	RelayManagerProbe::MainsPll pll;
+	memset(&pll, 0, sizeof(pll));
+	double t = 1000.0;
+	double max_err = 0;
+	for(int k = 0; k < 3000; k++){
+		// rampa de 49.5 a 50.5 Hz
+		double freq = 49.5 + (k / 3000.0);
+		double half = 500000.0 / freq;
+		RelayManagerProbe::pllUpdate(rig.mgr, pll, (uint32_t)t);
+		if(k > 100){
+			double err = fabs(predictionError(pll, t + half));
+			max_err = (err > max_err)? err : max_err;
+		}
+		t += half;
+	}
+	SIM_CHECK(pll.goodEdges >= RelayManagerProbe::PllLockEdges);
+	SIM_CHECK(max_err <= 20.0);
+	printf("PLL con rampa 49.5-50.5 Hz: error de predicción máximo %.1f us\n", max_err);
+}
+
+
+/** De extremo a extremo: con jitter y flancos espurios en el zerocross, las acciones sobre el paso por cero
+ *  predicho se ordenan con un error respecto del paso por cero real dentro del jitter del detector */
+static void testPredictedActuationWithNoisyEdges(){
+	static const float Freqs[] = {50.0f, 60.0f};
+	for(int f = 0; f < 2; f++){
+		SimRig rig(1, Freqs[f], true, false);
+		rig.mains.setJitter(150);
+		rig.mains.setGlitchRate(200);
+		rig.start();
+		double max_err = 0;
+		double sum = 0;
+		for(int n = 0; n < 40; n++){
+			HostSim::runFor(3170 * (n % 7));
+			rig.send(0, ((n & 1) == 0)? Blob::RlyManOn : Blob::RlyManOff);
+			HostSim::runFor(150000);
+			const std::vector<Relay::Operation>& h = rig.relay[0]->history();
+			SIM_CHECK(h.size() == (size_t)(n + 1));
+			double err = fabs(rig.mains.crossingError((double)h.back().cmdUs - RelayManagerProbe::DefaultSwitchingDelay));
+			max_err = (err > max_err)? err : max_err;
+			sum += err;
+		}
+		SIM_CHECK(RelayManagerProbe::pll(rig.mgr).rejectedEdges > 0);
+		SIM_CHECK(max_err <= 150.0);
+		printf("actuación predicha a %.0f Hz con jitter +-150 us y flancos espurios: error medio %.1f us, máximo %.1f us "
+			   "(%u flancos espurios, %u rechazados)\n", Freqs[f], sum / 40, max_err, rig.mains.glitches(),
+			   RelayManagerProbe::pll(rig.mgr).rejectedEdges);
+	}
+}
+
+
+int main(){
+	testLockAndPredictionError();
+	testGlitchRejection();
+	testGlitchNearCrossing();
+	testMissedEdgesAndReset();
+	testFrequencyTracking();
+	testPredictedActuationWithNoisyEdges();
+	return HostSim::report("test_pll");
+}
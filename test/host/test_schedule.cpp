@@ -0,0 +1,110 @@
+/*
+ * test_schedule.cpp
+ *
+ *	Pruebas del instante de actuación programado por temporizador: la orden al relé se da en el flanco del zerocross
+ *	más el retardo configurado (también con retardos mayores que el semiciclo), sobre el paso por cero predicho
+ *	cuando el estimador de red está enganchado, y tras el retardo desde la aceptación si no hay zerocross.
+ */
+
+#include "SimRig.h"
+
+
+/** Instante de la última orden dada a un relé */
+static uint64_t lastCommandUs(SimRig& rig, uint8_t id){
+	const std::vector<Relay::Operation>& h = rig.relay[id]->history();
+	return (h.empty())? 0 : h.back().cmdUs;
+}
+
+
+/** Sin estimación de red, la orden se da en el primer flanco tras el comando más el retardo configurado */
+static void testEdgeScheduledActuation(){
+	static const uint32_t Delays[] = {RelayManagerProbe::DefaultSwitchingDelay, 9750, 14200, 27300, RelayManagerProbe::MaxSwitchingDelay - 1};
+	for(uint32_t d = 0; d < sizeof(Delays)/sizeof(Delays[0]); d++){
+		SimRig rig(1, 50.0f, true, false);
+		// arranca sin dar tiempo a que el estimador de red se enganche. Los retardos se fijan tras recuperar la
+		// configuración en el arranque
+		rig.start(3000, 0);
+		RelayManagerProbe::setDelays(rig.mgr, 0, Delays[d], Delays[d]);
+		for(int on = 1; on >= 0; on--){
+			uint64_t t_cmd = HostSim::now();
+			rig.send(0, (on)? Blob::RlyManOn : Blob::RlyManOff);
+			HostSim::runFor(200000);
+
+			RelayManager::CalibrationInfo info;
+			SIM_CHECK(rig.mgr->getCalibrationInfo(0, &info));
+			SIM_CHECK(((on)? info.delayOnUs : info.delayOffUs) == Delays[d]);
+			double edge = rig.mains.nextCrossing((double)t_cmd);
+			double err = (double)lastCommandUs(rig, 0) - (edge + Delays[d]);
+			SIM_CHECK(rig.relay[0]->isOn() == (on != 0));
+			SIM_CHECK(fabs(err) <= 1.0);
+
+			// descarta la estimación de red para que la siguiente acción espere de nuevo a un flanco
+			RelayManagerProbe::resetPll(rig.mgr);
+		}
+	}
+}
+
+
+/** Con el estimador de red enganchado, la orden cae sobre el paso por cero predicho más el retardo, en el primer
+ *  instante de conmutación que aún no ha pasado, sea cual sea la fase del comando respecto de la red */
+static void testPredictedActuation(){
+	static const uint32_t Delays[] = {RelayManagerProbe::DefaultSwitchingDelay, 9900, 23400};
+	double max_err = 0;
+	double max_lat = 0;
+	for(uint32_t d = 0; d < sizeof(Delays)/sizeof(Delays[0]); d++){
+		SimRig rig(1, 50.0f, true, false);
+		rig.start();
+		RelayManagerProbe::setDelays(rig.mgr, 0, Delays[d], Delays[d]);
+		SIM_CHECK(RelayManagerProbe::pll(rig.mgr).goodEdges >= RelayManagerProbe::PllLockEdges);
+		double half = rig.mains.halfPeriodUs();
+		for(int n = 0; n < 20; n++){
+			// recorre la fase del comando respecto del último paso por cero
+			uint64_t t_cmd = (uint64_t)(rig.mains.lastCrossing((double)HostSim::now() + 100000) + ((n * half) / 20)) + 1;
+			HostSim::runUntil(t_cmd);
+			rig.send(0, ((n & 1) == 0)? Blob::RlyManOn : Blob::RlyManOff);
+			HostSim::runFor(150000);
+			uint64_t t_sw = lastCommandUs(rig, 0);
+			SIM_CHECK(rig.relay[0]->isOn() == ((n & 1) == 0));
+			// la referencia de la orden es un paso por cero real
+			double err = rig.mains.crossingError((double)t_sw - Delays[d]);
+			max_err = (fabs(err) > max_err)? fabs(err) : max_err;
+			SIM_CHECK(fabs(err) <= 2.0);
+			// y es el primero que permite conmutar con el margen mínimo
+			double lat = (double)(t_sw - t_cmd);
+			max_lat = (lat > max_lat)? lat : max_lat;
+			SIM_CHECK(lat >= RelayManagerProbe::PllMinLeadUs && lat < RelayManagerProbe::PllMinLeadUs + half + 1);
+		}
+	}
+	printf("actuación sobre el paso por cero predicho: error máximo %.1f us, latencia máxima %.0f us\n", max_err, max_lat);
+}
+
+
+/** Sin zerocross, la orden se da tras el retardo configurado desde la aceptación del comando */
+static void testUnsyncActuation(){
+	SimRig rig(2, 50.0f, false, false);
+	rig.start();
+	RelayManagerProbe::setDelays(rig.mgr, 0, 12000, 7000);
+	RelayManagerProbe::setDelays(rig.mgr, 1, 9000, 31000);
+	uint64_t t_cmd = HostSim::now();
+	rig.send(0, Blob::RlyManOn);
+	rig.send(1, Blob::RlyManOn);
+	HostSim::runFor(200000);
+	SIM_CHECK(lastCommandUs(rig, 0) == t_cmd + 12000);
+	SIM_CHECK(lastCommandUs(rig, 1) == t_cmd + 9000);
+
+	t_cmd = HostSim::now();
+	rig.send(0, Blob::RlyManOff);
+	rig.send(1, Blob::RlyManOff);
+	HostSim::runFor(200000);
+	SIM_CHECK(lastCommandUs(rig, 0) == t_cmd + 7000);
+	SIM_CHECK(lastCommandUs(rig, 1) == t_cmd + 31000);
+	SIM_CHECK(!rig.relay[0]->isOn() && !rig.relay[1]->isOn());
+}
+
+
+int main(){
+	testEdgeScheduledActuation();
+	testPredictedActuation();
+	testUnsyncActuation();
+	return HostSim::report("test_schedule");
+}
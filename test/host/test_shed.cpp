@@ -0,0 +1,76 @@
+/*
+ * test_shed.cpp
+ *
+ *	Pruebas de la desconexión de emergencia: sólo se apagan y cuentan como operación los relés que estaban
+ *	encendidos, incluidos los que acababan de conmutar en un lote interrumpido.
+ */
+
+#include "SimRig.h"
+
+
+/** Operaciones acumuladas por un relé */
+static uint32_t operations(SimRig& rig, uint8_t id){
+	Blob::RlyManHealth_t health;
+	SIM_CHECK(rig.mgr->getHealth(id, &health));
+	return health.operations;
+}
+
+
+/** Las desconexiones repetidas sólo cuentan el apagado de los relés que estaban encendidos */
+static void testShedCountsOnlyRelaysThatWereOn(){
+	SimRig rig(3);
+	rig.start();
+	rig.send(0, Blob::RlyManOn);
+	HostSim::runFor(300000);
+	rig.send(1, Blob::RlyManOn);
+	HostSim::runFor(300000);
+	rig.send(1, Blob::RlyManOff);
+	HostSim::runFor(300000);
+	SIM_CHECK(rig.relay[0]->isOn() && !rig.relay[1]->isOn());
+	SIM_CHECK(operations(rig, 0) == 1 && operations(rig, 1) == 2 && operations(rig, 2) == 0);
+	uint32_t cmds1 = rig.relay[1]->commands();
+
+	for(int n = 0; n < 5; n++){
+		uint64_t t0 = HostSim::now();
+		rig.shed(0x7);
+		HostSim::runFor(100000);
+		const HostSim::Publication* p = HostSim::lastPublication("stat/shed/rlyman", t0);
+		SIM_CHECK(p != NULL && ((Blob::RlyManShedAction_t*)&p->data[0])->offMask == 0x7);
+	}
+	SIM_CHECK(!rig.relay[0]->isOn() && !rig.relay[1]->isOn() && !rig.relay[2]->isOn());
+	SIM_CHECK(operations(rig, 0) == 2);
+	SIM_CHECK(operations(rig, 1) == 2);
+	SIM_CHECK(operations(rig, 2) == 0);
+
+	// el relé ya apagado no recibe órdenes. El de estado desconocido se apaga una vez por seguridad
+	SIM_CHECK(rig.relay[1]->commands() == cmds1);
+	SIM_CHECK(rig.relay[2]->commands() == 1);
+}
+
+
+/** Un relé que ya ha conmutado a On en un lote interrumpido por la desconexión se apaga y cuenta ambas operaciones */
+static void testShedAfterSwitchInFlight(){
+	SimRig rig(1);
+	rig.start();
+	rig.send(0, Blob::RlyManOn);
+	// tras la conmutación, durante la espera al pico de corriente
+	uint64_t t_cmd = HostSim::now();
+	while(!rig.relay[0]->isOn() && HostSim::now() - t_cmd < 200000){
+		HostSim::runFor(1000);
+	}
+	HostSim::runFor(5000);
+	SIM_CHECK(rig.relay[0]->isOn());
+	rig.shed(0x1);
+	HostSim::runFor(300000);
+	SIM_CHECK(!rig.relay[0]->isOn());
+	SIM_CHECK(operations(rig, 0) == 2);
+	Blob::RlyManRelayStat_t stat;
+	SIM_CHECK(rig.mgr->getRelayStat(0, &stat) && stat.state == Blob::RlyManOff);
+}
+
+
+int main(){
+	testShedCountsOnlyRelaysThatWereOn();
+	testShedAfterSwitchInFlight();
+	return HostSim::report("test_shed");
+}
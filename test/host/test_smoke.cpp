@@ -0,0 +1,137 @@
+/*
+ * test_smoke.cpp
+ *
+ *	Prueba básica del banco de simulación: arranque del módulo, conmutación sincronizada con el paso por cero,
+ *	publicación del resultado y grabación y recuperación de la configuración en la memoria NV simulada, incluida la
+ *	migración de las claves individuales de versiones anteriores y de un bloque grabado con otro número de relés.
+ */
+
+#include "SimRig.h"
+
+
+/** Comprueba una acción completa: conmuta, se publica en stat/value y el contacto queda cerca del paso por cero */
+static void testSwitchAndPublish(){
+	SimRig rig(2);
+	rig.start();
+	SIM_CHECK(rig.mgr->ready());
+
+	// las primeras acciones calibran el retardo del relé 0
+	for(int n = 0; n < 10; n++){
+		uint64_t t0 = HostSim::now();
+		Blob::RlyManEvtFlags req = ((n % 2) == 0)? Blob::RlyManOn : Blob::RlyManOff;
+		rig.send(0, req);
+		HostSim::runFor(300000);
+		SIM_CHECK(rig.relay[0]->isOn() == (req == Blob::RlyManOn));
+		const HostSim::Publication* p = HostSim::lastPublication("stat/value/rlyman", t0);
+		SIM_CHECK(p != NULL && p->data.size() == sizeof(Blob::RlyManAction_t));
+		if(p){
+			Blob::RlyManAction_t* a = (Blob::RlyManAction_t*)&p->data[0];
+			SIM_CHECK(a->id == 0 && a->request == req);
+		}
+	}
+	double err = rig.lastContactError(0);
+	printf("  error del contacto tras calibrar: %.0f us\n", err);
+	SIM_CHECK(fabs(err) < RelayManagerProbe::DefaultSwitchingDelta);
+	SIM_CHECK(rig.relay[1]->commands() == 0);
+}
+
+
+/** Comprueba que la calibración se graba en memoria NV y se recupera en el siguiente arranque */
+static void testPersistence(){
+	uint32_t on_us, off_us;
+	std::map<std::string, std::vector<uint8_t> > nvs;
+	{
+		SimRig rig(1);
+		rig.start();
+		for(int n = 0; n < 6; n++){
+			rig.send(0, ((n % 2) == 0)? Blob::RlyManOn : Blob::RlyManOff);
+			HostSim::runFor(300000);
+		}
+		// la grabación diferida se realiza tras el tiempo en reposo
+		HostSim::runFor((RelayManagerProbe::PersistIdleMs + RelayManagerProbe::PersistMinIntervalMs) * 1000);
+		Blob::RlyManRelayStat_t stat;
+		SIM_CHECK(rig.mgr->getRelayStat(0, &stat));
+		on_us = stat.delayOnUs;
+		off_us = stat.delayOffUs;
+		SIM_CHECK(on_us != RelayManagerProbe::DefaultSwitchingDelay || off_us != RelayManagerProbe::DefaultSwitchingDelay);
+		SIM_CHECK(HostSim::nvsWrites() > 0);
+		nvs = HostSim::nvs();
+	}
+	SimRig rig(1);
+	HostSim::nvs() = nvs;
+	rig.start();
+	Blob::RlyManRelayStat_t stat;
+	SIM_CHECK(rig.mgr->getRelayStat(0, &stat));
+	SIM_CHECK(stat.delayOnUs == on_us && stat.delayOffUs == off_us);
+}
+
+
+/** Retardos aplicados a un relé */
+static void delays(SimRig& rig, uint8_t id, uint32_t* on_us, uint32_t* off_us){
+	Blob::RlyManRelayStat_t stat;
+	SIM_CHECK(rig.mgr->getRelayStat(id, &stat));
+	*on_us = stat.delayOnUs;
+	*off_us = stat.delayOffUs;
+}
+
+
+/** Las claves individuales se migran al bloque empaquetado y se borran sólo si éste se graba */
+static void testLegacyMigration(){
+	static const char* Pack = "sim/RlyManCfgPack";
+	for(int fail = 1; fail >= 0; fail--){
+		SimRig rig(2);
+		for(uint32_t i = 0; i < 2; i++){
+			uint32_t v1[3] = {9000 + (i * 100), 8500 + (i * 100), RelayManagerProbe::DefaultSwitchingDelta};
+			char key[32];
+			sprintf(key, "sim/RlyManCfg_%u", i);
+			HostSim::nvs()[key].assign((uint8_t*)v1, ((uint8_t*)v1) + sizeof(v1));
+		}
+		HostSim::setNvsWriteFailure(fail != 0);
+		rig.start();
+		uint32_t on_us, off_us;
+		delays(rig, 1, &on_us, &off_us);
+		SIM_CHECK(on_us == 9100 && off_us == 8600);
+		bool kept = HostSim::nvs().count("sim/RlyManCfg_0") != 0 && HostSim::nvs().count("sim/RlyManCfg_1") != 0;
+		bool removed = HostSim::nvs().count("sim/RlyManCfg_0") == 0 && HostSim::nvs().count("sim/RlyManCfg_1") == 0;
+		SIM_CHECK((fail != 0)? (kept && HostSim::nvs().count(Pack) == 0) : (removed && HostSim::nvs().count(Pack) != 0));
+		HostSim::setNvsWriteFailure(false);
+	}
+}
+
+
+/** Un bloque grabado con otro número de relés conserva la configuración de los relés comunes */
+static void testResizedBlob(){
+	std::map<std::string, std::vector<uint8_t> > nvs;
+	{
+		SimRig rig(3);
+		rig.start();
+		for(uint8_t i = 0; i < 3; i++){
+			RelayManagerProbe::setDelays(rig.mgr, i, 9000 + (i * 100), 8500 + (i * 100));
+		}
+		SIM_CHECK(RelayManagerProbe::writeConfig(rig.mgr));
+		nvs = HostSim::nvs();
+	}
+	for(uint8_t count = 2; count <= 4; count += 2){
+		SimRig rig(count);
+		HostSim::nvs() = nvs;
+		rig.start();
+		for(uint8_t i = 0; i < count; i++){
+			uint32_t on_us, off_us;
+			delays(rig, i, &on_us, &off_us);
+			bool common = (i < 3);
+			SIM_CHECK(on_us == ((common)? (9000u + (i * 100)) : RelayManagerProbe::DefaultSwitchingDelay));
+			SIM_CHECK(off_us == ((common)? (8500u + (i * 100)) : RelayManagerProbe::DefaultSwitchingDelay));
+		}
+		// el bloque se graba de nuevo con el número de relés actual
+		SIM_CHECK(HostSim::nvs()["sim/RlyManCfgPack"] != nvs["sim/RlyManCfgPack"]);
+	}
+}
+
+
+int main(){
+	testSwitchAndPublish();
+	testPersistence();
+	testLegacyMigration();
+	testResizedBlob();
+	return HostSim::report("test_smoke");
+}
@@ -0,0 +1,111 @@
+/*
+ * test_static.cpp
+ *
+ *	Pruebas de las variantes de tamaño fijo (StaticRelayManager) con los caminos del lote especializados en
+ *	compilación: con y sin zerocross y con y sin feedback, la conmutación se programa igual que en la variante
+ *	dinámica equivalente. Sin feedback se rechazan los relés con feedback y no se publica en stat/fdbk.
+ */
+
+#include "SimRig.h"
+
+
+/** Instante de la última orden dada a un relé */
+static uint64_t lastCommandUs(Relay& relay){
+	const std::vector<Relay::Operation>& h = relay.history();
+	return (h.empty())? 0 : h.back().cmdUs;
+}
+
+
+/** Solicita una acción sobre un relé */
+static void send(uint8_t id, Blob::RlyManEvtFlags request){
+	Blob::RlyManAction_t action = {id, request};
+	MQ::MQClient::publish("set/value/rlyman", &action, sizeof(action), NULL);
+}
+
+
+/** Arranca el módulo con el topic base "rlyman" */
+static void start(RelayManager* mgr){
+	mgr->setPublicationBase("rlyman");
+	mgr->setSubscriptionBase("rlyman");
+	HostSim::runFor(300000);
+}
+
+
+/** Con zerocross y sin feedback, la orden cae sobre el paso por cero predicho más el retardo */
+static void testSyncNoFeedback(){
+	HostSim::reset();
+	ZcGenerator mains(SimRig::ZcPin);
+	FSManager fs("sim");
+	Relay r0(0), r1(1);
+	RelayFeedback fdb(&r0, &mains);
+	StaticRelayManager<2, true, 2048, false> mgr(SimRig::ZcPin, Zerocross::EdgeActiveAreBoth, &fs);
+	SIM_CHECK(mgr.addRelayHandler(&r0, &fdb) == -3);
+	SIM_CHECK(mgr.addRelayHandler(&r0, SimRig::SensePin) == -3);
+	SIM_CHECK(mgr.addRelayHandler(&r0) == 0 && mgr.addRelayHandler(&r1) == 1);
+	mains.start(3000);
+	start(&mgr);
+
+	uint64_t t0 = HostSim::now();
+	for(int n = 0; n < 6; n++){
+		send(n & 1, (n < 2)? Blob::RlyManOn : Blob::RlyManOff);
+		HostSim::runFor(150000);
+		Relay& r = (n & 1)? r1 : r0;
+		SIM_CHECK(r.isOn() == (n < 2));
+		SIM_CHECK(fabs(mains.crossingError((double)lastCommandUs(r) - RelayManagerProbe::DefaultSwitchingDelay)) <= 2.0);
+	}
+	SIM_CHECK(HostSim::countPublications("stat/value/rlyman", t0) == 6);
+	SIM_CHECK(HostSim::countPublications("stat/fdbk/rlyman", t0) == 0);
+}
+
+
+/** Sin zerocross ni feedback, la orden se da tras el retardo desde la aceptación */
+static void testUnsyncNoFeedback(){
+	HostSim::reset();
+	FSManager fs("sim");
+	Relay r0(0);
+	StaticRelayManager<1, false, 2048, false> mgr(&fs);
+	SIM_CHECK(mgr.addRelayHandler(&r0) == 0);
+	start(&mgr);
+	RelayManagerProbe::setDelays(&mgr, 0, 12000, 7000);
+
+	uint64_t t_cmd = HostSim::now();
+	send(0, Blob::RlyManOn);
+	HostSim::runFor(200000);
+	SIM_CHECK(r0.isOn() && lastCommandUs(r0) == t_cmd + 12000);
+	t_cmd = HostSim::now();
+	send(0, Blob::RlyManOff);
+	HostSim::runFor(200000);
+	SIM_CHECK(!r0.isOn() && lastCommandUs(r0) == t_cmd + 7000);
+	SIM_CHECK(HostSim::countPublications("stat/fdbk/rlyman") == 0);
+}
+
+
+/** Con zerocross y feedback, se calibra y se publica el feedback como en la variante dinámica */
+static void testSyncFeedback(){
+	HostSim::reset();
+	ZcGenerator mains(SimRig::ZcPin);
+	FSManager fs("sim");
+	Relay r0(0);
+	RelayFeedback fdb(&r0, &mains);
+	StaticRelayManager<1, true> mgr(SimRig::ZcPin, Zerocross::EdgeActiveAreBoth, &fs);
+	SIM_CHECK(mgr.addRelayHandler(&r0, &fdb) == 0);
+	mains.start(3000);
+	start(&mgr);
+
+	for(int n = 0; n < 8; n++){
+		send(0, ((n & 1) == 0)? Blob::RlyManOn : Blob::RlyManOff);
+		HostSim::runFor(300000);
+		SIM_CHECK(r0.isOn() == ((n & 1) == 0));
+	}
+	RelayManager::CalibrationInfo info;
+	SIM_CHECK(mgr.getCalibrationInfo(0, &info) && info.samplesOn == 4 && info.samplesOff == 4);
+	SIM_CHECK(HostSim::countPublications("stat/fdbk/rlyman") == 8);
+}
+
+
+int main(){
+	testSyncNoFeedback();
+	testUnsyncNoFeedback();
+	testSyncFeedback();
+	return HostSim::report("test_static");
+}
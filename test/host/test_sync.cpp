@@ -0,0 +1,161 @@
+/*
+ * test_sync.cpp
+ *
+ *	Pruebas de la pérdida y recuperación del zerocross: con un lote y una desconexión de emergencia esperando un
+ *	flanco y un relé en modo ráfaga, al cortarse los flancos todo se resuelve sin sincronizar en un tiempo acotado y se
+ *	publica el modo degradado. Durante el corte las acciones se ejecutan sin esperar y no se calibran, y al volver los
+ *	flancos se recupera la sincronización automáticamente. Al finalizar el modo ráfaga con una conmutación pendiente
+ *	del flanco anterior, el estado final es el conmutado en el relé.
+ */
+
+#include "SimRig.h"
+
+
+/** Instante de la última orden dada a un relé */
+static uint64_t lastCommandUs(SimRig& rig, uint8_t id){
+	const std::vector<Relay::Operation>& h = rig.relay[id]->history();
+	return (h.empty())? 0 : h.back().cmdUs;
+}
+
+
+/** Último estado de sincronización publicado desde 'since' (-1 si no hay) */
+static int lastSynced(uint64_t since){
+	const HostSim::Publication* p = HostSim::lastPublication("stat/sync/rlyman", since);
+	return (p == NULL)? -1 : ((Blob::RlyManSyncStat_t*)&p->data[0])->synced;
+}
+
+
+/** Corte con trabajo pendiente del siguiente flanco y modo ráfaga activo, y recuperación posterior */
+static void testDropoutWithPendingWork(){
+	static const uint32_t Bound = RelayManagerProbe::ZcLossTimeoutUs + RelayManagerProbe::ZcSupervisionUs;
+	static const uint64_t DropoutUs = 1000000;
+	// el contacto se lee en las entradas de feedback, sin pre-captura, de forma que los tiempos sólo dependen de la
+	// sincronización
+	SimRig rig(3, 50.0f, true, true, true);
+	rig.start();
+
+	// relé 1 encendido y relé 2 en modo ráfaga
+	rig.send(1, Blob::RlyManOn);
+	HostSim::runFor(300000);
+	Blob::RlyManBurstAction_t burst = {2, 500, 4, 1};
+	MQ::MQClient::publish("set/burst/rlyman", &burst, sizeof(burst), NULL);
+	HostSim::runFor(500000);
+	Blob::RlyManBurstStat_t binfo;
+	SIM_CHECK(rig.mgr->getBurstInfo(2, &binfo) && binfo.dutyPerMil == 500 && binfo.cycles > 0);
+	SIM_CHECK(rig.relay[1]->isOn() && rig.relay[2]->commands() > 2);
+	RelayManager::CalibrationInfo cal;
+	SIM_CHECK(rig.mgr->getCalibrationInfo(0, &cal));
+
+	// se cortan los flancos. Sin estimación de red, el lote y la desconexión esperan al siguiente flanco
+	uint64_t t_drop = HostSim::now();
+	uint64_t t_last = (uint64_t)rig.mains.lastCrossing((double)t_drop);
+	rig.mains.setDropout(t_drop, t_drop + DropoutUs);
+	RelayManagerProbe::resetPll(rig.mgr);
+	rig.send(0, Blob::RlyManOn);
+	rig.shed(0x2);
+	HostSim::runFor(20000);
+	SIM_CHECK(rig.relay[0]->commands() == 0 && rig.relay[1]->isOn());
+
+	// detectada la pérdida, se ejecutan sin sincronizar dentro de la cota, y el modo ráfaga termina apagado
+	HostSim::runUntil(t_last + Bound + RelayManagerProbe::MaxSwitchingDelay + 100000);
+	SIM_CHECK(rig.relay[0]->isOn() && !rig.relay[1]->isOn() && !rig.relay[2]->isOn());
+	uint64_t lat_batch = lastCommandUs(rig, 0) - t_drop;
+	uint64_t lat_shed = lastCommandUs(rig, 1) - t_drop;
+	SIM_CHECK(lastCommandUs(rig, 0) <= t_last + Bound + cal.delayOnUs);
+	SIM_CHECK(lastCommandUs(rig, 1) <= t_last + Bound + cal.delayOffUs);
+	SIM_CHECK(rig.mgr->getBurstInfo(2, &binfo) && binfo.dutyPerMil == 0);
+	SIM_CHECK(HostSim::lastPublication("stat/burst/rlyman", t_drop) != NULL);
+	SIM_CHECK(HostSim::lastPublication("stat/shed/rlyman", t_drop) != NULL);
+	SIM_CHECK(lastSynced(t_drop) == 0);
+	Blob::RlyManSyncStat_t sync;
+	rig.mgr->getSyncStat(&sync);
+	SIM_CHECK(sync.synced == 0 && sync.losses == 1 && sync.unsyncBatches >= 1);
+	Blob::RlyManRelayStat_t stat;
+	SIM_CHECK(rig.mgr->getRelayStat(1, &stat) && stat.state == Blob::RlyManOff);
+
+	// en modo degradado los comandos se ejecutan tras el retardo, sin esperar flancos, y no se calibra
+	for(int n = 0; n < 4; n++){
+		uint64_t t_cmd = HostSim::now();
+		rig.send(0, ((n & 1) == 0)? Blob::RlyManOff : Blob::RlyManOn);
+		HostSim::runFor(150000);
+		SIM_CHECK(rig.relay[0]->isOn() == ((n & 1) != 0));
+		SIM_CHECK(lastCommandUs(rig, 0) - t_cmd <= RelayManagerProbe::MaxSwitchingDelay);
+	}
+	RelayManager::CalibrationInfo cal2;
+	SIM_CHECK(rig.mgr->getCalibrationInfo(0, &cal2));
+	SIM_CHECK(cal2.delayOnUs == cal.delayOnUs && cal2.delayOffUs == cal.delayOffUs && cal2.samplesOn == cal.samplesOn);
+
+	// vuelven los flancos: se recupera la sincronización al engancharse el estimador de red
+	uint64_t t_back = t_drop + DropoutUs;
+	HostSim::runUntil(t_back + 300000);
+	SIM_CHECK(lastSynced(t_back) == 1);
+	rig.mgr->getSyncStat(&sync);
+	SIM_CHECK(sync.synced == 1 && sync.losses == 1);
+	uint32_t unsync = sync.unsyncBatches;
+	for(int n = 0; n < 6; n++){
+		rig.send(0, ((n & 1) == 0)? Blob::RlyManOff : Blob::RlyManOn);
+		HostSim::runFor(300000);
+	}
+	rig.mgr->getSyncStat(&sync);
+	SIM_CHECK(sync.unsyncBatches == unsync);
+	SIM_CHECK(fabs(rig.lastContactError(0)) < RelayManagerProbe::DefaultSwitchingDelta);
+	printf("corte del zerocross: lote pendiente ejecutado a %.1f ms y desconexión a %.1f ms del corte (cota %.1f ms más "
+		   "el retardo), error del contacto tras recuperar %.0f us\n", lat_batch / 1000.0, lat_shed / 1000.0,
+		   (t_last + Bound - t_drop) / 1000.0, rig.lastContactError(0));
+}
+
+
+/** Con el estimador enganchado, los comandos recibidos al comienzo del corte se sincronizan con el paso por cero
+ *  predicho. Una vez detectada la pérdida, se ejecutan sin esperar */
+static void testFreewheelThenDegraded(){
+	SimRig rig(1, 50.0f, true, false);
+	rig.start();
+	uint64_t t_drop = HostSim::now();
+	rig.mains.setDropout(t_drop, t_drop + 2000000);
+
+	// al comienzo del corte, sobre el paso por cero predicho
+	HostSim::runFor(30000);
+	rig.send(0, Blob::RlyManOn);
+	HostSim::runFor(100000);
+	double err = rig.mains.crossingError((double)lastCommandUs(rig, 0) - RelayManagerProbe::DefaultSwitchingDelay);
+	SIM_CHECK(rig.relay[0]->isOn() && fabs(err) <= 5.0);
+
+	// detectada la pérdida, tras el retardo desde la aceptación
+	HostSim::runUntil(t_drop + 300000);
+	SIM_CHECK(lastSynced(t_drop) == 0);
+	uint64_t t_cmd = HostSim::now();
+	rig.send(0, Blob::RlyManOff);
+	HostSim::runFor(100000);
+	SIM_CHECK(!rig.relay[0]->isOn() && lastCommandUs(rig, 0) == t_cmd + RelayManagerProbe::DefaultSwitchingDelay);
+	printf("al comienzo del corte la acción se sincroniza con el paso por cero predicho (error %.1f us)\n", err);
+}
+
+
+/** Al finalizar el modo ráfaga entre un flanco y su conmutación, el estado final es el del relé y éste queda apagado */
+static void testBurstStopBeforeSwitch(){
+	SimRig rig(1, 50.0f, true, false);
+	rig.start();
+	int mismatches = 0;
+	for(uint32_t offset = 0; offset < 80000; offset += 1000){
+		Blob::RlyManBurstAction_t burst = {0, 500, 4, 1};
+		MQ::MQClient::publish("set/burst/rlyman", &burst, sizeof(burst), NULL);
+		// el periodo de la ráfaga es de 80 ms: el final recorre todas las posiciones del periodo
+		HostSim::runFor(400000 + offset);
+		burst.dutyPerMil = 0;
+		MQ::MQClient::publish("set/burst/rlyman", &burst, sizeof(burst), NULL);
+		HostSim::runFor(300000);
+		Blob::RlyManRelayStat_t stat;
+		SIM_CHECK(rig.mgr->getRelayStat(0, &stat));
+		mismatches += (rig.relay[0]->isOn() || stat.state != Blob::RlyManOff)? 1 : 0;
+		SIM_CHECK(stat.switches == rig.relay[0]->commands());
+	}
+	SIM_CHECK(mismatches == 0);
+}
+
+
+int main(){
+	testDropoutWithPendingWork();
+	testFreewheelThenDegraded();
+	testBurstStopBeforeSwitch();
+	return HostSim::report("test_sync");
+}
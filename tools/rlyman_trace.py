@@ -0,0 +1,103 @@
+#!/usr/bin/env python3
+#
+# rlyman_trace.py
+#
+# Decodifica el volcado del log binario de trazas de RelayManager (respuesta en $BASE/trace/stat, o el contenido
+# de getTraceLog()) a texto, un evento por línea. Requiere compilar el módulo con RELAYMANAGER_ENABLE_TRACELOG.
+#
+#   python3 rlyman_trace.py dump.bin
+#   python3 rlyman_trace.py -            (lee de stdin)
+#
+# Formato (little-endian, ver RelayManagerBlob.h):
+#   RlyManTraceHeader_t: uint32 magic 'RLYT', uint16 version, uint16 recSize, uint32 written, uint32 count
+#   RlyManTraceRecord_t: uint32 ts, uint16 seq, uint8 evt, uint8 id, uint32 arg0, uint32 arg1
+#
+
+import struct
+import sys
+
+MAGIC = 0x54594C52
+VERSION = 1
+HEADER = struct.Struct('<IHHII')
+RECORD = struct.Struct('<IHBBII')
+
+# debe mantenerse en el mismo orden que Blob::RlyManTraceEvent
+EVENTS = [
+    None,
+    ('cmd', 'action/onMask', 'offMask'),
+    ('coalesce', 'action', None),
+    ('skip', 'state', None),
+    ('batch_start', 'count', 'has_on'),
+    ('await_zc', None, None),
+    ('schedule', 'edge_us', 'period_us'),
+    ('switch', 'action', 'slot'),
+    ('inrush', 'slots', None),
+    ('feedback', 'status', 'ton|toff'),
+    ('calib', 'delay_on_us', 'delay_off_us'),
+    ('calib_reject', 'innov_us', None),
+    ('batch_done', 'count', None),
+    ('shed', 'mask', None),
+    ('shed_done', 'mask', 'latency_us'),
+    ('publish', 'state', None),
+    ('sync', 'synced', 'edge_us'),
+    ('timed', 'tag', 'action'),
+]
+
+
+def fmt_args(evt, arg0, arg1):
+    name, n0, n1 = EVENTS[evt]
+    if name == 'feedback':
+        return 'status=0x%x ton=%d toff=%d' % (arg0, arg1 >> 16, arg1 & 0xFFFF)
+    if name == 'calib_reject':
+        return 'innov_us=%d' % struct.unpack('<i', struct.pack('<I', arg0))[0]
+    out = []
+    for n, v in ((n0, arg0), (n1, arg1)):
+        if n is not None:
+            out.append(('%s=0x%x' if 'mask' in n.lower() else '%s=%d') % (n, v))
+    return ' '.join(out)
+
+
+def decode(data, out):
+    if len(data) < HEADER.size:
+        raise ValueError('volcado incompleto')
+    magic, version, rec_size, written, count = HEADER.unpack_from(data, 0)
+    if magic != MAGIC:
+        raise ValueError('marca incorrecta 0x%08x' % magic)
+    if version != VERSION or rec_size != RECORD.size:
+        raise ValueError('formato no soportado: version=%d, recSize=%d' % (version, rec_size))
+    if len(data) < HEADER.size + count * rec_size:
+        raise ValueError('volcado truncado')
+
+    out.write('# %d eventos registrados, %d incluidos, %d perdidos\n' % (written, count, written - count))
+    first = written - count
+    prev_ts = None
+    for k in range(count):
+        ts, seq, evt, rid, arg0, arg1 = RECORD.unpack_from(data, HEADER.size + k * rec_size)
+        # un número de secuencia distinto indica que el registro se sobrescribió durante el volcado
+        if seq != ((first + k) & 0xFFFF):
+            out.write('%10s %-13s (registro sobrescrito)\n' % ('-', '?'))
+            prev_ts = None
+            continue
+        delta = '' if prev_ts is None else '+%d' % ((ts - prev_ts) & 0xFFFFFFFF)
+        prev_ts = ts
+        name = EVENTS[evt][0] if 0 < evt < len(EVENTS) else 'evt_%d' % evt
+        args = fmt_args(evt, arg0, arg1) if 0 < evt < len(EVENTS) else 'arg0=0x%x arg1=0x%x' % (arg0, arg1)
+        relay = '-' if rid == 0xFF else str(rid)
+        out.write('%10d %8s %-13s relay=%-2s %s\n' % (ts, delta, name, relay, args))
+
+
+def main(argv):
+    if len(argv) != 2:
+        sys.stderr.write('uso: %s <volcado.bin | ->\n' % argv[0])
+        return 2
+    data = sys.stdin.buffer.read() if argv[1] == '-' else open(argv[1], 'rb').read()
+    try:
+        decode(data, sys.stdout)
+    except ValueError as e:
+        sys.stderr.write('error: %s\n' % e)
+        return 1
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
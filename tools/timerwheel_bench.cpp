@@ -0,0 +1,92 @@
+/*
+ * timerwheel_bench.cpp
+ *
+ *	Banco de pruebas en el host de TimerWheel: mide las tasas de inserción, cancelación y vencimiento y comprueba
+ *	que cada entrada vence exactamente en su tick.
+ *
+ *		g++ -O2 -std=gnu++11 -I.. -o timerwheel_bench timerwheel_bench.cpp && ./timerwheel_bench [entradas] [ticks]
+ */
+
+#include "TimerWheel.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+
+/** Generador pseudoaleatorio (xorshift32) */
+static uint32_t s_seed = 0x2545F491;
+static uint32_t rnd(){
+	s_seed ^= s_seed << 13;
+	s_seed ^= s_seed >> 17;
+	s_seed ^= s_seed << 5;
+	return s_seed;
+}
+
+
+/** Devuelve los nanosegundos transcurridos desde 'since' */
+static double elapsedNs(std::chrono::steady_clock::time_point since){
+	return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - since).count();
+}
+
+
+int main(int argc, char** argv){
+	uint16_t count = (argc > 1)? (uint16_t)atoi(argv[1]) : 32768;
+	uint32_t ticks = (argc > 2)? (uint32_t)atoi(argv[2]) : 1000000;
+	if(count == 0 || count == TimerWheel::Nil || ticks == 0){
+		printf("uso: %s [entradas < 65535] [ticks]\n", argv[0]);
+		return 1;
+	}
+
+	std::vector<TimerWheel::Node> nodes(count);
+	std::vector<uint32_t> due(count);
+	TimerWheel wheel(&nodes[0], count);
+
+	// inserción: vencimientos repartidos en todos los niveles
+	auto t0 = std::chrono::steady_clock::now();
+	for(uint16_t i = 0; i < count; i++){
+		due[i] = wheel.now() + 1 + (rnd() % ticks);
+		wheel.insert(i, due[i]);
+	}
+	double insNs = elapsedNs(t0);
+
+	// cancelación y reinserción de la mitad de las entradas
+	t0 = std::chrono::steady_clock::now();
+	for(uint16_t i = 0; i < count; i += 2){
+		wheel.cancel(i);
+	}
+	double canNs = elapsedNs(t0);
+	for(uint16_t i = 0; i < count; i += 2){
+		due[i] = wheel.now() + 1 + (rnd() % ticks);
+		wheel.insert(i, due[i]);
+	}
+
+	// vencimiento: avanza hasta vaciar la rueda, reinsertando una de cada cuatro entradas vencidas
+	uint32_t expired = 0, errors = 0, reinserted = 0;
+	t0 = std::chrono::steady_clock::now();
+	while(wheel.pending() > 0){
+		uint32_t tick = wheel.now();
+		for(uint16_t i = wheel.step(); i != TimerWheel::Nil; ){
+			uint16_t next = wheel.next(i);
+			if(due[i] != tick){
+				errors++;
+			}
+			expired++;
+			if((expired & 3) == 0 && reinserted < count){
+				due[i] = wheel.now() + 1 + (rnd() % ticks);
+				wheel.insert(i, due[i]);
+				reinserted++;
+			}
+			i = next;
+		}
+	}
+	double expNs = elapsedNs(t0);
+	uint32_t steps = wheel.now();
+
+	printf("entradas=%u ticks=%u\n", count, ticks);
+	printf("insert: %.1f ns/op (%.2f Mop/s)\n", insNs / count, count * 1e3 / insNs);
+	printf("cancel: %.1f ns/op (%.2f Mop/s)\n", canNs / ((count + 1) / 2), ((count + 1) / 2) * 1e3 / canNs);
+	printf("expire: %u entradas en %u ticks, %.1f ns/entrada, %.1f ns/tick\n", expired, steps, expNs / expired, expNs / steps);
+	printf("errores: %u\n", errors);
+	return (errors == 0)? 0 : 2;
+}